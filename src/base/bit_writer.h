@@ -0,0 +1,225 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_BIT_WRITER_H_
+#define BASE_BIT_WRITER_H_
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "byte_conversions.h"
+#include "emulation_prevention.h"
+#include "logging.h"
+
+namespace libvavc8000d::base
+{
+
+// Emulation prevention policies. A policy appends |size| bytes of payload to
+// |out|, escaping them as required by the bitstream syntax, and is reset
+// whenever unescaped data such as a start code is written.
+
+// Writes the payload as is. Used for MPEG-4 Part 2 and VP8/VP9 headers, whose
+// syntax cannot emulate a start code.
+struct NoEmulationPrevention
+{
+    void Reset() { }
+
+    void Append(std::vector<uint8_t> &out, const uint8_t *bytes, size_t size)
+    {
+        out.insert(out.end(), bytes, bytes + size);
+    }
+};
+
+// Inserts an emulation_prevention_three_byte after two zero bytes when the
+// next byte is 0x03 or below, see H.264 section 7.4.1, H.265 section 7.4.2 and
+// SMPTE 421M Annex E.
+struct StartCodeEmulationPrevention
+{
+    void Reset() { zero_run_ = 0; }
+
+    void Append(std::vector<uint8_t> &out, const uint8_t *bytes, size_t size)
+    {
+        AppendWithEmulationPrevention(bytes, size, out, zero_run_);
+    }
+
+private:
+    size_t zero_run_ = 0;
+};
+
+// Inserts a zero byte after every 0xFF, as in JPEG entropy-coded segments
+// (ITU T.81 section B.1.1.5). Marker segments are written with
+// BitWriter::AppendRawBytes().
+struct JpegByteStuffing
+{
+    void Reset() { }
+
+    void Append(std::vector<uint8_t> &out, const uint8_t *bytes, size_t size)
+    {
+        for (size_t i = 0; i < size; i++) {
+            out.push_back(bytes[i]);
+            if (bytes[i] == 0xFF) { out.push_back(0x00); }
+        }
+    }
+};
+
+// Compile-time description of a run of fixed-length syntax elements. For
+// example, the H.264 profile_idc, the six constraint_set flags, the two
+// reserved bits and level_idc are BitFieldLayout<8, 1, 1, 1, 1, 1, 1, 2, 8>.
+// All the fields are packed into a single value and written at once, so
+// constant fields fold away at compile time.
+template <unsigned... kWidths> struct BitFieldLayout
+{
+    static constexpr unsigned kTotalBits = (kWidths + ... + 0u);
+    static_assert(kTotalBits <= 64, "BitFieldLayout must fit in 64 bits");
+    static_assert(((kWidths > 0) && ...), "BitFieldLayout fields must not be empty");
+
+    template <typename... Ts> static constexpr uint64_t Pack(Ts... values)
+    {
+        static_assert(sizeof...(Ts) == sizeof...(kWidths), "One value per field");
+        uint64_t packed = 0;
+        ((packed = ShiftIn(packed, kWidths, static_cast<uint64_t>(values))), ...);
+        return packed;
+    }
+
+private:
+    static constexpr uint64_t ShiftIn(uint64_t packed, unsigned width, uint64_t value)
+    {
+        if (width == 64) { return value; }
+        return (packed << width) | (value & ((uint64_t { 1 } << width) - 1));
+    }
+};
+
+// Writes a big-endian bitstream, buffering up to 64 bits in a register and
+// flushing it a word at a time through the |EmulationPrevention| policy.
+// This is the shared writer for the headers the driver has to rebuild from the
+// VA buffers (H.264/HEVC parameter sets, VC-1 and MPEG-4 sequence headers,
+// JPEG markers, VP8/VP9 frame headers).
+template <typename EmulationPrevention = NoEmulationPrevention> class BitWriter
+{
+public:
+    BitWriter() { data_.reserve(kInitialCapacity); }
+
+    // Appends the |num_bits| (at most 64) low bits of |value|.
+    void AppendBits(unsigned num_bits, uint64_t value)
+    {
+        if (num_bits == 0) { return; }
+        if (num_bits < 64) { value &= (uint64_t { 1 } << num_bits) - 1; }
+
+        const unsigned bits_free = kRegBits - bits_in_reg_;
+        if (num_bits < bits_free) {
+            reg_ = (reg_ << num_bits) | value;
+            bits_in_reg_ += num_bits;
+            return;
+        }
+
+        // Fill up the register, flush it and keep the remaining low bits.
+        const unsigned bits_left = num_bits - bits_free;
+        reg_ = bits_free == kRegBits ? value : (reg_ << bits_free) | (value >> bits_left);
+        const auto word = U64ToBigEndian(reg_);
+        epb_.Append(data_, word.data(), word.size());
+        reg_ = bits_left ? value & ((uint64_t { 1 } << bits_left) - 1) : 0;
+        bits_in_reg_ = bits_left;
+    }
+
+    void AppendBool(bool value) { AppendBits(1, value); }
+
+    // Appends the fields of |Layout| in a single write.
+    template <typename Layout, typename... Ts> void AppendFields(Ts... values)
+    {
+        AppendBits(Layout::kTotalBits, Layout::Pack(values...));
+    }
+
+    // Appends |value| as ue(v). The code is value + 1 preceded by as many zero
+    // bits as it has bits after its leading one, so it is written with a
+    // single register update.
+    void AppendUE(uint32_t value)
+    {
+        const uint64_t code = uint64_t { value } + 1;
+        const unsigned code_bits = static_cast<unsigned>(std::bit_width(code));
+        if (code_bits <= 32) {
+            AppendBits(2 * code_bits - 1, code);
+        } else {
+            // Only value 0xFFFFFFFF takes 65 bits.
+            AppendBits(code_bits - 1, 0);
+            AppendBits(code_bits, code);
+        }
+    }
+
+    // Appends |value| as se(v).
+    void AppendSE(int32_t value)
+    {
+        const uint32_t magnitude = value > 0 ? static_cast<uint32_t>(value)
+                                             : 0u - static_cast<uint32_t>(value);
+        AppendUE(value > 0 ? 2 * magnitude - 1 : 2 * magnitude);
+    }
+
+    bool IsByteAligned() const { return bits_in_reg_ % 8 == 0; }
+
+    // Pads with |fill_bit| up to the next byte boundary.
+    void AlignToByte(bool fill_bit = false)
+    {
+        const unsigned num_bits = (8 - bits_in_reg_ % 8) % 8;
+        AppendBits(num_bits, fill_bit ? ~uint64_t { 0 } : 0);
+    }
+
+    // Appends rbsp_trailing_bits(): a one bit followed by zero bits up to the
+    // next byte boundary. VC-1 RBDU stuffing uses the same pattern.
+    void AppendTrailingBits()
+    {
+        AppendBool(1);
+        AlignToByte(false);
+    }
+
+    // Appends |size| bytes without emulation prevention, e.g. a start code or
+    // slice data that is already escaped. Escaping restarts after them.
+    void AppendRawBytes(const uint8_t *bytes, size_t size)
+    {
+        Flush();
+        data_.insert(data_.end(), bytes, bytes + size);
+        epb_.Reset();
+    }
+
+    void AppendRawBytes(std::initializer_list<uint8_t> bytes)
+    {
+        AppendRawBytes(bytes.begin(), bytes.size());
+    }
+
+    // Writes out the bits held in the register, which must be byte aligned.
+    void Flush()
+    {
+        CHECK(IsByteAligned());
+        if (bits_in_reg_ == 0) { return; }
+        const auto word = U64ToBigEndian(reg_ << (kRegBits - bits_in_reg_));
+        epb_.Append(data_, word.data(), bits_in_reg_ / 8);
+        reg_ = 0;
+        bits_in_reg_ = 0;
+    }
+
+    // The bitstream written so far. Flush() must have been called since the
+    // last append.
+    const std::vector<uint8_t> &data() const
+    {
+        CHECK_EQ(bits_in_reg_, 0u);
+        return data_;
+    }
+
+private:
+    static constexpr unsigned kRegBits = 64;
+    // Enough for parameter sets and headers, slice data may grow it.
+    static constexpr size_t kInitialCapacity = 4096;
+
+    EmulationPrevention epb_;
+    // Pending bits, right-aligned. Always holds less than kRegBits bits.
+    uint64_t reg_ = 0;
+    unsigned bits_in_reg_ = 0;
+    std::vector<uint8_t> data_;
+};
+
+} // namespace libvavc8000d::base
+
+#endif // BASE_BIT_WRITER_H_
@@ -0,0 +1,68 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "bit_writer.h"
+
+#include <benchmark/benchmark.h>
+
+#include "test/h264_parameter_sets.h"
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // The SPS and PPS written before every H.264 IDR picture.
+    void BM_H264ParameterSetsLegacyBuilder(benchmark::State &state)
+    {
+        const test::H264ParameterSetFields fields;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(test::WriteLegacyParameterSets(fields));
+        }
+    }
+    BENCHMARK(BM_H264ParameterSetsLegacyBuilder);
+
+    void BM_H264ParameterSets(benchmark::State &state)
+    {
+        const test::H264ParameterSetFields fields;
+        for (auto _ : state) { benchmark::DoNotOptimize(test::WriteParameterSets(fields)); }
+    }
+    BENCHMARK(BM_H264ParameterSets);
+
+    // Exp-Golomb codes of all sizes, the bulk of header syntax.
+    template <typename Writer> void AppendUEs(Writer &writer)
+    {
+        for (uint32_t i = 0; i < 1024; i++) { writer.AppendUE(i * i); }
+    }
+
+    void BM_AppendUELegacyBuilder(benchmark::State &state)
+    {
+        for (auto _ : state) {
+            test::LegacyH264BitstreamBuilder builder(/*insert_emulation_prevention_bytes=*/true);
+            builder.BeginNALU(1, 0);
+            AppendUEs(builder);
+            builder.FinishNALU();
+            benchmark::DoNotOptimize(builder.data());
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 1024));
+    }
+    BENCHMARK(BM_AppendUELegacyBuilder);
+
+    void BM_AppendUE(benchmark::State &state)
+    {
+        for (auto _ : state) {
+            BitWriter<StartCodeEmulationPrevention> writer;
+            writer.AppendRawBytes({ 0x00, 0x00, 0x00, 0x01 });
+            writer.AppendFields<BitFieldLayout<1, 2, 5>>(0, 0, 1);
+            AppendUEs(writer);
+            writer.AppendTrailingBits();
+            writer.Flush();
+            benchmark::DoNotOptimize(writer.data().data());
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 1024));
+    }
+    BENCHMARK(BM_AppendUE);
+
+} // namespace
+} // namespace libvavc8000d::base
@@ -0,0 +1,142 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "bit_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "test/h264_parameter_sets.h"
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    using test::H264ParameterSetFields;
+    using test::LegacyH264BitstreamBuilder;
+
+    size_t CountEmulationPreventionBytes(const std::vector<uint8_t> &data)
+    {
+        size_t count = 0;
+        for (size_t i = 2; i < data.size(); i++) {
+            if (data[i - 2] == 0 && data[i - 1] == 0 && data[i] == 0x03) { count++; }
+        }
+        return count;
+    }
+
+    // Exp-Golomb codes of values up to 2^|max_bits| have up to |max_bits|
+    // leading zero bits, enough to need emulation prevention.
+    uint32_t RandomValue(std::mt19937 &rng, int max_bits)
+    {
+        return rng() & ((1u << (rng() % (max_bits + 1))) - 1);
+    }
+
+    TEST(BitWriterTest, H264ParameterSetsMatchLegacyBuilder)
+    {
+        // 1080p High profile, as the decoder sees it most of the time.
+        const H264ParameterSetFields fields;
+        EXPECT_EQ(test::WriteParameterSets(fields), test::WriteLegacyParameterSets(fields));
+
+        std::mt19937 rng(1);
+        size_t escaped = 0;
+        for (int i = 0; i < 5000; i++) {
+            H264ParameterSetFields f;
+            f.profile_idc = std::array<uint8_t, 4> { 66, 77, 100, 110 }[rng() % 4];
+            f.chroma_format_idc = rng() % 4;
+            f.bit_depth_luma_minus8 = rng() % 7;
+            f.bit_depth_chroma_minus8 = rng() % 7;
+            f.log2_max_frame_num_minus4 = rng() % 13;
+            f.pic_order_cnt_type = rng() % 2 ? 0 : 2;
+            f.log2_max_pic_order_cnt_lsb_minus4 = rng() % 13;
+            f.num_ref_frames = rng() % 17;
+            f.gaps_in_frame_num_value_allowed_flag = rng() % 2;
+            f.picture_width_in_mbs_minus1 = RandomValue(rng, 20);
+            f.picture_height_in_mbs_minus1 = RandomValue(rng, 20);
+            f.frame_mbs_only_flag = rng() % 2;
+            f.mb_adaptive_frame_field_flag = rng() % 2;
+            f.direct_8x8_inference_flag = rng() % 2;
+            f.entropy_coding_mode_flag = rng() % 2;
+            f.pic_order_present_flag = rng() % 2;
+            f.weighted_pred_flag = rng() % 2;
+            f.weighted_bipred_idc = rng() % 3;
+            f.pic_init_qp_minus26 = static_cast<int32_t>(rng() % 52) - 26;
+            f.pic_init_qs_minus26 = static_cast<int32_t>(rng() % 52) - 26;
+            f.chroma_qp_index_offset = static_cast<int32_t>(rng() % 25) - 12;
+            f.deblocking_filter_control_present_flag = rng() % 2;
+            f.constrained_intra_pred_flag = rng() % 2;
+            f.redundant_pic_cnt_present_flag = rng() % 2;
+
+            const auto parameter_sets = test::WriteParameterSets(f);
+            ASSERT_EQ(parameter_sets, test::WriteLegacyParameterSets(f)) << "iteration " << i;
+            escaped += CountEmulationPreventionBytes(parameter_sets);
+        }
+        // Only the largest picture sizes emulate start codes, but the
+        // comparison has to cover emulation prevention too.
+        EXPECT_GT(escaped, 10u);
+    }
+
+    // Any sequence of syntax elements, with runs of zero bits crossing the
+    // 64-bit registers of both writers.
+    TEST(BitWriterTest, SyntaxElementsMatchLegacyBuilder)
+    {
+        std::mt19937 rng(2);
+        size_t escaped = 0;
+        for (int i = 0; i < 2000; i++) {
+            LegacyH264BitstreamBuilder legacy(/*insert_emulation_prevention_bytes=*/true);
+            BitWriter<StartCodeEmulationPrevention> writer;
+            // A non-IDR slice NALU.
+            const int nal_ref_idc = static_cast<int>(rng() % 4);
+            legacy.BeginNALU(1, nal_ref_idc);
+            writer.AppendRawBytes({ 0x00, 0x00, 0x00, 0x01 });
+            writer.AppendFields<BitFieldLayout<1, 2, 5>>(0, nal_ref_idc, 1);
+
+            const int elements = static_cast<int>(rng() % 64);
+            for (int j = 0; j < elements; j++) {
+                // Mostly zeros, so that start codes are emulated.
+                const bool zero = rng() % 2;
+                switch (rng() % 4) {
+                case 0: {
+                    const unsigned num_bits = 1 + rng() % 64;
+                    const uint64_t value = zero ? 0 : (uint64_t { rng() } << 32 | rng());
+                    legacy.AppendBits(num_bits, value);
+                    writer.AppendBits(num_bits, value);
+                    break;
+                }
+                case 1: {
+                    const bool value = !zero && rng() % 2;
+                    legacy.AppendBool(value);
+                    writer.AppendBool(value);
+                    break;
+                }
+                case 2: {
+                    const uint32_t value = zero ? 0 : RandomValue(rng, 31);
+                    legacy.AppendUE(value);
+                    writer.AppendUE(value);
+                    break;
+                }
+                case 3: {
+                    const int32_t value = zero ? 0 : static_cast<int32_t>(RandomValue(rng, 29))
+                            * (rng() % 2 ? 1 : -1);
+                    legacy.AppendSE(value);
+                    writer.AppendSE(value);
+                    break;
+                }
+                }
+            }
+            legacy.FinishNALU();
+            writer.AppendTrailingBits();
+            writer.Flush();
+
+            const std::vector<uint8_t> expected(
+                legacy.data(), legacy.data() + legacy.BytesInBuffer());
+            ASSERT_EQ(writer.data(), expected) << "iteration " << i;
+            escaped += CountEmulationPreventionBytes(expected);
+        }
+        EXPECT_GT(escaped, 1000u);
+    }
+
+} // namespace
+} // namespace libvavc8000d::base
@@ -6,7 +6,12 @@
 #ifndef BASE_BYTE_CONVERSIONS_H_
 #define BASE_BYTE_CONVERSIONS_H_
 
+#include <array>
 #include <bit>
+#include <cstdint>
+#include <type_traits>
+
+#include "logging.h"
 
 namespace libvavc8000d::base
 {
@@ -0,0 +1,749 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "color_conversion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__riscv_vector)
+#include <riscv_vector.h>
+#include <sys/auxv.h>
+#endif
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // The conversions are done in fixed point with 12 fractional bits, which
+    // keeps every intermediate value within 32 bits.
+    constexpr int kShift = 12;
+    constexpr int32_t kHalf = 1 << (kShift - 1);
+    // Value of the padding byte of RGBX and BGRX.
+    constexpr uint8_t kOpaque = 0xff;
+
+    // R = (y_gain * (Y - y_offset) + r_v * (Cr - 128)) >> kShift
+    // G = (y_gain * (Y - y_offset) - g_u * (Cb - 128) - g_v * (Cr - 128)) >> kShift
+    // B = (y_gain * (Y - y_offset) + b_u * (Cb - 128)) >> kShift
+    // all rounded to the nearest and clamped to 0-255.
+    struct YuvToRgbCoefficients
+    {
+        int32_t y_offset;
+        int32_t y_gain;
+        int32_t r_v;
+        int32_t g_u;
+        int32_t g_v;
+        int32_t b_u;
+    };
+
+    // Y = (y_r * R + y_g * G + y_b * B) >> kShift + y_offset
+    // Cb = (u_r * R + u_g * G + u_b * B) >> kShift + 128
+    // Cr = (v_r * R + v_g * G + v_b * B) >> kShift + 128
+    // all rounded to the nearest. Chroma is computed from the average of a
+    // 2x2 block of pixels.
+    struct RgbToYuvCoefficients
+    {
+        int32_t y_r, y_g, y_b;
+        int32_t y_offset;
+        int32_t u_r, u_g, u_b;
+        int32_t v_r, v_g, v_b;
+    };
+
+    // Luma weights of R and B.
+    void GetLumaWeights(ColorMatrix matrix, double &kr, double &kb)
+    {
+        if (matrix == ColorMatrix::kBT709) {
+            kr = 0.2126;
+            kb = 0.0722;
+        } else {
+            kr = 0.299;
+            kb = 0.114;
+        }
+    }
+
+    int32_t ToFixed(double value)
+    {
+        return static_cast<int32_t>(std::lround(value * (1 << kShift)));
+    }
+
+    YuvToRgbCoefficients GetYuvToRgbCoefficients(const ColorSpace &color_space)
+    {
+        double kr, kb;
+        GetLumaWeights(color_space.matrix, kr, kb);
+        const double kg = 1.0 - kr - kb;
+        const double luma_scale = color_space.full_range ? 1.0 : 255.0 / 219.0;
+        const double chroma_scale = color_space.full_range ? 1.0 : 255.0 / 224.0;
+        return {
+            .y_offset = color_space.full_range ? 0 : 16,
+            .y_gain = ToFixed(luma_scale),
+            .r_v = ToFixed(2.0 * (1.0 - kr) * chroma_scale),
+            .g_u = ToFixed(2.0 * (1.0 - kb) * kb / kg * chroma_scale),
+            .g_v = ToFixed(2.0 * (1.0 - kr) * kr / kg * chroma_scale),
+            .b_u = ToFixed(2.0 * (1.0 - kb) * chroma_scale),
+        };
+    }
+
+    RgbToYuvCoefficients GetRgbToYuvCoefficients(const ColorSpace &color_space)
+    {
+        double kr, kb;
+        GetLumaWeights(color_space.matrix, kr, kb);
+        const double kg = 1.0 - kr - kb;
+        const double luma_scale = color_space.full_range ? 1.0 : 219.0 / 255.0;
+        const double u_scale = (color_space.full_range ? 1.0 : 224.0 / 255.0) / (2.0 * (1.0 - kb));
+        const double v_scale = (color_space.full_range ? 1.0 : 224.0 / 255.0) / (2.0 * (1.0 - kr));
+        return {
+            .y_r = ToFixed(kr * luma_scale),
+            .y_g = ToFixed(kg * luma_scale),
+            .y_b = ToFixed(kb * luma_scale),
+            .y_offset = color_space.full_range ? 0 : 16,
+            .u_r = ToFixed(-kr * u_scale),
+            .u_g = ToFixed(-kg * u_scale),
+            .u_b = ToFixed((1.0 - kb) * u_scale),
+            .v_r = ToFixed((1.0 - kr) * v_scale),
+            .v_g = ToFixed(-kg * v_scale),
+            .v_b = ToFixed(-kb * v_scale),
+        };
+    }
+
+    // Row kernels. |width| is in pixels, and the chroma rows hold one sample
+    // per pair of pixels. |bgr| selects BGRX over RGBX and |uyvy| UYVY over
+    // YUY2.
+    struct Kernels
+    {
+        void (*yuv_to_rgb_row)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+            uint32_t width, const YuvToRgbCoefficients &c, bool bgr);
+        void (*rgb_to_y_row)(const uint8_t *src, uint8_t *y, uint32_t width,
+            const RgbToYuvCoefficients &c, bool bgr);
+        // Takes two rows of pixels, the second one being the first one again
+        // at the bottom of odd height pictures.
+        void (*rgb_to_uv_row)(const uint8_t *src0, const uint8_t *src1, uint8_t *u, uint8_t *v,
+            uint32_t width, const RgbToYuvCoefficients &c, bool bgr);
+        void (*i420_to_422_row)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+            uint32_t width, bool uyvy);
+        void (*packed_422_to_y_row)(const uint8_t *src, uint8_t *y, uint32_t width, bool uyvy);
+        void (*packed_422_to_uv_row)(const uint8_t *src0, const uint8_t *src1, uint8_t *u,
+            uint8_t *v, uint32_t width, bool uyvy);
+    };
+
+    inline uint8_t Clamp(int32_t value) { return static_cast<uint8_t>(std::clamp(value, 0, 255)); }
+
+    void YuvToRgbRowScalar(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+        uint32_t width, const YuvToRgbCoefficients &c, bool bgr)
+    {
+        for (uint32_t x = 0; x < width; x++) {
+            const int32_t luma = c.y_gain * (y[x] - c.y_offset) + kHalf;
+            const int32_t cb = u[x / 2] - 128;
+            const int32_t cr = v[x / 2] - 128;
+            const uint8_t r = Clamp((luma + c.r_v * cr) >> kShift);
+            const uint8_t g = Clamp((luma - c.g_u * cb - c.g_v * cr) >> kShift);
+            const uint8_t b = Clamp((luma + c.b_u * cb) >> kShift);
+            dst[4 * x] = bgr ? b : r;
+            dst[4 * x + 1] = g;
+            dst[4 * x + 2] = bgr ? r : b;
+            dst[4 * x + 3] = kOpaque;
+        }
+    }
+
+    void RgbToYRowScalar(
+        const uint8_t *src, uint8_t *y, uint32_t width, const RgbToYuvCoefficients &c, bool bgr)
+    {
+        for (uint32_t x = 0; x < width; x++) {
+            const int32_t r = src[4 * x + (bgr ? 2 : 0)];
+            const int32_t g = src[4 * x + 1];
+            const int32_t b = src[4 * x + (bgr ? 0 : 2)];
+            y[x] = Clamp(
+                (c.y_r * r + c.y_g * g + c.y_b * b + (c.y_offset << kShift) + kHalf) >> kShift);
+        }
+    }
+
+    void RgbToUVRowScalar(const uint8_t *src0, const uint8_t *src1, uint8_t *u, uint8_t *v,
+        uint32_t width, const RgbToYuvCoefficients &c, bool bgr)
+    {
+        const uint32_t r_offset = bgr ? 2 : 0;
+        const uint32_t b_offset = bgr ? 0 : 2;
+        for (uint32_t i = 0; i < (width + 1) / 2; i++) {
+            // The last column of odd width pictures pairs with itself.
+            const uint32_t x0 = 4 * (2 * i);
+            const uint32_t x1 = 4 * std::min(2 * i + 1, width - 1);
+            const auto average = [&](uint32_t offset) {
+                return (src0[x0 + offset] + src0[x1 + offset] + src1[x0 + offset]
+                           + src1[x1 + offset] + 2)
+                    >> 2;
+            };
+            const int32_t r = average(r_offset);
+            const int32_t g = average(1);
+            const int32_t b = average(b_offset);
+            u[i] = Clamp((c.u_r * r + c.u_g * g + c.u_b * b + (128 << kShift) + kHalf) >> kShift);
+            v[i] = Clamp((c.v_r * r + c.v_g * g + c.v_b * b + (128 << kShift) + kHalf) >> kShift);
+        }
+    }
+
+    void I420To422RowScalar(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+        uint32_t width, bool uyvy)
+    {
+        for (uint32_t i = 0; i < (width + 1) / 2; i++) {
+            const uint8_t y0 = y[2 * i];
+            const uint8_t y1 = 2 * i + 1 < width ? y[2 * i + 1] : y0;
+            uint8_t *const pair = dst + 4 * i;
+            if (uyvy) {
+                pair[0] = u[i];
+                pair[1] = y0;
+                pair[2] = v[i];
+                pair[3] = y1;
+            } else {
+                pair[0] = y0;
+                pair[1] = u[i];
+                pair[2] = y1;
+                pair[3] = v[i];
+            }
+        }
+    }
+
+    void Packed422ToYRowScalar(const uint8_t *src, uint8_t *y, uint32_t width, bool uyvy)
+    {
+        for (uint32_t x = 0; x < width; x++) { y[x] = src[2 * x + (uyvy ? 1 : 0)]; }
+    }
+
+    void Packed422ToUVRowScalar(const uint8_t *src0, const uint8_t *src1, uint8_t *u, uint8_t *v,
+        uint32_t width, bool uyvy)
+    {
+        const uint32_t u_offset = uyvy ? 0 : 1;
+        const uint32_t v_offset = uyvy ? 2 : 3;
+        for (uint32_t i = 0; i < (width + 1) / 2; i++) {
+            u[i] = static_cast<uint8_t>((src0[4 * i + u_offset] + src1[4 * i + u_offset] + 1) >> 1);
+            v[i] = static_cast<uint8_t>((src0[4 * i + v_offset] + src1[4 * i + v_offset] + 1) >> 1);
+        }
+    }
+
+    const Kernels kScalarKernels = {
+        .yuv_to_rgb_row = YuvToRgbRowScalar,
+        .rgb_to_y_row = RgbToYRowScalar,
+        .rgb_to_uv_row = RgbToUVRowScalar,
+        .i420_to_422_row = I420To422RowScalar,
+        .packed_422_to_y_row = Packed422ToYRowScalar,
+        .packed_422_to_uv_row = Packed422ToUVRowScalar,
+    };
+
+#if defined(__riscv_vector)
+
+    // RVV 1.0, see emulation_prevention.cc for the TH1520. The kernels work on
+    // whole pixel pairs and leave the rest to the scalar ones.
+
+    inline vint32m4_t Widen(vuint8m1_t v, size_t vl)
+    {
+        return __riscv_vreinterpret_v_u32m4_i32m4(__riscv_vzext_vf4_u32m4(v, vl));
+    }
+
+    inline vuint8m1_t NarrowClamped(vint32m4_t v, size_t vl)
+    {
+        v = __riscv_vmin_vx_i32m4(__riscv_vmax_vx_i32m4(v, 0, vl), 255, vl);
+        return __riscv_vnsrl_wx_u8m1(
+            __riscv_vnsrl_wx_u16m2(__riscv_vreinterpret_v_i32m4_u32m4(v), 0, vl), 0, vl);
+    }
+
+    void YuvToRgbRowVector(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+        uint32_t width, const YuvToRgbCoefficients &c, bool bgr)
+    {
+        const size_t pairs = width / 2;
+        size_t i = 0;
+        while (i < pairs) {
+            const size_t vl = __riscv_vsetvl_e8m1(pairs - i);
+            const vuint8m1x2_t luma = __riscv_vlseg2e8_v_u8m1x2(y + 2 * i, vl);
+            const vint32m4_t cb
+                = __riscv_vsub_vx_i32m4(Widen(__riscv_vle8_v_u8m1(u + i, vl), vl), 128, vl);
+            const vint32m4_t cr
+                = __riscv_vsub_vx_i32m4(Widen(__riscv_vle8_v_u8m1(v + i, vl), vl), 128, vl);
+            const vint32m4_t r_chroma = __riscv_vmul_vx_i32m4(cr, c.r_v, vl);
+            const vint32m4_t g_chroma = __riscv_vadd_vv_i32m4(
+                __riscv_vmul_vx_i32m4(cb, c.g_u, vl), __riscv_vmul_vx_i32m4(cr, c.g_v, vl), vl);
+            const vint32m4_t b_chroma = __riscv_vmul_vx_i32m4(cb, c.b_u, vl);
+            const vuint8m1_t opaque = __riscv_vmv_v_x_u8m1(kOpaque, vl);
+            // The even pixels, then the odd ones, each with a strided store.
+            for (int odd = 0; odd < 2; odd++) {
+                const vuint8m1_t samples = odd ? __riscv_vget_v_u8m1x2_u8m1(luma, 1)
+                                               : __riscv_vget_v_u8m1x2_u8m1(luma, 0);
+                const vint32m4_t l = __riscv_vadd_vx_i32m4(
+                    __riscv_vmul_vx_i32m4(__riscv_vsub_vx_i32m4(Widen(samples, vl), c.y_offset, vl),
+                        c.y_gain, vl),
+                    kHalf, vl);
+                const vuint8m1_t r = NarrowClamped(
+                    __riscv_vsra_vx_i32m4(__riscv_vadd_vv_i32m4(l, r_chroma, vl), kShift, vl), vl);
+                const vuint8m1_t g = NarrowClamped(
+                    __riscv_vsra_vx_i32m4(__riscv_vsub_vv_i32m4(l, g_chroma, vl), kShift, vl), vl);
+                const vuint8m1_t b = NarrowClamped(
+                    __riscv_vsra_vx_i32m4(__riscv_vadd_vv_i32m4(l, b_chroma, vl), kShift, vl), vl);
+                __riscv_vssseg4e8_v_u8m1x4(dst + 8 * i + 4 * odd, 8,
+                    bgr ? __riscv_vcreate_v_u8m1x4(b, g, r, opaque)
+                        : __riscv_vcreate_v_u8m1x4(r, g, b, opaque),
+                    vl);
+            }
+            i += vl;
+        }
+        YuvToRgbRowScalar(y + 2 * i, u + i, v + i, dst + 8 * i, width - 2 * i, c, bgr);
+    }
+
+    void RgbToYRowVector(
+        const uint8_t *src, uint8_t *y, uint32_t width, const RgbToYuvCoefficients &c, bool bgr)
+    {
+        size_t x = 0;
+        while (x < width) {
+            const size_t vl = __riscv_vsetvl_e8m1(width - x);
+            const vuint8m1x4_t pixels = __riscv_vlseg4e8_v_u8m1x4(src + 4 * x, vl);
+            const vint32m4_t r = Widen(__riscv_vget_v_u8m1x4_u8m1(pixels, bgr ? 2 : 0), vl);
+            const vint32m4_t g = Widen(__riscv_vget_v_u8m1x4_u8m1(pixels, 1), vl);
+            const vint32m4_t b = Widen(__riscv_vget_v_u8m1x4_u8m1(pixels, bgr ? 0 : 2), vl);
+            vint32m4_t luma = __riscv_vmul_vx_i32m4(r, c.y_r, vl);
+            luma = __riscv_vmacc_vx_i32m4(luma, c.y_g, g, vl);
+            luma = __riscv_vmacc_vx_i32m4(luma, c.y_b, b, vl);
+            luma = __riscv_vadd_vx_i32m4(luma, (c.y_offset << kShift) + kHalf, vl);
+            __riscv_vse8_v_u8m1(
+                y + x, NarrowClamped(__riscv_vsra_vx_i32m4(luma, kShift, vl), vl), vl);
+            x += vl;
+        }
+    }
+
+    void RgbToUVRowVector(const uint8_t *src0, const uint8_t *src1, uint8_t *u, uint8_t *v,
+        uint32_t width, const RgbToYuvCoefficients &c, bool bgr)
+    {
+        const size_t pairs = width / 2;
+        size_t i = 0;
+        while (i < pairs) {
+            const size_t vl = __riscv_vsetvl_e8m1(pairs - i);
+            const vuint8m1x4_t even0 = __riscv_vlsseg4e8_v_u8m1x4(src0 + 8 * i, 8, vl);
+            const vuint8m1x4_t odd0 = __riscv_vlsseg4e8_v_u8m1x4(src0 + 8 * i + 4, 8, vl);
+            const vuint8m1x4_t even1 = __riscv_vlsseg4e8_v_u8m1x4(src1 + 8 * i, 8, vl);
+            const vuint8m1x4_t odd1 = __riscv_vlsseg4e8_v_u8m1x4(src1 + 8 * i + 4, 8, vl);
+            // Rounded average of the 2x2 block.
+            const auto average = [&](int channel) {
+                const vuint16m2_t sum = __riscv_vadd_vv_u16m2(
+                    __riscv_vwaddu_vv_u16m2(__riscv_vget_v_u8m1x4_u8m1(even0, channel),
+                        __riscv_vget_v_u8m1x4_u8m1(odd0, channel), vl),
+                    __riscv_vwaddu_vv_u16m2(__riscv_vget_v_u8m1x4_u8m1(even1, channel),
+                        __riscv_vget_v_u8m1x4_u8m1(odd1, channel), vl),
+                    vl);
+                return __riscv_vreinterpret_v_u32m4_i32m4(__riscv_vzext_vf2_u32m4(
+                    __riscv_vsrl_vx_u16m2(__riscv_vadd_vx_u16m2(sum, 2, vl), 2, vl), vl));
+            };
+            const vint32m4_t r = average(bgr ? 2 : 0);
+            const vint32m4_t g = average(1);
+            const vint32m4_t b = average(bgr ? 0 : 2);
+            const auto chroma = [&](int32_t cr, int32_t cg, int32_t cb) {
+                vint32m4_t sum = __riscv_vmul_vx_i32m4(r, cr, vl);
+                sum = __riscv_vmacc_vx_i32m4(sum, cg, g, vl);
+                sum = __riscv_vmacc_vx_i32m4(sum, cb, b, vl);
+                sum = __riscv_vadd_vx_i32m4(sum, (128 << kShift) + kHalf, vl);
+                return NarrowClamped(__riscv_vsra_vx_i32m4(sum, kShift, vl), vl);
+            };
+            __riscv_vse8_v_u8m1(u + i, chroma(c.u_r, c.u_g, c.u_b), vl);
+            __riscv_vse8_v_u8m1(v + i, chroma(c.v_r, c.v_g, c.v_b), vl);
+            i += vl;
+        }
+        RgbToUVRowScalar(src0 + 8 * i, src1 + 8 * i, u + i, v + i, width - 2 * i, c, bgr);
+    }
+
+    void I420To422RowVector(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+        uint32_t width, bool uyvy)
+    {
+        const size_t pairs = width / 2;
+        size_t i = 0;
+        while (i < pairs) {
+            const size_t vl = __riscv_vsetvl_e8m2(pairs - i);
+            const vuint8m2x2_t luma = __riscv_vlseg2e8_v_u8m2x2(y + 2 * i, vl);
+            const vuint8m2_t y0 = __riscv_vget_v_u8m2x2_u8m2(luma, 0);
+            const vuint8m2_t y1 = __riscv_vget_v_u8m2x2_u8m2(luma, 1);
+            const vuint8m2_t cb = __riscv_vle8_v_u8m2(u + i, vl);
+            const vuint8m2_t cr = __riscv_vle8_v_u8m2(v + i, vl);
+            __riscv_vsseg4e8_v_u8m2x4(dst + 4 * i,
+                uyvy ? __riscv_vcreate_v_u8m2x4(cb, y0, cr, y1)
+                     : __riscv_vcreate_v_u8m2x4(y0, cb, y1, cr),
+                vl);
+            i += vl;
+        }
+        I420To422RowScalar(y + 2 * i, u + i, v + i, dst + 4 * i, width - 2 * i, uyvy);
+    }
+
+    void Packed422ToYRowVector(const uint8_t *src, uint8_t *y, uint32_t width, bool uyvy)
+    {
+        const size_t pairs = width / 2;
+        size_t i = 0;
+        while (i < pairs) {
+            const size_t vl = __riscv_vsetvl_e8m2(pairs - i);
+            const vuint8m2x4_t pixels = __riscv_vlseg4e8_v_u8m2x4(src + 4 * i, vl);
+            const vuint8m2x2_t luma = uyvy
+                ? __riscv_vcreate_v_u8m2x2(__riscv_vget_v_u8m2x4_u8m2(pixels, 1),
+                    __riscv_vget_v_u8m2x4_u8m2(pixels, 3))
+                : __riscv_vcreate_v_u8m2x2(__riscv_vget_v_u8m2x4_u8m2(pixels, 0),
+                    __riscv_vget_v_u8m2x4_u8m2(pixels, 2));
+            __riscv_vsseg2e8_v_u8m2x2(y + 2 * i, luma, vl);
+            i += vl;
+        }
+        Packed422ToYRowScalar(src + 4 * i, y + 2 * i, width - 2 * i, uyvy);
+    }
+
+    void Packed422ToUVRowVector(const uint8_t *src0, const uint8_t *src1, uint8_t *u, uint8_t *v,
+        uint32_t width, bool uyvy)
+    {
+        const size_t pairs = width / 2;
+        size_t i = 0;
+        while (i < pairs) {
+            const size_t vl = __riscv_vsetvl_e8m2(pairs - i);
+            const vuint8m2x4_t row0 = __riscv_vlseg4e8_v_u8m2x4(src0 + 4 * i, vl);
+            const vuint8m2x4_t row1 = __riscv_vlseg4e8_v_u8m2x4(src1 + 4 * i, vl);
+            const auto average = [&](int field) {
+                const vuint16m4_t sum
+                    = __riscv_vwaddu_vv_u16m4(__riscv_vget_v_u8m2x4_u8m2(row0, field),
+                        __riscv_vget_v_u8m2x4_u8m2(row1, field), vl);
+                return __riscv_vnsrl_wx_u8m2(__riscv_vadd_vx_u16m4(sum, 1, vl), 1, vl);
+            };
+            __riscv_vse8_v_u8m2(u + i, average(uyvy ? 0 : 1), vl);
+            __riscv_vse8_v_u8m2(v + i, average(uyvy ? 2 : 3), vl);
+            i += vl;
+        }
+        Packed422ToUVRowScalar(src0 + 4 * i, src1 + 4 * i, u + i, v + i, width - 2 * i, uyvy);
+    }
+
+    // The V extension bit of AT_HWCAP. Kernels built for RVV still run on
+    // cores without it, e.g. when the library is shared with other boards.
+    bool CpuHasVectorKernels() { return getauxval(AT_HWCAP) & (1ul << ('V' - 'A')); }
+
+#elif (defined(__SSE2__) || defined(__ARM_NEON)) && __has_builtin(__builtin_shufflevector)
+
+    typedef uint8_t U8x8 __attribute__((vector_size(8)));
+    typedef uint8_t U8x16 __attribute__((vector_size(16)));
+    typedef uint16_t U16x8 __attribute__((vector_size(16)));
+    typedef int32_t I32x8 __attribute__((vector_size(32)));
+    typedef int32_t I32x16 __attribute__((vector_size(64)));
+
+    inline U8x16 EvenBytes(U8x16 a, U8x16 b)
+    {
+        return __builtin_shufflevector(
+            a, b, 0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    }
+
+    inline U8x16 OddBytes(U8x16 a, U8x16 b)
+    {
+        return __builtin_shufflevector(
+            a, b, 1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    }
+
+    inline U8x16 InterleaveLow(U8x16 a, U8x16 b)
+    {
+        return __builtin_shufflevector(
+            a, b, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+    }
+
+    inline U8x16 InterleaveHigh(U8x16 a, U8x16 b)
+    {
+        return __builtin_shufflevector(
+            a, b, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+    }
+
+    // Writes 64 bytes at |dst|: byte i of |a|, |b|, |c| and |d|, for each i.
+    inline void Store4(U8x16 a, U8x16 b, U8x16 c, U8x16 d, uint8_t *dst)
+    {
+        const U16x8 ab[2] = { (U16x8)InterleaveLow(a, b), (U16x8)InterleaveHigh(a, b) };
+        const U16x8 cd[2] = { (U16x8)InterleaveLow(c, d), (U16x8)InterleaveHigh(c, d) };
+        const U16x8 out[4] = {
+            __builtin_shufflevector(ab[0], cd[0], 0, 8, 1, 9, 2, 10, 3, 11),
+            __builtin_shufflevector(ab[0], cd[0], 4, 12, 5, 13, 6, 14, 7, 15),
+            __builtin_shufflevector(ab[1], cd[1], 0, 8, 1, 9, 2, 10, 3, 11),
+            __builtin_shufflevector(ab[1], cd[1], 4, 12, 5, 13, 6, 14, 7, 15),
+        };
+        memcpy(dst, out, sizeof(out));
+    }
+
+    // Reads 16 pixels of 4 bytes at |src| into their first, second and third
+    // bytes.
+    inline void Load4(const uint8_t *src, U8x16 &first, U8x16 &second, U8x16 &third)
+    {
+        U8x16 v[4];
+        memcpy(v, src, sizeof(v));
+        const U8x16 even[2] = { EvenBytes(v[0], v[1]), EvenBytes(v[2], v[3]) };
+        const U8x16 odd[2] = { OddBytes(v[0], v[1]), OddBytes(v[2], v[3]) };
+        first = EvenBytes(even[0], even[1]);
+        second = EvenBytes(odd[0], odd[1]);
+        third = OddBytes(even[0], even[1]);
+    }
+
+    // The wide vectors are passed by reference, as passing them by value
+    // would depend on whether AVX is enabled.
+    inline I32x16 &Widen(U8x16 v, I32x16 &out)
+    {
+        out = __builtin_convertvector(v, I32x16);
+        return out;
+    }
+
+    inline U8x16 NarrowClamped(const I32x16 &v)
+    {
+        const I32x16 zero = {};
+        const I32x16 max = zero + 255;
+        I32x16 clamped = v < zero ? zero : v;
+        clamped = clamped > max ? max : clamped;
+        return __builtin_convertvector(clamped, U8x16);
+    }
+
+    // Rounded average of |a| and |b|, without overflow.
+    inline U8x16 Average(U8x16 a, U8x16 b) { return (a | b) - ((a ^ b) >> 1); }
+
+    void YuvToRgbRowVector(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+        uint32_t width, const YuvToRgbCoefficients &c, bool bgr)
+    {
+        // 32 pixels, i.e. 16 chroma samples, at a time.
+        constexpr uint32_t kBlock = 32;
+        const U8x16 opaque = U8x16 {} + kOpaque;
+        uint32_t x = 0;
+        for (; x + kBlock <= width; x += kBlock) {
+            U8x16 luma[2], cb_samples, cr_samples;
+            memcpy(luma, y + x, sizeof(luma));
+            memcpy(&cb_samples, u + x / 2, sizeof(cb_samples));
+            memcpy(&cr_samples, v + x / 2, sizeof(cr_samples));
+            I32x16 cb, cr;
+            Widen(cb_samples, cb) -= 128;
+            Widen(cr_samples, cr) -= 128;
+            const I32x16 r_chroma = cr * c.r_v;
+            const I32x16 g_chroma = cb * c.g_u + cr * c.g_v;
+            const I32x16 b_chroma = cb * c.b_u;
+            U8x16 r[2], g[2], b[2];
+            const U8x16 samples[2] = { EvenBytes(luma[0], luma[1]), OddBytes(luma[0], luma[1]) };
+            for (int odd = 0; odd < 2; odd++) {
+                I32x16 l;
+                l = (Widen(samples[odd], l) - c.y_offset) * c.y_gain + kHalf;
+                const I32x16 red = (l + r_chroma) >> kShift;
+                const I32x16 green = (l - g_chroma) >> kShift;
+                const I32x16 blue = (l + b_chroma) >> kShift;
+                r[odd] = NarrowClamped(red);
+                g[odd] = NarrowClamped(green);
+                b[odd] = NarrowClamped(blue);
+            }
+            // Back to pixel order.
+            const U8x16 red[2] = { InterleaveLow(r[0], r[1]), InterleaveHigh(r[0], r[1]) };
+            const U8x16 green[2] = { InterleaveLow(g[0], g[1]), InterleaveHigh(g[0], g[1]) };
+            const U8x16 blue[2] = { InterleaveLow(b[0], b[1]), InterleaveHigh(b[0], b[1]) };
+            for (int half = 0; half < 2; half++) {
+                Store4(bgr ? blue[half] : red[half], green[half], bgr ? red[half] : blue[half],
+                    opaque, dst + 4 * x + 64 * half);
+            }
+        }
+        YuvToRgbRowScalar(y + x, u + x / 2, v + x / 2, dst + 4 * x, width - x, c, bgr);
+    }
+
+    void RgbToYRowVector(
+        const uint8_t *src, uint8_t *y, uint32_t width, const RgbToYuvCoefficients &c, bool bgr)
+    {
+        constexpr uint32_t kBlock = 16;
+        uint32_t x = 0;
+        for (; x + kBlock <= width; x += kBlock) {
+            U8x16 first, g, third;
+            Load4(src + 4 * x, first, g, third);
+            I32x16 r, green, b;
+            Widen(bgr ? third : first, r);
+            Widen(g, green);
+            Widen(bgr ? first : third, b);
+            const I32x16 luma = (r * c.y_r + green * c.y_g + b * c.y_b
+                                    + ((c.y_offset << kShift) + kHalf))
+                >> kShift;
+            const U8x16 out = NarrowClamped(luma);
+            memcpy(y + x, &out, sizeof(out));
+        }
+        RgbToYRowScalar(src + 4 * x, y + x, width - x, c, bgr);
+    }
+
+    void RgbToUVRowVector(const uint8_t *src0, const uint8_t *src1, uint8_t *u, uint8_t *v,
+        uint32_t width, const RgbToYuvCoefficients &c, bool bgr)
+    {
+        // 16 pixels of both rows, i.e. 8 chroma samples, at a time.
+        constexpr uint32_t kBlock = 16;
+        uint32_t x = 0;
+        for (; x + kBlock <= width; x += kBlock) {
+            U8x16 channels[2][3];
+            Load4(src0 + 4 * x, channels[0][0], channels[0][1], channels[0][2]);
+            Load4(src1 + 4 * x, channels[1][0], channels[1][1], channels[1][2]);
+            I32x8 averages[3];
+            for (int channel = 0; channel < 3; channel++) {
+                I32x16 row0, row1;
+                const I32x16 sum
+                    = Widen(channels[0][channel], row0) + Widen(channels[1][channel], row1);
+                const I32x8 even = __builtin_shufflevector(sum, sum, 0, 2, 4, 6, 8, 10, 12, 14);
+                const I32x8 odd = __builtin_shufflevector(sum, sum, 1, 3, 5, 7, 9, 11, 13, 15);
+                averages[channel] = (even + odd + 2) >> 2;
+            }
+            const I32x8 r = averages[bgr ? 2 : 0];
+            const I32x8 g = averages[1];
+            const I32x8 b = averages[bgr ? 0 : 2];
+            const auto chroma = [&r, &g, &b](int32_t cr, int32_t cg, int32_t cb) {
+                const I32x8 zero = {};
+                const I32x8 max = zero + 255;
+                I32x8 value = (r * cr + g * cg + b * cb + ((128 << kShift) + kHalf)) >> kShift;
+                value = value < zero ? zero : value;
+                value = value > max ? max : value;
+                return __builtin_convertvector(value, U8x8);
+            };
+            const U8x8 cb = chroma(c.u_r, c.u_g, c.u_b);
+            const U8x8 cr = chroma(c.v_r, c.v_g, c.v_b);
+            memcpy(u + x / 2, &cb, sizeof(cb));
+            memcpy(v + x / 2, &cr, sizeof(cr));
+        }
+        RgbToUVRowScalar(src0 + 4 * x, src1 + 4 * x, u + x / 2, v + x / 2, width - x, c, bgr);
+    }
+
+    void I420To422RowVector(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst,
+        uint32_t width, bool uyvy)
+    {
+        constexpr uint32_t kBlock = 32;
+        uint32_t x = 0;
+        for (; x + kBlock <= width; x += kBlock) {
+            U8x16 luma[2], cb, cr;
+            memcpy(luma, y + x, sizeof(luma));
+            memcpy(&cb, u + x / 2, sizeof(cb));
+            memcpy(&cr, v + x / 2, sizeof(cr));
+            const U8x16 y0 = EvenBytes(luma[0], luma[1]);
+            const U8x16 y1 = OddBytes(luma[0], luma[1]);
+            if (uyvy) {
+                Store4(cb, y0, cr, y1, dst + 2 * x);
+            } else {
+                Store4(y0, cb, y1, cr, dst + 2 * x);
+            }
+        }
+        I420To422RowScalar(y + x, u + x / 2, v + x / 2, dst + 2 * x, width - x, uyvy);
+    }
+
+    void Packed422ToYRowVector(const uint8_t *src, uint8_t *y, uint32_t width, bool uyvy)
+    {
+        constexpr uint32_t kBlock = 32;
+        uint32_t x = 0;
+        for (; x + kBlock <= width; x += kBlock) {
+            U8x16 pixels[4];
+            memcpy(pixels, src + 2 * x, sizeof(pixels));
+            const U8x16 luma[2] = {
+                uyvy ? OddBytes(pixels[0], pixels[1]) : EvenBytes(pixels[0], pixels[1]),
+                uyvy ? OddBytes(pixels[2], pixels[3]) : EvenBytes(pixels[2], pixels[3]),
+            };
+            memcpy(y + x, luma, sizeof(luma));
+        }
+        Packed422ToYRowScalar(src + 2 * x, y + x, width - x, uyvy);
+    }
+
+    void Packed422ToUVRowVector(const uint8_t *src0, const uint8_t *src1, uint8_t *u, uint8_t *v,
+        uint32_t width, bool uyvy)
+    {
+        constexpr uint32_t kBlock = 32;
+        uint32_t x = 0;
+        for (; x + kBlock <= width; x += kBlock) {
+            U8x16 rows[2][4];
+            memcpy(rows[0], src0 + 2 * x, sizeof(rows[0]));
+            memcpy(rows[1], src1 + 2 * x, sizeof(rows[1]));
+            // Cb and Cr alternate in the odd bytes of YUY2 and the even ones of
+            // UYVY.
+            U8x16 chroma[2];
+            for (int half = 0; half < 2; half++) {
+                const U8x16 a = Average(rows[0][2 * half], rows[1][2 * half]);
+                const U8x16 b = Average(rows[0][2 * half + 1], rows[1][2 * half + 1]);
+                chroma[half] = uyvy ? EvenBytes(a, b) : OddBytes(a, b);
+            }
+            const U8x16 cb = EvenBytes(chroma[0], chroma[1]);
+            const U8x16 cr = OddBytes(chroma[0], chroma[1]);
+            memcpy(u + x / 2, &cb, sizeof(cb));
+            memcpy(v + x / 2, &cr, sizeof(cr));
+        }
+        Packed422ToUVRowScalar(src0 + 2 * x, src1 + 2 * x, u + x / 2, v + x / 2, width - x, uyvy);
+    }
+
+    // SSE2 and NEON are part of x86-64 and AArch64.
+    bool CpuHasVectorKernels() { return true; }
+
+#else
+
+#    define NO_VECTOR_KERNELS
+
+#endif
+
+#if defined(NO_VECTOR_KERNELS)
+    const Kernels &kVectorKernels = kScalarKernels;
+
+    bool CpuHasVectorKernels() { return false; }
+#else
+    const Kernels kVectorKernels = {
+        .yuv_to_rgb_row = YuvToRgbRowVector,
+        .rgb_to_y_row = RgbToYRowVector,
+        .rgb_to_uv_row = RgbToUVRowVector,
+        .i420_to_422_row = I420To422RowVector,
+        .packed_422_to_y_row = Packed422ToYRowVector,
+        .packed_422_to_uv_row = Packed422ToUVRowVector,
+    };
+#endif
+
+    const Kernels &GetKernels()
+    {
+        static const Kernels &kernels = [&]() -> const Kernels & {
+            const char *use_scalar_env_var = getenv("USE_SCALAR_CONVERSION");
+            const bool use_scalar = use_scalar_env_var && strcmp(use_scalar_env_var, "1") == 0;
+            return use_scalar || !CpuHasVectorKernels() ? kScalarKernels : kVectorKernels;
+        }();
+        return kernels;
+    }
+
+    bool IsRgb(PackedFormat format)
+    {
+        return format == PackedFormat::kRGBX || format == PackedFormat::kBGRX;
+    }
+
+} // namespace
+
+void I420ToPacked(const uint8_t *y, size_t y_stride, const uint8_t *u, size_t u_stride,
+    const uint8_t *v, size_t v_stride, uint8_t *dst, size_t dst_stride, uint32_t width,
+    uint32_t height, PackedFormat format, const ColorSpace &color_space)
+{
+    const Kernels &kernels = GetKernels();
+    const YuvToRgbCoefficients coefficients = GetYuvToRgbCoefficients(color_space);
+    for (uint32_t row = 0; row < height; row++) {
+        const uint8_t *const y_row = y + row * y_stride;
+        const uint8_t *const u_row = u + row / 2 * u_stride;
+        const uint8_t *const v_row = v + row / 2 * v_stride;
+        uint8_t *const dst_row = dst + row * dst_stride;
+        if (IsRgb(format)) {
+            kernels.yuv_to_rgb_row(
+                y_row, u_row, v_row, dst_row, width, coefficients, format == PackedFormat::kBGRX);
+        } else {
+            kernels.i420_to_422_row(
+                y_row, u_row, v_row, dst_row, width, format == PackedFormat::kUYVY);
+        }
+    }
+}
+
+void PackedToI420(const uint8_t *src, size_t src_stride, uint8_t *y, size_t y_stride, uint8_t *u,
+    size_t u_stride, uint8_t *v, size_t v_stride, uint32_t width, uint32_t height,
+    PackedFormat format, const ColorSpace &color_space)
+{
+    const Kernels &kernels = GetKernels();
+    const RgbToYuvCoefficients coefficients = GetRgbToYuvCoefficients(color_space);
+    const bool rgb = IsRgb(format);
+    const bool swapped = format == PackedFormat::kBGRX || format == PackedFormat::kUYVY;
+    for (uint32_t row = 0; row < height; row += 2) {
+        // The last row of odd height pictures pairs with itself.
+        const uint32_t rows = std::min(2u, height - row);
+        const uint8_t *const src_rows[2] = { src + row * src_stride,
+            src + (row + rows - 1) * src_stride };
+        for (uint32_t i = 0; i < rows; i++) {
+            uint8_t *const y_row = y + (row + i) * y_stride;
+            if (rgb) {
+                kernels.rgb_to_y_row(src_rows[i], y_row, width, coefficients, swapped);
+            } else {
+                kernels.packed_422_to_y_row(src_rows[i], y_row, width, swapped);
+            }
+        }
+        uint8_t *const u_row = u + row / 2 * u_stride;
+        uint8_t *const v_row = v + row / 2 * v_stride;
+        if (rgb) {
+            kernels.rgb_to_uv_row(
+                src_rows[0], src_rows[1], u_row, v_row, width, coefficients, swapped);
+        } else {
+            kernels.packed_422_to_uv_row(src_rows[0], src_rows[1], u_row, v_row, width, swapped);
+        }
+    }
+}
+
+} // namespace libvavc8000d::base
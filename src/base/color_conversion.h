@@ -0,0 +1,60 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_COLOR_CONVERSION_H_
+#define BASE_COLOR_CONVERSION_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libvavc8000d::base
+{
+
+// Conversions between I420 and the packed formats VA images can be in. The
+// row kernels come in scalar, generic vector (SSE2/NEON) and RVV versions,
+// which produce the same results. The fastest one the CPU supports is picked
+// the first time a conversion runs, and USE_SCALAR_CONVERSION=1 forces the
+// scalar ones.
+
+// Matrix coefficients of YUV samples, see ITU-T H.273.
+enum class ColorMatrix {
+    kBT601,
+    kBT709,
+};
+
+struct ColorSpace
+{
+    ColorMatrix matrix = ColorMatrix::kBT601;
+    // Whether the samples use the full 0-255 range rather than 16-235 (luma)
+    // and 16-240 (chroma).
+    bool full_range = false;
+};
+
+// Layouts of one-plane pictures, named after their byte order in memory.
+enum class PackedFormat {
+    // 4:2:2, Y0 Cb Y1 Cr.
+    kYUY2,
+    // 4:2:2, Cb Y0 Cr Y1.
+    kUYVY,
+    kRGBX,
+    kBGRX,
+};
+
+// Converts the |width| x |height| I420 picture in |y|, |u| and |v| to |dst|.
+// 4:2:2 formats repeat each chroma row, and odd widths repeat the last luma
+// sample in the last pixel pair. |color_space| only applies to RGB.
+void I420ToPacked(const uint8_t *y, size_t y_stride, const uint8_t *u, size_t u_stride,
+    const uint8_t *v, size_t v_stride, uint8_t *dst, size_t dst_stride, uint32_t width,
+    uint32_t height, PackedFormat format, const ColorSpace &color_space);
+
+// Converts the |width| x |height| picture in |src| to I420. Chroma is the
+// rounded average of each pair of rows, and for RGB of each 2x2 block of
+// pixels. |color_space| only applies to RGB.
+void PackedToI420(const uint8_t *src, size_t src_stride, uint8_t *y, size_t y_stride, uint8_t *u,
+    size_t u_stride, uint8_t *v, size_t v_stride, uint32_t width, uint32_t height,
+    PackedFormat format, const ColorSpace &color_space);
+
+} // namespace libvavc8000d::base
+
+#endif // BASE_COLOR_CONVERSION_H_
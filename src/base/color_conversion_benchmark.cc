@@ -0,0 +1,74 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "color_conversion.h"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // A 1080p picture, as vaGetImage() and vaPutImage() convert them. Run with
+    // USE_SCALAR_CONVERSION=1 for the numbers of the scalar kernels.
+    constexpr uint32_t kWidth = 1920;
+    constexpr uint32_t kHeight = 1080;
+    constexpr ColorSpace kColorSpace = { .matrix = ColorMatrix::kBT709 };
+
+    std::vector<uint8_t> RandomBytes(size_t size)
+    {
+        std::mt19937 rng(1);
+        std::vector<uint8_t> data(size);
+        for (auto &byte : data) { byte = static_cast<uint8_t>(rng()); }
+        return data;
+    }
+
+    size_t PackedStride(PackedFormat format)
+    {
+        return format == PackedFormat::kYUY2 || format == PackedFormat::kUYVY ? 2 * kWidth
+                                                                              : 4 * kWidth;
+    }
+
+    void BM_I420ToPacked(benchmark::State &state, PackedFormat format)
+    {
+        const auto y = RandomBytes(kWidth * kHeight);
+        const auto u = RandomBytes(kWidth / 2 * kHeight / 2);
+        const auto v = RandomBytes(kWidth / 2 * kHeight / 2);
+        std::vector<uint8_t> dst(PackedStride(format) * kHeight);
+        for (auto _ : state) {
+            I420ToPacked(y.data(), kWidth, u.data(), kWidth / 2, v.data(), kWidth / 2, dst.data(),
+                PackedStride(format), kWidth, kHeight, format, kColorSpace);
+            benchmark::DoNotOptimize(dst.data());
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+    BENCHMARK_CAPTURE(BM_I420ToPacked, YUY2, PackedFormat::kYUY2);
+    BENCHMARK_CAPTURE(BM_I420ToPacked, UYVY, PackedFormat::kUYVY);
+    BENCHMARK_CAPTURE(BM_I420ToPacked, RGBX, PackedFormat::kRGBX);
+    BENCHMARK_CAPTURE(BM_I420ToPacked, BGRX, PackedFormat::kBGRX);
+
+    void BM_PackedToI420(benchmark::State &state, PackedFormat format)
+    {
+        const auto src = RandomBytes(PackedStride(format) * kHeight);
+        std::vector<uint8_t> y(kWidth * kHeight);
+        std::vector<uint8_t> u(kWidth / 2 * kHeight / 2);
+        std::vector<uint8_t> v(kWidth / 2 * kHeight / 2);
+        for (auto _ : state) {
+            PackedToI420(src.data(), PackedStride(format), y.data(), kWidth, u.data(), kWidth / 2,
+                v.data(), kWidth / 2, kWidth, kHeight, format, kColorSpace);
+            benchmark::DoNotOptimize(y.data());
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+    BENCHMARK_CAPTURE(BM_PackedToI420, YUY2, PackedFormat::kYUY2);
+    BENCHMARK_CAPTURE(BM_PackedToI420, UYVY, PackedFormat::kUYVY);
+    BENCHMARK_CAPTURE(BM_PackedToI420, RGBX, PackedFormat::kRGBX);
+    BENCHMARK_CAPTURE(BM_PackedToI420, BGRX, PackedFormat::kBGRX);
+
+} // namespace
+} // namespace libvavc8000d::base
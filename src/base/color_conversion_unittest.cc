@@ -0,0 +1,289 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "color_conversion.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // Odd sizes leave pixel pairs and rows to the scalar tails of the vector
+    // kernels, and widths around 16 and 32 pixels cross their lanes.
+    constexpr std::pair<uint32_t, uint32_t> kSizes[] = { { 1, 1 }, { 1, 2 }, { 2, 1 }, { 3, 3 },
+        { 15, 7 }, { 16, 16 }, { 17, 5 }, { 31, 3 }, { 33, 9 }, { 65, 4 }, { 127, 3 } };
+
+    // Written to the padding of the destination rows, which must be left
+    // alone.
+    constexpr uint8_t kCanary = 0xcd;
+
+    // A plane with rows |padding| bytes longer than |row_bytes|.
+    struct Plane
+    {
+        Plane(size_t row_bytes, size_t rows, size_t padding)
+            : stride(row_bytes + padding), row_bytes(row_bytes), data(stride * rows, kCanary)
+        {}
+
+        uint8_t &at(size_t x, size_t y) { return data[y * stride + x]; }
+        uint8_t at(size_t x, size_t y) const { return data[y * stride + x]; }
+
+        bool PaddingIntact() const
+        {
+            for (size_t offset = 0; offset < data.size(); offset += stride) {
+                if (!std::all_of(data.begin() + offset + row_bytes, data.begin() + offset + stride,
+                        [](uint8_t byte) { return byte == kCanary; })) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        size_t stride;
+        size_t row_bytes;
+        std::vector<uint8_t> data;
+    };
+
+    struct I420Picture
+    {
+        I420Picture(uint32_t width, uint32_t height, size_t padding)
+            : y(width, height, padding)
+            , u((width + 1) / 2, (height + 1) / 2, padding)
+            , v((width + 1) / 2, (height + 1) / 2, padding)
+        {}
+
+        // Samples within [min, max], so that conversions to RGB don't clip.
+        void Fill(std::mt19937 &rng, int luma_min, int luma_max, int chroma_min, int chroma_max)
+        {
+            for (Plane *plane : { &y, &u, &v }) {
+                const bool luma = plane == &y;
+                const int min = luma ? luma_min : chroma_min;
+                const int max = luma ? luma_max : chroma_max;
+                for (size_t row = 0; row * plane->stride < plane->data.size(); row++) {
+                    for (size_t x = 0; x < plane->row_bytes; x++) {
+                        plane->at(x, row) = static_cast<uint8_t>(min + rng() % (max - min + 1));
+                    }
+                }
+            }
+        }
+
+        Plane y, u, v;
+    };
+
+    void ToPacked(const I420Picture &src, Plane &dst, uint32_t width, uint32_t height,
+        PackedFormat format, const ColorSpace &color_space = ColorSpace())
+    {
+        I420ToPacked(src.y.data.data(), src.y.stride, src.u.data.data(), src.u.stride,
+            src.v.data.data(), src.v.stride, dst.data.data(), dst.stride, width, height, format,
+            color_space);
+    }
+
+    void ToI420(const Plane &src, I420Picture &dst, uint32_t width, uint32_t height,
+        PackedFormat format, const ColorSpace &color_space = ColorSpace())
+    {
+        PackedToI420(src.data.data(), src.stride, dst.y.data.data(), dst.y.stride,
+            dst.u.data.data(), dst.u.stride, dst.v.data.data(), dst.v.stride, width, height,
+            format, color_space);
+    }
+
+    // The conversions to and from RGB, in floating point as ITU-T H.273
+    // describes them.
+    void YuvToRgbReference(
+        int y, int cb, int cr, const ColorSpace &color_space, double &r, double &g, double &b)
+    {
+        const double kr = color_space.matrix == ColorMatrix::kBT709 ? 0.2126 : 0.299;
+        const double kb = color_space.matrix == ColorMatrix::kBT709 ? 0.0722 : 0.114;
+        const double kg = 1.0 - kr - kb;
+        const double luma = color_space.full_range ? y : (y - 16) * 255.0 / 219.0;
+        const double scale = color_space.full_range ? 1.0 : 255.0 / 224.0;
+        const double u = (cb - 128) * scale;
+        const double v = (cr - 128) * scale;
+        r = luma + 2.0 * (1.0 - kr) * v;
+        g = luma - (2.0 * (1.0 - kb) * kb * u + 2.0 * (1.0 - kr) * kr * v) / kg;
+        b = luma + 2.0 * (1.0 - kb) * u;
+    }
+
+    const ColorSpace kColorSpaces[] = {
+        { ColorMatrix::kBT601, false },
+        { ColorMatrix::kBT601, true },
+        { ColorMatrix::kBT709, false },
+        { ColorMatrix::kBT709, true },
+    };
+
+    TEST(ColorConversionTest, I420ToPacked422MatchesReference)
+    {
+        std::mt19937 rng(1);
+        for (const auto [width, height] : kSizes) {
+            for (const PackedFormat format : { PackedFormat::kYUY2, PackedFormat::kUYVY }) {
+                I420Picture src(width, height, 3);
+                src.Fill(rng, 0, 255, 0, 255);
+                const uint32_t pairs = (width + 1) / 2;
+                Plane dst(4 * pairs, height, 5);
+                ToPacked(src, dst, width, height, format);
+
+                const bool uyvy = format == PackedFormat::kUYVY;
+                for (uint32_t row = 0; row < height; row++) {
+                    for (uint32_t i = 0; i < pairs; i++) {
+                        // Odd widths repeat the last luma sample.
+                        const uint8_t y0 = src.y.at(2 * i, row);
+                        const uint8_t y1 = src.y.at(std::min(2 * i + 1, width - 1), row);
+                        const uint8_t u = src.u.at(i, row / 2);
+                        const uint8_t v = src.v.at(i, row / 2);
+                        const uint8_t expected[4] = { uyvy ? u : y0, uyvy ? y0 : u,
+                            uyvy ? v : y1, uyvy ? y1 : v };
+                        for (int byte = 0; byte < 4; byte++) {
+                            ASSERT_EQ(dst.at(4 * i + byte, row), expected[byte])
+                                << width << "x" << height << " pixel pair " << i << " row " << row;
+                        }
+                    }
+                }
+                EXPECT_TRUE(dst.PaddingIntact());
+            }
+        }
+    }
+
+    TEST(ColorConversionTest, Packed422RoundTrip)
+    {
+        std::mt19937 rng(2);
+        for (const auto [width, height] : kSizes) {
+            for (const PackedFormat format : { PackedFormat::kYUY2, PackedFormat::kUYVY }) {
+                I420Picture src(width, height, 1);
+                src.Fill(rng, 0, 255, 0, 255);
+                Plane packed(4 * ((width + 1) / 2), height, 7);
+                ToPacked(src, packed, width, height, format);
+                I420Picture dst(width, height, 2);
+                ToI420(packed, dst, width, height, format);
+
+                // 4:2:2 repeats each chroma row, which averages back to itself.
+                for (uint32_t row = 0; row < height; row++) {
+                    for (uint32_t x = 0; x < width; x++) {
+                        ASSERT_EQ(dst.y.at(x, row), src.y.at(x, row));
+                    }
+                }
+                for (uint32_t row = 0; row < (height + 1) / 2; row++) {
+                    for (uint32_t i = 0; i < (width + 1) / 2; i++) {
+                        ASSERT_EQ(dst.u.at(i, row), src.u.at(i, row));
+                        ASSERT_EQ(dst.v.at(i, row), src.v.at(i, row));
+                    }
+                }
+                EXPECT_TRUE(dst.y.PaddingIntact());
+                EXPECT_TRUE(dst.u.PaddingIntact());
+                EXPECT_TRUE(dst.v.PaddingIntact());
+            }
+        }
+    }
+
+    TEST(ColorConversionTest, I420ToRgbMatchesReference)
+    {
+        std::mt19937 rng(3);
+        for (const auto [width, height] : kSizes) {
+            for (const PackedFormat format : { PackedFormat::kRGBX, PackedFormat::kBGRX }) {
+                for (const ColorSpace &color_space : kColorSpaces) {
+                    I420Picture src(width, height, 3);
+                    src.Fill(rng, 0, 255, 0, 255);
+                    Plane dst(4 * width, height, 4);
+                    ToPacked(src, dst, width, height, format, color_space);
+
+                    const bool bgr = format == PackedFormat::kBGRX;
+                    for (uint32_t row = 0; row < height; row++) {
+                        for (uint32_t x = 0; x < width; x++) {
+                            double r, g, b;
+                            YuvToRgbReference(src.y.at(x, row), src.u.at(x / 2, row / 2),
+                                src.v.at(x / 2, row / 2), color_space, r, g, b);
+                            // Fixed point rounding is off by one at most.
+                            const uint8_t *pixel = &dst.at(4 * x, row);
+                            ASSERT_NEAR(pixel[bgr ? 2 : 0], std::clamp(r, 0.0, 255.0), 1.0);
+                            ASSERT_NEAR(pixel[1], std::clamp(g, 0.0, 255.0), 1.0);
+                            ASSERT_NEAR(pixel[bgr ? 0 : 2], std::clamp(b, 0.0, 255.0), 1.0);
+                            ASSERT_EQ(pixel[3], 0xff);
+                        }
+                    }
+                    EXPECT_TRUE(dst.PaddingIntact());
+                }
+            }
+        }
+    }
+
+    TEST(ColorConversionTest, RgbRoundTrip)
+    {
+        std::mt19937 rng(4);
+        for (const auto [width, height] : kSizes) {
+            for (const PackedFormat format : { PackedFormat::kRGBX, PackedFormat::kBGRX }) {
+                for (const ColorSpace &color_space : kColorSpaces) {
+                    // The samples stay within what RGB represents without
+                    // clipping.
+                    I420Picture src(width, height, 2);
+                    src.Fill(rng, 64, 192, 112, 144);
+                    Plane rgb(4 * width, height, 3);
+                    ToPacked(src, rgb, width, height, format, color_space);
+                    I420Picture dst(width, height, 5);
+                    ToI420(rgb, dst, width, height, format, color_space);
+
+                    for (uint32_t row = 0; row < height; row++) {
+                        for (uint32_t x = 0; x < width; x++) {
+                            ASSERT_NEAR(dst.y.at(x, row), src.y.at(x, row), 1)
+                                << width << "x" << height << " at " << x << "," << row;
+                        }
+                    }
+                    // Chroma is shared by each 2x2 block, so averaging the
+                    // block gives it back.
+                    for (uint32_t row = 0; row < (height + 1) / 2; row++) {
+                        for (uint32_t i = 0; i < (width + 1) / 2; i++) {
+                            ASSERT_NEAR(dst.u.at(i, row), src.u.at(i, row), 2);
+                            ASSERT_NEAR(dst.v.at(i, row), src.v.at(i, row), 2);
+                        }
+                    }
+                    EXPECT_TRUE(dst.y.PaddingIntact());
+                    EXPECT_TRUE(dst.u.PaddingIntact());
+                    EXPECT_TRUE(dst.v.PaddingIntact());
+                }
+            }
+        }
+    }
+
+    TEST(ColorConversionTest, RgbToI420AveragesChromaBlocks)
+    {
+        // A picture with a different colour in each pixel of each 2x2 block,
+        // whose chroma must be the one of the average colour. The last column
+        // and row of odd sizes pair with themselves.
+        std::mt19937 rng(5);
+        for (const auto [width, height] : kSizes) {
+            Plane rgb(4 * width, height, 1);
+            for (uint32_t row = 0; row < height; row++) {
+                for (uint32_t x = 0; x < 4 * width; x++) {
+                    rgb.at(x, row) = static_cast<uint8_t>(rng());
+                }
+            }
+            I420Picture dst(width, height, 1);
+            ToI420(rgb, dst, width, height, PackedFormat::kRGBX, { ColorMatrix::kBT601, true });
+
+            for (uint32_t row = 0; row < (height + 1) / 2; row++) {
+                for (uint32_t i = 0; i < (width + 1) / 2; i++) {
+                    double average[3] = {};
+                    for (const uint32_t y : { 2 * row, std::min(2 * row + 1, height - 1) }) {
+                        for (const uint32_t x : { 2 * i, std::min(2 * i + 1, width - 1) }) {
+                            for (int c = 0; c < 3; c++) { average[c] += rgb.at(4 * x + c, y); }
+                        }
+                    }
+                    for (double &value : average) { value /= 4; }
+                    const double cb = 128 - 0.168736 * average[0] - 0.331264 * average[1]
+                        + 0.5 * average[2];
+                    const double cr = 128 + 0.5 * average[0] - 0.418688 * average[1]
+                        - 0.081312 * average[2];
+                    ASSERT_NEAR(dst.u.at(i, row), std::clamp(cb, 0.0, 255.0), 1.0);
+                    ASSERT_NEAR(dst.v.at(i, row), std::clamp(cr, 0.0, 255.0), 1.0);
+                }
+            }
+        }
+    }
+
+} // namespace
+} // namespace libvavc8000d::base
@@ -0,0 +1,178 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "detile.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__riscv_vector)
+#include <riscv_vector.h>
+#endif
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // Both shapes are four rows high.
+    constexpr uint32_t kTileHeight = 4;
+
+    // Copies the first |rows| rows of the row of tiles at |src| from byte
+    // column |x| up to |width|, a tile row at a time.
+    template <uint32_t kTileWidth>
+    void DetileRowScalar(const uint8_t *src, uint8_t *dst, size_t dst_stride, uint32_t x,
+        uint32_t width, uint32_t rows)
+    {
+        constexpr size_t kTileBytes = kTileWidth * kTileHeight;
+        for (; x < width; x += kTileWidth) {
+            const uint8_t *tile = src + x / kTileWidth * kTileBytes;
+            const uint32_t bytes = std::min(kTileWidth, width - x);
+            for (uint32_t row = 0; row < rows; row++) {
+                memcpy(dst + row * dst_stride + x, tile + row * kTileWidth, bytes);
+            }
+        }
+    }
+
+#if defined(__riscv_vector)
+
+    // RVV 1.0. A row of a tile is a single 32-bit or 64-bit element, so each
+    // pixel row is gathered from the row of tiles with a strided load. The
+    // elements must be naturally aligned, otherwise the scalar copy is used.
+    // Returns the number of bytes copied from each row.
+    template <uint32_t kTileWidth>
+    uint32_t DetileRowVector(const uint8_t *src, uint8_t *dst, size_t dst_stride, uint32_t width)
+    {
+        constexpr ptrdiff_t kTileBytes = kTileWidth * kTileHeight;
+        if ((reinterpret_cast<uintptr_t>(src) | reinterpret_cast<uintptr_t>(dst) | dst_stride)
+            % kTileWidth) {
+            return 0;
+        }
+        const size_t tiles = width / kTileWidth;
+        for (uint32_t row = 0; row < kTileHeight; row++) {
+            const uint8_t *s = src + row * kTileWidth;
+            uint8_t *d = dst + row * dst_stride;
+            for (size_t i = 0; i < tiles;) {
+                if constexpr (kTileWidth == 4) {
+                    const size_t vl = __riscv_vsetvl_e32m8(tiles - i);
+                    const vuint32m8_t v = __riscv_vlse32_v_u32m8(
+                        reinterpret_cast<const uint32_t *>(s + i * kTileBytes), kTileBytes, vl);
+                    __riscv_vse32_v_u32m8(reinterpret_cast<uint32_t *>(d + i * kTileWidth), v, vl);
+                    i += vl;
+                } else {
+                    const size_t vl = __riscv_vsetvl_e64m8(tiles - i);
+                    const vuint64m8_t v = __riscv_vlse64_v_u64m8(
+                        reinterpret_cast<const uint64_t *>(s + i * kTileBytes), kTileBytes, vl);
+                    __riscv_vse64_v_u64m8(reinterpret_cast<uint64_t *>(d + i * kTileWidth), v, vl);
+                    i += vl;
+                }
+            }
+        }
+        return static_cast<uint32_t>(tiles * kTileWidth);
+    }
+
+#elif (defined(__SSE2__) || defined(__ARM_NEON)) && __has_builtin(__builtin_shufflevector)
+
+    typedef uint32_t U32x4 __attribute__((vector_size(16)));
+    typedef uint64_t U64x2 __attribute__((vector_size(16)));
+
+    // Both kernels turn 64 bytes of tiles, four 4x4 tiles or two 8x4 tiles,
+    // into 16 bytes of each of the four pixel rows. Returns the number of
+    // bytes copied from each row.
+    template <uint32_t kTileWidth>
+    uint32_t DetileRowVector(const uint8_t *src, uint8_t *dst, size_t dst_stride, uint32_t width);
+
+    template <>
+    uint32_t DetileRowVector<4>(const uint8_t *src, uint8_t *dst, size_t dst_stride, uint32_t width)
+    {
+        constexpr uint32_t kBlock = 16;
+        uint32_t x = 0;
+        for (; x + kBlock <= width; x += kBlock) {
+            // A 4x4 transpose of the 32-bit tile rows.
+            U32x4 t[4];
+            memcpy(t, src + x * kTileHeight, sizeof(t));
+            const U32x4 t01_lo = __builtin_shufflevector(t[0], t[1], 0, 4, 1, 5);
+            const U32x4 t01_hi = __builtin_shufflevector(t[0], t[1], 2, 6, 3, 7);
+            const U32x4 t23_lo = __builtin_shufflevector(t[2], t[3], 0, 4, 1, 5);
+            const U32x4 t23_hi = __builtin_shufflevector(t[2], t[3], 2, 6, 3, 7);
+            const U32x4 rows[kTileHeight] = {
+                __builtin_shufflevector(t01_lo, t23_lo, 0, 1, 4, 5),
+                __builtin_shufflevector(t01_lo, t23_lo, 2, 3, 6, 7),
+                __builtin_shufflevector(t01_hi, t23_hi, 0, 1, 4, 5),
+                __builtin_shufflevector(t01_hi, t23_hi, 2, 3, 6, 7),
+            };
+            for (uint32_t row = 0; row < kTileHeight; row++) {
+                memcpy(dst + row * dst_stride + x, &rows[row], kBlock);
+            }
+        }
+        return x;
+    }
+
+    template <>
+    uint32_t DetileRowVector<8>(const uint8_t *src, uint8_t *dst, size_t dst_stride, uint32_t width)
+    {
+        constexpr uint32_t kBlock = 16;
+        uint32_t x = 0;
+        for (; x + kBlock <= width; x += kBlock) {
+            // Rows 0-1 and 2-3 of the first tile, then of the second one.
+            U64x2 t[4];
+            memcpy(t, src + x * kTileHeight, sizeof(t));
+            const U64x2 rows[kTileHeight] = {
+                __builtin_shufflevector(t[0], t[2], 0, 2),
+                __builtin_shufflevector(t[0], t[2], 1, 3),
+                __builtin_shufflevector(t[1], t[3], 0, 2),
+                __builtin_shufflevector(t[1], t[3], 1, 3),
+            };
+            for (uint32_t row = 0; row < kTileHeight; row++) {
+                memcpy(dst + row * dst_stride + x, &rows[row], kBlock);
+            }
+        }
+        return x;
+    }
+
+#else
+
+    // Leaves everything to the scalar copy, whose tile row copies compile to
+    // single word moves.
+    template <uint32_t kTileWidth>
+    uint32_t DetileRowVector(const uint8_t *, uint8_t *, size_t, uint32_t)
+    {
+        return 0;
+    }
+
+#endif
+
+    template <uint32_t kTileWidth>
+    void DetilePlaneWithShape(const uint8_t *src, size_t src_stride, uint8_t *dst,
+        size_t dst_stride, uint32_t width, uint32_t height)
+    {
+        for (uint32_t y = 0; y < height; y += kTileHeight) {
+            const uint8_t *tiles = src + y / kTileHeight * src_stride;
+            uint8_t *rows = dst + y * dst_stride;
+            const uint32_t num_rows = std::min(kTileHeight, height - y);
+            // The vector kernels only handle complete rows of tiles, and leave
+            // the right edge to the scalar copy.
+            const uint32_t x = num_rows == kTileHeight
+                ? DetileRowVector<kTileWidth>(tiles, rows, dst_stride, width)
+                : 0;
+            DetileRowScalar<kTileWidth>(tiles, rows, dst_stride, x, width, num_rows);
+        }
+    }
+
+} // namespace
+
+void DetilePlane(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+    uint32_t width, uint32_t height, TileShape shape)
+{
+    switch (shape) {
+    case TileShape::k4x4:
+        DetilePlaneWithShape<4>(src, src_stride, dst, dst_stride, width, height);
+        break;
+    case TileShape::k8x4:
+        DetilePlaneWithShape<8>(src, src_stride, dst, dst_stride, width, height);
+        break;
+    }
+}
+
+} // namespace libvavc8000d::base
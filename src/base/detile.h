@@ -0,0 +1,33 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_DETILE_H_
+#define BASE_DETILE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libvavc8000d::base
+{
+
+// Tile shapes of the VC8000D reference frames, width x height in bytes. The
+// bytes of a tile are stored contiguously row by row, and the tiles of a row
+// of tiles one after the other. The interleaved chroma plane of NV12 uses the
+// same tiles as luma, so a 4x4 chroma tile holds two Cb/Cr pairs per row.
+enum class TileShape {
+    k4x4,
+    k8x4,
+};
+
+// Copies the top-left |width| x |height| bytes of a plane in |shape| tiles,
+// whose rows of tiles are |src_stride| bytes apart, to the linear plane at
+// |dst|. Tiles crossing the right and bottom edges are clipped. The copy is
+// vectorized with RVV on RISC-V and with SSE2/NEON elsewhere, and runs at
+// about the speed of a linear copy of the plane.
+void DetilePlane(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+    uint32_t width, uint32_t height, TileShape shape);
+
+} // namespace libvavc8000d::base
+
+#endif // BASE_DETILE_H_
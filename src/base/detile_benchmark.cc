@@ -0,0 +1,80 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "detile.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // The luma plane of a 1080p reference frame.
+    constexpr uint32_t kWidth = 1920;
+    constexpr uint32_t kHeight = 1080;
+    constexpr uint32_t kTileHeight = 4;
+
+    std::vector<uint8_t> RandomBytes(size_t size)
+    {
+        std::mt19937 rng(1);
+        std::vector<uint8_t> data(size);
+        for (auto &byte : data) { byte = static_cast<uint8_t>(rng()); }
+        return data;
+    }
+
+    // DetilePlane() is meant to run at about the speed of this.
+    void BM_LinearCopy(benchmark::State &state)
+    {
+        const auto src = RandomBytes(kWidth * kHeight);
+        std::vector<uint8_t> dst(kWidth * kHeight);
+        for (auto _ : state) {
+            memcpy(dst.data(), src.data(), dst.size());
+            benchmark::DoNotOptimize(dst.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+    BENCHMARK(BM_LinearCopy);
+
+    // A copy of each tile row on its own, as the kernels do at the edges.
+    void BM_DetilePlaneScalar(benchmark::State &state, uint32_t tile_width)
+    {
+        const size_t src_stride = kWidth * kTileHeight;
+        const auto src = RandomBytes(src_stride * kHeight / kTileHeight);
+        std::vector<uint8_t> dst(kWidth * kHeight);
+        for (auto _ : state) {
+            for (uint32_t y = 0; y < kHeight; y++) {
+                const uint8_t *tiles = src.data() + y / kTileHeight * src_stride
+                    + y % kTileHeight * tile_width;
+                for (uint32_t x = 0; x < kWidth; x += tile_width) {
+                    memcpy(dst.data() + y * kWidth + x, tiles + x * kTileHeight, tile_width);
+                }
+            }
+            benchmark::DoNotOptimize(dst.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+    BENCHMARK_CAPTURE(BM_DetilePlaneScalar, 4x4, 4);
+    BENCHMARK_CAPTURE(BM_DetilePlaneScalar, 8x4, 8);
+
+    void BM_DetilePlane(benchmark::State &state, TileShape shape)
+    {
+        const size_t src_stride = kWidth * kTileHeight;
+        const auto src = RandomBytes(src_stride * kHeight / kTileHeight);
+        std::vector<uint8_t> dst(kWidth * kHeight);
+        for (auto _ : state) {
+            DetilePlane(src.data(), src_stride, dst.data(), kWidth, kWidth, kHeight, shape);
+            benchmark::DoNotOptimize(dst.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+    BENCHMARK_CAPTURE(BM_DetilePlane, 4x4, TileShape::k4x4);
+    BENCHMARK_CAPTURE(BM_DetilePlane, 8x4, TileShape::k8x4);
+
+} // namespace
+} // namespace libvavc8000d::base
@@ -0,0 +1,104 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "detile.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    constexpr uint32_t kTileHeight = 4;
+    constexpr uint8_t kCanary = 0xcd;
+
+    uint32_t TileWidth(TileShape shape) { return shape == TileShape::k4x4 ? 4 : 8; }
+
+    // Where byte (|x|, |y|) of the plane is in its tiles, as the header
+    // describes the layout.
+    size_t TiledOffset(uint32_t x, uint32_t y, size_t stride, TileShape shape)
+    {
+        const uint32_t tile_width = TileWidth(shape);
+        return y / kTileHeight * stride + x / tile_width * tile_width * kTileHeight
+            + y % kTileHeight * tile_width + x % tile_width;
+    }
+
+    void CheckDetile(std::mt19937 &rng, uint32_t width, uint32_t height, TileShape shape,
+        size_t src_offset, size_t dst_offset)
+    {
+        const uint32_t tile_width = TileWidth(shape);
+        // Rows of tiles hold whole tiles, and possibly some padding.
+        const size_t src_stride
+            = ((width + tile_width - 1) / tile_width + rng() % 2) * tile_width * kTileHeight;
+        const uint32_t tile_rows = (height + kTileHeight - 1) / kTileHeight;
+        std::vector<uint8_t> src(src_offset + src_stride * tile_rows);
+        for (auto &byte : src) { byte = static_cast<uint8_t>(rng()); }
+
+        const size_t dst_stride = dst_offset + width + 3;
+        std::vector<uint8_t> dst(dst_offset + dst_stride * height, kCanary);
+        DetilePlane(src.data() + src_offset, src_stride, dst.data() + dst_offset, dst_stride, width,
+            height, shape);
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < dst_stride; x++) {
+                const uint8_t expected = x < width
+                    ? src[src_offset + TiledOffset(x, y, src_stride, shape)]
+                    : kCanary;
+                ASSERT_EQ(dst[dst_offset + y * dst_stride + x], expected)
+                    << width << "x" << height << " at " << x << "," << y << ", offsets "
+                    << src_offset << " and " << dst_offset;
+            }
+        }
+        for (size_t i = 0; i < dst_offset; i++) { ASSERT_EQ(dst[i], kCanary); }
+    }
+
+    class DetileTest : public testing::TestWithParam<TileShape>
+    {
+    };
+
+    // Every width and height up to a few tiles and vector blocks, so that the
+    // right and bottom edges clip the tiles at every position.
+    TEST_P(DetileTest, MatchesReference)
+    {
+        std::mt19937 rng(1);
+        for (uint32_t height = 1; height <= 13; height++) {
+            for (uint32_t width = 1; width <= 70; width++) {
+                CheckDetile(rng, width, height, GetParam(), 0, 0);
+            }
+        }
+    }
+
+    TEST_P(DetileTest, MatchesReferenceForLargePlanes)
+    {
+        std::mt19937 rng(2);
+        for (const auto [width, height] :
+            { std::pair(176u, 144u), std::pair(1920u, 1080u), std::pair(1918u, 1082u) }) {
+            CheckDetile(rng, width, height, GetParam(), 0, 0);
+        }
+    }
+
+    // The vector kernels only take naturally aligned tile rows on RISC-V, the
+    // other ones any alignment.
+    TEST_P(DetileTest, MatchesReferenceAtUnalignedAddresses)
+    {
+        std::mt19937 rng(3);
+        for (size_t src_offset = 0; src_offset < 8; src_offset++) {
+            for (size_t dst_offset = 0; dst_offset < 8; dst_offset++) {
+                for (const uint32_t width : { 15u, 16u, 33u, 64u, 67u }) {
+                    CheckDetile(rng, width, 9, GetParam(), src_offset, dst_offset);
+                }
+            }
+        }
+    }
+
+    INSTANTIATE_TEST_SUITE_P(, DetileTest, testing::Values(TileShape::k4x4, TileShape::k8x4),
+        [](const testing::TestParamInfo<TileShape> &info) {
+            return info.param == TileShape::k4x4 ? "4x4" : "8x4";
+        });
+
+} // namespace
+} // namespace libvavc8000d::base
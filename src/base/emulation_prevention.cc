@@ -0,0 +1,185 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "emulation_prevention.h"
+
+#include <bit>
+#include <cstring>
+
+#if defined(__riscv_vector)
+#include <riscv_vector.h>
+#endif
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    constexpr uint8_t kEmulationByte = 0x03u;
+
+    // The vector kernels locate the first match with a count of trailing zeros.
+    static_assert(std::endian::native == std::endian::little);
+
+    size_t FindZeroPairScalar(const uint8_t *data, size_t size)
+    {
+        for (size_t i = 0; i + 1 < size; i++) {
+            if (data[i] == 0 && data[i + 1] == 0) { return i; }
+        }
+        return size;
+    }
+
+#if defined(__riscv_vector)
+
+    // RVV 1.0. The C910 cores of the TH1520 implement the 0.7.1 draft, whose
+    // toolchains don't define __riscv_vector, so they use the SWAR kernel.
+    size_t FindZeroPairVector(const uint8_t *data, size_t size)
+    {
+        if (size < 2) { return size; }
+        // Positions that can start a pair. The second load reads one byte
+        // ahead, so it stays within |data|.
+        const size_t count = size - 1;
+        for (size_t i = 0; i < count;) {
+            const size_t vl = __riscv_vsetvl_e8m8(count - i);
+            const vuint8m8_t first = __riscv_vle8_v_u8m8(data + i, vl);
+            const vuint8m8_t second = __riscv_vle8_v_u8m8(data + i + 1, vl);
+            const vbool1_t pairs = __riscv_vmand_mm_b1(__riscv_vmseq_vx_u8m8_b1(first, 0, vl),
+                __riscv_vmseq_vx_u8m8_b1(second, 0, vl), vl);
+            const long index = __riscv_vfirst_m_b1(pairs, vl);
+            if (index >= 0) { return i + static_cast<size_t>(index); }
+            i += vl;
+        }
+        return size;
+    }
+
+#elif defined(__SSE2__) || defined(__ARM_NEON)
+
+    typedef uint8_t U8x16 __attribute__((vector_size(16)));
+    typedef uint64_t U64x2 __attribute__((vector_size(16)));
+
+    inline bool AnyLane(U8x16 lanes)
+    {
+        U64x2 words;
+        memcpy(&words, &lanes, sizeof(words));
+        return (words[0] | words[1]) != 0;
+    }
+
+    size_t FindZeroPairVector(const uint8_t *data, size_t size)
+    {
+        constexpr size_t kLanes = sizeof(U8x16);
+        constexpr size_t kBlock = 4 * kLanes;
+        size_t i = 0;
+        // Zero bytes are rare in slice data, so skip whole blocks that have
+        // none and only look for pairs in the others. The pair search reads one
+        // byte past the block.
+        for (; i + kBlock + 1 <= size; i += kBlock) {
+            U8x16 v[4];
+            memcpy(v, data + i, kBlock);
+            if (!AnyLane((v[0] == 0) | (v[1] == 0) | (v[2] == 0) | (v[3] == 0))) { continue; }
+            for (size_t j = 0; j < kBlock; j += kLanes) {
+                U8x16 first, second;
+                memcpy(&first, data + i + j, kLanes);
+                memcpy(&second, data + i + j + 1, kLanes);
+                const U8x16 pairs = (U8x16)((first == 0) & (second == 0));
+                U64x2 mask;
+                memcpy(&mask, &pairs, sizeof(mask));
+                if (mask[0]) { return i + j + std::countr_zero(mask[0]) / 8; }
+                if (mask[1]) { return i + j + 8 + std::countr_zero(mask[1]) / 8; }
+            }
+        }
+        return i + FindZeroPairScalar(data + i, size - i);
+    }
+
+#else
+
+    // Sets the top bit of exactly the bytes of |word| that are zero.
+    inline uint64_t ZeroBytes(uint64_t word)
+    {
+        constexpr uint64_t kLow7 = 0x7F7F7F7F7F7F7F7Full;
+        return ~(((word & kLow7) + kLow7) | word | kLow7);
+    }
+
+    size_t FindZeroPairVector(const uint8_t *data, size_t size)
+    {
+        size_t i = 0;
+        // The second load reads one byte ahead.
+        for (; i + sizeof(uint64_t) + 1 <= size; i += sizeof(uint64_t)) {
+            uint64_t first, second;
+            memcpy(&first, data + i, sizeof(first));
+            const uint64_t zeros = ZeroBytes(first);
+            // A pair can only start in a word that has a zero byte.
+            if (!zeros) { continue; }
+            memcpy(&second, data + i + 1, sizeof(second));
+            const uint64_t pairs = zeros & ZeroBytes(second);
+            if (pairs) { return i + std::countr_zero(pairs) / 8; }
+        }
+        return i + FindZeroPairScalar(data + i, size - i);
+    }
+
+#endif
+
+} // namespace
+
+size_t FindZeroPair(const uint8_t *data, size_t size) { return FindZeroPairVector(data, size); }
+
+size_t FindStartCode(const uint8_t *data, size_t size)
+{
+    size_t i = 0;
+    while (i < size) {
+        const size_t pair = i + FindZeroPair(data + i, size - i);
+        if (pair + 2 >= size) { break; }
+        if (data[pair + 2] == 0x01) { return pair; }
+        // 00 00 00 may still be the start of 00 00 01, anything else ends the
+        // zero run.
+        i = data[pair + 2] == 0 ? pair + 1 : pair + 3;
+    }
+    return size;
+}
+
+void AppendWithEmulationPrevention(
+    const uint8_t *data, size_t size, std::vector<uint8_t> &out, size_t &zero_run)
+{
+    // Finish the zero run carried over from the previous call byte by byte.
+    size_t i = 0;
+    for (; i < size && zero_run > 0; i++) {
+        if (zero_run >= 2 && data[i] <= kEmulationByte) {
+            out.push_back(kEmulationByte);
+            zero_run = 0;
+        }
+        out.push_back(data[i]);
+        zero_run = data[i] == 0 ? zero_run + 1 : 0;
+    }
+    if (i == size) { return; }
+
+    // From here on, copy everything up to each pair of zero bytes in bulk.
+    for (;;) {
+        const size_t pair = i + FindZeroPair(data + i, size - i);
+        if (pair + 2 >= size) {
+            out.insert(out.end(), data + i, data + size);
+            zero_run = 0;
+            for (size_t k = size; k > i && zero_run < 2 && data[k - 1] == 0; k--) { zero_run++; }
+            return;
+        }
+        out.insert(out.end(), data + i, data + pair + 2);
+        if (data[pair + 2] <= kEmulationByte) { out.push_back(kEmulationByte); }
+        i = pair + 2;
+    }
+}
+
+size_t RemoveEmulationPrevention(const uint8_t *data, size_t size, uint8_t *out)
+{
+    size_t i = 0, written = 0;
+    while (i < size) {
+        const size_t pair = i + FindZeroPair(data + i, size - i);
+        if (pair + 2 >= size) { break; }
+        // Keep the zero bytes, and drop the byte after them if it is an escape.
+        const size_t end = data[pair + 2] == kEmulationByte ? pair + 2 : pair + 1;
+        memmove(out + written, data + i, end - i);
+        written += end - i;
+        i = data[pair + 2] == kEmulationByte ? pair + 3 : pair + 1;
+    }
+    memmove(out + written, data + i, size - i);
+    return written + size - i;
+}
+
+} // namespace libvavc8000d::base
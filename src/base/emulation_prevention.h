@@ -0,0 +1,42 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_EMULATION_PREVENTION_H_
+#define BASE_EMULATION_PREVENTION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace libvavc8000d::base
+{
+
+// Scanning and escaping of start-code based bitstreams (H.264 section 7.4.1,
+// H.265 section 7.4.2, SMPTE 421M Annex E). All of them are built on a kernel
+// that looks for two consecutive zero bytes, which is vectorized with RVV on
+// RISC-V and with SSE2/NEON elsewhere.
+
+// Returns the offset of the first pair of zero bytes in |data|, or |size| if
+// there is none.
+size_t FindZeroPair(const uint8_t *data, size_t size);
+
+// Returns the offset of the first start code prefix (00 00 01) in |data|, or
+// |size| if there is none.
+size_t FindStartCode(const uint8_t *data, size_t size);
+
+// Appends |size| bytes from |data| to |out|, inserting an
+// emulation_prevention_three_byte wherever two zero bytes are followed by a
+// byte in 0x00..0x03. |zero_run| is the number of zero bytes (0 to 2) at the
+// end of |out| since the last escape, and is updated for the next call.
+void AppendWithEmulationPrevention(
+    const uint8_t *data, size_t size, std::vector<uint8_t> &out, size_t &zero_run);
+
+// Copies |size| bytes from |data| to |out|, dropping every
+// emulation_prevention_three_byte, and returns the number of bytes written.
+// |out| must hold |size| bytes and may be |data| to unescape in place.
+size_t RemoveEmulationPrevention(const uint8_t *data, size_t size, uint8_t *out);
+
+} // namespace libvavc8000d::base
+
+#endif // BASE_EMULATION_PREVENTION_H_
@@ -0,0 +1,91 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "emulation_prevention.h"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // Entropy coded slice data: random bytes, with the zero pairs that are
+    // rare in it.
+    std::vector<uint8_t> SliceData(size_t size)
+    {
+        std::mt19937 rng(1);
+        std::vector<uint8_t> data(size);
+        for (auto &byte : data) { byte = static_cast<uint8_t>(rng()); }
+        return data;
+    }
+
+    // What the kernels replace, to compare their throughput against.
+    size_t FindZeroPairScalar(const uint8_t *data, size_t size)
+    {
+        for (size_t i = 0; i + 1 < size; i++) {
+            if (data[i] == 0 && data[i + 1] == 0) { return i; }
+        }
+        return size;
+    }
+
+    void BM_FindZeroPairScalar(benchmark::State &state)
+    {
+        const auto data = SliceData(static_cast<size_t>(state.range(0)));
+        for (auto _ : state) {
+            for (size_t i = 0; i < data.size();) {
+                const size_t pair = i + FindZeroPairScalar(data.data() + i, data.size() - i);
+                benchmark::DoNotOptimize(pair);
+                i = pair + 1;
+            }
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * data.size()));
+    }
+    BENCHMARK(BM_FindZeroPairScalar)->Arg(64 << 10);
+
+    void BM_FindZeroPair(benchmark::State &state)
+    {
+        const auto data = SliceData(static_cast<size_t>(state.range(0)));
+        for (auto _ : state) {
+            for (size_t i = 0; i < data.size();) {
+                const size_t pair = i + FindZeroPair(data.data() + i, data.size() - i);
+                benchmark::DoNotOptimize(pair);
+                i = pair + 1;
+            }
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * data.size()));
+    }
+    BENCHMARK(BM_FindZeroPair)->Arg(64 << 10);
+
+    void BM_AppendWithEmulationPrevention(benchmark::State &state)
+    {
+        const auto data = SliceData(static_cast<size_t>(state.range(0)));
+        std::vector<uint8_t> out;
+        out.reserve(data.size() * 3 / 2);
+        for (auto _ : state) {
+            out.clear();
+            size_t zero_run = 0;
+            AppendWithEmulationPrevention(data.data(), data.size(), out, zero_run);
+            benchmark::DoNotOptimize(out.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * data.size()));
+    }
+    BENCHMARK(BM_AppendWithEmulationPrevention)->Arg(64 << 10);
+
+    void BM_RemoveEmulationPrevention(benchmark::State &state)
+    {
+        const auto data = SliceData(static_cast<size_t>(state.range(0)));
+        std::vector<uint8_t> out(data.size());
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(
+                RemoveEmulationPrevention(data.data(), data.size(), out.data()));
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * data.size()));
+    }
+    BENCHMARK(BM_RemoveEmulationPrevention)->Arg(64 << 10);
+
+} // namespace
+} // namespace libvavc8000d::base
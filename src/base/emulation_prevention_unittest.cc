@@ -0,0 +1,227 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "emulation_prevention.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // Byte by byte versions of the kernels, as the specifications describe
+    // them. The vector kernels must give the same results for any input.
+    size_t FindZeroPairReference(const std::vector<uint8_t> &data)
+    {
+        for (size_t i = 0; i + 1 < data.size(); i++) {
+            if (data[i] == 0 && data[i + 1] == 0) { return i; }
+        }
+        return data.size();
+    }
+
+    size_t FindStartCodeReference(const std::vector<uint8_t> &data)
+    {
+        for (size_t i = 0; i + 2 < data.size(); i++) {
+            if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) { return i; }
+        }
+        return data.size();
+    }
+
+    std::vector<uint8_t> EscapeReference(const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> out;
+        size_t zeros = 0;
+        for (const uint8_t byte : data) {
+            if (zeros >= 2 && byte <= 0x03) {
+                out.push_back(0x03);
+                zeros = 0;
+            }
+            out.push_back(byte);
+            zeros = byte == 0 ? zeros + 1 : 0;
+        }
+        return out;
+    }
+
+    std::vector<uint8_t> UnescapeReference(const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> out;
+        for (size_t i = 0; i < data.size();) {
+            if (i + 2 < data.size() && data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 0x03) {
+                out.insert(out.end(), { 0x00, 0x00 });
+                i += 3;
+            } else {
+                out.push_back(data[i++]);
+            }
+        }
+        return out;
+    }
+
+    std::vector<uint8_t> Escape(const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> out;
+        size_t zero_run = 0;
+        AppendWithEmulationPrevention(data.data(), data.size(), out, zero_run);
+        return out;
+    }
+
+    std::vector<uint8_t> Unescape(const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> out(data.size());
+        out.resize(RemoveEmulationPrevention(data.data(), data.size(), out.data()));
+        return out;
+    }
+
+    // Random bytes where zeros and the values emulation prevention looks at,
+    // 0x00 to 0x03, are common, one byte in |1 << zero_bits| being a zero.
+    std::vector<uint8_t> RandomBytes(std::mt19937 &rng, size_t size, int zero_bits)
+    {
+        std::vector<uint8_t> data(size);
+        for (auto &byte : data) {
+            const uint32_t value = rng();
+            if ((value & ((1u << zero_bits) - 1)) == 0) {
+                byte = 0;
+            } else {
+                byte = static_cast<uint8_t>(value >> 24) % 6;
+                if (byte > 3) { byte = static_cast<uint8_t>(value >> 16) | 1; }
+            }
+        }
+        return data;
+    }
+
+    // Inputs that put zero pairs, followed by each byte that needs escaping,
+    // on both sides of the 16-byte lanes and 64-byte blocks of the vector
+    // kernels and of the tails they leave to scalar code.
+    std::vector<std::vector<uint8_t>> AdversarialInputs()
+    {
+        std::vector<std::vector<uint8_t>> inputs;
+        for (size_t size : { 1u, 2u, 3u, 15u, 16u, 17u, 63u, 64u, 65u, 66u, 67u, 130u, 200u }) {
+            for (size_t position = 0; position < size; position++) {
+                for (uint8_t next = 0; next <= 4; next++) {
+                    std::vector<uint8_t> data(size, 0xA5);
+                    data[position] = 0;
+                    if (position + 1 < size) { data[position + 1] = 0; }
+                    if (position + 2 < size) { data[position + 2] = next; }
+                    inputs.push_back(std::move(data));
+                }
+            }
+            inputs.emplace_back(size, 0x00);
+            // Lone zeros on every other byte never make a pair.
+            std::vector<uint8_t> alternating(size, 0x00);
+            for (size_t i = 1; i < size; i += 2) { alternating[i] = 0x01; }
+            inputs.push_back(std::move(alternating));
+        }
+        return inputs;
+    }
+
+    TEST(EmulationPreventionTest, FindZeroPairMatchesReference)
+    {
+        for (const auto &data : AdversarialInputs()) {
+            EXPECT_EQ(FindZeroPair(data.data(), data.size()), FindZeroPairReference(data));
+        }
+        std::mt19937 rng(1);
+        for (int i = 0; i < 2000; i++) {
+            const auto data = RandomBytes(rng, rng() % 300, 1 + i % 8);
+            EXPECT_EQ(FindZeroPair(data.data(), data.size()), FindZeroPairReference(data));
+        }
+    }
+
+    TEST(EmulationPreventionTest, FindZeroPairAtUnalignedAddresses)
+    {
+        std::mt19937 rng(2);
+        const auto data = RandomBytes(rng, 4096, 6);
+        for (size_t offset = 0; offset < 64; offset++) {
+            for (size_t size : { 0u, 1u, 31u, 64u, 65u, 129u, 1000u }) {
+                const std::vector<uint8_t> window(
+                    data.begin() + offset, data.begin() + offset + size);
+                EXPECT_EQ(FindZeroPair(data.data() + offset, size), FindZeroPairReference(window));
+            }
+        }
+    }
+
+    TEST(EmulationPreventionTest, FindStartCodeMatchesReference)
+    {
+        for (const auto &data : AdversarialInputs()) {
+            EXPECT_EQ(FindStartCode(data.data(), data.size()), FindStartCodeReference(data));
+        }
+        std::mt19937 rng(3);
+        for (int i = 0; i < 2000; i++) {
+            const auto data = RandomBytes(rng, rng() % 300, 1 + i % 8);
+            EXPECT_EQ(FindStartCode(data.data(), data.size()), FindStartCodeReference(data));
+        }
+    }
+
+    TEST(EmulationPreventionTest, EscapeMatchesReference)
+    {
+        for (const auto &data : AdversarialInputs()) {
+            EXPECT_EQ(Escape(data), EscapeReference(data));
+        }
+        std::mt19937 rng(4);
+        for (int i = 0; i < 2000; i++) {
+            const auto data = RandomBytes(rng, rng() % 300, 1 + i % 8);
+            EXPECT_EQ(Escape(data), EscapeReference(data));
+        }
+    }
+
+    TEST(EmulationPreventionTest, EscapeCarriesZeroRunAcrossCalls)
+    {
+        std::mt19937 rng(5);
+        for (int i = 0; i < 200; i++) {
+            const auto data = RandomBytes(rng, 1 + rng() % 100, 1 + i % 3);
+            const auto expected = EscapeReference(data);
+            for (size_t split = 0; split <= data.size(); split++) {
+                std::vector<uint8_t> out;
+                size_t zero_run = 0;
+                AppendWithEmulationPrevention(data.data(), split, out, zero_run);
+                AppendWithEmulationPrevention(
+                    data.data() + split, data.size() - split, out, zero_run);
+                ASSERT_EQ(out, expected) << "split at " << split;
+
+                size_t trailing_zeros = 0;
+                for (size_t k = out.size(); k > 0 && out[k - 1] == 0; k--) { trailing_zeros++; }
+                EXPECT_EQ(zero_run, std::min<size_t>(trailing_zeros, 2));
+            }
+        }
+    }
+
+    TEST(EmulationPreventionTest, UnescapeMatchesReference)
+    {
+        for (const auto &data : AdversarialInputs()) {
+            EXPECT_EQ(Unescape(data), UnescapeReference(data));
+        }
+        std::mt19937 rng(6);
+        for (int i = 0; i < 2000; i++) {
+            const auto data = RandomBytes(rng, rng() % 300, 1 + i % 8);
+            EXPECT_EQ(Unescape(data), UnescapeReference(data));
+        }
+    }
+
+    TEST(EmulationPreventionTest, UnescapeUndoesEscape)
+    {
+        for (const auto &data : AdversarialInputs()) {
+            EXPECT_EQ(Unescape(Escape(data)), data);
+        }
+        std::mt19937 rng(7);
+        for (int i = 0; i < 2000; i++) {
+            const auto data = RandomBytes(rng, rng() % 300, 1 + i % 8);
+            EXPECT_EQ(Unescape(Escape(data)), data);
+        }
+    }
+
+    TEST(EmulationPreventionTest, UnescapeInPlace)
+    {
+        std::mt19937 rng(8);
+        for (int i = 0; i < 500; i++) {
+            const auto data = RandomBytes(rng, rng() % 300, 1 + i % 4);
+            std::vector<uint8_t> escaped = Escape(data);
+            escaped.resize(
+                RemoveEmulationPrevention(escaped.data(), escaped.size(), escaped.data()));
+            EXPECT_EQ(escaped, data);
+        }
+    }
+
+} // namespace
+} // namespace libvavc8000d::base
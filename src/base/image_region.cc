@@ -0,0 +1,34 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "image_region.h"
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    constexpr int kTileSize = 4;
+
+} // namespace
+
+bool IsRegionWithin(
+    int x, int y, uint32_t width, uint32_t height, uint32_t max_width, uint32_t max_height)
+{
+    return x >= 0 && y >= 0 && width <= max_width && height <= max_height
+        && static_cast<uint32_t>(x) <= max_width - width
+        && static_cast<uint32_t>(y) <= max_height - height;
+}
+
+bool IsChromaAligned(int x, int y) { return x % 2 == 0 && y % 2 == 0; }
+
+bool IsTileAligned(int x, int y) { return x % kTileSize == 0 && y % (2 * kTileSize) == 0; }
+
+bool IsHalf(uint32_t src, uint32_t dst)
+{
+    // Rounded up without overflowing for the largest sizes.
+    return dst == src / 2 || dst == src / 2 + src % 2;
+}
+
+} // namespace libvavc8000d::base
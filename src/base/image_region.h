@@ -0,0 +1,36 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_IMAGE_REGION_H_
+#define BASE_IMAGE_REGION_H_
+
+#include <cstdint>
+
+namespace libvavc8000d::base
+{
+
+// Checks of the regions vaGetImage() and vaPutImage() copy between images and
+// surfaces. The coordinates come from the client as signed integers and the
+// sizes as unsigned ones, so none of the checks can overflow.
+
+// Returns whether the |width| x |height| region at (|x|, |y|) lies within a
+// |max_width| x |max_height| picture.
+bool IsRegionWithin(
+    int x, int y, uint32_t width, uint32_t height, uint32_t max_width, uint32_t max_height);
+
+// Returns whether a region at (|x|, |y|) of a 4:2:0 picture starts on a whole
+// chroma sample.
+bool IsChromaAligned(int x, int y);
+
+// Returns whether a region at (|x|, |y|) of a 4:2:0 picture in 4x4 tiles
+// starts on whole tiles of both planes. The chroma plane has half as many
+// rows, so |y| must be a multiple of 8.
+bool IsTileAligned(int x, int y);
+
+// Returns whether |dst| is |src| downscaled by two, rounded either way.
+bool IsHalf(uint32_t src, uint32_t dst);
+
+} // namespace libvavc8000d::base
+
+#endif // BASE_IMAGE_REGION_H_
@@ -0,0 +1,95 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "image_region.h"
+
+#include <gtest/gtest.h>
+
+#include <climits>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    TEST(ImageRegionTest, WholePictureIsWithin)
+    {
+        EXPECT_TRUE(IsRegionWithin(0, 0, 1920, 1080, 1920, 1080));
+        EXPECT_TRUE(IsRegionWithin(0, 0, 0, 0, 0, 0));
+        EXPECT_FALSE(IsRegionWithin(0, 0, 1921, 1080, 1920, 1080));
+        EXPECT_FALSE(IsRegionWithin(0, 0, 1920, 1081, 1920, 1080));
+    }
+
+    // Every region of a small picture, and regions just past its edges, against
+    // the same check in 64-bit arithmetic.
+    TEST(ImageRegionTest, SubRectanglesMatchReference)
+    {
+        constexpr uint32_t kWidth = 7;
+        constexpr uint32_t kHeight = 5;
+        for (int x = -2; x <= 9; x++) {
+            for (int y = -2; y <= 7; y++) {
+                for (uint32_t width = 0; width <= kWidth + 2; width++) {
+                    for (uint32_t height = 0; height <= kHeight + 2; height++) {
+                        const bool expected = x >= 0 && y >= 0
+                            && int64_t { x } + width <= kWidth && int64_t { y } + height <= kHeight;
+                        EXPECT_EQ(IsRegionWithin(x, y, width, height, kWidth, kHeight), expected)
+                            << width << "x" << height << " at " << x << "," << y;
+                    }
+                }
+            }
+        }
+    }
+
+    // Sums of the coordinates and sizes the client passes must not wrap
+    // around into the picture.
+    TEST(ImageRegionTest, RejectsOverflowingRegions)
+    {
+        EXPECT_FALSE(IsRegionWithin(INT_MAX, 0, 2, 1, 1920, 1080));
+        EXPECT_FALSE(IsRegionWithin(1, 0, UINT32_MAX, 1, 1920, 1080));
+        EXPECT_FALSE(IsRegionWithin(0, 1, 1, UINT32_MAX, 1920, 1080));
+        EXPECT_FALSE(IsRegionWithin(INT_MIN, INT_MIN, 1, 1, 1920, 1080));
+        EXPECT_FALSE(IsRegionWithin(-1, 0, 0, 0, 1920, 1080));
+        EXPECT_FALSE(IsRegionWithin(1921, 0, 0, 0, 1920, 1080));
+        EXPECT_TRUE(IsRegionWithin(1920, 1080, 0, 0, 1920, 1080));
+    }
+
+    TEST(ImageRegionTest, RejectsOddOffsets)
+    {
+        for (int x = 0; x < 8; x++) {
+            for (int y = 0; y < 8; y++) {
+                EXPECT_EQ(IsChromaAligned(x, y), x % 2 == 0 && y % 2 == 0) << x << "," << y;
+            }
+        }
+    }
+
+    // Luma tiles are 4 pixels wide and 4 rows high, chroma tiles 2 Cb/Cr
+    // pairs wide and 4 chroma rows, i.e. 8 picture rows, high.
+    TEST(ImageRegionTest, RejectsRegionsOffTileBoundaries)
+    {
+        for (int x = 0; x < 32; x++) {
+            for (int y = 0; y < 32; y++) {
+                EXPECT_EQ(IsTileAligned(x, y), x % 4 == 0 && y % 8 == 0) << x << "," << y;
+            }
+        }
+        EXPECT_TRUE(IsTileAligned(1916, 1072));
+        EXPECT_FALSE(IsTileAligned(1918, 1072));
+        EXPECT_FALSE(IsTileAligned(1916, 1076));
+    }
+
+    TEST(ImageRegionTest, IsHalf)
+    {
+        EXPECT_TRUE(IsHalf(1920, 960));
+        EXPECT_FALSE(IsHalf(1920, 961));
+        EXPECT_TRUE(IsHalf(1081, 540));
+        EXPECT_TRUE(IsHalf(1081, 541));
+        EXPECT_FALSE(IsHalf(1081, 539));
+        EXPECT_FALSE(IsHalf(1081, 542));
+        EXPECT_TRUE(IsHalf(1, 0));
+        EXPECT_TRUE(IsHalf(1, 1));
+        EXPECT_FALSE(IsHalf(2, 2));
+        EXPECT_TRUE(IsHalf(UINT32_MAX, UINT32_MAX / 2 + 1));
+    }
+
+} // namespace
+} // namespace libvavc8000d::base
@@ -0,0 +1,181 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "color_conversion.h"
+#include "detile.h"
+#include "plane_copy.h"
+
+// The kernels GetSurfaceImage() and PutSurfaceImage() run for a 1080p NV12
+// surface and each kind of image, in the same order, from and to memory with
+// the stride of a surface. The surface memory is cached here, unlike on the
+// target, so these measure the work done in cached memory.
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    constexpr uint32_t kWidth = 1920;
+    constexpr uint32_t kHeight = 1080;
+    constexpr uint32_t kChromaWidth = kWidth / 2;
+    constexpr uint32_t kChromaHeight = kHeight / 2;
+    constexpr size_t kSurfaceStride = 2048;
+    constexpr uint32_t kTileSize = 4;
+
+    std::vector<uint8_t> RandomBytes(size_t size)
+    {
+        std::mt19937 rng(1);
+        std::vector<uint8_t> data(size);
+        for (auto &byte : data) { byte = static_cast<uint8_t>(rng()); }
+        return data;
+    }
+
+    struct Surface
+    {
+        std::vector<uint8_t> y = RandomBytes(kSurfaceStride * kHeight);
+        std::vector<uint8_t> uv = RandomBytes(kSurfaceStride * kChromaHeight);
+    };
+
+    void SetPixelsProcessed(benchmark::State &state)
+    {
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+
+    void BM_GetLinearNV12ToI420(benchmark::State &state)
+    {
+        const Surface surface;
+        std::vector<uint8_t> image(kWidth * kHeight * 3 / 2);
+        uint8_t *const u = image.data() + kWidth * kHeight;
+        uint8_t *const v = u + kChromaWidth * kChromaHeight;
+        for (auto _ : state) {
+            CopyPlane(surface.y.data(), kSurfaceStride, image.data(), kWidth, kWidth, kHeight);
+            SplitUVPlane(surface.uv.data(), kSurfaceStride, u, kChromaWidth, v, kChromaWidth,
+                kChromaWidth, kChromaHeight);
+            benchmark::DoNotOptimize(image.data());
+        }
+        SetPixelsProcessed(state);
+    }
+    BENCHMARK(BM_GetLinearNV12ToI420);
+
+    void BM_GetTiledNV12ToNV12(benchmark::State &state)
+    {
+        const Surface surface;
+        std::vector<uint8_t> image(kWidth * kHeight * 3 / 2);
+        for (auto _ : state) {
+            DetilePlane(surface.y.data(), kTileSize * kSurfaceStride, image.data(), kWidth, kWidth,
+                kHeight, TileShape::k4x4);
+            DetilePlane(surface.uv.data(), kTileSize * kSurfaceStride,
+                image.data() + kWidth * kHeight, kWidth, kWidth, kChromaHeight, TileShape::k4x4);
+            benchmark::DoNotOptimize(image.data());
+        }
+        SetPixelsProcessed(state);
+    }
+    BENCHMARK(BM_GetTiledNV12ToNV12);
+
+    // Detiling and splitting both reorder the chroma, which goes through a
+    // linear copy.
+    void BM_GetTiledNV12ToI420(benchmark::State &state)
+    {
+        const Surface surface;
+        std::vector<uint8_t> image(kWidth * kHeight * 3 / 2);
+        uint8_t *const u = image.data() + kWidth * kHeight;
+        uint8_t *const v = u + kChromaWidth * kChromaHeight;
+        for (auto _ : state) {
+            DetilePlane(surface.y.data(), kTileSize * kSurfaceStride, image.data(), kWidth, kWidth,
+                kHeight, TileShape::k4x4);
+            std::vector<uint8_t> uv(kWidth * kChromaHeight);
+            DetilePlane(surface.uv.data(), kTileSize * kSurfaceStride, uv.data(), kWidth, kWidth,
+                kChromaHeight, TileShape::k4x4);
+            SplitUVPlane(
+                uv.data(), kWidth, u, kChromaWidth, v, kChromaWidth, kChromaWidth, kChromaHeight);
+            benchmark::DoNotOptimize(image.data());
+        }
+        SetPixelsProcessed(state);
+    }
+    BENCHMARK(BM_GetTiledNV12ToI420);
+
+    // Converted formats go through an I420 copy of the region.
+    void BM_GetLinearNV12ToRGBX(benchmark::State &state)
+    {
+        const Surface surface;
+        std::vector<uint8_t> image(4 * kWidth * kHeight);
+        for (auto _ : state) {
+            std::vector<uint8_t> i420(kWidth * kHeight * 3 / 2);
+            uint8_t *const u = i420.data() + kWidth * kHeight;
+            uint8_t *const v = u + kChromaWidth * kChromaHeight;
+            CopyPlane(surface.y.data(), kSurfaceStride, i420.data(), kWidth, kWidth, kHeight);
+            SplitUVPlane(surface.uv.data(), kSurfaceStride, u, kChromaWidth, v, kChromaWidth,
+                kChromaWidth, kChromaHeight);
+            I420ToPacked(i420.data(), kWidth, u, kChromaWidth, v, kChromaWidth, image.data(),
+                4 * kWidth, kWidth, kHeight, PackedFormat::kRGBX, ColorSpace());
+            benchmark::DoNotOptimize(image.data());
+        }
+        SetPixelsProcessed(state);
+    }
+    BENCHMARK(BM_GetLinearNV12ToRGBX);
+
+    void BM_PutI420ToNV12(benchmark::State &state)
+    {
+        const auto image = RandomBytes(kWidth * kHeight * 3 / 2);
+        const uint8_t *const u = image.data() + kWidth * kHeight;
+        const uint8_t *const v = u + kChromaWidth * kChromaHeight;
+        Surface surface;
+        for (auto _ : state) {
+            CopyPlane(image.data(), kWidth, surface.y.data(), kSurfaceStride, kWidth, kHeight);
+            MergeUVPlane(u, kChromaWidth, v, kChromaWidth, surface.uv.data(), kSurfaceStride,
+                kChromaWidth, kChromaHeight);
+            benchmark::DoNotOptimize(surface.y.data());
+        }
+        SetPixelsProcessed(state);
+    }
+    BENCHMARK(BM_PutI420ToNV12);
+
+    // Counts the pixels of the source image, as the others do.
+    void BM_PutI420ToNV12Halved(benchmark::State &state)
+    {
+        const auto image = RandomBytes(kWidth * kHeight * 3 / 2);
+        const uint8_t *const u = image.data() + kWidth * kHeight;
+        const uint8_t *const v = u + kChromaWidth * kChromaHeight;
+        Surface surface;
+        constexpr uint32_t kHalfChromaWidth = kChromaWidth / 2;
+        constexpr uint32_t kHalfChromaHeight = kChromaHeight / 2;
+        for (auto _ : state) {
+            HalvePlane(image.data(), kWidth, kWidth, kHeight, surface.y.data(), kSurfaceStride,
+                kWidth / 2, kHeight / 2);
+            std::vector<uint8_t> halved(2 * kHalfChromaWidth * kHalfChromaHeight);
+            uint8_t *const halved_v = halved.data() + kHalfChromaWidth * kHalfChromaHeight;
+            HalvePlane(u, kChromaWidth, kChromaWidth, kChromaHeight, halved.data(),
+                kHalfChromaWidth, kHalfChromaWidth, kHalfChromaHeight);
+            HalvePlane(v, kChromaWidth, kChromaWidth, kChromaHeight, halved_v, kHalfChromaWidth,
+                kHalfChromaWidth, kHalfChromaHeight);
+            MergeUVPlane(halved.data(), kHalfChromaWidth, halved_v, kHalfChromaWidth,
+                surface.uv.data(), kSurfaceStride, kHalfChromaWidth, kHalfChromaHeight);
+            benchmark::DoNotOptimize(surface.y.data());
+        }
+        SetPixelsProcessed(state);
+    }
+    BENCHMARK(BM_PutI420ToNV12Halved);
+
+    void BM_PutNV12ToP010(benchmark::State &state)
+    {
+        const auto image = RandomBytes(kWidth * kHeight * 3 / 2);
+        std::vector<uint8_t> y(2 * kSurfaceStride * kHeight);
+        std::vector<uint8_t> uv(2 * kSurfaceStride * kChromaHeight);
+        for (auto _ : state) {
+            ExpandPlaneTo16Bit(image.data(), kWidth, y.data(), 2 * kSurfaceStride, kWidth, kHeight);
+            ExpandPlaneTo16Bit(image.data() + kWidth * kHeight, kWidth, uv.data(),
+                2 * kSurfaceStride, kWidth, kChromaHeight);
+            benchmark::DoNotOptimize(y.data());
+        }
+        SetPixelsProcessed(state);
+    }
+    BENCHMARK(BM_PutNV12ToP010);
+
+} // namespace
+} // namespace libvavc8000d::base
@@ -0,0 +1,342 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "plane_copy.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#if defined(__riscv_vector)
+#include <riscv_vector.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // P010 samples are stored little-endian.
+    static_assert(std::endian::native == std::endian::little);
+
+    void SplitUVRowScalar(const uint8_t *src, uint8_t *dst_u, uint8_t *dst_v, size_t pairs)
+    {
+        for (size_t i = 0; i < pairs; i++) {
+            dst_u[i] = src[2 * i];
+            dst_v[i] = src[2 * i + 1];
+        }
+    }
+
+    void MergeUVRowScalar(const uint8_t *src_u, const uint8_t *src_v, uint8_t *dst, size_t pairs)
+    {
+        for (size_t i = 0; i < pairs; i++) {
+            dst[2 * i] = src_u[i];
+            dst[2 * i + 1] = src_v[i];
+        }
+    }
+
+    void ExpandRowScalar(const uint8_t *src, uint8_t *dst, size_t samples)
+    {
+        for (size_t i = 0; i < samples; i++) {
+            dst[2 * i] = 0;
+            dst[2 * i + 1] = src[i];
+        }
+    }
+
+    // Averages the samples 2 * i and 2 * i + 1 of both rows, for i from |begin|
+    // to |end|, pairing the last sample of the row with itself.
+    void HalveRowScalar(const uint8_t *row0, const uint8_t *row1, size_t src_width, uint8_t *dst,
+        size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++) {
+            const size_t x0 = 2 * i;
+            const size_t x1 = std::min(x0 + 1, src_width - 1);
+            dst[i] = static_cast<uint8_t>((row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2);
+        }
+    }
+
+#if defined(__riscv_vector)
+
+    // RVV 1.0, see emulation_prevention.cc for the TH1520.
+    void CopyRow(const uint8_t *src, uint8_t *dst, size_t size)
+    {
+        for (size_t i = 0; i < size;) {
+            const size_t vl = __riscv_vsetvl_e8m8(size - i);
+            __riscv_vse8_v_u8m8(dst + i, __riscv_vle8_v_u8m8(src + i, vl), vl);
+            i += vl;
+        }
+    }
+
+    void SplitUVRow(const uint8_t *src, uint8_t *dst_u, uint8_t *dst_v, size_t pairs)
+    {
+        for (size_t i = 0; i < pairs;) {
+            const size_t vl = __riscv_vsetvl_e8m4(pairs - i);
+            const vuint8m4x2_t uv = __riscv_vlseg2e8_v_u8m4x2(src + 2 * i, vl);
+            __riscv_vse8_v_u8m4(dst_u + i, __riscv_vget_v_u8m4x2_u8m4(uv, 0), vl);
+            __riscv_vse8_v_u8m4(dst_v + i, __riscv_vget_v_u8m4x2_u8m4(uv, 1), vl);
+            i += vl;
+        }
+    }
+
+    void MergeUVRow(const uint8_t *src_u, const uint8_t *src_v, uint8_t *dst, size_t pairs)
+    {
+        for (size_t i = 0; i < pairs;) {
+            const size_t vl = __riscv_vsetvl_e8m4(pairs - i);
+            const vuint8m4x2_t uv = __riscv_vcreate_v_u8m4x2(
+                __riscv_vle8_v_u8m4(src_u + i, vl), __riscv_vle8_v_u8m4(src_v + i, vl));
+            __riscv_vsseg2e8_v_u8m4x2(dst + 2 * i, uv, vl);
+            i += vl;
+        }
+    }
+
+    void ExpandRow(const uint8_t *src, uint8_t *dst, size_t samples)
+    {
+        // Byte pairs of a zero and the sample, so that |dst| needs no
+        // alignment.
+        for (size_t i = 0; i < samples;) {
+            const size_t vl = __riscv_vsetvl_e8m4(samples - i);
+            const vuint8m4x2_t pairs = __riscv_vcreate_v_u8m4x2(
+                __riscv_vmv_v_x_u8m4(0, vl), __riscv_vle8_v_u8m4(src + i, vl));
+            __riscv_vsseg2e8_v_u8m4x2(dst + 2 * i, pairs, vl);
+            i += vl;
+        }
+    }
+
+    size_t HalveRowVector(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, size_t count)
+    {
+        for (size_t i = 0; i < count;) {
+            const size_t vl = __riscv_vsetvl_e8m2(count - i);
+            const vuint8m2x2_t a = __riscv_vlseg2e8_v_u8m2x2(row0 + 2 * i, vl);
+            const vuint8m2x2_t b = __riscv_vlseg2e8_v_u8m2x2(row1 + 2 * i, vl);
+            const vuint16m4_t sum = __riscv_vadd_vv_u16m4(
+                __riscv_vwaddu_vv_u16m4(
+                    __riscv_vget_v_u8m2x2_u8m2(a, 0), __riscv_vget_v_u8m2x2_u8m2(a, 1), vl),
+                __riscv_vwaddu_vv_u16m4(
+                    __riscv_vget_v_u8m2x2_u8m2(b, 0), __riscv_vget_v_u8m2x2_u8m2(b, 1), vl),
+                vl);
+            __riscv_vse8_v_u8m2(
+                dst + i, __riscv_vnsrl_wx_u8m2(__riscv_vadd_vx_u16m4(sum, 2, vl), 2, vl), vl);
+            i += vl;
+        }
+        return count;
+    }
+
+#elif (defined(__SSE2__) || defined(__ARM_NEON)) && __has_builtin(__builtin_shufflevector)
+
+    typedef uint8_t U8x16 __attribute__((vector_size(16)));
+    typedef uint16_t U16x16 __attribute__((vector_size(32)));
+    constexpr size_t kLanes = sizeof(U8x16);
+
+    // Loads 16 bytes from |src|, which must be 16-byte aligned.
+    inline U8x16 LoadAligned(const uint8_t *src)
+    {
+#    if defined(__SSE4_1__)
+        return (U8x16)_mm_stream_load_si128(
+            reinterpret_cast<__m128i *>(const_cast<uint8_t *>(src)));
+#    else
+        U8x16 v;
+        memcpy(&v, src, sizeof(v));
+        return v;
+#    endif
+    }
+
+    // Returns the number of bytes before |src| is 16-byte aligned, at most
+    // |size|.
+    inline size_t BytesToAlignment(const uint8_t *src, size_t size)
+    {
+        const size_t misalignment = reinterpret_cast<uintptr_t>(src) % kLanes;
+        return misalignment ? std::min(kLanes - misalignment, size) : 0;
+    }
+
+    inline U8x16 EvenBytes(U8x16 a, U8x16 b)
+    {
+        return __builtin_shufflevector(
+            a, b, 0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    }
+
+    inline U8x16 OddBytes(U8x16 a, U8x16 b)
+    {
+        return __builtin_shufflevector(
+            a, b, 1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    }
+
+    // Interleaves |a| and |b| into 32 bytes at |dst|.
+    inline void StoreInterleaved(U8x16 a, U8x16 b, uint8_t *dst)
+    {
+        const U8x16 v[2] = {
+            __builtin_shufflevector(a, b, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23),
+            __builtin_shufflevector(
+                a, b, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31),
+        };
+        memcpy(dst, v, sizeof(v));
+    }
+
+    void CopyRow(const uint8_t *src, uint8_t *dst, size_t size)
+    {
+        // A cache line at a time, so that a whole burst is read at once.
+        constexpr size_t kBlock = 4 * kLanes;
+        size_t i = BytesToAlignment(src, size);
+        memcpy(dst, src, i);
+        for (; i + kBlock <= size; i += kBlock) {
+            const U8x16 v[4] = { LoadAligned(src + i), LoadAligned(src + i + kLanes),
+                LoadAligned(src + i + 2 * kLanes), LoadAligned(src + i + 3 * kLanes) };
+            memcpy(dst + i, v, kBlock);
+        }
+        memcpy(dst + i, src + i, size - i);
+    }
+
+    void SplitUVRow(const uint8_t *src, uint8_t *dst_u, uint8_t *dst_v, size_t pairs)
+    {
+        // Start with the pairs before the first aligned one. Rows that start
+        // in the middle of a pair never get there.
+        const size_t head = BytesToAlignment(src, 2 * pairs);
+        size_t i = head % 2 ? pairs : head / 2;
+        SplitUVRowScalar(src, dst_u, dst_v, i);
+        for (; i + 2 * kLanes <= pairs; i += 2 * kLanes) {
+            const U8x16 a = LoadAligned(src + 2 * i);
+            const U8x16 b = LoadAligned(src + 2 * i + kLanes);
+            const U8x16 c = LoadAligned(src + 2 * i + 2 * kLanes);
+            const U8x16 d = LoadAligned(src + 2 * i + 3 * kLanes);
+            const U8x16 u[2] = { EvenBytes(a, b), EvenBytes(c, d) };
+            const U8x16 v[2] = { OddBytes(a, b), OddBytes(c, d) };
+            memcpy(dst_u + i, u, sizeof(u));
+            memcpy(dst_v + i, v, sizeof(v));
+        }
+        SplitUVRowScalar(src + 2 * i, dst_u + i, dst_v + i, pairs - i);
+    }
+
+    // The sources of the writing kernels are in cached memory, so only the
+    // stores come in whole cache lines.
+    void MergeUVRow(const uint8_t *src_u, const uint8_t *src_v, uint8_t *dst, size_t pairs)
+    {
+        size_t i = 0;
+        for (; i + 2 * kLanes <= pairs; i += 2 * kLanes) {
+            U8x16 u[2], v[2];
+            memcpy(u, src_u + i, sizeof(u));
+            memcpy(v, src_v + i, sizeof(v));
+            StoreInterleaved(u[0], v[0], dst + 2 * i);
+            StoreInterleaved(u[1], v[1], dst + 2 * i + 2 * kLanes);
+        }
+        MergeUVRowScalar(src_u + i, src_v + i, dst + 2 * i, pairs - i);
+    }
+
+    void ExpandRow(const uint8_t *src, uint8_t *dst, size_t samples)
+    {
+        const U8x16 zero = {};
+        size_t i = 0;
+        for (; i + 2 * kLanes <= samples; i += 2 * kLanes) {
+            U8x16 v[2];
+            memcpy(v, src + i, sizeof(v));
+            StoreInterleaved(zero, v[0], dst + 2 * i);
+            StoreInterleaved(zero, v[1], dst + 2 * i + 2 * kLanes);
+        }
+        ExpandRowScalar(src + i, dst + 2 * i, samples - i);
+    }
+
+    size_t HalveRowVector(const uint8_t *row0, const uint8_t *row1, uint8_t *dst, size_t count)
+    {
+        size_t i = 0;
+        for (; i + kLanes <= count; i += kLanes) {
+            U8x16 a[2], b[2];
+            memcpy(a, row0 + 2 * i, sizeof(a));
+            memcpy(b, row1 + 2 * i, sizeof(b));
+            const U16x16 sum = __builtin_convertvector(EvenBytes(a[0], a[1]), U16x16)
+                + __builtin_convertvector(OddBytes(a[0], a[1]), U16x16)
+                + __builtin_convertvector(EvenBytes(b[0], b[1]), U16x16)
+                + __builtin_convertvector(OddBytes(b[0], b[1]), U16x16) + 2;
+            const U8x16 average = __builtin_convertvector(sum >> 2, U8x16);
+            memcpy(dst + i, &average, sizeof(average));
+        }
+        return i;
+    }
+
+#else
+
+    void CopyRow(const uint8_t *src, uint8_t *dst, size_t size) { memcpy(dst, src, size); }
+
+    void SplitUVRow(const uint8_t *src, uint8_t *dst_u, uint8_t *dst_v, size_t pairs)
+    {
+        SplitUVRowScalar(src, dst_u, dst_v, pairs);
+    }
+
+    void MergeUVRow(const uint8_t *src_u, const uint8_t *src_v, uint8_t *dst, size_t pairs)
+    {
+        MergeUVRowScalar(src_u, src_v, dst, pairs);
+    }
+
+    void ExpandRow(const uint8_t *src, uint8_t *dst, size_t samples)
+    {
+        ExpandRowScalar(src, dst, samples);
+    }
+
+    size_t HalveRowVector(const uint8_t *, const uint8_t *, uint8_t *, size_t) { return 0; }
+
+#endif
+
+} // namespace
+
+void CopyPlane(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+    size_t row_bytes, size_t rows)
+{
+    // Copy planes without padding in one go.
+    if (src_stride == row_bytes && dst_stride == row_bytes) {
+        CopyRow(src, dst, row_bytes * rows);
+        return;
+    }
+    for (size_t y = 0; y < rows; y++) {
+        CopyRow(src, dst, row_bytes);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+void SplitUVPlane(const uint8_t *src, size_t src_stride, uint8_t *dst_u, size_t dst_u_stride,
+    uint8_t *dst_v, size_t dst_v_stride, size_t pairs, size_t rows)
+{
+    for (size_t y = 0; y < rows; y++) {
+        SplitUVRow(src, dst_u, dst_v, pairs);
+        src += src_stride;
+        dst_u += dst_u_stride;
+        dst_v += dst_v_stride;
+    }
+}
+
+void MergeUVPlane(const uint8_t *src_u, size_t src_u_stride, const uint8_t *src_v,
+    size_t src_v_stride, uint8_t *dst, size_t dst_stride, size_t pairs, size_t rows)
+{
+    for (size_t y = 0; y < rows; y++) {
+        MergeUVRow(src_u, src_v, dst, pairs);
+        src_u += src_u_stride;
+        src_v += src_v_stride;
+        dst += dst_stride;
+    }
+}
+
+void ExpandPlaneTo16Bit(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+    size_t samples, size_t rows)
+{
+    for (size_t y = 0; y < rows; y++) {
+        ExpandRow(src, dst, samples);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+void HalvePlane(const uint8_t *src, size_t src_stride, size_t src_width, size_t src_height,
+    uint8_t *dst, size_t dst_stride, size_t dst_width, size_t dst_height)
+{
+    // The vector kernels only take columns with both samples of the pair.
+    const size_t whole_pairs = std::min(dst_width, src_width / 2);
+    for (size_t y = 0; y < dst_height; y++) {
+        const uint8_t *const row0 = src + 2 * y * src_stride;
+        const uint8_t *const row1 = 2 * y + 1 < src_height ? row0 + src_stride : row0;
+        const size_t done = HalveRowVector(row0, row1, dst, whole_pairs);
+        HalveRowScalar(row0, row1, src_width, dst, done, dst_width);
+        dst += dst_stride;
+    }
+}
+
+} // namespace libvavc8000d::base
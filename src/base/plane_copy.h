@@ -0,0 +1,49 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_PLANE_COPY_H_
+#define BASE_PLANE_COPY_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libvavc8000d::base
+{
+
+// Kernels that move planes in and out of surfaces. Surface memory is usually
+// mapped uncached or write-combined, where every access goes to DRAM and small
+// ones waste most of each burst, so the kernels touch it exactly once with the
+// widest accesses available: non-temporal MOVNTDQA loads with SSE4.1, LMUL=8
+// accesses with RVV, and 16-byte vectors with SSE2/NEON, written out 64 bytes
+// at a time.
+
+// Copies |rows| rows of |row_bytes| bytes.
+void CopyPlane(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+    size_t row_bytes, size_t rows);
+
+// Splits |rows| rows of |pairs| interleaved byte pairs, e.g. the CbCr plane of
+// NV12, into the first bytes at |dst_u| and the second bytes at |dst_v|.
+void SplitUVPlane(const uint8_t *src, size_t src_stride, uint8_t *dst_u, size_t dst_u_stride,
+    uint8_t *dst_v, size_t dst_v_stride, size_t pairs, size_t rows);
+
+// The reverse of SplitUVPlane(): interleaves |rows| rows of |pairs| bytes from
+// |src_u| and |src_v| into byte pairs.
+void MergeUVPlane(const uint8_t *src_u, size_t src_u_stride, const uint8_t *src_v,
+    size_t src_v_stride, uint8_t *dst, size_t dst_stride, size_t pairs, size_t rows);
+
+// Stores |rows| rows of |samples| 8-bit samples in the most significant bits
+// of 16-bit little-endian samples, as P010 does.
+void ExpandPlaneTo16Bit(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+    size_t samples, size_t rows);
+
+// Downscales the |src_width| x |src_height| plane at |src| by two in both
+// directions with a 2x2 box filter, writing |dst_width| x |dst_height|
+// samples. The destination can be up to half the source size rounded up, the
+// last column and row of odd sized sources then pair with themselves.
+void HalvePlane(const uint8_t *src, size_t src_stride, size_t src_width, size_t src_height,
+    uint8_t *dst, size_t dst_stride, size_t dst_width, size_t dst_height);
+
+} // namespace libvavc8000d::base
+
+#endif // BASE_PLANE_COPY_H_
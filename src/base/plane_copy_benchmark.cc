@@ -0,0 +1,118 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "plane_copy.h"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // The planes of a 1080p NV12 picture, with the stride of a surface.
+    constexpr size_t kWidth = 1920;
+    constexpr size_t kHeight = 1080;
+    constexpr size_t kStride = 2048;
+
+    std::vector<uint8_t> RandomBytes(size_t size)
+    {
+        std::mt19937 rng(1);
+        std::vector<uint8_t> data(size);
+        for (auto &byte : data) { byte = static_cast<uint8_t>(rng()); }
+        return data;
+    }
+
+    void BM_CopyPlane(benchmark::State &state)
+    {
+        const auto src = RandomBytes(kStride * kHeight);
+        std::vector<uint8_t> dst(kWidth * kHeight);
+        for (auto _ : state) {
+            CopyPlane(src.data(), kStride, dst.data(), kWidth, kWidth, kHeight);
+            benchmark::DoNotOptimize(dst.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+    BENCHMARK(BM_CopyPlane);
+
+    // What SplitUVPlane() replaces, to compare its throughput against.
+    void BM_SplitUVPlaneScalar(benchmark::State &state)
+    {
+        const auto src = RandomBytes(kStride * kHeight / 2);
+        std::vector<uint8_t> u(kWidth / 2 * kHeight / 2);
+        std::vector<uint8_t> v(kWidth / 2 * kHeight / 2);
+        for (auto _ : state) {
+            for (size_t y = 0; y < kHeight / 2; y++) {
+                const uint8_t *row = src.data() + y * kStride;
+                for (size_t x = 0; x < kWidth / 2; x++) {
+                    u[y * kWidth / 2 + x] = row[2 * x];
+                    v[y * kWidth / 2 + x] = row[2 * x + 1];
+                }
+            }
+            benchmark::DoNotOptimize(u.data());
+            benchmark::DoNotOptimize(v.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight / 2));
+    }
+    BENCHMARK(BM_SplitUVPlaneScalar);
+
+    void BM_SplitUVPlane(benchmark::State &state)
+    {
+        const auto src = RandomBytes(kStride * kHeight / 2);
+        std::vector<uint8_t> u(kWidth / 2 * kHeight / 2);
+        std::vector<uint8_t> v(kWidth / 2 * kHeight / 2);
+        for (auto _ : state) {
+            SplitUVPlane(src.data(), kStride, u.data(), kWidth / 2, v.data(), kWidth / 2,
+                kWidth / 2, kHeight / 2);
+            benchmark::DoNotOptimize(u.data());
+            benchmark::DoNotOptimize(v.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight / 2));
+    }
+    BENCHMARK(BM_SplitUVPlane);
+
+    void BM_MergeUVPlane(benchmark::State &state)
+    {
+        const auto u = RandomBytes(kWidth / 2 * kHeight / 2);
+        const auto v = RandomBytes(kWidth / 2 * kHeight / 2);
+        std::vector<uint8_t> dst(kStride * kHeight / 2);
+        for (auto _ : state) {
+            MergeUVPlane(u.data(), kWidth / 2, v.data(), kWidth / 2, dst.data(), kStride,
+                kWidth / 2, kHeight / 2);
+            benchmark::DoNotOptimize(dst.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight / 2));
+    }
+    BENCHMARK(BM_MergeUVPlane);
+
+    void BM_ExpandPlaneTo16Bit(benchmark::State &state)
+    {
+        const auto src = RandomBytes(kWidth * kHeight);
+        std::vector<uint8_t> dst(2 * kStride * kHeight);
+        for (auto _ : state) {
+            ExpandPlaneTo16Bit(src.data(), kWidth, dst.data(), 2 * kStride, kWidth, kHeight);
+            benchmark::DoNotOptimize(dst.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+    BENCHMARK(BM_ExpandPlaneTo16Bit);
+
+    void BM_HalvePlane(benchmark::State &state)
+    {
+        const auto src = RandomBytes(kStride * kHeight);
+        std::vector<uint8_t> dst(kWidth / 2 * kHeight / 2);
+        for (auto _ : state) {
+            HalvePlane(src.data(), kStride, kWidth, kHeight, dst.data(), kWidth / 2, kWidth / 2,
+                kHeight / 2);
+            benchmark::DoNotOptimize(dst.data());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * kWidth * kHeight));
+    }
+    BENCHMARK(BM_HalvePlane);
+
+} // namespace
+} // namespace libvavc8000d::base
@@ -0,0 +1,167 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "plane_copy.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace libvavc8000d::base
+{
+namespace
+{
+
+    // Row sizes around the 16-byte lanes and 64-byte blocks of the vector
+    // kernels, and the odd ones of odd width pictures.
+    constexpr size_t kRowSizes[] = { 1, 2, 3, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 129 };
+    constexpr size_t kRows = 3;
+    // The kernels align their loads on the source, so every misalignment is
+    // tried.
+    constexpr size_t kMaxOffset = 16;
+
+    constexpr uint8_t kCanary = 0xcd;
+
+    std::vector<uint8_t> RandomBytes(std::mt19937 &rng, size_t size)
+    {
+        std::vector<uint8_t> data(size);
+        for (auto &byte : data) { byte = static_cast<uint8_t>(rng()); }
+        return data;
+    }
+
+    TEST(PlaneCopyTest, CopyPlane)
+    {
+        std::mt19937 rng(1);
+        for (const size_t row_bytes : kRowSizes) {
+            for (size_t offset = 0; offset < kMaxOffset; offset++) {
+                // Without padding the plane is copied as a single row.
+                for (const size_t padding : { 0u, 5u }) {
+                    const size_t src_stride = row_bytes + padding;
+                    const auto src = RandomBytes(rng, offset + src_stride * kRows);
+                    const size_t dst_stride = row_bytes + padding;
+                    std::vector<uint8_t> dst(dst_stride * kRows, kCanary);
+                    CopyPlane(src.data() + offset, src_stride, dst.data(), dst_stride, row_bytes,
+                        kRows);
+                    for (size_t y = 0; y < kRows; y++) {
+                        for (size_t x = 0; x < dst_stride; x++) {
+                            ASSERT_EQ(dst[y * dst_stride + x],
+                                x < row_bytes ? src[offset + y * src_stride + x] : kCanary)
+                                << row_bytes << " bytes at offset " << offset;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // NV12 to I420 splits CbCr into U and V, NV12 to YV12 and NV21 to I420
+    // the same with the destination planes swapped, and the reverse
+    // conversions merge them back.
+    TEST(PlaneCopyTest, SplitAndMergeUVPlaneRoundTrip)
+    {
+        std::mt19937 rng(2);
+        for (const size_t pairs : kRowSizes) {
+            for (size_t offset = 0; offset < kMaxOffset; offset++) {
+                const size_t src_stride = 2 * pairs + 3;
+                const auto src = RandomBytes(rng, offset + src_stride * kRows);
+                const size_t dst_stride = pairs + 1;
+                std::vector<uint8_t> u(dst_stride * kRows, kCanary);
+                std::vector<uint8_t> v(dst_stride * kRows, kCanary);
+                SplitUVPlane(src.data() + offset, src_stride, u.data(), dst_stride, v.data(),
+                    dst_stride, pairs, kRows);
+                for (size_t y = 0; y < kRows; y++) {
+                    for (size_t i = 0; i < pairs; i++) {
+                        ASSERT_EQ(u[y * dst_stride + i], src[offset + y * src_stride + 2 * i])
+                            << pairs << " pairs at offset " << offset;
+                        ASSERT_EQ(v[y * dst_stride + i], src[offset + y * src_stride + 2 * i + 1])
+                            << pairs << " pairs at offset " << offset;
+                    }
+                    ASSERT_EQ(u[y * dst_stride + pairs], kCanary);
+                    ASSERT_EQ(v[y * dst_stride + pairs], kCanary);
+                }
+
+                std::vector<uint8_t> merged(offset + src_stride * kRows, kCanary);
+                MergeUVPlane(u.data(), dst_stride, v.data(), dst_stride, merged.data() + offset,
+                    src_stride, pairs, kRows);
+                for (size_t y = 0; y < kRows; y++) {
+                    const size_t row = offset + y * src_stride;
+                    ASSERT_TRUE(std::equal(
+                        src.begin() + row, src.begin() + row + 2 * pairs, merged.begin() + row))
+                        << pairs << " pairs at offset " << offset;
+                    ASSERT_EQ(merged[row + 2 * pairs], kCanary);
+                }
+
+                // Merging with the planes swapped gives CrCb, as in NV21.
+                std::vector<uint8_t> swapped(src_stride * kRows, kCanary);
+                MergeUVPlane(v.data(), dst_stride, u.data(), dst_stride, swapped.data(), src_stride,
+                    pairs, kRows);
+                for (size_t y = 0; y < kRows; y++) {
+                    for (size_t i = 0; i < pairs; i++) {
+                        ASSERT_EQ(swapped[y * src_stride + 2 * i], v[y * dst_stride + i]);
+                        ASSERT_EQ(swapped[y * src_stride + 2 * i + 1], u[y * dst_stride + i]);
+                    }
+                }
+            }
+        }
+    }
+
+    TEST(PlaneCopyTest, ExpandPlaneTo16Bit)
+    {
+        std::mt19937 rng(3);
+        for (const size_t samples : kRowSizes) {
+            for (size_t offset = 0; offset < kMaxOffset; offset++) {
+                const size_t src_stride = samples + 2;
+                const auto src = RandomBytes(rng, offset + src_stride * kRows);
+                const size_t dst_stride = 2 * samples + 4;
+                std::vector<uint8_t> dst(dst_stride * kRows, kCanary);
+                ExpandPlaneTo16Bit(
+                    src.data() + offset, src_stride, dst.data(), dst_stride, samples, kRows);
+                for (size_t y = 0; y < kRows; y++) {
+                    for (size_t x = 0; x < samples; x++) {
+                        ASSERT_EQ(dst[y * dst_stride + 2 * x], 0);
+                        ASSERT_EQ(dst[y * dst_stride + 2 * x + 1], src[offset + y * src_stride + x])
+                            << samples << " samples at offset " << offset;
+                    }
+                    ASSERT_EQ(dst[y * dst_stride + 2 * samples], kCanary);
+                }
+            }
+        }
+    }
+
+    TEST(PlaneCopyTest, HalvePlane)
+    {
+        std::mt19937 rng(4);
+        for (const size_t src_width : kRowSizes) {
+            for (const size_t src_height : { 1u, 2u, 3u, 4u, 5u }) {
+                const size_t src_stride = src_width + 3;
+                const auto src = RandomBytes(rng, src_stride * src_height);
+                // Up to half the size, rounded up, of which the last column and
+                // row of odd sizes pair with themselves.
+                const size_t dst_width = (src_width + 1) / 2;
+                const size_t dst_height = (src_height + 1) / 2;
+                const size_t dst_stride = dst_width + 1;
+                std::vector<uint8_t> dst(dst_stride * dst_height, kCanary);
+                HalvePlane(src.data(), src_stride, src_width, src_height, dst.data(), dst_stride,
+                    dst_width, dst_height);
+                for (size_t y = 0; y < dst_height; y++) {
+                    const size_t y0 = 2 * y;
+                    const size_t y1 = std::min(y0 + 1, src_height - 1);
+                    for (size_t x = 0; x < dst_width; x++) {
+                        const size_t x0 = 2 * x;
+                        const size_t x1 = std::min(x0 + 1, src_width - 1);
+                        const int sum = src[y0 * src_stride + x0] + src[y0 * src_stride + x1]
+                            + src[y1 * src_stride + x0] + src[y1 * src_stride + x1];
+                        ASSERT_EQ(dst[y * dst_stride + x], (sum + 2) >> 2)
+                            << src_width << "x" << src_height << " at " << x << "," << y;
+                    }
+                    ASSERT_EQ(dst[y * dst_stride + dst_width], kCanary);
+                }
+            }
+        }
+    }
+
+} // namespace
+} // namespace libvavc8000d::base
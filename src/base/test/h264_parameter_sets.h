@@ -0,0 +1,412 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_TEST_H264_PARAMETER_SETS_H_
+#define BASE_TEST_H264_PARAMETER_SETS_H_
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "../bit_writer.h"
+#include "../byte_conversions.h"
+#include "../logging.h"
+
+// The H.264 parameter sets of H264DecoderDelegate, written both through
+// BitWriter and through the bitstream builder it replaced, to check that they
+// give the same bytes and to compare their speed.
+
+namespace libvavc8000d::base::test
+{
+
+// The bitstream builder H264DecoderDelegate used before BitWriter, a copy of
+// Chromium's H26xAnnexBBitstreamBuilder
+// (//media/filters/h26x_annex_b_bitstream_builder.h). Only the NALU type
+// argument changed, from H264NALU::Type to int.
+class LegacyH264BitstreamBuilder
+{
+public:
+    explicit LegacyH264BitstreamBuilder(bool insert_emulation_prevention_bytes = false)
+        : insert_emulation_prevention_bytes_(insert_emulation_prevention_bytes)
+    {
+        Reset();
+    }
+
+    template <typename T> void AppendBits(size_t num_bits, T val)
+    {
+        AppendU64(num_bits, static_cast<uint64_t>(val));
+    }
+
+    void AppendBits(size_t num_bits, bool val)
+    {
+        CHECK_EQ(num_bits, 1ul);
+        AppendBool(val);
+    }
+
+    // Append a one-bit bool/flag value |val| to the stream.
+    void AppendBool(bool val)
+    {
+        if (bits_left_in_reg_ == 0u) { FlushReg(); }
+
+        reg_ <<= 1;
+        reg_ |= (static_cast<uint64_t>(val) & 1u);
+        --bits_left_in_reg_;
+    }
+
+    // Append a signed value in |val| in Exp-Golomb code.
+    void AppendSE(int val)
+    {
+        if (val > 0) {
+            AppendUE(val * 2 - 1);
+        } else {
+            AppendUE(-val * 2);
+        }
+    }
+
+    // Append an unsigned value in |val| in Exp-Golomb code.
+    void AppendUE(unsigned int val)
+    {
+        size_t num_zeros = 0u;
+        unsigned int v = val + 1u;
+
+        while (v > 1) {
+            v >>= 1;
+            ++num_zeros;
+        }
+
+        AppendBits(num_zeros, 0);
+        AppendBits(num_zeros + 1, val + 1u);
+    }
+
+    void BeginNALU(int nalu_type, int nal_ref_idc)
+    {
+        CHECK(!in_nalu_);
+        CHECK_EQ(bits_left_in_reg_, kRegBitSize);
+
+        CHECK_GE(nal_ref_idc, 0);
+        CHECK_LE(nal_ref_idc, 3);
+
+        AppendBits(32, 0x00000001);
+        Flush();
+        in_nalu_ = true;
+        AppendBits(1, 0); // forbidden_zero_bit.
+        AppendBits(2, nal_ref_idc);
+        CHECK_NE(nalu_type, 0);
+        AppendBits(5, nalu_type);
+    }
+
+    void FinishNALU()
+    {
+        // RBSP stop one bit.
+        AppendBits(1, 1);
+
+        // Byte-alignment zero bits.
+        AppendBits(bits_left_in_reg_ % 8, 0);
+
+        Flush();
+        in_nalu_ = false;
+    }
+
+    void Flush()
+    {
+        if (bits_left_in_reg_ != kRegBitSize) { FlushReg(); }
+    }
+
+    size_t BytesInBuffer() const
+    {
+        CHECK_EQ(bits_left_in_reg_, kRegBitSize);
+        return pos_;
+    }
+
+    const uint8_t *data() const
+    {
+        CHECK(!data_.empty());
+        CHECK_EQ(bits_left_in_reg_, kRegBitSize);
+
+        return data_.data();
+    }
+
+private:
+    typedef uint64_t RegType;
+    enum {
+        // Sizes of reg_.
+        kRegByteSize = sizeof(RegType),
+        kRegBitSize = kRegByteSize * 8,
+        // Amount of bytes to grow the buffer by when we run out of
+        // previously-allocated memory for it.
+        kGrowBytes = 4096,
+    };
+
+    void Grow()
+    {
+        static_assert(kGrowBytes >= kRegByteSize, "kGrowBytes must be larger than kRegByteSize");
+        data_.resize(data_.size() + kGrowBytes);
+    }
+
+    void Reset()
+    {
+        data_ = std::vector<uint8_t>(kGrowBytes, 0);
+        pos_ = 0;
+        bits_in_buffer_ = 0;
+        reg_ = 0;
+        bits_left_in_reg_ = kRegBitSize;
+        in_nalu_ = false;
+    }
+
+    void AppendU64(size_t num_bits, uint64_t val)
+    {
+        CHECK_LE(num_bits, kRegBitSize);
+        while (num_bits > 0u) {
+            if (bits_left_in_reg_ == 0u) { FlushReg(); }
+
+            uint64_t bits_to_write = num_bits > bits_left_in_reg_ ? bits_left_in_reg_ : num_bits;
+            uint64_t val_to_write = (val >> (num_bits - bits_to_write));
+            if (bits_to_write < 64u) {
+                val_to_write &= ((1ull << bits_to_write) - 1);
+                reg_ <<= bits_to_write;
+                reg_ |= val_to_write;
+            } else {
+                reg_ = val_to_write;
+            }
+            num_bits -= bits_to_write;
+            bits_left_in_reg_ -= bits_to_write;
+        }
+    }
+
+    void FlushReg()
+    {
+        // Flush all bytes that have at least one bit cached, but not more
+        // (on Flush(), reg_ may not be full).
+        size_t bits_in_reg = kRegBitSize - bits_left_in_reg_;
+        if (bits_in_reg == 0u) { return; }
+
+        size_t bytes_in_reg = AlignUp(bits_in_reg, size_t { 8 }) / 8u;
+        reg_ <<= (kRegBitSize - bits_in_reg);
+
+        // Convert to MSB and append as such to the stream.
+        std::array<uint8_t, 8> reg_be = U64ToBigEndian(reg_);
+
+        if (insert_emulation_prevention_bytes_ && in_nalu_) {
+            // The EPB only works on complete bytes being flushed.
+            CHECK_EQ(bits_in_reg % 8u, 0u);
+            // Insert emulation prevention bytes (spec 7.3.1).
+            constexpr uint8_t kEmulationByte = 0x03u;
+
+            for (size_t i = 0; i < bytes_in_reg; ++i) {
+                // This will possibly check the NALU header byte. However the
+                // CHECK_NE(nalu_type, 0) makes sure that it is not 0.
+                if (pos_ >= 2u && data_[pos_ - 2u] == 0 && data_[pos_ - 1u] == 0u
+                    && reg_be[i] <= kEmulationByte) {
+                    if (pos_ + 1u > data_.size()) { Grow(); }
+                    data_[pos_++] = kEmulationByte;
+                    bits_in_buffer_ += 8u;
+                }
+                if (pos_ + 1u > data_.size()) { Grow(); }
+                data_[pos_++] = reg_be[i];
+                bits_in_buffer_ += 8u;
+            }
+        } else {
+            // Make sure we have enough space.
+            if (pos_ + bytes_in_reg > data_.size()) { Grow(); }
+
+            std::copy(reg_be.cbegin(), reg_be.cbegin() + bytes_in_reg, data_.begin() + pos_);
+
+            bits_in_buffer_ = pos_ * 8u + bits_in_reg;
+            pos_ += bytes_in_reg;
+        }
+
+        reg_ = 0u;
+        bits_left_in_reg_ = kRegBitSize;
+    }
+
+    // Whether to insert emulation prevention bytes in RBSP.
+    bool insert_emulation_prevention_bytes_;
+
+    // Whether BeginNALU() has been called but not FinishNALU().
+    bool in_nalu_;
+
+    // Unused bits left in reg_.
+    size_t bits_left_in_reg_;
+
+    // Cache for appended bits. Bits are flushed to data_ with kRegByteSize
+    // granularity, i.e. when reg_ becomes full, or when an explicit FlushReg()
+    // is called.
+    RegType reg_;
+
+    // Current byte offset in data_ (points to the start of unwritten bits).
+    size_t pos_;
+    // Current last bit in data_ (points to the start of unwritten bit).
+    size_t bits_in_buffer_;
+
+    // Buffer for stream data. Only the bytes before `pos_` can be assumed to have
+    // been initialized.
+    std::vector<uint8_t> data_;
+};
+
+// The fields of VAPictureParameterBufferH264 the parameter sets are built
+// from, and the profile_idc the VA profile maps to.
+struct H264ParameterSetFields
+{
+    uint8_t profile_idc = 100;
+    uint32_t chroma_format_idc = 1;
+    uint32_t bit_depth_luma_minus8 = 0;
+    uint32_t bit_depth_chroma_minus8 = 0;
+    uint32_t log2_max_frame_num_minus4 = 0;
+    uint32_t pic_order_cnt_type = 0;
+    uint32_t log2_max_pic_order_cnt_lsb_minus4 = 0;
+    uint32_t num_ref_frames = 1;
+    bool gaps_in_frame_num_value_allowed_flag = false;
+    uint32_t picture_width_in_mbs_minus1 = 119;
+    uint32_t picture_height_in_mbs_minus1 = 67;
+    bool frame_mbs_only_flag = true;
+    bool mb_adaptive_frame_field_flag = false;
+    bool direct_8x8_inference_flag = true;
+
+    bool entropy_coding_mode_flag = true;
+    bool pic_order_present_flag = false;
+    bool weighted_pred_flag = false;
+    uint32_t weighted_bipred_idc = 0;
+    int32_t pic_init_qp_minus26 = 0;
+    int32_t pic_init_qs_minus26 = 0;
+    int32_t chroma_qp_index_offset = 0;
+    bool deblocking_filter_control_present_flag = true;
+    bool constrained_intra_pred_flag = false;
+    bool redundant_pic_cnt_present_flag = false;
+};
+
+constexpr int kNALUTypeSPS = 7;
+constexpr int kNALUTypePPS = 8;
+constexpr uint8_t kLevelIDC5p1 = 51;
+
+inline bool HasChromaFormat(uint8_t profile_idc)
+{
+    return profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244
+        || profile_idc == 44 || profile_idc == 83 || profile_idc == 86 || profile_idc == 118
+        || profile_idc == 128 || profile_idc == 138 || profile_idc == 139 || profile_idc == 134
+        || profile_idc == 135;
+}
+
+// The SPS and PPS as BuildPackedH264SPS() and BuildPackedH264PPS() write them
+// through the legacy builder, one syntax element at a time.
+inline std::vector<uint8_t> WriteLegacyParameterSets(const H264ParameterSetFields &f)
+{
+    LegacyH264BitstreamBuilder builder(/*insert_emulation_prevention_bytes=*/true);
+
+    builder.BeginNALU(kNALUTypeSPS, 3);
+    builder.AppendBits(8, f.profile_idc); // profile_idc u(8).
+    for (int i = 0; i < 6; i++) { builder.AppendBool(0); } // constraint_set0..5_flag u(1).
+    builder.AppendBits(2, 0); // reserved_zero_2bits u(2).
+    builder.AppendBits(8, kLevelIDC5p1); // level_idc u(8).
+    builder.AppendUE(0); // seq_parameter_set_id ue(v).
+    if (HasChromaFormat(f.profile_idc)) {
+        builder.AppendUE(f.chroma_format_idc);
+        if (f.chroma_format_idc == 3) { builder.AppendBool(0); }
+        builder.AppendUE(f.bit_depth_luma_minus8);
+        builder.AppendUE(f.bit_depth_chroma_minus8);
+        builder.AppendBool(0); // qpprime_y_zero_transform_bypass_flag u(1).
+        builder.AppendBool(0); // seq_scaling_matrix_present_flag u(1).
+    }
+    builder.AppendUE(f.log2_max_frame_num_minus4);
+    builder.AppendUE(f.pic_order_cnt_type);
+    if (f.pic_order_cnt_type == 0) { builder.AppendUE(f.log2_max_pic_order_cnt_lsb_minus4); }
+    builder.AppendUE(f.num_ref_frames);
+    builder.AppendBool(f.gaps_in_frame_num_value_allowed_flag);
+    builder.AppendUE(f.picture_width_in_mbs_minus1);
+    builder.AppendUE(f.picture_height_in_mbs_minus1);
+    builder.AppendBool(f.frame_mbs_only_flag);
+    if (!f.frame_mbs_only_flag) { builder.AppendBool(f.mb_adaptive_frame_field_flag); }
+    builder.AppendBool(f.direct_8x8_inference_flag);
+    builder.AppendBool(0); // frame_cropping_flag u(1).
+    builder.AppendBool(1); // vui_parameters_present_flag u(1).
+    builder.AppendBool(1); // aspect_ratio_info_present_flag u(1).
+    builder.AppendBits(8, 1); // aspect_ratio_idc u(8).
+    // overscan_info_present_flag to bitstream_restriction_flag u(1).
+    for (int i = 0; i < 8; i++) { builder.AppendBool(0); }
+    builder.FinishNALU();
+
+    builder.BeginNALU(kNALUTypePPS, 3);
+    builder.AppendUE(0); // pic_parameter_set_id ue(v).
+    builder.AppendUE(0); // seq_parameter_set_id ue(v).
+    builder.AppendBool(f.entropy_coding_mode_flag);
+    builder.AppendBool(f.pic_order_present_flag);
+    builder.AppendUE(0); // num_slice_groups_minus1 ue(v).
+    builder.AppendUE(4); // num_ref_idx_l0_default_active_minus1 ue(v).
+    builder.AppendUE(0); // num_ref_idx_l1_default_active_minus1 ue(v).
+    builder.AppendBool(f.weighted_pred_flag);
+    builder.AppendBits(2, f.weighted_bipred_idc);
+    builder.AppendSE(f.pic_init_qp_minus26);
+    builder.AppendSE(f.pic_init_qs_minus26);
+    builder.AppendSE(f.chroma_qp_index_offset);
+    builder.AppendBool(f.deblocking_filter_control_present_flag);
+    builder.AppendBool(f.constrained_intra_pred_flag);
+    builder.AppendBool(f.redundant_pic_cnt_present_flag);
+    builder.FinishNALU();
+
+    return std::vector<uint8_t>(builder.data(), builder.data() + builder.BytesInBuffer());
+}
+
+// The same parameter sets as H264DecoderDelegate writes them with BitWriter.
+inline std::vector<uint8_t> WriteParameterSets(const H264ParameterSetFields &f)
+{
+    using H264NALUHeader = BitFieldLayout<1, 2, 5>;
+    using H264SPSProfileAndLevel = BitFieldLayout<8, 1, 1, 1, 1, 1, 1, 2, 8>;
+    BitWriter<StartCodeEmulationPrevention> writer;
+
+    writer.AppendRawBytes({ 0x00, 0x00, 0x00, 0x01 });
+    writer.AppendFields<H264NALUHeader>(0, 3, kNALUTypeSPS);
+    writer.AppendFields<H264SPSProfileAndLevel>(f.profile_idc, 0, 0, 0, 0, 0, 0, 0, kLevelIDC5p1);
+    writer.AppendUE(0); // seq_parameter_set_id ue(v).
+    if (HasChromaFormat(f.profile_idc)) {
+        writer.AppendUE(f.chroma_format_idc);
+        if (f.chroma_format_idc == 3) { writer.AppendBool(0); }
+        writer.AppendUE(f.bit_depth_luma_minus8);
+        writer.AppendUE(f.bit_depth_chroma_minus8);
+        writer.AppendBool(0); // qpprime_y_zero_transform_bypass_flag u(1).
+        writer.AppendBool(0); // seq_scaling_matrix_present_flag u(1).
+    }
+    writer.AppendUE(f.log2_max_frame_num_minus4);
+    writer.AppendUE(f.pic_order_cnt_type);
+    if (f.pic_order_cnt_type == 0) { writer.AppendUE(f.log2_max_pic_order_cnt_lsb_minus4); }
+    writer.AppendUE(f.num_ref_frames);
+    writer.AppendBool(f.gaps_in_frame_num_value_allowed_flag);
+    writer.AppendUE(f.picture_width_in_mbs_minus1);
+    writer.AppendUE(f.picture_height_in_mbs_minus1);
+    writer.AppendBool(f.frame_mbs_only_flag);
+    if (!f.frame_mbs_only_flag) { writer.AppendBool(f.mb_adaptive_frame_field_flag); }
+    writer.AppendBool(f.direct_8x8_inference_flag);
+    writer.AppendBool(0); // frame_cropping_flag u(1).
+    writer.AppendBool(1); // vui_parameters_present_flag u(1).
+    writer.AppendBool(1); // aspect_ratio_info_present_flag u(1).
+    writer.AppendBits(8, 1); // aspect_ratio_idc u(8).
+    // overscan_info_present_flag to bitstream_restriction_flag u(1).
+    for (int i = 0; i < 8; i++) { writer.AppendBool(0); }
+    writer.AppendTrailingBits();
+    writer.Flush();
+
+    writer.AppendRawBytes({ 0x00, 0x00, 0x00, 0x01 });
+    writer.AppendFields<H264NALUHeader>(0, 3, kNALUTypePPS);
+    writer.AppendUE(0); // pic_parameter_set_id ue(v).
+    writer.AppendUE(0); // seq_parameter_set_id ue(v).
+    writer.AppendBool(f.entropy_coding_mode_flag);
+    writer.AppendBool(f.pic_order_present_flag);
+    writer.AppendUE(0); // num_slice_groups_minus1 ue(v).
+    writer.AppendUE(4); // num_ref_idx_l0_default_active_minus1 ue(v).
+    writer.AppendUE(0); // num_ref_idx_l1_default_active_minus1 ue(v).
+    writer.AppendBool(f.weighted_pred_flag);
+    writer.AppendBits(2, f.weighted_bipred_idc);
+    writer.AppendSE(f.pic_init_qp_minus26);
+    writer.AppendSE(f.pic_init_qs_minus26);
+    writer.AppendSE(f.chroma_qp_index_offset);
+    writer.AppendBool(f.deblocking_filter_control_present_flag);
+    writer.AppendBool(f.constrained_intra_pred_flag);
+    writer.AppendBool(f.redundant_pic_cnt_present_flag);
+    writer.AppendTrailingBits();
+    writer.Flush();
+
+    return writer.data();
+}
+
+} // namespace libvavc8000d::base::test
+
+#endif // BASE_TEST_H264_PARAMETER_SETS_H_
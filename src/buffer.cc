@@ -25,11 +25,22 @@ VSBuffer::VSBuffer(IdType id, VAContextID context, VABufferType type, unsigned i
     , context_(context)
     , type_(type)
     , data_size_(CalculateDataSize(size_per_element, num_elements))
-    , data_(std::make_unique<uint8_t[]>(data_size_))
+    , owned_data_(std::make_unique<uint8_t[]>(data_size_))
+    , data_(owned_data_.get())
 {
-    if (data) { memcpy(data_.get(), data, data_size_); }
+    if (data) { memcpy(data_, data, data_size_); }
 }
 
+VSBuffer::VSBuffer(IdType id, VAContextID context, VABufferType type, size_t size, uint8_t *data,
+    const ScopedBOMapping &mapping)
+    : id_(id)
+    , context_(context)
+    , type_(type)
+    , data_size_(size)
+    , data_(data)
+    , mapping_(&mapping)
+{}
+
 VSBuffer::~VSBuffer() = default;
 
 VSBuffer::IdType VSBuffer::GetID() const { return id_; }
@@ -40,6 +51,22 @@ VABufferType VSBuffer::GetType() const { return type_; }
 
 size_t VSBuffer::GetDataSize() const { return data_size_; }
 
-void *VSBuffer::GetData() const { return data_.get(); }
+void *VSBuffer::GetData() const { return data_; }
+
+void *VSBuffer::Map() const
+{
+    const std::lock_guard<std::mutex> lock(map_lock_);
+    if (mapping_ && map_count_++ == 0) {
+        access_.reset(new ScopedBOMapping::ScopedAccess(mapping_->BeginAccess()));
+    }
+    return data_;
+}
+
+void VSBuffer::Unmap() const
+{
+    const std::lock_guard<std::mutex> lock(map_lock_);
+    if (!mapping_ || map_count_ == 0) { return; }
+    if (--map_count_ == 0) { access_.reset(); }
+}
 
 } // namespace libvavc8000d
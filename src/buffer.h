@@ -7,9 +7,12 @@
 #define FAKE_BUFFER_H_
 
 #include <memory>
+#include <mutex>
 
 #include <va/va.h>
 
+#include "scoped_bo_mapping_factory.h"
+
 namespace libvavc8000d
 {
 
@@ -21,6 +24,9 @@ namespace libvavc8000d
 // externally, but calls to the VSBuffer public methods themselves are
 // thread-safe. Users of VSBuffer must not free the memory pointed to by
 // the pointer that GetData() returns.
+//
+// A VSBuffer either owns its memory or wraps external memory, such as the
+// planes of a surface that a derived image gives access to.
 class VSBuffer
 {
 public:
@@ -28,6 +34,10 @@ public:
 
     VSBuffer(IdType id, VAContextID context, VABufferType type, unsigned int size_per_element,
         unsigned int num_elements, const void *data);
+    // Wraps the |size| bytes at |data|, which lie in the CPU mapping of
+    // |mapping|. Both must outlive the VSBuffer.
+    VSBuffer(IdType id, VAContextID context, VABufferType type, size_t size, uint8_t *data,
+        const ScopedBOMapping &mapping);
     VSBuffer(const VSBuffer &) = delete;
     VSBuffer &operator=(const VSBuffer &) = delete;
     ~VSBuffer();
@@ -38,12 +48,27 @@ public:
     size_t GetDataSize() const;
     void *GetData() const;
 
+    // Give the client access to the data, from vaMapBuffer() to vaUnmapBuffer().
+    // The caches of wrapped buffer objects are synchronized for the CPU for as
+    // long as the buffer is mapped. Calls may be nested.
+    void *Map() const;
+    void Unmap() const;
+
 private:
     const IdType id_;
     const VAContextID context_;
     const VABufferType type_;
     const size_t data_size_;
-    const std::unique_ptr<uint8_t[]> data_;
+    // Null when the buffer wraps external memory.
+    const std::unique_ptr<uint8_t[]> owned_data_;
+    uint8_t *const data_;
+
+    // The mapping external memory belongs to, accessed while the buffer is
+    // mapped.
+    const ScopedBOMapping *const mapping_ = nullptr;
+    mutable std::mutex map_lock_;
+    mutable uint32_t map_count_ = 0;
+    mutable std::unique_ptr<ScopedBOMapping::ScopedAccess> access_;
 };
 
 } // namespace libvavc8000d
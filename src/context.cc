@@ -8,15 +8,18 @@
 #include "base/logging.h"
 #include "config.h"
 #include "h264_decoder_delegate.h"
+#include "mpeg4_decoder_delegate.h"
 #include "no_op_context_delegate.h"
+#include "vc1_decoder_delegate.h"
+#include "video_proc_delegate.h"
 #include <fstream>
 #include <va/va.h>
 
 namespace
 {
 
-std::unique_ptr<libvavc8000d::ContextDelegate> CreateDelegate(
-    const libvavc8000d::VSConfig &config, int picture_width, int picture_height)
+std::unique_ptr<libvavc8000d::ContextDelegate> CreateDelegate(const libvavc8000d::VSConfig &config,
+    int picture_width, int picture_height, libvavc8000d::SurfaceLayout output_layout)
 {
     const char *use_no_op_context_delegate_env_var = getenv("USE_NO_OP_CONTEXT_DELEGATE");
     if (use_no_op_context_delegate_env_var
@@ -24,14 +27,27 @@ std::unique_ptr<libvavc8000d::ContextDelegate> CreateDelegate(
         return std::make_unique<libvavc8000d::NoOpContextDelegate>();
     }
 
+    if (config.GetEntrypoint() == VAEntrypointVideoProc) {
+        return std::make_unique<libvavc8000d::VideoProcDelegate>();
+    }
     if (config.GetEntrypoint() != VAEntrypointVLD) { return nullptr; }
 
     switch (config.GetProfile()) {
     case VAProfileH264ConstrainedBaseline:
     case VAProfileH264Main:
     case VAProfileH264High:
+    case VAProfileH264High10:
         return std::make_unique<libvavc8000d::H264DecoderDelegate>(
-            picture_width, picture_height, config.GetProfile());
+            picture_width, picture_height, config.GetProfile(), output_layout);
+    case VAProfileVC1Simple:
+    case VAProfileVC1Main:
+    case VAProfileVC1Advanced:
+        return std::make_unique<libvavc8000d::Vc1DecoderDelegate>(
+            picture_width, picture_height, config.GetProfile(), output_layout);
+    case VAProfileMPEG4Simple:
+    case VAProfileMPEG4AdvancedSimple:
+        return std::make_unique<libvavc8000d::Mpeg4DecoderDelegate>(
+            picture_width, picture_height, config.GetProfile(), output_layout);
     default: break;
     }
 
@@ -44,14 +60,15 @@ namespace libvavc8000d
 {
 
 VSContext::VSContext(VSContext::IdType id, const VSConfig &config, int picture_width,
-    int picture_height, int flag, std::vector<VASurfaceID> render_targets)
+    int picture_height, int flag, std::vector<VASurfaceID> render_targets,
+    SurfaceLayout output_layout)
     : id_(id)
     , config_(config)
     , picture_width_(picture_width)
     , picture_height_(picture_height)
     , flag_(flag)
     , render_targets_(std::move(render_targets))
-    , delegate_(CreateDelegate(config_, picture_width_, picture_height_))
+    , delegate_(CreateDelegate(config_, picture_width_, picture_height_, output_layout))
 {}
 VSContext::~VSContext() = default;
 
@@ -73,16 +90,28 @@ void VSContext::BeginPicture(const VSSurface &surface) const
     delegate_->SetRenderTarget(surface);
 }
 
+void VSContext::SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces) const
+{
+    CHECK(delegate_);
+    delegate_->SetAdditionalOutputs(surfaces);
+}
+
+void VSContext::SetInputSurface(const VSSurface &surface) const
+{
+    CHECK(delegate_);
+    delegate_->SetInputSurface(surface);
+}
+
 void VSContext::RenderPicture(const std::vector<const VSBuffer *> &buffers) const
 {
     CHECK(delegate_);
     delegate_->EnqueueWork(buffers);
 }
 
-void VSContext::EndPicture() const
+VAStatus VSContext::EndPicture() const
 {
     CHECK(delegate_);
-    delegate_->Run();
+    return delegate_->Run();
 }
 
 } // namespace libvavc8000d
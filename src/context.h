@@ -15,6 +15,7 @@ namespace libvavc8000d
 {
 
 class ContextDelegate;
+enum class SurfaceLayout;
 class VSSurface;
 class VSBuffer;
 class VSConfig;
@@ -29,9 +30,10 @@ class VSContext
 public:
     using IdType = VAContextID;
 
-    // Note: |config| must outlive the VSContext.
+    // Note: |config| must outlive the VSContext. |output_layout| is the layout
+    // shared by all the |render_targets|.
     VSContext(IdType id, const VSConfig &config, int picture_width, int picture_height, int flag,
-        std::vector<VASurfaceID> render_targets);
+        std::vector<VASurfaceID> render_targets, SurfaceLayout output_layout);
     VSContext(const VSContext &) = delete;
     VSContext &operator=(const VSContext &) = delete;
     ~VSContext();
@@ -44,8 +46,10 @@ public:
     const std::vector<VASurfaceID> &GetRenderTargets() const;
 
     void BeginPicture(const VSSurface &surface) const;
+    void SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces) const;
+    void SetInputSurface(const VSSurface &surface) const;
     void RenderPicture(const std::vector<const VSBuffer *> &buffers) const;
-    void EndPicture() const;
+    VAStatus EndPicture() const;
 
 private:
     const IdType id_;
@@ -6,6 +6,7 @@
 #ifndef CONTEXT_DELEGATE_H_
 #define CONTEXT_DELEGATE_H_
 
+#include <va/va.h>
 #include <vector>
 
 namespace libvavc8000d
@@ -48,6 +49,20 @@ public:
     // surface or the ContextDelegate is destroyed).
     virtual void SetRenderTarget(const VSSurface &surface) = 0;
 
+    // Sets extra destinations for the work enqueued next, e.g. the renditions of
+    // a decoded picture requested through
+    // VAProcPipelineParameterBuffer::additional_outputs. They are cleared by
+    // Run(), and must remain alive under the same conditions as the render
+    // target. ContextDelegates that produce a single output ignore them.
+    virtual void SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces) {}
+
+    // Sets the source of the work enqueued next for ContextDelegates that read
+    // a surface other than the render target, i.e. the
+    // VAProcPipelineParameterBuffer::surface of a video-processing
+    // ContextDelegate. It is cleared by Run(), and must remain alive under the
+    // same conditions as the render target. Other ContextDelegates ignore it.
+    virtual void SetInputSurface(const VSSurface &surface) {}
+
     // Enqueues work to be performed using the |surface| passed to
     // SetRenderTarget() as the source or destination (depending on the type of
     // work) and |buffers| as parameters. For example, for decoding, the
@@ -63,8 +78,9 @@ public:
     // Executes the enqueued work. EnqueueWork() must be called before this. After
     // Run() returns, the caller may assume that the ContextDelegate does not have
     // any more work enqueued. Thus, if the caller wants to call Run() again, it
-    // must enqueue more work using EnqueueWork().
-    virtual void Run() = 0;
+    // must enqueue more work using EnqueueWork(). Returns the status reported by
+    // vaEndPicture(), i.e. VA_STATUS_SUCCESS unless the work could not be done.
+    virtual VAStatus Run() = 0;
 };
 
 } // namespace libvavc8000d
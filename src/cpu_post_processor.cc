@@ -0,0 +1,245 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cpu_post_processor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // An 8-bit plane without padding.
+    struct Plane
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> data;
+
+        Plane(uint32_t plane_width, uint32_t plane_height)
+            : width(plane_width)
+            , height(plane_height)
+            , data(static_cast<size_t>(plane_width) * plane_height)
+        {}
+    };
+
+    // Part of a source plane. Consecutive samples are |step| bytes apart, so
+    // the Cb and Cr samples of NV12 are read in place.
+    struct PlaneRegion
+    {
+        const uint8_t *data;
+        uint32_t stride;
+        uint32_t step;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // Returns the 16.16 fixed point position in the source of output sample
+    // |i|, aligning the sample centres, clamped to the first and last samples.
+    int64_t SourcePosition(uint32_t i, int64_t ratio, uint32_t src_size)
+    {
+        const int64_t position = i * ratio + ratio / 2 - (1 << 15);
+        return std::clamp<int64_t>(position, 0, static_cast<int64_t>(src_size - 1) << 16);
+    }
+
+    // Bilinear scaling of |src| to the size of |dst|.
+    void ScalePlane(const PlaneRegion &src, Plane &dst)
+    {
+        const int64_t ratio_x = (static_cast<int64_t>(src.width) << 16) / dst.width;
+        const int64_t ratio_y = (static_cast<int64_t>(src.height) << 16) / dst.height;
+        for (uint32_t y = 0; y < dst.height; y++) {
+            const int64_t sy = SourcePosition(y, ratio_y, src.height);
+            const uint32_t y0 = static_cast<uint32_t>(sy >> 16);
+            const uint32_t y1 = std::min(y0 + 1, src.height - 1);
+            const uint64_t fy = sy & 0xFFFF;
+            const uint8_t *row0 = src.data + static_cast<size_t>(y0) * src.stride;
+            const uint8_t *row1 = src.data + static_cast<size_t>(y1) * src.stride;
+            uint8_t *out = dst.data.data() + static_cast<size_t>(y) * dst.width;
+            for (uint32_t x = 0; x < dst.width; x++) {
+                const int64_t sx = SourcePosition(x, ratio_x, src.width);
+                const uint32_t x0 = static_cast<uint32_t>(sx >> 16);
+                const uint32_t x1 = std::min(x0 + 1, src.width - 1);
+                const uint64_t fx = sx & 0xFFFF;
+                const uint64_t top
+                    = row0[x0 * src.step] * (0x10000 - fx) + row0[x1 * src.step] * fx;
+                const uint64_t bottom
+                    = row1[x0 * src.step] * (0x10000 - fx) + row1[x1 * src.step] * fx;
+                out[x] = static_cast<uint8_t>(
+                    (top * (0x10000 - fy) + bottom * fy + (uint64_t { 1 } << 31)) >> 32);
+            }
+        }
+    }
+
+    uint8_t ClampToByte(float value)
+    {
+        return static_cast<uint8_t>(std::clamp(std::lround(value), 0l, 255l));
+    }
+
+    // Converts the planar 4:2:0 picture in |y|, |cb| and |cr| to RGB with the
+    // conversion matrix |rgb_standard|, see GetRgbStandard(). The components of
+    // consecutive pixels are written |pixel_step| bytes apart to |r|, |g| and
+    // |b|, which may point into the same packed buffer.
+    void ConvertToRgb(const Plane &y, const Plane &cb, const Plane &cr, uint32_t rgb_standard,
+        uint8_t *r, uint8_t *g, uint8_t *b, uint32_t pixel_step)
+    {
+        float kr = 0.299f, kb = 0.114f;
+        switch (rgb_standard) {
+        case BT709:
+        case BT709_L:
+            kr = 0.2126f;
+            kb = 0.0722f;
+            break;
+        case BT2020:
+        case BT2020_L:
+            kr = 0.2627f;
+            kb = 0.0593f;
+            break;
+        default: break;
+        }
+        const float kg = 1.0f - kr - kb;
+        const bool limited
+            = rgb_standard == BT601_L || rgb_standard == BT709_L || rgb_standard == BT2020_L;
+        const float luma_offset = limited ? 16.0f : 0.0f;
+        const float luma_scale = limited ? 255.0f / 219.0f : 1.0f;
+        const float chroma_scale = limited ? 255.0f / 224.0f : 1.0f;
+
+        size_t out = 0;
+        for (uint32_t row = 0; row < y.height; row++) {
+            const size_t chroma_row = static_cast<size_t>(row / 2) * cb.width;
+            for (uint32_t col = 0; col < y.width; col++, out += pixel_step) {
+                const float luma
+                    = (y.data[static_cast<size_t>(row) * y.width + col] - luma_offset)
+                    * luma_scale;
+                const float u = (cb.data[chroma_row + col / 2] - 128.0f) * chroma_scale;
+                const float v = (cr.data[chroma_row + col / 2] - 128.0f) * chroma_scale;
+                r[out] = ClampToByte(luma + 2.0f * (1.0f - kr) * v);
+                g[out] = ClampToByte(
+                    luma - (2.0f * kb * (1.0f - kb) * u + 2.0f * kr * (1.0f - kr) * v) / kg);
+                b[out] = ClampToByte(luma + 2.0f * (1.0f - kb) * u);
+            }
+        }
+    }
+
+    // Writes |region| of |source|, scaled to |output|, to |surface|. Returns
+    // false when the surface can't hold the picture.
+    bool WriteOutput(const SourcePicture &source, const CropRegion &region,
+        uint32_t rgb_standard, const PostProcessingOutput &output, const VSSurface &surface,
+        const PictureTransform &transform)
+    {
+        const uint32_t width = output.width ? output.width : region.width;
+        const uint32_t height = output.height ? output.height : region.height;
+        const uint32_t chroma_width = (width + 1) / 2;
+        const uint32_t chroma_height = (height + 1) / 2;
+
+        // Scale to I420 first, the layouts are produced from it.
+        const bool nv12 = source.format == SurfaceFormat::kNV12;
+        const uint32_t chroma_x = region.x / 2;
+        const uint32_t chroma_y = region.y / 2;
+        const PlaneRegion src_chroma[2] = {
+            { source.planes[1] + static_cast<size_t>(chroma_y) * source.strides[1]
+                    + chroma_x * (nv12 ? 2 : 1),
+                source.strides[1], nv12 ? 2u : 1u, (region.width + 1) / 2,
+                (region.height + 1) / 2 },
+            { nv12 ? source.planes[1] + static_cast<size_t>(chroma_y) * source.strides[1]
+                        + chroma_x * 2 + 1
+                   : source.planes[2] + static_cast<size_t>(chroma_y) * source.strides[2]
+                        + chroma_x,
+                nv12 ? source.strides[1] : source.strides[2], nv12 ? 2u : 1u,
+                (region.width + 1) / 2, (region.height + 1) / 2 },
+        };
+        Plane y(width, height), cb(chroma_width, chroma_height), cr(chroma_width, chroma_height);
+        ScalePlane({ source.planes[0] + static_cast<size_t>(region.y) * source.strides[0]
+                           + region.x,
+                       source.strides[0], 1, region.width, region.height },
+            y);
+        ScalePlane(src_chroma[0], cb);
+        ScalePlane(src_chroma[1], cr);
+
+        OutputPicture picture = {
+            .luma = y.data.data(),
+            .chroma = nullptr,
+            .width = width,
+            .height = height,
+            .luma_stride = width,
+            .chroma_stride = 0,
+            .format = DEC_OUT_FRM_YUV420SP,
+        };
+        std::vector<uint8_t> converted;
+        switch (output.format) {
+        case SurfaceFormat::kNV12:
+        // Expanded to 16-bit samples as it is written.
+        case SurfaceFormat::kP010:
+            converted.resize(static_cast<size_t>(chroma_width) * 2 * chroma_height);
+            for (size_t i = 0; i < cb.data.size(); i++) {
+                converted[2 * i] = cb.data[i];
+                converted[2 * i + 1] = cr.data[i];
+            }
+            picture.chroma = converted.data();
+            picture.chroma_stride = chroma_width * 2;
+            break;
+        case SurfaceFormat::kI420:
+            converted = cb.data;
+            converted.insert(converted.end(), cr.data.begin(), cr.data.end());
+            picture.chroma = converted.data();
+            picture.chroma_stride = chroma_width;
+            picture.format = DEC_OUT_FRM_YUV420P;
+            break;
+        case SurfaceFormat::kY800: picture.format = DEC_OUT_FRM_YUV400; break;
+        case SurfaceFormat::kRGBX:
+        case SurfaceFormat::kBGRX: {
+            converted.assign(static_cast<size_t>(width) * height * 4, 0xFF);
+            uint8_t *pixels = converted.data();
+            const bool rgbx = output.format == SurfaceFormat::kRGBX;
+            ConvertToRgb(y, cb, cr, rgb_standard, rgbx ? pixels : pixels + 2, pixels + 1,
+                rgbx ? pixels + 2 : pixels, 4);
+            picture.luma = pixels;
+            picture.luma_stride = width * 4;
+            picture.format = rgbx ? DEC_OUT_FRM_ABGR888 : DEC_OUT_FRM_ARGB888;
+            break;
+        }
+        case SurfaceFormat::kRGBP: {
+            const size_t plane_size = static_cast<size_t>(width) * height;
+            converted.resize(plane_size * 3);
+            uint8_t *planes = converted.data();
+            ConvertToRgb(
+                y, cb, cr, rgb_standard, planes, planes + plane_size, planes + 2 * plane_size, 1);
+            picture.luma = planes;
+            picture.format = DEC_OUT_FRM_RGB888_P;
+            break;
+        }
+        }
+        return WriteOutputPicture(picture, surface, transform);
+    }
+
+} // namespace
+
+bool RunCpuPostProcessing(const SourcePicture &source, const DecodedStreamInfo &stream,
+    const PostProcessingParams &params, const PictureOutputs &outputs)
+{
+    CHECK(source.format == SurfaceFormat::kNV12 || source.format == SurfaceFormat::kI420);
+    CropRegion region = ClampCropRegion(stream, params);
+    if (!region.enabled) {
+        region.width = source.width;
+        region.height = source.height;
+    }
+    const uint32_t rgb_standard = GetRgbStandard(stream);
+
+    bool written = WriteOutput(source, region, rgb_standard,
+        { .width = params.scale_width,
+            .height = params.scale_height,
+            .format = GetSurfaceFormat(*outputs.render_target) },
+        *outputs.render_target, outputs.transform);
+    for (uint32_t i = 0; i < params.num_additional_outputs; i++) {
+        written &= WriteOutput(source, region, rgb_standard, params.additional_outputs[i],
+            *outputs.additional_outputs[i], outputs.transform);
+    }
+    return written;
+}
+
+} // namespace libvavc8000d
@@ -0,0 +1,38 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CPU_POST_PROCESSOR_H_
+#define CPU_POST_PROCESSOR_H_
+
+#include <array>
+#include <cstdint>
+
+#include "output_picture.h"
+#include "post_processor.h"
+
+namespace libvavc8000d
+{
+
+// A picture read by a surface-to-surface processing pass. NV12 pictures use
+// the first two planes, I420 pictures all three.
+struct SourcePicture
+{
+    std::array<const uint8_t *, 3> planes {};
+    std::array<uint32_t, 3> strides {};
+    uint32_t width = 0;
+    uint32_t height = 0;
+    SurfaceFormat format = SurfaceFormat::kNV12;
+};
+
+// Does on the CPU what the post-processor does for |params|: crops |source|,
+// scales it bilinearly and converts it to the format of each surface of
+// |outputs|. This is a reference for the standalone post-processor, to compare
+// its output against or to run clients on machines without the VPU, and is
+// much slower. Returns false when an output could not be written.
+bool RunCpuPostProcessing(const SourcePicture &source, const DecodedStreamInfo &stream,
+    const PostProcessingParams &params, const PictureOutputs &outputs);
+
+} // namespace libvavc8000d
+
+#endif // CPU_POST_PROCESSOR_H_
@@ -0,0 +1,299 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DECODE_ENGINE_H_
+#define DECODE_ENGINE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "base/logging.h"
+#include "dwl.h"
+#include "output_picture.h"
+
+namespace libvavc8000d
+{
+
+// Codec-agnostic classification of the return value of a *DecDecode() call.
+enum class DecodeEvent {
+    // Nothing to do, just call the decoder again.
+    kContinue,
+    // New stream headers have been parsed.
+    kHeadersReady,
+    // A picture has been decoded, pending output pictures must be drained.
+    kPictureDecoded,
+    // All the input data has been consumed.
+    kStreamProcessed,
+    // The decoder needs (more) DPB buffers.
+    kWaitingForBuffer,
+    kError,
+};
+
+// Counters kept by a DecodeEngine over its lifetime.
+struct DecodeStats
+{
+    uint64_t frames_submitted = 0;
+    uint64_t stream_bytes = 0;
+    uint64_t decode_calls = 0;
+    uint64_t pictures_output = 0;
+    uint64_t dpb_buffers_allocated = 0;
+    uint64_t dpb_bytes_allocated = 0;
+    uint64_t stream_buffer_allocations = 0;
+    uint64_t errors = 0;
+    // Memory written for the output pictures, and the chroma writes that
+    // monochrome (luma only) outputs saved.
+    uint64_t output_bytes = 0;
+    uint64_t chroma_bytes_saved = 0;
+    // Tiled reference frames passed straight to tiled surfaces. Linear
+    // surfaces would need the post-processor to read and write them once more.
+    uint64_t tiled_output_bytes = 0;
+    uint64_t post_processing_bytes_saved = 0;
+    // Uncompressed size of the reference frame traffic, counting one write to
+    // the DPB and one read by motion compensation per picture, and an estimate
+    // of what reference compression saved of it.
+    uint64_t reference_bytes = 0;
+    uint64_t reference_bytes_saved = 0;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const DecodeStats &stats)
+{
+    return os << "frames=" << stats.frames_submitted << " stream_bytes=" << stats.stream_bytes
+              << " decode_calls=" << stats.decode_calls
+              << " pictures_output=" << stats.pictures_output
+              << " dpb_buffers=" << stats.dpb_buffers_allocated
+              << " dpb_bytes=" << stats.dpb_bytes_allocated
+              << " stream_buffer_allocations=" << stats.stream_buffer_allocations
+              << " errors=" << stats.errors << " output_bytes=" << stats.output_bytes
+              << " chroma_bytes_saved=" << stats.chroma_bytes_saved << " chroma_bytes_saved/frame="
+              << (stats.pictures_output ? stats.chroma_bytes_saved / stats.pictures_output : 0)
+              << " tiled_output_bytes=" << stats.tiled_output_bytes
+              << " post_processing_bytes_saved/frame="
+              << (stats.pictures_output
+                         ? stats.post_processing_bytes_saved / stats.pictures_output
+                         : 0)
+              << " reference_bytes=" << stats.reference_bytes << " reference_bytes_saved/frame="
+              << (stats.pictures_output ? stats.reference_bytes_saved / stats.pictures_output
+                                        : 0);
+}
+
+// DecodeEngine implements the part of hardware decoding that is the same for
+// every VeriSilicon codec API: the *DecDecode() state machine, the input stream
+// buffer, the DPB buffer pool, output draining and statistics. The per-codec
+// calls are bound at compile time through |Traits|, which must provide:
+//
+//   using Inst, Input, Output, Picture, BufferInfo, Ret;
+//   static DecodeEvent Classify(Ret ret);
+//   static Ret Decode(Inst inst, Input *input, Output *output);
+//   static bool NextPicture(Inst inst, Picture *picture);
+//   static void PictureConsumed(Inst inst, Picture *picture);
+//   static void GetBufferInfo(Inst inst, BufferInfo *buffer_info);
+//   static void AddBuffer(Inst inst, DWLLinearMem *mem);
+//   static void Abort(Inst inst);
+//   static void SetInput(Input &input, const DWLLinearMem &stream_mem,
+//                        uint32_t size, uint32_t pic_id);
+//   static void AdvanceInput(Input &input, const Output &output);
+//   static uint32_t DataLeft(const Input &input);
+//   static uint32_t GetPicId(const Picture &picture);
+//   // Returns a picture with zero width if output |index| is not in use.
+//   static OutputPicture GetOutput(const Picture &picture, int index);
+//
+// The decoder instance itself is owned by the caller since its initialization
+// differs between codecs. The DWL instance must outlive the DecodeEngine, and
+// the decoder instance must be released before the DecodeEngine is destroyed.
+template <typename Traits> class DecodeEngine
+{
+public:
+    using Inst = typename Traits::Inst;
+    using Picture = typename Traits::Picture;
+
+    explicit DecodeEngine(const void *dwl)
+        : dwl_(dwl)
+    {
+        memset(&stream_mem_, 0, sizeof(stream_mem_));
+    }
+    DecodeEngine(const DecodeEngine &) = delete;
+    DecodeEngine &operator=(const DecodeEngine &) = delete;
+    ~DecodeEngine()
+    {
+        if (stream_mem_.virtual_address) { DWLFreeLinear(dwl_, &stream_mem_); }
+        for (auto &mem : dpb_buffers_) { DWLFreeLinear(dwl_, &mem); }
+    }
+
+    // Decodes the |size| bytes at |data|, tagging the resulting picture with
+    // |pic_id|. |on_headers| is called without arguments when new stream headers
+    // are ready, and |on_picture| with each Picture the decoder outputs.
+    // Returns false if the decoder reported an error.
+    template <typename OnHeaders, typename OnPicture>
+    bool Decode(Inst inst, const uint8_t *data, size_t size, uint32_t pic_id,
+        OnHeaders &&on_headers, OnPicture &&on_picture)
+    {
+        EnsureStreamCapacity(size);
+        memcpy(stream_mem_.virtual_address, data, size);
+
+        typename Traits::Input input;
+        memset(&input, 0, sizeof(input));
+        Traits::SetInput(input, stream_mem_, static_cast<uint32_t>(size), pic_id);
+        typename Traits::Output output;
+        memset(&output, 0, sizeof(output));
+
+        stats_.frames_submitted++;
+        stats_.stream_bytes += size;
+
+        bool ok = false, fail = false;
+        do {
+            auto ret = Traits::Decode(inst, &input, &output);
+            stats_.decode_calls++;
+            switch (Traits::Classify(ret)) {
+            case DecodeEvent::kContinue: break;
+            case DecodeEvent::kHeadersReady: on_headers(); break;
+            case DecodeEvent::kPictureDecoded: Drain(inst, on_picture); break;
+            case DecodeEvent::kStreamProcessed: ok = true; break;
+            case DecodeEvent::kWaitingForBuffer: AddDpbBuffers(inst); break;
+            case DecodeEvent::kError:
+                std::cerr << "HW Decoder Error: " << ret << std::endl;
+                fail = true;
+                break;
+            }
+            Traits::AdvanceInput(input, output);
+        } while (!ok && !fail && Traits::DataLeft(input) > 0);
+
+        if (fail) {
+            stats_.errors++;
+            Traits::Abort(inst);
+        }
+        return !fail;
+    }
+
+    const DecodeStats &stats() const { return stats_; }
+
+    // Sets the uncompressed size of the reference frames of the stream, once its
+    // headers are parsed, and whether the decoder compresses them.
+    void SetReferenceFrames(uint64_t frame_bytes, bool compressed)
+    {
+        reference_frame_bytes_ = frame_bytes;
+        compressed_references_ = compressed;
+    }
+
+private:
+    // The stream buffer is kept across frames and only reallocated when a frame
+    // does not fit, instead of doing a DWL allocation per frame.
+    void EnsureStreamCapacity(size_t size)
+    {
+        if (stream_mem_.virtual_address && stream_mem_.logical_size >= size) { return; }
+        if (stream_mem_.virtual_address) { DWLFreeLinear(dwl_, &stream_mem_); }
+
+        // Leave room to grow, frame sizes vary a lot within a stream.
+        constexpr size_t kMinStreamBufferSize = 256 * 1024;
+        memset(&stream_mem_, 0, sizeof(stream_mem_));
+        stream_mem_.mem_type = DWL_MEM_TYPE_SLICE;
+        const size_t alloc_size = std::max(size * 2, kMinStreamBufferSize);
+        CHECK_EQ(DWLMallocLinear(dwl_, static_cast<u32>(alloc_size), &stream_mem_), 0);
+        stats_.stream_buffer_allocations++;
+    }
+
+    template <typename OnPicture> void Drain(Inst inst, OnPicture &&on_picture)
+    {
+        Picture picture;
+        while (Traits::NextPicture(inst, &picture)) {
+            stats_.pictures_output++;
+            AccountReferences();
+            AccountOutputs(picture);
+            on_picture(static_cast<const Picture &>(picture));
+            Traits::PictureConsumed(inst, &picture);
+        }
+    }
+
+    void AccountReferences()
+    {
+        // The actual ratio depends on the content and isn't reported by the
+        // decoder, compressed reference frames typically take half the traffic.
+        constexpr uint64_t kCompressedPercent = 50;
+        const uint64_t bytes = 2 * reference_frame_bytes_;
+        stats_.reference_bytes += bytes;
+        if (compressed_references_) {
+            stats_.reference_bytes_saved += bytes - bytes * kCompressedPercent / 100;
+        }
+    }
+
+    void AccountOutputs(const Picture &picture)
+    {
+        for (int i = 0; i < DEC_MAX_OUT_COUNT; i++) {
+            const OutputPicture output = Traits::GetOutput(picture, i);
+            if (output.width == 0 || output.height == 0) { continue; }
+            const uint64_t plane_bytes = uint64_t { output.luma_stride } * output.height;
+            if (IS_PIC_PLANAR_RGB(output.format)) {
+                stats_.output_bytes += 3 * plane_bytes;
+            } else if (IS_PIC_PACKED_RGB(output.format)) {
+                stats_.output_bytes += plane_bytes;
+            } else if (IS_PIC_MONOCHROME(output.format)) {
+                // 4:2:0 chroma takes half the memory of luma.
+                stats_.output_bytes += plane_bytes;
+                stats_.chroma_bytes_saved += plane_bytes / 2;
+            } else if (IS_PIC_TILE(output.format)) {
+                // The strides are given per row of 4x4 tiles.
+                const uint64_t bytes = (uint64_t { output.luma_stride } * output.height
+                                           + uint64_t { output.chroma_stride } * output.height / 2)
+                    / 4;
+                stats_.output_bytes += bytes;
+                stats_.tiled_output_bytes += bytes;
+                // Written by the decoder itself, rather than the post-processor.
+                if (output.format == DEC_OUT_FRM_TILED_4X4) {
+                    stats_.post_processing_bytes_saved += 2 * bytes;
+                }
+            } else {
+                stats_.output_bytes
+                    += plane_bytes + uint64_t { output.chroma_stride } * ((output.height + 1) / 2);
+            }
+        }
+    }
+
+    void AddDpbBuffers(Inst inst)
+    {
+        // The decoder hands back the buffers that are too small after a
+        // resolution change one per call, and reports the buffers it needs once
+        // there is none left to free.
+        typename Traits::BufferInfo buffer_info;
+        do {
+            memset(&buffer_info, 0, sizeof(buffer_info));
+            Traits::GetBufferInfo(inst, &buffer_info);
+            auto it = std::find_if(dpb_buffers_.begin(), dpb_buffers_.end(),
+                [&buffer_info](const DWLLinearMem &mem) {
+                    return buffer_info.buf_to_free.virtual_address
+                        && mem.virtual_address == buffer_info.buf_to_free.virtual_address;
+                });
+            if (it != dpb_buffers_.end()) {
+                DWLFreeLinear(dwl_, &*it);
+                dpb_buffers_.erase(it);
+            }
+        } while (buffer_info.buf_to_free.virtual_address);
+
+        // The size covers the compression tables and the motion vectors stored
+        // along with each reference frame, so it grows when the references are
+        // compressed.
+        for (u32 i = 0; i < buffer_info.buf_num; i++) {
+            DWLLinearMem mem;
+            memset(&mem, 0, sizeof(mem));
+            mem.mem_type = DWL_MEM_TYPE_DPB;
+            CHECK_EQ(DWLMallocLinear(dwl_, buffer_info.next_buf_size, &mem), 0);
+            Traits::AddBuffer(inst, &mem);
+            dpb_buffers_.push_back(mem);
+            stats_.dpb_buffers_allocated++;
+            stats_.dpb_bytes_allocated += buffer_info.next_buf_size;
+        }
+    }
+
+    const void *const dwl_;
+    DWLLinearMem stream_mem_;
+    std::vector<DWLLinearMem> dpb_buffers_;
+    uint64_t reference_frame_bytes_ = 0;
+    bool compressed_references_ = false;
+    DecodeStats stats_;
+};
+
+} // namespace libvavc8000d
+
+#endif // DECODE_ENGINE_H_
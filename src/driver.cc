@@ -26,11 +26,16 @@ const VSConfig &VSDriver::GetConfig(VSConfig::IdType id) { return config_.GetObj
 
 void VSDriver::DestroyConfig(VSConfig::IdType id) { config_.DestroyObject(id); }
 
-VSSurface::IdType VSDriver::CreateSurface(unsigned int format, unsigned int width,
-    unsigned int height, std::vector<VASurfaceAttrib> attrib_list)
+VAStatus VSDriver::CreateSurface(unsigned int format, unsigned int width, unsigned int height,
+    std::vector<VASurfaceAttrib> attrib_list, unsigned int index, VSSurface::IdType &id)
 {
-    return surface_.CreateObject(
-        format, width, height, std::move(attrib_list), scoped_bo_mapping_factory_);
+    VAStatus status = VA_STATUS_SUCCESS;
+    const std::optional<VSSurface::IdType> created = surface_.TryCreateObject(format, width,
+        height, std::move(attrib_list), index, scoped_bo_mapping_factory_, surface_memory_pool_,
+        status);
+    if (!created) { return status; }
+    id = *created;
+    return VA_STATUS_SUCCESS;
 }
 
 bool VSDriver::SurfaceExists(VSSurface::IdType id) { return surface_.ObjectExists(id); }
@@ -40,10 +45,11 @@ const VSSurface &VSDriver::GetSurface(VSSurface::IdType id) { return surface_.Ge
 void VSDriver::DestroySurface(VSSurface::IdType id) { surface_.DestroyObject(id); }
 
 VSContext::IdType VSDriver::CreateContext(VAConfigID config_id, int picture_width,
-    int picture_height, int flag, std::vector<VASurfaceID> render_targets)
+    int picture_height, int flag, std::vector<VASurfaceID> render_targets,
+    SurfaceLayout output_layout)
 {
-    return context_.CreateObject(
-        GetConfig(config_id), picture_width, picture_height, flag, std::move(render_targets));
+    return context_.CreateObject(GetConfig(config_id), picture_width, picture_height, flag,
+        std::move(render_targets), output_layout);
 }
 
 bool VSDriver::ContextExists(VSContext::IdType id) { return context_.ObjectExists(id); }
@@ -58,6 +64,12 @@ VSBuffer::IdType VSDriver::CreateBuffer(VAContextID context, VABufferType type,
     return buffers_.CreateObject(context, type, size_per_element, num_elements, data);
 }
 
+VSBuffer::IdType VSDriver::CreateBuffer(
+    VABufferType type, size_t size, uint8_t *data, const ScopedBOMapping &mapping)
+{
+    return buffers_.CreateObject(/*context=*/VA_INVALID_ID, type, size, data, mapping);
+}
+
 bool VSDriver::BufferExists(VSBuffer::IdType id) { return buffers_.ObjectExists(id); }
 
 const VSBuffer &VSDriver::GetBuffer(VSBuffer::IdType id) { return buffers_.GetObject(id); }
@@ -69,6 +81,14 @@ void VSDriver::CreateImage(const VAImageFormat &format, int width, int height, V
     images_.CreateObject(format, width, height, /*fake_driver=*/*this, va_image);
 }
 
+bool VSDriver::DeriveImage(VSSurface::IdType surface_id, VAImage *va_image)
+{
+    const VSSurface &surface = GetSurface(surface_id);
+    if (!VSImage::CanDerive(surface)) { return false; }
+    images_.CreateObject(surface, /*fake_driver=*/*this, va_image);
+    return true;
+}
+
 bool VSDriver::ImageExists(VSImage::IdType id) { return images_.ObjectExists(id); }
 
 const VSImage &VSDriver::GetImage(VSImage::IdType id) { return images_.GetObject(id); }
@@ -18,6 +18,7 @@
 #include "object_tracker.h"
 #include "scoped_bo_mapping_factory.h"
 #include "surface.h"
+#include "surface_memory_pool.h"
 
 namespace libvavc8000d
 {
@@ -41,14 +42,17 @@ public:
     const VSConfig &GetConfig(VSConfig::IdType id);
     void DestroyConfig(VSConfig::IdType id);
 
-    VSSurface::IdType CreateSurface(unsigned int format, unsigned int width, unsigned int height,
-        std::vector<VASurfaceAttrib> attrib_list);
+    // Creates a surface and sets |id| to its ID, or returns why it can't be
+    // created. |index| is the position of the surface in its
+    // vaCreateSurfaces() call.
+    VAStatus CreateSurface(unsigned int format, unsigned int width, unsigned int height,
+        std::vector<VASurfaceAttrib> attrib_list, unsigned int index, VSSurface::IdType &id);
     bool SurfaceExists(VSSurface::IdType id);
     const VSSurface &GetSurface(VSSurface::IdType id);
     void DestroySurface(VSSurface::IdType id);
 
     VSContext::IdType CreateContext(VAConfigID config_id, int picture_width, int picture_height,
-        int flag, std::vector<VASurfaceID> render_targets);
+        int flag, std::vector<VASurfaceID> render_targets, SurfaceLayout output_layout);
     bool ContextExists(VSContext::IdType id);
     const VSContext &GetContext(VSContext::IdType id);
     void DestroyContext(VSContext::IdType id);
@@ -56,10 +60,17 @@ public:
     VSBuffer::IdType CreateBuffer(VAContextID context, VABufferType type,
         unsigned int size_per_element, unsigned int num_elements, const void *data);
     bool BufferExists(VSBuffer::IdType id);
+    // Creates a buffer wrapping |size| bytes of the CPU mapping of |mapping| at
+    // |data|.
+    VSBuffer::IdType CreateBuffer(
+        VABufferType type, size_t size, uint8_t *data, const ScopedBOMapping &mapping);
     const VSBuffer &GetBuffer(VSBuffer::IdType id);
     void DestroyBuffer(VSBuffer::IdType id);
 
     void CreateImage(const VAImageFormat &format, int width, int height, VAImage *va_image);
+    // Creates an image giving access to the memory of surface |surface_id| in
+    // place, and returns false if its memory can't be accessed that way.
+    bool DeriveImage(VSSurface::IdType surface_id, VAImage *va_image);
     bool ImageExists(VSImage::IdType id);
     const VSImage &GetImage(VSImage::IdType id);
     void DestroyImage(VSImage::IdType id);
@@ -70,6 +81,9 @@ private:
     // |scoped_bo_mapping_factory_| when creating a VSSurface. Therefore,
     // |scoped_bo_mapping_factory_| should outlive all VSSurface instances.
     ScopedBOMappingFactory scoped_bo_mapping_factory_;
+    // Allocates the buffers of the VSSurfaces that have no external one, so it
+    // must outlive them too.
+    SurfaceMemoryPool surface_memory_pool_;
     ObjectTracker<VSConfig> config_;
     ObjectTracker<VSSurface> surface_;
     ObjectTracker<VSContext> context_;
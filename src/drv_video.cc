@@ -11,12 +11,15 @@
 #include <va/va.h>
 #include <va/va_backend.h>
 #include <va/va_drmcommon.h>
+#include <va/va_vpp.h>
 
 #include <fstream>
 #include <set>
 
 #include "base/logging.h"
 #include "driver.h"
+#include "image_transfer.h"
+#include "post_processor.h"
 
 VAStatus vsTerminate(VADriverContextP ctx)
 {
@@ -28,7 +31,33 @@ VAStatus vsTerminate(VADriverContextP ctx)
 #define MAX_CAPABILITY_ATTRIBUTES 5
 
 const VAImageFormat kSupportedImageFormats[]
-    = { { .fourcc = VA_FOURCC_NV12, .byte_order = VA_LSB_FIRST, .bits_per_pixel = 12 } };
+    = { { .fourcc = VA_FOURCC_NV12, .byte_order = VA_LSB_FIRST, .bits_per_pixel = 12 },
+          { .fourcc = VA_FOURCC_I420, .byte_order = VA_LSB_FIRST, .bits_per_pixel = 12 },
+          { .fourcc = VA_FOURCC_YV12, .byte_order = VA_LSB_FIRST, .bits_per_pixel = 12 },
+          { .fourcc = VA_FOURCC_P010, .byte_order = VA_LSB_FIRST, .bits_per_pixel = 24 },
+          { .fourcc = VA_FOURCC_NV21, .byte_order = VA_LSB_FIRST, .bits_per_pixel = 12 },
+          { .fourcc = VA_FOURCC_YUY2, .byte_order = VA_LSB_FIRST, .bits_per_pixel = 16 },
+          { .fourcc = VA_FOURCC_UYVY, .byte_order = VA_LSB_FIRST, .bits_per_pixel = 16 },
+          // Byte order R, G, B, X in memory.
+          { .fourcc = VA_FOURCC_RGBX,
+              .byte_order = VA_LSB_FIRST,
+              .bits_per_pixel = 32,
+              .depth = 24,
+              .red_mask = 0x000000ff,
+              .green_mask = 0x0000ff00,
+              .blue_mask = 0x00ff0000 },
+          { .fourcc = VA_FOURCC_BGRX,
+              .byte_order = VA_LSB_FIRST,
+              .bits_per_pixel = 32,
+              .depth = 24,
+              .red_mask = 0x00ff0000,
+              .green_mask = 0x0000ff00,
+              .blue_mask = 0x000000ff } };
+
+// Formats decoded pictures can be written in. RGB and luma-only pictures are
+// produced by the post-processor.
+constexpr unsigned int kDecodeRTFormats
+    = VA_RT_FORMAT_YUV420 | VA_RT_FORMAT_YUV400 | VA_RT_FORMAT_RGB32 | VA_RT_FORMAT_RGBP;
 
 struct Capability
 {
@@ -58,19 +87,70 @@ const struct Capability kCapabilities[] = { { VAProfileAV1Profile0, VAEntrypoint
         {
             { VAConfigAttribRTFormat, VA_RT_FORMAT_YUV420 },
         } },
-    { VAProfileH264ConstrainedBaseline, VAEntrypointVLD, 1,
+    { VAProfileH264ConstrainedBaseline, VAEntrypointVLD, 2,
         {
-            { VAConfigAttribRTFormat, VA_RT_FORMAT_YUV420 },
+            { VAConfigAttribRTFormat, kDecodeRTFormats },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
         } },
 
-    { VAProfileH264Main, VAEntrypointVLD, 1,
+    { VAProfileH264Main, VAEntrypointVLD, 2,
         {
-            { VAConfigAttribRTFormat, VA_RT_FORMAT_YUV420 },
+            { VAConfigAttribRTFormat, kDecodeRTFormats },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
         } },
 
-    { VAProfileH264High, VAEntrypointVLD, 1,
+    { VAProfileH264High, VAEntrypointVLD, 2,
         {
-            { VAConfigAttribRTFormat, VA_RT_FORMAT_YUV420 },
+            { VAConfigAttribRTFormat, kDecodeRTFormats },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
+        } },
+
+    // 10-bit streams can be decoded to P010 or truncated to 8 bits by the
+    // post-processor.
+    { VAProfileH264High10, VAEntrypointVLD, 2,
+        {
+            { VAConfigAttribRTFormat, kDecodeRTFormats | VA_RT_FORMAT_YUV420_10 },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
+        } },
+
+    { VAProfileVC1Simple, VAEntrypointVLD, 2,
+        {
+            { VAConfigAttribRTFormat, kDecodeRTFormats },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
+        } },
+
+    { VAProfileVC1Main, VAEntrypointVLD, 2,
+        {
+            { VAConfigAttribRTFormat, kDecodeRTFormats },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
+        } },
+
+    { VAProfileVC1Advanced, VAEntrypointVLD, 2,
+        {
+            { VAConfigAttribRTFormat, kDecodeRTFormats },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
+        } },
+
+    { VAProfileMPEG4Simple, VAEntrypointVLD, 2,
+        {
+            { VAConfigAttribRTFormat, kDecodeRTFormats },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
+        } },
+
+    { VAProfileMPEG4AdvancedSimple, VAEntrypointVLD, 2,
+        {
+            { VAConfigAttribRTFormat, kDecodeRTFormats },
+            { VAConfigAttribDecProcessing, VA_DEC_PROCESSING },
+        } },
+
+    // Scaling, cropping and conversion by the post-processor, either while the
+    // decoder writes a picture out, requested with a
+    // VAProcPipelineParameterBuffer rendered to the decode context
+    // (VAConfigAttribDecProcessing above), or from surface to surface in a
+    // context of this config.
+    { VAProfileNone, VAEntrypointVideoProc, 1,
+        {
+            { VAConfigAttribRTFormat, kDecodeRTFormats | VA_RT_FORMAT_YUV420_10 },
         } } };
 
 const size_t kCapabilitiesSize = sizeof(kCapabilities) / sizeof(struct Capability);
@@ -279,13 +359,26 @@ VAStatus vsCreateContext(VADriverContextP ctx, VAConfigID config_id, int picture
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->ConfigExists(config_id));
-
-    for (int i = 0; i < num_render_targets; i++) { CHECK(fdrv->SurfaceExists(render_targets[i])); }
+    if (!fdrv->ConfigExists(config_id)) { return VA_STATUS_ERROR_INVALID_CONFIG; }
+
+    // Decoders keep their reference frames in the tiled layout when all the
+    // render targets take it, so the pictures are written out without a
+    // post-processing pass.
+    libvavc8000d::SurfaceLayout output_layout = num_render_targets > 0
+        ? libvavc8000d::SurfaceLayout::kTiled4x4
+        : libvavc8000d::SurfaceLayout::kLinear;
+    for (int i = 0; i < num_render_targets; i++) {
+        if (!fdrv->SurfaceExists(render_targets[i])) { return VA_STATUS_ERROR_INVALID_SURFACE; }
+        if (libvavc8000d::GetSurfaceLayout(fdrv->GetSurface(render_targets[i]))
+            != libvavc8000d::SurfaceLayout::kTiled4x4) {
+            output_layout = libvavc8000d::SurfaceLayout::kLinear;
+        }
+    }
 
     *context = fdrv->CreateContext(config_id, picture_width, picture_height, flag,
         std::vector<VASurfaceID>(
-            render_targets, render_targets + static_cast<size_t>(num_render_targets)));
+            render_targets, render_targets + static_cast<size_t>(num_render_targets)),
+        output_layout);
 
     return VA_STATUS_SUCCESS;
 }
@@ -304,7 +397,7 @@ VAStatus vsCreateBuffer(VADriverContextP ctx, VAContextID context, VABufferType
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->ContextExists(context));
+    if (!fdrv->ContextExists(context)) { return VA_STATUS_ERROR_INVALID_CONTEXT; }
 
     *buf_id = fdrv->CreateBuffer(context, type, /*size_per_element=*/size, num_elements, data);
 
@@ -319,11 +412,16 @@ VAStatus vsBufferSetNumElements(VADriverContextP ctx, VABufferID buf_id, unsigne
 VAStatus vsMapBuffer(VADriverContextP ctx, VABufferID buf_id, void **pbuf)
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
-    *pbuf = fdrv->GetBuffer(buf_id).GetData();
+    *pbuf = fdrv->GetBuffer(buf_id).Map();
     return VA_STATUS_SUCCESS;
 }
 
-VAStatus vsUnmapBuffer(VADriverContextP ctx, VABufferID buf_id) { return VA_STATUS_SUCCESS; }
+VAStatus vsUnmapBuffer(VADriverContextP ctx, VABufferID buf_id)
+{
+    libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
+    fdrv->GetBuffer(buf_id).Unmap();
+    return VA_STATUS_SUCCESS;
+}
 
 VAStatus vsDestroyBuffer(VADriverContextP ctx, VABufferID buffer_id)
 {
@@ -338,8 +436,8 @@ VAStatus vsBeginPicture(VADriverContextP ctx, VAContextID context, VASurfaceID r
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->SurfaceExists(render_target));
-    CHECK(fdrv->ContextExists(context));
+    if (!fdrv->SurfaceExists(render_target)) { return VA_STATUS_ERROR_INVALID_SURFACE; }
+    if (!fdrv->ContextExists(context)) { return VA_STATUS_ERROR_INVALID_CONTEXT; }
 
     fdrv->GetContext(context).BeginPicture(fdrv->GetSurface(render_target));
 
@@ -351,15 +449,38 @@ VAStatus vsRenderPicture(
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->ContextExists(context));
+    if (!fdrv->ContextExists(context)) { return VA_STATUS_ERROR_INVALID_CONTEXT; }
+    const libvavc8000d::VSContext &fcontext = fdrv->GetContext(context);
+    const bool video_proc = fcontext.GetConfig().GetEntrypoint() == VAEntrypointVideoProc;
 
     std::vector<const libvavc8000d::VSBuffer *> buffer_list;
+    std::vector<const libvavc8000d::VSSurface *> additional_outputs;
+    const libvavc8000d::VSSurface *input_surface = nullptr;
     for (int i = 0; i < num_buffers; i++) {
-        CHECK(fdrv->BufferExists(buffers[i]));
-        buffer_list.push_back(&(fdrv->GetBuffer(buffers[i])));
+        if (!fdrv->BufferExists(buffers[i])) { return VA_STATUS_ERROR_INVALID_BUFFER; }
+        const libvavc8000d::VSBuffer &buffer = fdrv->GetBuffer(buffers[i]);
+        buffer_list.push_back(&buffer);
+
+        // Contexts can't look up surfaces, so the surfaces of the pipeline are
+        // resolved here. Decodes read the bitstream, not |pipeline->surface|.
+        if (buffer.GetType() != VAProcPipelineParameterBufferType) continue;
+        const VAProcPipelineParameterBuffer *pipeline
+            = reinterpret_cast<const VAProcPipelineParameterBuffer *>(buffer.GetData());
+        if (video_proc) {
+            if (!fdrv->SurfaceExists(pipeline->surface)) { return VA_STATUS_ERROR_INVALID_SURFACE; }
+            input_surface = &fdrv->GetSurface(pipeline->surface);
+        }
+        for (uint32_t j = 0; j < pipeline->num_additional_outputs; j++) {
+            if (!fdrv->SurfaceExists(pipeline->additional_outputs[j])) {
+                return VA_STATUS_ERROR_INVALID_SURFACE;
+            }
+            additional_outputs.push_back(&fdrv->GetSurface(pipeline->additional_outputs[j]));
+        }
     }
 
-    fdrv->GetContext(context).RenderPicture(buffer_list);
+    if (!additional_outputs.empty()) { fcontext.SetAdditionalOutputs(additional_outputs); }
+    if (input_surface) { fcontext.SetInputSurface(*input_surface); }
+    fcontext.RenderPicture(buffer_list);
 
     return VA_STATUS_SUCCESS;
 }
@@ -368,18 +489,16 @@ VAStatus vsEndPicture(VADriverContextP ctx, VAContextID context)
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->ContextExists(context));
+    if (!fdrv->ContextExists(context)) { return VA_STATUS_ERROR_INVALID_CONTEXT; }
 
-    fdrv->GetContext(context).EndPicture();
-
-    return VA_STATUS_SUCCESS;
+    return fdrv->GetContext(context).EndPicture();
 }
 
 VAStatus vsSyncSurface(VADriverContextP ctx, VASurfaceID render_target)
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->SurfaceExists(render_target));
+    if (!fdrv->SurfaceExists(render_target)) { return VA_STATUS_ERROR_INVALID_SURFACE; }
 
     return VA_STATUS_SUCCESS;
 }
@@ -398,7 +517,7 @@ VAStatus vsPutSurface(VADriverContextP ctx, VASurfaceID surface, void *draw, sho
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->SurfaceExists(surface));
+    if (!fdrv->SurfaceExists(surface)) { return VA_STATUS_ERROR_INVALID_SURFACE; }
 
     return VA_STATUS_SUCCESS;
 }
@@ -421,6 +540,9 @@ VAStatus vsCreateImage(
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
+    if (!libvavc8000d::VSImage::IsSupportedFormat(*format)) {
+        return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+    }
     fdrv->CreateImage(*format, width, height, image);
     return VA_STATUS_SUCCESS;
 }
@@ -443,62 +565,17 @@ VAStatus vsGetImage(VADriverContextP ctx, VASurfaceID surface, int x, int y, uns
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->SurfaceExists(surface));
+    if (!fdrv->SurfaceExists(surface)) { return VA_STATUS_ERROR_INVALID_SURFACE; }
 
     const libvavc8000d::VSSurface &fake_surface = fdrv->GetSurface(surface);
 
-    CHECK(fdrv->ImageExists(image));
-
-    // TODO(b/316609501): Look into replacing this and making this function
-    // operate the same for both testing and non-testing environments.
-    if (!fake_surface.GetMappedBO().IsValid()) { return VA_STATUS_SUCCESS; }
-
-    // Chrome should only request images starting at (0, 0).
-    CHECK_EQ(x, 0);
-    CHECK_EQ(y, 0);
-    CHECK_LE(width, fake_surface.GetWidth());
-    CHECK_LE(height, fake_surface.GetHeight());
-
-    // Chrome should only ask the fake driver for images sourced from NV12
-    // surfaces.
-    CHECK_EQ(fake_surface.GetVAFourCC(), static_cast<uint32_t>(VA_FOURCC_NV12));
-
-    const libvavc8000d::ScopedBOMapping::ScopedAccess mapped_bo
-        = fake_surface.GetMappedBO().BeginAccess();
+    if (!fdrv->ImageExists(image)) { return VA_STATUS_ERROR_INVALID_IMAGE; }
 
     const libvavc8000d::VSImage &fake_image = fdrv->GetImage(image);
 
-    // Chrome should only ask the fake driver to download NV12 surfaces onto NV12
+    // Tiled surfaces are detiled on the way, so clients always get linear
     // images.
-    CHECK_EQ(fake_image.GetFormat().fourcc, static_cast<uint32_t>(VA_FOURCC_NV12));
-
-    // The image dimensions must be large enough to contain the surface.
-    CHECK_GE(static_cast<unsigned int>(fake_image.GetWidth()), width);
-    CHECK_GE(static_cast<unsigned int>(fake_image.GetHeight()), height);
-
-    uint8_t *const dst_y_addr
-        = static_cast<uint8_t *>(fake_image.GetBuffer().GetData()) + fake_image.GetPlaneOffset(0);
-    const int dst_y_stride = static_cast<int>(fake_image.GetPlaneStride(0));
-
-    uint8_t *const dst_uv_addr
-        = static_cast<uint8_t *>(fake_image.GetBuffer().GetData()) + fake_image.GetPlaneOffset(1);
-    const int dst_uv_stride = static_cast<int>(fake_image.GetPlaneStride(1));
-
-    // const int copy_result = libyuv::NV12Copy(
-    //     /*src_y=*/mapped_bo.GetData(0),
-    //     /*src_stride_y=*/static_cast<int>(mapped_bo.GetStride(0)),
-    //     /*src_uv=*/mapped_bo.GetData(1),
-    //     /*src_stride_uv=*/static_cast<int>(mapped_bo.GetStride(1)),
-    //     /*dst_y=*/dst_y_addr,
-    //     /*dst_stride_y=*/dst_y_stride,
-    //     /*dst_uv=*/dst_uv_addr,
-    //     /*dst_stride_uv=*/dst_uv_stride,
-    //     /*width=*/width,
-    //     /*height=*/height);
-
-    // CHECK_EQ(copy_result, 0);
-
-    return VA_STATUS_SUCCESS;
+    return libvavc8000d::GetSurfaceImage(fake_surface, x, y, width, height, fake_image);
 }
 
 VAStatus vsPutImage(VADriverContextP ctx, VASurfaceID surface, VAImageID image, int src_x,
@@ -507,17 +584,23 @@ VAStatus vsPutImage(VADriverContextP ctx, VASurfaceID surface, VAImageID image,
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->SurfaceExists(surface));
+    if (!fdrv->SurfaceExists(surface)) { return VA_STATUS_ERROR_INVALID_SURFACE; }
+    if (!fdrv->ImageExists(image)) { return VA_STATUS_ERROR_INVALID_IMAGE; }
 
-    return VA_STATUS_SUCCESS;
+    return libvavc8000d::PutSurfaceImage(fdrv->GetSurface(surface), fdrv->GetImage(image), src_x,
+        src_y, src_width, src_height, dest_x, dest_y, dest_width, dest_height);
 }
 
 VAStatus vsDeriveImage(VADriverContextP ctx, VASurfaceID surface, VAImage *image)
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->SurfaceExists(surface));
+    if (!fdrv->SurfaceExists(surface)) { return VA_STATUS_ERROR_INVALID_SURFACE; }
 
+    // Tiled surfaces and surfaces without a CPU mapping can't be accessed in
+    // place. Clients then fall back to vaCreateImage() and vaGetImage(), which
+    // detiles.
+    if (!fdrv->DeriveImage(surface, image)) { return VA_STATUS_ERROR_OPERATION_FAILED; }
     return VA_STATUS_SUCCESS;
 }
 
@@ -596,7 +679,7 @@ VAStatus vsQuerySurfaceAttributes(
 {
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
-    CHECK(fdrv->ConfigExists(config));
+    if (!fdrv->ConfigExists(config)) { return VA_STATUS_ERROR_INVALID_CONFIG; }
 
     // This function is called once with |attribs| NULL to dimension output. The
     // second time, |num_attribs| must be larger than kMaxNumSurfaceAttributes.
@@ -644,6 +727,60 @@ VAStatus vsQuerySurfaceAttributes(
     attribs[i].value.value.i = VA_FOURCC_YV12;
     i++;
 
+    // Formats that depend on the render target formats of the config.
+    const struct
+    {
+        unsigned int rt_format;
+        uint32_t fourcc;
+    } kRTFormatFourCCs[] = {
+        { VA_RT_FORMAT_YUV420, VA_FOURCC_I420 },
+        { VA_RT_FORMAT_YUV420_10, VA_FOURCC_P010 },
+        { VA_RT_FORMAT_YUV400, VA_FOURCC_Y800 },
+        { VA_RT_FORMAT_RGB32, VA_FOURCC_RGBX },
+        { VA_RT_FORMAT_RGB32, VA_FOURCC_BGRX },
+        { VA_RT_FORMAT_RGBP, VA_FOURCC_RGBP },
+    };
+    const libvavc8000d::VSConfig &fconfig = fdrv->GetConfig(config);
+    for (const auto &config_attrib : fconfig.GetConfigAttribs()) {
+        if (config_attrib.type != VAConfigAttribRTFormat) { continue; }
+        for (const auto &rt_format_fourcc : kRTFormatFourCCs) {
+            if (!(config_attrib.value & rt_format_fourcc.rt_format)) { continue; }
+            attribs[i].type = VASurfaceAttribPixelFormat;
+            attribs[i].value.type = VAGenericValueTypeInteger;
+            attribs[i].flags = VA_SURFACE_ATTRIB_GETTABLE | VA_SURFACE_ATTRIB_SETTABLE;
+            attribs[i].value.value.i = static_cast<int>(rt_format_fourcc.fourcc);
+            i++;
+        }
+        break;
+    }
+
+    // Surfaces the driver allocates take a layout their consumer supports,
+    // negotiated from the list of DRM format modifiers given at creation.
+    attribs[i].type = VASurfaceAttribDRMFormatModifiers;
+    attribs[i].value.type = VAGenericValueTypePointer;
+    attribs[i].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[i].value.value.p = nullptr;
+    i++;
+
+    // Client memory is either imported as dma-bufs or, for CPU producers, used
+    // in place through a VASurfaceAttribExternalBuffers.
+    attribs[i].type = VASurfaceAttribMemoryType;
+    attribs[i].value.type = VAGenericValueTypeInteger;
+    attribs[i].flags = VA_SURFACE_ATTRIB_GETTABLE | VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[i].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_VA
+        | VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2 | VA_SURFACE_ATTRIB_MEM_TYPE_USER_PTR;
+    i++;
+
+    // Surfaces the driver allocates for video processing input only, without
+    // the export hint, are read by the post-processor in place.
+    attribs[i].type = VASurfaceAttribUsageHint;
+    attribs[i].value.type = VAGenericValueTypeInteger;
+    attribs[i].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[i].value.value.i = VA_SURFACE_ATTRIB_USAGE_HINT_DECODER
+        | VA_SURFACE_ATTRIB_USAGE_HINT_VPP_READ | VA_SURFACE_ATTRIB_USAGE_HINT_VPP_WRITE
+        | VA_SURFACE_ATTRIB_USAGE_HINT_EXPORT;
+    i++;
+
     attribs[i].type = VASurfaceAttribMaxWidth;
     attribs[i].value.type = VAGenericValueTypeInteger;
     attribs[i].flags = VA_SURFACE_ATTRIB_GETTABLE;
@@ -667,14 +804,76 @@ VAStatus vsCreateSurfaces2(VADriverContextP ctx, unsigned int format, unsigned i
     libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
 
     for (unsigned int i = 0; i < num_surfaces; i++) {
-        surfaces[i] = fdrv->CreateSurface(format, width, height,
-            std::vector<VASurfaceAttrib>(attrib_list, attrib_list + num_attribs));
+        const VAStatus status = fdrv->CreateSurface(format, width, height,
+            std::vector<VASurfaceAttrib>(attrib_list, attrib_list + num_attribs), i, surfaces[i]);
+        if (status != VA_STATUS_SUCCESS) {
+            // The surfaces are created all or none.
+            for (unsigned int j = 0; j < i; j++) { fdrv->DestroySurface(surfaces[j]); }
+            return status;
+        }
+    }
+
+    return VA_STATUS_SUCCESS;
+}
+
+VAStatus vsExportSurfaceHandle(VADriverContextP ctx, VASurfaceID surface_id, uint32_t mem_type,
+    uint32_t flags, void *descriptor)
+{
+    libvavc8000d::VSDriver *fdrv = static_cast<libvavc8000d::VSDriver *>(ctx->pDriverData);
+
+    if (!fdrv->SurfaceExists(surface_id)) { return VA_STATUS_ERROR_INVALID_SURFACE; }
+    if (mem_type != VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2) {
+        return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
     }
 
+    // Decoding completes in vaEndPicture, so the surface is ready to be shared
+    // with the consumer right away.
+    return fdrv->GetSurface(surface_id)
+        .ExportDRMPrime(flags, *static_cast<VADRMPRIMESurfaceDescriptor *>(descriptor));
+}
+
+VAStatus vsQueryVideoProcFilters(VADriverContextP ctx, VAContextID context,
+    VAProcFilterType *filters, unsigned int *num_filters)
+{
+    // Scaling and cropping are part of the pipeline, not filters.
+    *num_filters = 0;
     return VA_STATUS_SUCCESS;
 }
 
-#define MAX_PROFILES 9
+VAStatus vsQueryVideoProcFilterCaps(VADriverContextP ctx, VAContextID context,
+    VAProcFilterType type, void *filter_caps, unsigned int *num_filter_caps)
+{
+    *num_filter_caps = 0;
+    return VA_STATUS_ERROR_UNSUPPORTED_FILTER;
+}
+
+VAStatus vsQueryVideoProcPipelineCaps(VADriverContextP ctx, VAContextID context,
+    VABufferID *filters, unsigned int num_filters, VAProcPipelineCaps *pipeline_caps)
+{
+    if (num_filters) { return VA_STATUS_ERROR_UNSUPPORTED_FILTER; }
+
+    // Limits of the VC8000D post-processor, which downscales by up to 1/8 in
+    // each direction, see PpUnitConfig::scale.
+    memset(pipeline_caps, 0, sizeof(*pipeline_caps));
+    pipeline_caps->max_input_width = 4096;
+    pipeline_caps->max_input_height = 4096;
+    pipeline_caps->min_input_width = 48;
+    pipeline_caps->min_input_height = 48;
+    pipeline_caps->max_output_width = 4096;
+    pipeline_caps->max_output_height = 4096;
+    pipeline_caps->min_output_width = 16;
+    pipeline_caps->min_output_height = 16;
+    // The post-processor can't rotate, the pictures are rotated and mirrored
+    // as they are written to their surfaces.
+    pipeline_caps->rotation_flags = (1 << VA_ROTATION_NONE) | (1 << VA_ROTATION_90)
+        | (1 << VA_ROTATION_180) | (1 << VA_ROTATION_270);
+    pipeline_caps->mirror_flags = VA_MIRROR_HORIZONTAL | VA_MIRROR_VERTICAL;
+    // One rendition per post-processor unit besides the render target.
+    pipeline_caps->num_additional_outputs = libvavc8000d::kMaxAdditionalOutputs;
+    return VA_STATUS_SUCCESS;
+}
+
+#define MAX_PROFILES 16
 #define MAX_ENTRYPOINTS 8
 #define MAX_CONFIG_ATTRIBUTES 32
 #if MAX_CAPABILITY_ATTRIBUTES >= MAX_CONFIG_ATTRIBUTES
@@ -752,6 +951,13 @@ extern "C" VAStatus DLL_EXPORT __vaDriverInit_1_0(VADriverContextP ctx)
     // other advanced functionality.
     vtable->vaQuerySurfaceAttributes = vsQuerySurfaceAttributes;
     vtable->vaCreateSurfaces2 = vsCreateSurfaces2;
+    vtable->vaExportSurfaceHandle = vsExportSurfaceHandle;
+
+    struct VADriverVTableVPP *const vtable_vpp = ctx->vtable_vpp;
+    vtable_vpp->version = VA_DRIVER_VTABLE_VPP_VERSION;
+    vtable_vpp->vaQueryVideoProcFilters = vsQueryVideoProcFilters;
+    vtable_vpp->vaQueryVideoProcFilterCaps = vsQueryVideoProcFilterCaps;
+    vtable_vpp->vaQueryVideoProcPipelineCaps = vsQueryVideoProcPipelineCaps;
 
     return VA_STATUS_SUCCESS;
 }
\ No newline at end of file
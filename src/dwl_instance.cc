@@ -0,0 +1,42 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "dwl_instance.h"
+
+#include "dwl.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace libvavc8000d
+{
+
+DWLInstance::DWLInstance(u32 client_type)
+    : client_type(client_type)
+{
+    DWLInitParam param;
+    param.client_type = client_type;
+    instance = nullptr;
+    instance = DWLInit(&param);
+}
+
+DWLInstance::~DWLInstance() { DWLRelease(instance); }
+
+bool DWLInstance::UseReferenceCompression() const
+{
+    DWLHwConfig hw_config;
+    memset(&hw_config, 0, sizeof(hw_config));
+    DWLReadAsicConfig(&hw_config, client_type);
+
+    const char *use_reference_compression_env_var = getenv("USE_REFERENCE_COMPRESSION");
+    if (!use_reference_compression_env_var) { return hw_config.rfc_support; }
+    const bool enabled = strcmp(use_reference_compression_env_var, "1") == 0;
+    if (enabled && !hw_config.rfc_support) {
+        std::cerr << "Reference compression forced on, but not reported by the hardware"
+                  << std::endl;
+    }
+    return enabled;
+}
+
+} // namespace libvavc8000d
@@ -0,0 +1,31 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DWL_INSTANCE_H_
+#define DWL_INSTANCE_H_
+
+#include <cstdint>
+
+namespace libvavc8000d
+{
+
+// Owns a DWL (decoder wrapper layer) instance for a given hardware client type
+// (DWL_CLIENT_TYPE_*). The instance is released on destruction.
+struct DWLInstance
+{
+    const void *instance;
+    const uint32_t client_type;
+    DWLInstance(uint32_t client_type);
+    ~DWLInstance();
+
+    // Whether decoders of this client should keep their reference frames
+    // compressed, which cuts the memory traffic of motion compensation. On when
+    // the hardware reports support for it, USE_REFERENCE_COMPRESSION=0 or 1
+    // overrides that per context.
+    bool UseReferenceCompression() const;
+};
+
+} // namespace libvavc8000d
+
+#endif // DWL_INSTANCE_H_
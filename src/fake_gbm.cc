@@ -42,6 +42,7 @@
 #define GBM_EXPORT
 
 #define GBM_FORMAT_P010 __gbm_fourcc_code('P', '0', '1', '0')
+#define GBM_FORMAT_RGBP __gbm_fourcc_code('R', 'G', 'B', 'P')
 
 // This is an opaque type in GBM, so its definition does not really matter.
 struct gbm_device
@@ -66,7 +67,7 @@ struct gbm_bo_mapping
 
 uint32_t get_y_subsample(struct gbm_bo *bo, size_t plane)
 {
-    if (plane == 0) {
+    if (plane == 0 || bo->meta.format == GBM_FORMAT_RGBP) {
         return 1;
     } else {
         return 2;
@@ -79,7 +80,8 @@ uint32_t get_x_subsample(struct gbm_bo *bo, size_t plane)
 
     switch (bo->meta.format) {
     case GBM_FORMAT_NV12:
-    case GBM_FORMAT_P010: return 1;
+    case GBM_FORMAT_P010:
+    case GBM_FORMAT_RGBP: return 1;
     case GBM_FORMAT_YUV420: return 2;
     default: CHECK(false);
     }
@@ -105,8 +107,12 @@ GBM_EXPORT uint32_t gbm_bo_get_bpp(struct gbm_bo *bo)
 
     switch (bo->meta.format) {
     case GBM_FORMAT_NV12:
-    case GBM_FORMAT_YUV420: return 1;
+    case GBM_FORMAT_YUV420:
+    case GBM_FORMAT_RGBP:
+    case GBM_FORMAT_R8: return 1;
     case GBM_FORMAT_P010: return 2;
+    case GBM_FORMAT_XRGB8888:
+    case GBM_FORMAT_XBGR8888: return 4;
     default: CHECK(false);
     }
 }
@@ -116,9 +122,13 @@ GBM_EXPORT int gbm_bo_get_plane_count(struct gbm_bo *bo)
     CHECK(bo);
 
     switch (bo->meta.format) {
+    case GBM_FORMAT_XRGB8888:
+    case GBM_FORMAT_XBGR8888:
+    case GBM_FORMAT_R8: return 1;
     case GBM_FORMAT_NV12:
     case GBM_FORMAT_P010: return 2;
-    case GBM_FORMAT_YUV420: return 3;
+    case GBM_FORMAT_YUV420:
+    case GBM_FORMAT_RGBP: return 3;
     default: CHECK(false);
     }
 }
@@ -225,7 +235,7 @@ GBM_EXPORT int gbm_bo_get_fd_for_plane(struct gbm_bo *bo, int plane)
     return gbm_bo_get_fd(bo);
 }
 
-GBM_EXPORT uint64_t gbm_bo_get_modifier(struct gbm_bo *bo) { return 0; }
+GBM_EXPORT uint64_t gbm_bo_get_modifier(struct gbm_bo *bo) { return bo->meta.modifier; }
 
 GBM_EXPORT uint32_t gbm_bo_get_format(struct gbm_bo *bo)
 {
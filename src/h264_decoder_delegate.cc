@@ -5,18 +5,19 @@
 
 #include "h264_decoder_delegate.h"
 
-#include "base/byte_conversions.h"
+#include "base/bit_writer.h"
 #include "base/logging.h"
 #include "basetype.h"
 #include "buffer.h"
 #include "decapicommon.h"
+#include "decode_engine.h"
 #include "dectypes.h"
 #include "dwl.h"
 #include "h264decapi.h"
+#include "output_picture.h"
 #include "surface.h"
 #include <cstdio>
 #include <cstring>
-#include <fstream>
 #include <iostream>
 #include <unistd.h>
 
@@ -33,6 +34,7 @@ namespace
         kProfileIDCConstrainedBaseline = kProfileIDCBaseline,
         kProfileIDCMain = 77,
         kProfileIDCHigh = 100,
+        kProfileIDCHigh10 = 110,
     };
 
     enum H264LevelIDC : uint8_t {
@@ -105,234 +107,32 @@ namespace
         u32 num_reorder_frames;
     };
 
-    // H264BitstreamBuilder is mostly a copy&paste from Chromium's
-    // H26xAnnexBBitstreamBuilder
-    // (//media/filters/h26x_annex_b_bitstream_builder.h). The reason to not just
-    // include that file is that the fake libva driver is in the process of being
-    // moved out of the Chromium tree and into its own project, and we want to
-    // avoid depending on Chromium's utilities.
-    class H264BitstreamBuilder
-    {
-    public:
-        explicit H264BitstreamBuilder(bool insert_emulation_prevention_bytes = false)
-            : insert_emulation_prevention_bytes_(insert_emulation_prevention_bytes)
-        {
-            Reset();
-        }
-
-        template <typename T> void AppendBits(size_t num_bits, T val)
-        {
-            AppendU64(num_bits, static_cast<uint64_t>(val));
-        }
-
-        void AppendBits(size_t num_bits, bool val)
-        {
-            CHECK_EQ(num_bits, 1ul);
-            AppendBool(val);
-        }
-
-        // Append a one-bit bool/flag value |val| to the stream.
-        void AppendBool(bool val)
-        {
-            if (bits_left_in_reg_ == 0u) { FlushReg(); }
-
-            reg_ <<= 1;
-            reg_ |= (static_cast<uint64_t>(val) & 1u);
-            --bits_left_in_reg_;
-        }
-
-        // Append a signed value in |val| in Exp-Golomb code.
-        void AppendSE(int val)
-        {
-            if (val > 0) {
-                AppendUE(val * 2 - 1);
-            } else {
-                AppendUE(-val * 2);
-            }
-        }
-
-        // Append an unsigned value in |val| in Exp-Golomb code.
-        void AppendUE(unsigned int val)
-        {
-            size_t num_zeros = 0u;
-            unsigned int v = val + 1u;
-
-            while (v > 1) {
-                v >>= 1;
-                ++num_zeros;
-            }
-
-            AppendBits(num_zeros, 0);
-            AppendBits(num_zeros + 1, val + 1u);
-        }
-
-        void BeginNALU(H264NALU::Type nalu_type, int nal_ref_idc)
-        {
-            CHECK(!in_nalu_);
-            CHECK_EQ(bits_left_in_reg_, kRegBitSize);
-
-            CHECK_LE(nalu_type, H264NALU::kEOStream);
-            CHECK_GE(nal_ref_idc, 0);
-            CHECK_LE(nal_ref_idc, 3);
-
-            AppendBits(32, 0x00000001);
-            Flush();
-            in_nalu_ = true;
-            AppendBits(1, 0); // forbidden_zero_bit.
-            AppendBits(2, nal_ref_idc);
-            CHECK_NE(nalu_type, 0);
-            AppendBits(5, nalu_type);
-        }
-
-        void FinishNALU()
-        {
-            // RBSP stop one bit.
-            AppendBits(1, 1);
-
-            // Byte-alignment zero bits.
-            AppendBits(bits_left_in_reg_ % 8, 0);
-
-            Flush();
-            in_nalu_ = false;
-        }
-
-        void Flush()
-        {
-            if (bits_left_in_reg_ != kRegBitSize) { FlushReg(); }
-        }
-
-        size_t BytesInBuffer() const
-        {
-            CHECK_EQ(bits_left_in_reg_, kRegBitSize);
-            return pos_;
-        }
-
-        const uint8_t *data() const
-        {
-            CHECK(!data_.empty());
-            CHECK_EQ(bits_left_in_reg_, kRegBitSize);
-
-            return data_.data();
-        }
-
-    private:
-        typedef uint64_t RegType;
-        enum {
-            // Sizes of reg_.
-            kRegByteSize = sizeof(RegType),
-            kRegBitSize = kRegByteSize * 8,
-            // Amount of bytes to grow the buffer by when we run out of
-            // previously-allocated memory for it.
-            kGrowBytes = 4096,
-        };
-
-        void Grow()
-        {
-            static_assert(
-                kGrowBytes >= kRegByteSize, "kGrowBytes must be larger than kRegByteSize");
-            data_.resize(data_.size() + kGrowBytes);
-        }
-
-        void Reset()
-        {
-            data_ = std::vector<uint8_t>(kGrowBytes, 0);
-            pos_ = 0;
-            bits_in_buffer_ = 0;
-            reg_ = 0;
-            bits_left_in_reg_ = kRegBitSize;
-            in_nalu_ = false;
-        }
-
-        void AppendU64(size_t num_bits, uint64_t val)
-        {
-            CHECK_LE(num_bits, kRegBitSize);
-            while (num_bits > 0u) {
-                if (bits_left_in_reg_ == 0u) { FlushReg(); }
-
-                uint64_t bits_to_write
-                    = num_bits > bits_left_in_reg_ ? bits_left_in_reg_ : num_bits;
-                uint64_t val_to_write = (val >> (num_bits - bits_to_write));
-                if (bits_to_write < 64u) {
-                    val_to_write &= ((1ull << bits_to_write) - 1);
-                    reg_ <<= bits_to_write;
-                    reg_ |= val_to_write;
-                } else {
-                    reg_ = val_to_write;
-                }
-                num_bits -= bits_to_write;
-                bits_left_in_reg_ -= bits_to_write;
-            }
-        }
-
-        void FlushReg()
-        {
-            // Flush all bytes that have at least one bit cached, but not more
-            // (on Flush(), reg_ may not be full).
-            size_t bits_in_reg = kRegBitSize - bits_left_in_reg_;
-            if (bits_in_reg == 0u) { return; }
-
-            size_t bytes_in_reg = base::AlignUp(bits_in_reg, size_t{ 8 }) / 8u;
-            reg_ <<= (kRegBitSize - bits_in_reg);
-
-            // Convert to MSB and append as such to the stream.
-            std::array<uint8_t, 8> reg_be = base::U64ToBigEndian(reg_);
-
-            if (insert_emulation_prevention_bytes_ && in_nalu_) {
-                // The EPB only works on complete bytes being flushed.
-                CHECK_EQ(bits_in_reg % 8u, 0u);
-                // Insert emulation prevention bytes (spec 7.3.1).
-                constexpr uint8_t kEmulationByte = 0x03u;
-
-                for (size_t i = 0; i < bytes_in_reg; ++i) {
-                    // This will possibly check the NALU header byte. However the
-                    // CHECK_NE(nalu_type, 0) makes sure that it is not 0.
-                    if (pos_ >= 2u && data_[pos_ - 2u] == 0 && data_[pos_ - 1u] == 0u
-                        && reg_be[i] <= kEmulationByte) {
-                        if (pos_ + 1u > data_.size()) { Grow(); }
-                        data_[pos_++] = kEmulationByte;
-                        bits_in_buffer_ += 8u;
-                    }
-                    if (pos_ + 1u > data_.size()) { Grow(); }
-                    data_[pos_++] = reg_be[i];
-                    bits_in_buffer_ += 8u;
-                }
-            } else {
-                // Make sure we have enough space.
-                if (pos_ + bytes_in_reg > data_.size()) { Grow(); }
-
-                std::copy(reg_be.cbegin(), reg_be.cbegin() + bytes_in_reg, data_.begin() + pos_);
+    // Parameter sets are escaped since the decoder strips emulation prevention
+    // bytes from every NALU.
+    using H264BitstreamBuilder = base::BitWriter<base::StartCodeEmulationPrevention>;
 
-                bits_in_buffer_ = pos_ * 8u + bits_in_reg;
-                pos_ += bytes_in_reg;
-            }
-
-            reg_ = 0u;
-            bits_left_in_reg_ = kRegBitSize;
-        }
-
-        // Whether to insert emulation prevention bytes in RBSP.
-        bool insert_emulation_prevention_bytes_;
-
-        // Whether BeginNALU() has been called but not FinishNALU().
-        bool in_nalu_;
+    // forbidden_zero_bit, nal_ref_idc and nal_unit_type, spec section 7.3.1.
+    using H264NALUHeader = base::BitFieldLayout<1, 2, 5>;
+    using H264SPSProfileAndLevel = base::BitFieldLayout<8, 1, 1, 1, 1, 1, 1, 2, 8>;
 
-        // Unused bits left in reg_.
-        size_t bits_left_in_reg_;
-
-        // Cache for appended bits. Bits are flushed to data_ with kRegByteSize
-        // granularity, i.e. when reg_ becomes full, or when an explicit FlushReg()
-        // is called.
-        RegType reg_;
-
-        // Current byte offset in data_ (points to the start of unwritten bits).
-        size_t pos_;
-        // Current last bit in data_ (points to the start of unwritten bit).
-        size_t bits_in_buffer_;
+    void BeginNALU(
+        H264BitstreamBuilder &bitstream_builder, H264NALU::Type nalu_type, int nal_ref_idc)
+    {
+        CHECK(bitstream_builder.IsByteAligned());
+        CHECK_NE(nalu_type, 0);
+        CHECK_LE(nalu_type, H264NALU::kEOStream);
+        CHECK_GE(nal_ref_idc, 0);
+        CHECK_LE(nal_ref_idc, 3);
+
+        bitstream_builder.AppendRawBytes({ 0x00, 0x00, 0x00, 0x01 });
+        bitstream_builder.AppendFields<H264NALUHeader>(0, nal_ref_idc, nalu_type);
+    }
 
-        // Buffer for stream data. Only the bytes before `pos_` can be assumed to have
-        // been initialized.
-        std::vector<uint8_t> data_;
-    };
+    void FinishNALU(H264BitstreamBuilder &bitstream_builder)
+    {
+        bitstream_builder.AppendTrailingBits();
+        bitstream_builder.Flush();
+    }
 
     void BuildPackedH264SPS(const VAPictureParameterBufferH264 *pic_param_buffer,
         std::vector<const VSBuffer *> slice_param_buffers, const VAProfile profile,
@@ -345,52 +145,23 @@ namespace
         // const VAH264SPS *sps = reinterpret_cast<const VAH264SPS *>(&(sliceParam->RefPicList0));
 
         // Build NAL header following spec section 7.3.1.
-        bitstream_builder.BeginNALU(H264NALU::kSPS, 3);
+        BeginNALU(bitstream_builder, H264NALU::kSPS, 3);
         int profile_idc = 0;
-        // Build SPS following spec section 7.3.2.1.
         switch (profile) {
         case VAProfileH264Baseline:
-        case VAProfileH264ConstrainedBaseline:
-            profile_idc = kProfileIDCBaseline;
-            bitstream_builder.AppendBits(8,
-                kProfileIDCBaseline); // profile_idc u(8).
-            bitstream_builder.AppendBool(0); // Constraint Set0 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set1 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set2 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set3 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set4 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set5 Flag u(1).
-            bitstream_builder.AppendBits(2, 0); // Reserved zero 2bits u(2).
-            bitstream_builder.AppendBits(8, kLevelIDC5p1); // level_idc u(8).
-            break;
-        case VAProfileH264Main:
-            profile_idc = kProfileIDCMain;
-            bitstream_builder.AppendBits(8, kProfileIDCMain);
-            bitstream_builder.AppendBool(0); // Constraint Set0 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set1 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set2 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set3 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set4 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set5 Flag u(1).
-            bitstream_builder.AppendBits(2, 0); // Reserved zero 2bits u(2).
-            bitstream_builder.AppendBits(8, kLevelIDC5p1); // level_idc u(8).
-            break;
-        case VAProfileH264High:
-            profile_idc = kProfileIDCHigh;
-            bitstream_builder.AppendBits(8, kProfileIDCHigh);
-            bitstream_builder.AppendBool(0); // Constraint Set0 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set1 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set2 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set3 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set4 Flag u(1).
-            bitstream_builder.AppendBool(0); // Constraint Set5 Flag u(1).
-            bitstream_builder.AppendBits(2, 0); // Reserved zero 2bits u(2).
-            bitstream_builder.AppendBits(8, kLevelIDC5p1); // level_idc u(8).
-            break;
+        case VAProfileH264ConstrainedBaseline: profile_idc = kProfileIDCBaseline; break;
+        case VAProfileH264Main: profile_idc = kProfileIDCMain; break;
+        case VAProfileH264High: profile_idc = kProfileIDCHigh; break;
+        case VAProfileH264High10: profile_idc = kProfileIDCHigh10; break;
         // TODO(b/328430784): Support additional H264 profiles.
         default: CHECK(false); break;
         }
 
+        // Build SPS following spec section 7.3.2.1: profile_idc u(8),
+        // constraint_set0..5_flag u(1), reserved_zero_2bits u(2), level_idc u(8).
+        bitstream_builder.AppendFields<H264SPSProfileAndLevel>(
+            profile_idc, 0, 0, 0, 0, 0, 0, 0, kLevelIDC5p1);
+
         // TODO(b/328430784): find a way to get the seq_parameter_set_id.
         bitstream_builder.AppendUE(0); // seq_parameter_set_id ue(v).
 
@@ -404,9 +175,9 @@ namespace
                 bitstream_builder.AppendBool(0); // separate_colour_plane_flag u(1).
             }
             bitstream_builder.AppendUE(
-                pic_param_buffer->bit_depth_chroma_minus8); // bit_depth_luma_minus8 ue(v).
+                pic_param_buffer->bit_depth_luma_minus8); // bit_depth_luma_minus8 ue(v).
             bitstream_builder.AppendUE(
-                pic_param_buffer->bit_depth_luma_minus8); // bit_depth_chroma_minus8 ue(v).
+                pic_param_buffer->bit_depth_chroma_minus8); // bit_depth_chroma_minus8 ue(v).
             bitstream_builder.AppendBool(0); // qpprime_y_zero_transform_bypass_flag u(1).
             bitstream_builder.AppendBool(0); // seq_scaling_matrix_present_flag u(1).
             if (0) {
@@ -495,7 +266,7 @@ namespace
             }
         }
 
-        bitstream_builder.FinishNALU();
+        FinishNALU(bitstream_builder);
     }
 
     void BuildPackedH264PPS(const VAPictureParameterBufferH264 *pic_param_buffer,
@@ -503,7 +274,7 @@ namespace
         H264BitstreamBuilder &bitstream_builder)
     {
         // Build NAL header following spec section 7.3.1.
-        bitstream_builder.BeginNALU(H264NALU::kPPS, 3);
+        BeginNALU(bitstream_builder, H264NALU::kPPS, 3);
 
         // Build PPS following spec section 7.3.2.2.
 
@@ -555,42 +326,125 @@ namespace
                 .redundant_pic_cnt_present_flag); // redundant_pic_cnt_present_flag
                                                   // u(1).
 
-        bitstream_builder.FinishNALU();
+        FinishNALU(bitstream_builder);
     }
 
 } // namespace
 
-// Size of the timestamp cache, needs to be large enough for frame-reordering.
-constexpr size_t kTimestampCacheSize = 128;
-
-DWLInstance::DWLInstance(u32 client_type)
+struct H264DecodeTraits
 {
-    DWLInitParam param;
-    param.client_type = client_type;
-    instance = nullptr;
-    instance = DWLInit(&param);
-}
+    using Inst = H264DecInst;
+    using Input = H264DecInput;
+    using Output = H264DecOutput;
+    using Picture = H264DecPicture;
+    using BufferInfo = H264DecBufferInfo;
+    using Ret = enum DecRet;
+
+    static DecodeEvent Classify(Ret ret)
+    {
+        switch (ret) {
+        case DEC_OK: return DecodeEvent::kContinue;
+        case DEC_HDRS_RDY: return DecodeEvent::kHeadersReady;
+        case DEC_PENDING_FLUSH:
+        case DEC_PIC_DECODED: return DecodeEvent::kPictureDecoded;
+        case DEC_STRM_PROCESSED: return DecodeEvent::kStreamProcessed;
+        case DEC_WAITING_FOR_BUFFER: return DecodeEvent::kWaitingForBuffer;
+        default: return DecodeEvent::kError;
+        }
+    }
+
+    static Ret Decode(Inst inst, Input *input, Output *output)
+    {
+        return H264DecDecode(inst, input, output);
+    }
+
+    static bool NextPicture(Inst inst, Picture *picture)
+    {
+        auto ret = H264DecNextPicture(inst, picture, 0);
+        return ret == DEC_PIC_RDY || ret == DEC_FLUSHED;
+    }
+
+    static void PictureConsumed(Inst inst, Picture *picture)
+    {
+        H264DecPictureConsumed(inst, picture);
+    }
+
+    static void GetBufferInfo(Inst inst, BufferInfo *buffer_info)
+    {
+        H264DecGetBufferInfo(inst, buffer_info);
+    }
+
+    static void AddBuffer(Inst inst, DWLLinearMem *mem) { H264DecAddBuffer(inst, mem); }
 
-DWLInstance::~DWLInstance() { DWLRelease(instance); }
+    static void Abort(Inst inst) { H264DecAbort(inst); }
 
-H264DecoderDelegate::H264DecoderDelegate(
-    int picture_width_hint, int picture_height_hint, VAProfile profile)
-    : profile_(profile), ts_to_render_target_(kTimestampCacheSize)
+    static void SetInput(
+        Input &input, const DWLLinearMem &stream_mem, uint32_t size, uint32_t pic_id)
+    {
+        input.stream = reinterpret_cast<uint8_t *>(stream_mem.virtual_address);
+        input.stream_bus_address = stream_mem.bus_address;
+        input.data_len = size;
+        input.buffer = reinterpret_cast<u8 *>(
+            reinterpret_cast<addr_t>(input.stream) & ~BUFFER_ALIGN_MASK);
+        input.buffer_bus_address = input.stream_bus_address & ~BUFFER_ALIGN_MASK;
+        input.buff_len = input.data_len + (input.stream_bus_address & BUFFER_ALIGN_MASK);
+        input.pic_id = pic_id;
+        input.skip_non_reference = 0;
+        input.p_user_data = stream_mem.virtual_address;
+    }
+
+    static void AdvanceInput(Input &input, const Output &output)
+    {
+        input.stream = output.strm_curr_pos;
+        input.data_len = output.data_left;
+        input.stream_bus_address = output.strm_curr_bus_address;
+    }
+
+    static uint32_t DataLeft(const Input &input) { return input.data_len; }
+
+    static uint32_t GetPicId(const Picture &picture) { return picture.pic_id; }
+
+    static OutputPicture GetOutput(const Picture &picture, int index)
+    {
+        const auto &output = picture.pictures[index];
+        return {
+            .luma = reinterpret_cast<const uint8_t *>(output.output_picture),
+            .chroma = reinterpret_cast<const uint8_t *>(output.output_picture_chroma),
+            .width = output.pic_width,
+            .height = output.pic_height,
+            .luma_stride = output.pic_stride,
+            .chroma_stride = output.pic_stride_ch,
+            .format = output.output_format,
+        };
+    }
+};
+
+// Size of the timestamp cache, needs to be large enough for frame-reordering.
+constexpr size_t kTimestampCacheSize = 128;
+
+H264DecoderDelegate::H264DecoderDelegate(int picture_width_hint, int picture_height_hint,
+    VAProfile profile, SurfaceLayout output_layout)
+    : profile_(profile)
+    , output_layout_(output_layout)
+    , ts_to_outputs_(kTimestampCacheSize)
 {
-    dwl_instance_ = std::make_unique<DWLInstance>(DWL_CLIENT_TYPE_H264_DEC);
-    H264DecConfig dec_config;
-    memset(&dec_config, 0, sizeof(dec_config));
-    dec_config.dpb_flags = DEC_REF_FRM_RASTER_SCAN;
-    dec_config.decoder_mode = DEC_NORMAL;
-    dec_config.error_handling = DEC_EC_FAST_FREEZE;
-    dec_config.no_output_reordering = 1;
-    dec_config.use_display_smoothing = 0;
-    dec_config.use_video_compressor = 0;
-    dec_config.use_adaptive_buffers = 1;
-    dec_config.guard_size = 0;
+    // High 10 streams are decoded by a dedicated hardware client.
+    dwl_instance_ = std::make_unique<DWLInstance>(
+        profile == VAProfileH264High10 ? DWL_CLIENT_TYPE_H264_MAIN10 : DWL_CLIENT_TYPE_H264_DEC);
+    memset(&dec_config_, 0, sizeof(dec_config_));
+    dec_config_.dpb_flags = GetDpbFlags(output_layout_);
+    dec_config_.decoder_mode = DEC_NORMAL;
+    dec_config_.error_handling = DEC_EC_FAST_FREEZE;
+    dec_config_.no_output_reordering = 1;
+    dec_config_.use_display_smoothing = 0;
+    reference_compression_ = dwl_instance_->UseReferenceCompression();
+    dec_config_.use_video_compressor = reference_compression_;
+    dec_config_.use_adaptive_buffers = 1;
+    dec_config_.guard_size = 0;
     auto ret = H264DecInit(
-        const_cast<const void **>(&hw_decoder_), dwl_instance_->instance, &dec_config);
-    std::cerr << "HW Decoder Initialized. Return code: " << ret << std::endl;
+        const_cast<const void **>(&hw_decoder_), dwl_instance_->instance, &dec_config_);
+    CHECK_EQ(ret, DEC_OK);
+    engine_ = std::make_unique<DecodeEngine<H264DecodeTraits>>(dwl_instance_->instance);
 }
 
 H264DecoderDelegate::~H264DecoderDelegate() { H264DecRelease(hw_decoder_); }
@@ -598,7 +452,12 @@ H264DecoderDelegate::~H264DecoderDelegate() { H264DecRelease(hw_decoder_); }
 void H264DecoderDelegate::SetRenderTarget(const VSSurface &surface)
 {
     render_target_ = &surface;
-    ts_to_render_target_.Put(current_ts_, &surface);
+    ts_to_outputs_.Put(current_ts_, PictureOutputs { .render_target = &surface });
+}
+
+void H264DecoderDelegate::SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces)
+{
+    additional_outputs_ = surfaces;
 }
 
 void H264DecoderDelegate::EnqueueWork(const std::vector<const VSBuffer *> &buffers)
@@ -611,12 +470,21 @@ void H264DecoderDelegate::EnqueueWork(const std::vector<const VSBuffer *> &buffe
         case VAPictureParameterBufferType: pic_param_buffer_ = buffer; break;
         case VAIQMatrixBufferType: matrix_buffer_ = buffer; break;
         case VASliceParameterBufferType: slice_param_buffers_.push_back(buffer); break;
+        case VAProcPipelineParameterBufferType:
+            pp_params_ = ParsePostProcessingParams(
+                *reinterpret_cast<VAProcPipelineParameterBuffer *>(buffer->GetData()),
+                PictureOutputs { render_target_, additional_outputs_ });
+            // Outputs beyond the post-processor units are ignored.
+            if (pp_params_.num_additional_outputs < additional_outputs_.size()) {
+                additional_outputs_.resize(pp_params_.num_additional_outputs);
+            }
+            break;
         default: break;
         };
     }
 }
 
-void H264DecoderDelegate::Run()
+VAStatus H264DecoderDelegate::Run()
 {
     H264BitstreamBuilder bitstream_builder;
 
@@ -631,152 +499,82 @@ void H264DecoderDelegate::Run()
         BuildPackedH264PPS(pic_param_buffer, slice_param_buffers_, profile_, bitstream_builder);
     }
 
-    {
-        std::ofstream bitstream_file("bitstream0.h264", std::ios::binary | std::ios::trunc);
-        if (bitstream_file.is_open()) {
-            bitstream_file.write(reinterpret_cast<const char *>(bitstream_builder.data()),
-                bitstream_builder.BytesInBuffer());
-            bitstream_file.close();
-        } else {
-            std::cerr << "Unable to open bitstream file for writing." << std::endl;
-        }
-    }
-
     for (const auto &slice_data_buffer : slice_data_buffers_) {
-        // Add the H264 start code for each slice.
-        bitstream_builder.AppendBits(32, 0x00000001);
-        const uint8_t *data = reinterpret_cast<uint8_t *>(slice_data_buffer->GetData());
-        for (size_t i = 0; i < slice_data_buffer->GetDataSize(); i++) {
-            bitstream_builder.AppendBits<uint8_t>(8, data[i]);
-        }
+        // Add the H264 start code for each slice. The slice data is already
+        // escaped.
+        bitstream_builder.AppendRawBytes({ 0x00, 0x00, 0x00, 0x01 });
+        bitstream_builder.AppendRawBytes(reinterpret_cast<uint8_t *>(slice_data_buffer->GetData()),
+            slice_data_buffer->GetDataSize());
     }
 
-    bitstream_builder.Flush();
+    if (headers_ready_ && pp_params_ != applied_pp_params_) { ConfigurePostProcessor(); }
 
-    // Dump bitstream to file for debugging.
-    {
-        std::ofstream bitstream_file("bitstream.h264", std::ios::binary | std::ios::app);
-        if (bitstream_file.is_open()) {
-            bitstream_file.write(reinterpret_cast<const char *>(bitstream_builder.data()),
-                bitstream_builder.BytesInBuffer());
-            bitstream_file.close();
-        } else {
-            std::cerr << "Unable to open bitstream file for writing." << std::endl;
-        }
-    }
+    ts_to_outputs_.Put(current_ts_,
+        PictureOutputs { render_target_, additional_outputs_, pp_params_.transform });
 
     // Invoke HW Decoder
-    H264DecInput input;
-    input.skip_non_reference = 0;
-
-    DWLLinearMem stream_mem;
-    memset(&stream_mem, 0, sizeof(stream_mem));
-    stream_mem.mem_type = DWL_MEM_TYPE_SLICE;
-    DWLMallocLinear(dwl_instance_->instance, bitstream_builder.BytesInBuffer() * 2, &stream_mem);
-    input.stream = reinterpret_cast<uint8_t *>(stream_mem.virtual_address);
-    input.stream_bus_address = stream_mem.bus_address;
-    input.data_len = bitstream_builder.BytesInBuffer();
-    memcpy(stream_mem.virtual_address, bitstream_builder.data(), bitstream_builder.BytesInBuffer());
-
-    input.buffer
-        = reinterpret_cast<u8 *>(reinterpret_cast<addr_t>(input.stream) & ~BUFFER_ALIGN_MASK);
-    input.buffer_bus_address = input.stream_bus_address & ~BUFFER_ALIGN_MASK;
-    input.buff_len = input.data_len + (input.stream_bus_address & BUFFER_ALIGN_MASK);
-    input.pic_id = current_ts_++;
-
-    input.p_user_data = stream_mem.virtual_address;
-
-    H264DecOutput output;
-    memset(&output, 0, sizeof(output));
-    std::cerr << "HW Decoder Started" << std::endl;
-    bool ok = 0, fail = 0;
-    do {
-        auto ret = H264DecDecode(hw_decoder_, &input, &output);
-        std::cerr << "HW Decoder Return: " << ret << std::endl;
-        switch (ret) {
-        case DEC_STREAM_NOT_SUPPORTED: {
-            fail = true;
-            break;
-        }
-        case DEC_HDRS_RDY: break;
-        case DEC_PENDING_FLUSH:
-        case DEC_PIC_DECODED: {
-            H264DecPicture picture;
-            for (;;) {
-                auto ret = H264DecNextPicture(hw_decoder_, &picture, 0);
-                std::cerr << "HW Decoder Next Picture Return: " << ret << std::endl;
-                if (ret == DEC_PIC_RDY || ret == DEC_FLUSHED) {
-                    OnFrameReady(picture);
-                    H264DecPictureConsumed(hw_decoder_, &picture);
-                } else
-                    break;
-            }
-            break;
-        }
-        case DEC_STRM_PROCESSED: {
-            // All data has been processed, we can stop the loop.
-            ok = true;
-            break;
-        }
-        case DEC_OK:
-            /* nothing to do, just call again */
-            break;
-        case DEC_WAITING_FOR_BUFFER: {
-            DWLLinearMem mem;
-            H264DecBufferInfo buffer_info;
-            H264DecGetBufferInfo(hw_decoder_, &buffer_info);
-            std::cerr << "HW Decoder Buffer Info:\n"
-                      << "\t Buf to free:" << std::hex << buffer_info.buf_to_free.virtual_address
-                      << "\n"
-                      << "\t Next buf size:" << std::dec << buffer_info.next_buf_size
-                      << "\n\t Buf num:" << std::dec << buffer_info.buf_num << std::endl;
-
-            for (int i = 0; i < buffer_info.buf_num; i++) {
-                mem.mem_type = DWL_MEM_TYPE_DPB;
-                DWLMallocLinear(dwl_instance_->instance, buffer_info.next_buf_size, &mem);
-                H264DecAddBuffer(hw_decoder_, &mem);
-            }
-            break;
-        }
-        default: {
-            std::cerr << "HW Decoder Error: " << ret << std::endl;
-            fail = true;
-            break;
-        }
-        }
-        // update input stream
-        input.stream = output.strm_curr_pos;
-        input.data_len = output.data_left;
-        input.stream_bus_address = output.strm_curr_bus_address;
-
-    } while (!ok && !fail);
-
-    std::cerr << "HW Decoder Stopped" << std::endl;
-    if (fail) { H264DecAbort(hw_decoder_); }
-    DWLFreeLinear(dwl_instance_->instance, &stream_mem);
+    const std::vector<uint8_t> &bitstream = bitstream_builder.data();
+    const bool decoded = engine_->Decode(
+        hw_decoder_, bitstream.data(), bitstream.size(), current_ts_++,
+        [this]() { ConfigurePostProcessor(); },
+        [this](const H264DecPicture &picture) { OnFrameReady(picture); });
     slice_data_buffers_.clear();
     slice_param_buffers_.clear();
+    // The client may destroy the buffers once vaEndPicture() returns.
+    pic_param_buffer_ = nullptr;
+    matrix_buffer_ = nullptr;
+    pp_params_ = PostProcessingParams();
+    additional_outputs_.clear();
+    if (!decoded) { return VA_STATUS_ERROR_DECODING_ERROR; }
+    return post_processing_failed_ ? VA_STATUS_ERROR_OPERATION_FAILED : VA_STATUS_SUCCESS;
 }
 
-void H264DecoderDelegate::OnFrameReady(H264DecPicture picture)
+void H264DecoderDelegate::ConfigurePostProcessor()
 {
-    const uint32_t ts = picture.pic_id;
-    std::cerr << "Picture Id: " << ts << std::endl;
-    // auto render_target_it = ts_to_render_target_.Peek(ts);
-    // CHECK(render_target_it != ts_to_render_target_.end());
-    // const VSSurface *render_target = render_target_it->second;
-    // CHECK(render_target);
-
-    // const ScopedBOMapping &bo_mapping = render_target->GetMappedBO();
-    // CHECK(bo_mapping.IsValid());
-    // const ScopedBOMapping::ScopedAccess mapped_bo = bo_mapping.BeginAccess();
-    for (int i = 0; i < DEC_MAX_OUT_COUNT; i++) {
-        if (picture.pictures[i].pic_width == 0 || picture.pictures[i].pic_height == 0) continue;
-        std::cerr << "Picture " << i << ": width=" << picture.pictures[i].pic_width
-                  << ", height=" << picture.pictures[i].pic_height << std::endl;
-        // TODO: Copy the data from the picture to the render target.
+    H264DecInfo info;
+    memset(&info, 0, sizeof(info));
+    H264DecGetInfo(hw_decoder_, &info);
+
+    CHECK(render_target_);
+    DecodedStreamInfo stream = { info.pic_width, info.pic_height, info.bit_depth };
+    if (info.colour_description_present_flag) {
+        stream.matrix_coefficients = info.matrix_coefficients;
     }
-    //;
+    stream.full_range = info.video_range;
+    stream.tiled_references = output_layout_ == SurfaceLayout::kTiled4x4;
+    stream.compressed_references = reference_compression_;
+    // 4:2:0, with 10-bit samples packed.
+    engine_->SetReferenceFrames(
+        uint64_t { info.pic_width } * info.pic_height * 3 / 2 * info.bit_depth / 8,
+        reference_compression_);
+    const bool applied = ApplyPostProcessing(
+        stream, pp_params_, *render_target_, dec_config_.ppu_config, [this]() {
+            const auto ret = H264DecSetInfo(hw_decoder_, &dec_config_);
+            if (ret != DEC_OK) {
+                std::cerr << "Unsupported post-processing, return code: " << ret << std::endl;
+            }
+            return ret == DEC_OK;
+        });
+    post_processing_failed_ = !applied;
+    if (!applied) { std::cerr << "No post-processing configuration accepted" << std::endl; }
+    // Not retried for every picture if it was rejected.
+    applied_pp_params_ = pp_params_;
+    headers_ready_ = true;
+}
+
+void H264DecoderDelegate::OnFrameReady(const H264DecPicture &picture)
+{
+    const uint32_t ts = H264DecodeTraits::GetPicId(picture);
+    auto outputs_it = ts_to_outputs_.Peek(ts);
+    CHECK(outputs_it != ts_to_outputs_.end());
+    const PictureOutputs &outputs = outputs_it->second;
+    CHECK(outputs.render_target);
+    if (post_processing_failed_) { return; }
+
+    // The post-processor units write the render target and the additional
+    // outputs, in that order.
+    WritePictureOutputs(outputs,
+        [&picture](int index) { return H264DecodeTraits::GetOutput(picture, index); });
 }
 
 } // namespace libvavc8000d
@@ -12,49 +12,72 @@
 
 #include "base/lru_cache.h"
 #include "context_delegate.h"
+#include "dwl_instance.h"
 #include "h264decapi.h"
+#include "post_processor.h"
 #include <hal/csi_vdec.h>
 
 namespace libvavc8000d
 {
-struct DWLInstance
-{
-    const void *instance;
-    DWLInstance(uint32_t client_type);
-    ~DWLInstance();
-};
+
+template <typename Traits> class DecodeEngine;
+struct H264DecodeTraits;
+
 // Class used for H264 software decoding.
 class H264DecoderDelegate : public ContextDelegate
 {
 public:
-    explicit H264DecoderDelegate(
-        int picture_width_hint, int picture_height_hint, VAProfile profile);
+    // |output_layout| is the layout shared by all the render targets.
+    explicit H264DecoderDelegate(int picture_width_hint, int picture_height_hint,
+        VAProfile profile, SurfaceLayout output_layout);
     H264DecoderDelegate(const H264DecoderDelegate &) = delete;
     H264DecoderDelegate &operator=(const H264DecoderDelegate &) = delete;
     ~H264DecoderDelegate() override;
 
     // ContextDelegate implementation.
     void SetRenderTarget(const VSSurface &surface) override;
+    void SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces) override;
     void EnqueueWork(const std::vector<const VSBuffer *> &buffers) override;
-    void Run() override;
+    VAStatus Run() override;
 
 private:
-    void OnFrameReady(H264DecPicture picture);
+    // Programs the post-processor once the stream headers are known, and again
+    // whenever the requested processing changes, e.g. to scale the output or to
+    // produce P010 or 8-bit output for 10-bit streams.
+    void ConfigurePostProcessor();
+    void OnFrameReady(const H264DecPicture &picture);
 
     const VAProfile profile_;
+    const SurfaceLayout output_layout_;
+    // Whether the decoder compresses its reference frames, see
+    // DWLInstance::UseReferenceCompression().
+    bool reference_compression_ = false;
 
     std::vector<const VSBuffer *> slice_data_buffers_;
     std::vector<const VSBuffer *> slice_param_buffers_;
 
     const VSSurface *render_target_{ nullptr };
+    std::vector<const VSSurface *> additional_outputs_;
     const VSBuffer *pic_param_buffer_{ nullptr };
     const VSBuffer *matrix_buffer_{ nullptr };
 
+    // Processing requested for the picture being decoded, and the one the
+    // post-processor is currently programmed with.
+    PostProcessingParams pp_params_;
+    PostProcessingParams applied_pp_params_;
+    bool headers_ready_ = false;
+    // Whether the decoder rejected every post-processor configuration for
+    // |applied_pp_params_|. The pictures are then in a layout the surfaces
+    // don't have, so they are dropped and vaEndPicture() fails.
+    bool post_processing_failed_ = false;
+
     std::unique_ptr<DWLInstance> dwl_instance_;
+    H264DecConfig dec_config_;
     H264DecInst hw_decoder_;
+    std::unique_ptr<DecodeEngine<H264DecodeTraits>> engine_;
 
     uint32_t current_ts_ = 0;
-    base::LRUCache<uint32_t, const VSSurface *> ts_to_render_target_;
+    base::LRUCache<uint32_t, PictureOutputs> ts_to_outputs_;
 };
 
 } // namespace libvavc8000d
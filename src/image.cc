@@ -10,49 +10,127 @@
 
 #include "image.h"
 
+#include <libdrm/drm_fourcc.h>
+
+#include <algorithm>
+#include <array>
+
 #include "base/ptr_util.h"
 #include "buffer.h"
 #include "driver.h"
+#include "surface.h"
 
 namespace libvavc8000d
 {
-
-std::unique_ptr<VSImage> VSImage::Create(IdType id, const VAImageFormat &format, int width,
-    int height, VSDriver &fake_driver, VAImage *va_image)
+namespace
 {
-    // Chrome should only request NV12 images from the fake driver.
-    CHECK_EQ(format.fourcc, static_cast<uint32_t>(VA_FOURCC_NV12));
 
-    // Validate the |format|. Chrome should request VA_LSB_FIRST images only.
-    CHECK_EQ(format.byte_order, static_cast<uint32_t>(VA_LSB_FIRST));
-    CHECK_EQ(format.bits_per_pixel, 12u);
+    // Surface formats that derived images can expose.
+    struct DerivedFormat
+    {
+        uint32_t fourcc;
+        uint32_t bits_per_pixel;
+        // Only set for packed RGB.
+        uint32_t depth;
+        uint32_t red_mask;
+        uint32_t green_mask;
+        uint32_t blue_mask;
+        uint32_t num_planes;
+        // Vertical subsampling of each plane.
+        std::array<uint32_t, 3> subsampling;
+    };
 
-    std::vector<Plane> planes;
-    planes.emplace_back(/*stride=*/static_cast<uint32_t>(width),
-        /*offset=*/0);
+    constexpr DerivedFormat kDerivedFormats[] = {
+        { VA_FOURCC_NV12, 12, 0, 0, 0, 0, 2, { 1, 2 } },
+        { VA_FOURCC_I420, 12, 0, 0, 0, 0, 3, { 1, 2, 2 } },
+        { VA_FOURCC_P010, 24, 0, 0, 0, 0, 2, { 1, 2 } },
+        { VA_FOURCC_Y800, 8, 0, 0, 0, 0, 1, { 1 } },
+        // Byte order R, G, B, X in memory.
+        { VA_FOURCC_RGBX, 32, 24, 0x000000ff, 0x0000ff00, 0x00ff0000, 1, { 1 } },
+        { VA_FOURCC_BGRX, 32, 24, 0x00ff0000, 0x0000ff00, 0x000000ff, 1, { 1 } },
+        { VA_FOURCC_RGBP, 24, 0, 0, 0, 0, 3, { 1, 1, 1 } },
+    };
 
-    // TODO(b/358445928): bring back safe math.
-    // UV stride = ceil(width / 2) * 2.
-    uint32_t uv_stride = static_cast<uint32_t>(width);
-    uv_stride += 1;
-    uv_stride /= 2;
-    uv_stride *= 2;
+    const DerivedFormat *FindDerivedFormat(uint32_t fourcc)
+    {
+        for (const auto &derived_format : kDerivedFormats) {
+            if (derived_format.fourcc == fourcc) { return &derived_format; }
+        }
+        return nullptr;
+    }
+
+    // Formats of the images that own their buffer. The planes are stored one
+    // after the other without padding.
+    enum class PlaneLayout {
+        // 4:2:0 with Cb and Cr interleaved in a single plane.
+        kSemiPlanar,
+        // 4:2:0 with a plane per component.
+        kPlanar,
+        // A single plane of pixels, in pairs for 4:2:2.
+        kPacked,
+    };
 
-    // UV offset = Y plane size = width * height.
-    uint32_t uv_offset = static_cast<uint32_t>(width);
-    uv_offset *= static_cast<uint32_t>(height);
+    struct OwnedFormat
+    {
+        uint32_t fourcc;
+        uint32_t bits_per_pixel;
+        // Bytes per sample for 4:2:0, per pixel for packed formats.
+        uint32_t bytes_per_sample;
+        PlaneLayout layout;
+    };
 
-    planes.emplace_back(/*stride=*/uv_stride,
-        /*offset=*/uv_offset);
+    constexpr OwnedFormat kOwnedFormats[] = {
+        { VA_FOURCC_NV12, 12, 1, PlaneLayout::kSemiPlanar },
+        { VA_FOURCC_NV21, 12, 1, PlaneLayout::kSemiPlanar },
+        { VA_FOURCC_I420, 12, 1, PlaneLayout::kPlanar },
+        { VA_FOURCC_YV12, 12, 1, PlaneLayout::kPlanar },
+        { VA_FOURCC_P010, 24, 2, PlaneLayout::kSemiPlanar },
+        { VA_FOURCC_YUY2, 16, 2, PlaneLayout::kPacked },
+        { VA_FOURCC_UYVY, 16, 2, PlaneLayout::kPacked },
+        { VA_FOURCC_RGBX, 32, 4, PlaneLayout::kPacked },
+        { VA_FOURCC_BGRX, 32, 4, PlaneLayout::kPacked },
+    };
 
-    // UV plane size = ceil(height / 2) * UV stride.
-    uint32_t uv_size = static_cast<uint32_t>(height);
-    uv_size += 1;
-    uv_size /= 2;
-    uv_size *= uv_stride;
+    const OwnedFormat *FindOwnedFormat(uint32_t fourcc)
+    {
+        for (const auto &owned_format : kOwnedFormats) {
+            if (owned_format.fourcc == fourcc) { return &owned_format; }
+        }
+        return nullptr;
+    }
 
-    // Total size = UV offset + UV plane size.
-    const unsigned int data_size = uv_offset + uv_size;
+} // namespace
+
+std::unique_ptr<VSImage> VSImage::Create(IdType id, const VAImageFormat &format, int width,
+    int height, VSDriver &fake_driver, VAImage *va_image)
+{
+    CHECK(IsSupportedFormat(format));
+    const OwnedFormat &owned_format = *FindOwnedFormat(format.fourcc);
+
+    // TODO(b/358445928): bring back safe math.
+    const uint32_t chroma_width = (static_cast<uint32_t>(width) + 1) / 2;
+    const uint32_t chroma_height = (static_cast<uint32_t>(height) + 1) / 2;
+    // 4:2:2 rows hold whole pixel pairs.
+    const bool pixel_pairs = format.fourcc == VA_FOURCC_YUY2 || format.fourcc == VA_FOURCC_UYVY;
+    const uint32_t first_stride
+        = (pixel_pairs ? 2 * chroma_width : static_cast<uint32_t>(width))
+        * owned_format.bytes_per_sample;
+
+    // Y or the pixels, then either the interleaved CbCr plane or the two
+    // chroma planes.
+    std::vector<Plane> planes;
+    planes.emplace_back(/*stride=*/first_stride, /*offset=*/0);
+    uint32_t data_size = first_stride * static_cast<uint32_t>(height);
+    if (owned_format.layout == PlaneLayout::kSemiPlanar) {
+        const uint32_t uv_stride = 2 * chroma_width * owned_format.bytes_per_sample;
+        planes.emplace_back(/*stride=*/uv_stride, /*offset=*/data_size);
+        data_size += uv_stride * chroma_height;
+    } else if (owned_format.layout == PlaneLayout::kPlanar) {
+        for (int plane = 1; plane < 3; plane++) {
+            planes.emplace_back(/*stride=*/chroma_width, /*offset=*/data_size);
+            data_size += chroma_width * chroma_height;
+        }
+    }
 
     memset(va_image, 0, sizeof(VAImage));
     va_image->image_id = id;
@@ -66,16 +144,79 @@ std::unique_ptr<VSImage> VSImage::Create(IdType id, const VAImageFormat &format,
     va_image->width = static_cast<uint16_t>(width);
     va_image->height = static_cast<uint16_t>(height);
     va_image->data_size = data_size;
-    va_image->num_planes = 2;
-    va_image->pitches[0] = static_cast<uint32_t>(width);
-    va_image->pitches[1] = uv_stride;
-    va_image->offsets[0] = 0;
-    va_image->offsets[1] = uv_offset;
+    va_image->num_planes = static_cast<uint32_t>(planes.size());
+    for (size_t plane = 0; plane < planes.size(); plane++) {
+        va_image->pitches[plane] = planes[plane].stride;
+        va_image->offsets[plane] = planes[plane].offset;
+    }
 
     return base::WrapUnique(new VSImage(
         id, format, width, height, std::move(planes), fake_driver.GetBuffer(buf), fake_driver));
 }
 
+std::unique_ptr<VSImage> VSImage::Create(
+    IdType id, const VSSurface &surface, VSDriver &fake_driver, VAImage *va_image)
+{
+    CHECK(CanDerive(surface));
+    const DerivedFormat &derived_format = *FindDerivedFormat(surface.GetVAFourCC());
+    const ScopedBOMapping &mapped_bo = surface.GetMappedBO();
+
+    VAImageFormat format;
+    memset(&format, 0, sizeof(format));
+    format.fourcc = derived_format.fourcc;
+    format.byte_order = VA_LSB_FIRST;
+    format.bits_per_pixel = derived_format.bits_per_pixel;
+    format.depth = derived_format.depth;
+    format.red_mask = derived_format.red_mask;
+    format.green_mask = derived_format.green_mask;
+    format.blue_mask = derived_format.blue_mask;
+
+    memset(va_image, 0, sizeof(VAImage));
+    va_image->image_id = id;
+    va_image->format = format;
+    va_image->width = static_cast<uint16_t>(surface.GetWidth());
+    va_image->height = static_cast<uint16_t>(surface.GetHeight());
+    va_image->num_planes = derived_format.num_planes;
+
+    // The buffer starts at the first plane, the others are at the same
+    // distance from it as in the dma-buf.
+    std::vector<Plane> planes;
+    uint32_t data_size = 0;
+    for (uint32_t plane = 0; plane < derived_format.num_planes; plane++) {
+        const uint32_t stride = mapped_bo.GetPlaneStride(plane);
+        const uint32_t offset = mapped_bo.GetPlaneOffset(plane) - mapped_bo.GetPlaneOffset(0);
+        const uint32_t subsampling = derived_format.subsampling[plane];
+        const uint32_t rows = (surface.GetHeight() + subsampling - 1) / subsampling;
+        planes.emplace_back(stride, offset);
+        va_image->pitches[plane] = stride;
+        va_image->offsets[plane] = offset;
+        data_size = std::max(data_size, offset + stride * rows);
+    }
+    va_image->data_size = data_size;
+
+    VSBuffer::IdType buf = fake_driver.CreateBuffer(
+        VAImageBufferType, data_size, mapped_bo.GetContiguousData(), mapped_bo);
+    va_image->buf = buf;
+
+    return base::WrapUnique(new VSImage(id, format, static_cast<int>(surface.GetWidth()),
+        static_cast<int>(surface.GetHeight()), std::move(planes), fake_driver.GetBuffer(buf),
+        fake_driver));
+}
+
+bool VSImage::IsSupportedFormat(const VAImageFormat &format)
+{
+    return format.byte_order == VA_LSB_FIRST && FindOwnedFormat(format.fourcc);
+}
+
+bool VSImage::CanDerive(const VSSurface &surface)
+{
+    const ScopedBOMapping &mapped_bo = surface.GetMappedBO();
+    if (!mapped_bo.IsValid() || surface.GetModifier() != DRM_FORMAT_MOD_LINEAR) { return false; }
+    const DerivedFormat *derived_format = FindDerivedFormat(surface.GetVAFourCC());
+    return derived_format && mapped_bo.GetNumPlanes() == derived_format->num_planes
+        && mapped_bo.GetContiguousData();
+}
+
 VSImage::VSImage(VSImage::IdType id, const VAImageFormat &format, int width, int height,
     std::vector<Plane> planes, const VSBuffer &buffer, VSDriver &driver)
     : id_(id)
@@ -16,6 +16,7 @@ namespace libvavc8000d
 
 class VSBuffer;
 class VSDriver;
+class VSSurface;
 
 // Class used for tracking a VAImage and all information relevant to it.
 //
@@ -27,7 +28,9 @@ class VSDriver;
 // the VSBuffer is thread-safe, writes and reads to this buffer must be
 // synchronized externally.
 //
-// Note: Currently the VSImage only supports the NV12 image format.
+// Images created with vaCreateImage() own their buffer and support the NV12,
+// NV21, I420, YV12, P010, YUY2, UYVY, RGBX and BGRX formats. Derived images
+// wrap the memory of a surface in its format.
 class VSImage
 {
 public:
@@ -41,6 +44,21 @@ public:
     static std::unique_ptr<VSImage> Create(IdType id, const VAImageFormat &format, int width,
         int height, VSDriver &fake_driver, VAImage *va_image);
 
+    // Returns whether images in |format| can be created with the Create()
+    // above.
+    static bool IsSupportedFormat(const VAImageFormat &format);
+
+    // Creates a VSImage whose buffer aliases the mapped planes of |surface|, for
+    // vaDeriveImage(). CanDerive() must be true for |surface|, which must
+    // outlive the created `VSImage`.
+    static std::unique_ptr<VSImage> Create(
+        IdType id, const VSSurface &surface, VSDriver &fake_driver, VAImage *va_image);
+
+    // Returns whether clients can access the memory of |surface| in place: it
+    // must be linear and mapped for the CPU with all its planes addressable
+    // from one pointer.
+    static bool CanDerive(const VSSurface &surface);
+
     VSImage(const VSImage &) = delete;
     VSImage &operator=(const VSImage &) = delete;
     ~VSImage();
@@ -0,0 +1,428 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "image_transfer.h"
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "base/color_conversion.h"
+#include "base/detile.h"
+#include "base/image_region.h"
+#include "base/logging.h"
+#include "base/plane_copy.h"
+#include "buffer.h"
+#include "image.h"
+#include "output_picture.h"
+#include "surface.h"
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // Tiled surfaces use 4x4 tiles, whose rows are four pixel rows apart.
+    constexpr uint32_t kTileSize = 4;
+
+    // Planes of an image, in Y, Cb, Cr order. Semi-planar images only use the
+    // first two, and packed ones the first one.
+    struct ImagePlanes
+    {
+        uint8_t *data[3];
+        uint32_t stride[3];
+    };
+
+    ImagePlanes GetImagePlanes(const VSImage &image)
+    {
+        ImagePlanes planes = {};
+        uint8_t *const base = static_cast<uint8_t *>(image.GetBuffer().GetData());
+        uint32_t num_planes = 1;
+        switch (image.GetFormat().fourcc) {
+        case VA_FOURCC_NV12:
+        case VA_FOURCC_NV21:
+        case VA_FOURCC_P010: num_planes = 2; break;
+        case VA_FOURCC_I420:
+        case VA_FOURCC_YV12: num_planes = 3; break;
+        default: break;
+        }
+        for (uint32_t plane = 0; plane < num_planes; plane++) {
+            planes.data[plane] = base + image.GetPlaneOffset(plane);
+            planes.stride[plane] = image.GetPlaneStride(plane);
+        }
+        // YV12 stores Cr before Cb.
+        if (image.GetFormat().fourcc == VA_FOURCC_YV12) {
+            std::swap(planes.data[1], planes.data[2]);
+            std::swap(planes.stride[1], planes.stride[2]);
+        }
+        return planes;
+    }
+
+    // Returns whether images in |fourcc| can be read from surfaces in |format|.
+    bool CanRead(SurfaceFormat format, uint32_t fourcc)
+    {
+        switch (format) {
+        case SurfaceFormat::kNV12:
+            return fourcc == VA_FOURCC_NV12 || fourcc == VA_FOURCC_I420
+                || fourcc == VA_FOURCC_YV12;
+        case SurfaceFormat::kI420: return fourcc == VA_FOURCC_I420 || fourcc == VA_FOURCC_YV12;
+        case SurfaceFormat::kP010: return fourcc == VA_FOURCC_P010;
+        default: return false;
+        }
+    }
+
+    // Returns whether images in |fourcc| can be written to surfaces in
+    // |format|.
+    bool CanWrite(SurfaceFormat format, uint32_t fourcc)
+    {
+        const bool yuv420 = fourcc == VA_FOURCC_NV12 || fourcc == VA_FOURCC_I420
+            || fourcc == VA_FOURCC_YV12;
+        switch (format) {
+        case SurfaceFormat::kNV12: return yuv420;
+        case SurfaceFormat::kP010: return yuv420 || fourcc == VA_FOURCC_P010;
+        default: return false;
+        }
+    }
+
+    // Writes 8-bit samples to a surface plane, as they are or, for P010
+    // surfaces, as 16-bit samples.
+    void WriteSamples(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride,
+        uint32_t samples, uint32_t rows, bool expand)
+    {
+        if (expand) {
+            base::ExpandPlaneTo16Bit(src, src_stride, dst, dst_stride, samples, rows);
+        } else {
+            base::CopyPlane(src, src_stride, dst, dst_stride, samples, rows);
+        }
+    }
+
+    // Formats converted through an I420 copy of the region in cached memory.
+    bool IsConvertedFormat(uint32_t fourcc)
+    {
+        switch (fourcc) {
+        case VA_FOURCC_NV21:
+        case VA_FOURCC_YUY2:
+        case VA_FOURCC_UYVY:
+        case VA_FOURCC_RGBX:
+        case VA_FOURCC_BGRX: return true;
+        default: return false;
+        }
+    }
+
+    base::PackedFormat GetPackedFormat(uint32_t fourcc)
+    {
+        switch (fourcc) {
+        case VA_FOURCC_YUY2: return base::PackedFormat::kYUY2;
+        case VA_FOURCC_UYVY: return base::PackedFormat::kUYVY;
+        case VA_FOURCC_RGBX: return base::PackedFormat::kRGBX;
+        case VA_FOURCC_BGRX: return base::PackedFormat::kBGRX;
+        default: CHECK(false); return base::PackedFormat::kYUY2;
+        }
+    }
+
+    // Neither VA images nor surfaces carry a colour description, and the size
+    // of a surface says nothing about the stream decoded into it, which may be
+    // cropped or scaled. RGB images are converted with limited range BT.601,
+    // the usual default for YUV without a colour description.
+    constexpr base::ColorSpace kImageColorSpace
+        = { .matrix = base::ColorMatrix::kBT601, .full_range = false };
+
+    // A picture in I420 in cached memory.
+    struct I420Picture
+    {
+        I420Picture(uint32_t width, uint32_t height)
+            : chroma_width((width + 1) / 2)
+            , chroma_height((height + 1) / 2)
+            , data(width * height + 2 * chroma_width * chroma_height)
+        {
+            planes.data[0] = data.data();
+            planes.stride[0] = width;
+            planes.data[1] = planes.data[0] + width * height;
+            planes.stride[1] = chroma_width;
+            planes.data[2] = planes.data[1] + chroma_width * chroma_height;
+            planes.stride[2] = chroma_width;
+        }
+
+        const uint32_t chroma_width;
+        const uint32_t chroma_height;
+        std::vector<uint8_t> data;
+        ImagePlanes planes = {};
+    };
+
+    // Converts the |width| x |height| picture |i420| to the planes of an
+    // image in |fourcc|, one of the converted formats.
+    void ConvertFromI420(const I420Picture &i420, uint32_t width, uint32_t height,
+        const ImagePlanes &dst, uint32_t fourcc, const base::ColorSpace &color_space)
+    {
+        const ImagePlanes &src = i420.planes;
+        if (fourcc == VA_FOURCC_NV21) {
+            base::CopyPlane(src.data[0], src.stride[0], dst.data[0], dst.stride[0], width, height);
+            base::MergeUVPlane(src.data[2], src.stride[2], src.data[1], src.stride[1],
+                dst.data[1], dst.stride[1], i420.chroma_width, i420.chroma_height);
+            return;
+        }
+        base::I420ToPacked(src.data[0], src.stride[0], src.data[1], src.stride[1], src.data[2],
+            src.stride[2], dst.data[0], dst.stride[0], width, height, GetPackedFormat(fourcc),
+            color_space);
+    }
+
+    // Converts the |width| x |height| region at (|x|, |y|) of the planes of an
+    // image in |fourcc|, one of the converted formats, to |i420|. 4:2:2
+    // regions start on the pixel pair of |x|.
+    void ConvertToI420(const ImagePlanes &src, uint32_t fourcc, uint32_t x, uint32_t y,
+        uint32_t width, uint32_t height, I420Picture &i420, const base::ColorSpace &color_space)
+    {
+        const ImagePlanes &dst = i420.planes;
+        if (fourcc == VA_FOURCC_NV21) {
+            base::CopyPlane(src.data[0] + y * src.stride[0] + x, src.stride[0], dst.data[0],
+                dst.stride[0], width, height);
+            base::SplitUVPlane(src.data[1] + y / 2 * src.stride[1] + x / 2 * 2, src.stride[1],
+                dst.data[2], dst.stride[2], dst.data[1], dst.stride[1], i420.chroma_width,
+                i420.chroma_height);
+            return;
+        }
+        const base::PackedFormat format = GetPackedFormat(fourcc);
+        const uint32_t offset = format == base::PackedFormat::kRGBX
+                || format == base::PackedFormat::kBGRX
+            ? 4 * x
+            : 4 * (x / 2);
+        base::PackedToI420(src.data[0] + y * src.stride[0] + offset, src.stride[0], dst.data[0],
+            dst.stride[0], dst.data[1], dst.stride[1], dst.data[2], dst.stride[2], width, height,
+            format, color_space);
+    }
+
+    // Copies the |width| x |height| region at (|x|, |y|) of the surface
+    // accessed through |src| to |dst|, the planes of an image in |dst_fourcc|.
+    // The region and formats must have been validated.
+    void ReadSurface(const ScopedBOMapping::ScopedAccess &src, SurfaceFormat surface_format,
+        bool tiled, uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+        const ImagePlanes &dst, uint32_t dst_fourcc)
+    {
+        const bool split_chroma = surface_format == SurfaceFormat::kNV12
+            && dst_fourcc != VA_FOURCC_NV12;
+        // Chroma samples covering the region. Regions at odd positions start in
+        // the middle of a sample.
+        const uint32_t chroma_x = x / 2;
+        const uint32_t chroma_y = y / 2;
+        const uint32_t chroma_width = (width + 1) / 2;
+        const uint32_t chroma_height = (height + 1) / 2;
+
+        if (tiled) {
+            // Tiles are 16 bytes, so a tile column starts every four bytes.
+            base::DetilePlane(src.GetData(0) + y * src.GetStride(0) + x * kTileSize,
+                kTileSize * src.GetStride(0), dst.data[0], dst.stride[0], width, height,
+                base::TileShape::k4x4);
+            const uint8_t *const src_uv = src.GetData(1) + chroma_y * src.GetStride(1)
+                + 2 * chroma_x * kTileSize;
+            if (!split_chroma) {
+                base::DetilePlane(src_uv, kTileSize * src.GetStride(1), dst.data[1], dst.stride[1],
+                    2 * chroma_width, chroma_height, base::TileShape::k4x4);
+                return;
+            }
+            // Detiling and splitting both reorder the bytes, so the chroma goes
+            // through a linear copy in cached memory.
+            std::vector<uint8_t> uv(2 * chroma_width * chroma_height);
+            base::DetilePlane(src_uv, kTileSize * src.GetStride(1), uv.data(), 2 * chroma_width,
+                2 * chroma_width, chroma_height, base::TileShape::k4x4);
+            base::SplitUVPlane(uv.data(), 2 * chroma_width, dst.data[1], dst.stride[1], dst.data[2],
+                dst.stride[2], chroma_width, chroma_height);
+            return;
+        }
+
+        const uint32_t bytes_per_sample = surface_format == SurfaceFormat::kP010 ? 2 : 1;
+        base::CopyPlane(src.GetData(0) + y * src.GetStride(0) + x * bytes_per_sample,
+            src.GetStride(0), dst.data[0], dst.stride[0], width * bytes_per_sample, height);
+        if (surface_format == SurfaceFormat::kI420) {
+            for (size_t plane = 1; plane < 3; plane++) {
+                base::CopyPlane(src.GetData(plane) + chroma_y * src.GetStride(plane) + chroma_x,
+                    src.GetStride(plane), dst.data[plane], dst.stride[plane], chroma_width,
+                    chroma_height);
+            }
+            return;
+        }
+        const uint8_t *const src_uv
+            = src.GetData(1) + chroma_y * src.GetStride(1) + 2 * chroma_x * bytes_per_sample;
+        if (split_chroma) {
+            base::SplitUVPlane(src_uv, src.GetStride(1), dst.data[1], dst.stride[1], dst.data[2],
+                dst.stride[2], chroma_width, chroma_height);
+        } else {
+            base::CopyPlane(src_uv, src.GetStride(1), dst.data[1], dst.stride[1],
+                2 * chroma_width * bytes_per_sample, chroma_height);
+        }
+    }
+
+} // namespace
+
+VAStatus GetSurfaceImage(const VSSurface &surface, int x, int y, uint32_t width, uint32_t height,
+    const VSImage &image)
+{
+    if (!base::IsRegionWithin(x, y, width, height, surface.GetWidth(), surface.GetHeight())
+        || width > static_cast<uint32_t>(image.GetWidth())
+        || height > static_cast<uint32_t>(image.GetHeight())) {
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+    const SurfaceFormat surface_format = GetSurfaceFormat(surface);
+    const uint32_t fourcc = image.GetFormat().fourcc;
+    if (!CanRead(surface_format, IsConvertedFormat(fourcc) ? VA_FOURCC_I420 : fourcc)) {
+        return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+    }
+    const bool tiled = GetSurfaceLayout(surface) == SurfaceLayout::kTiled4x4;
+    if (tiled && !base::IsTileAligned(x, y)) {
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    // TODO(b/316609501): Look into replacing this and making this function
+    // operate the same for both testing and non-testing environments.
+    const ScopedBOMapping &bo_mapping = surface.GetMappedBO();
+    if (!bo_mapping.IsValid()) { return VA_STATUS_SUCCESS; }
+
+    // Reads don't need the CPU writes to be flushed afterwards.
+    constexpr ScopedBOMapping::AccessMode kRead = ScopedBOMapping::AccessMode::kRead;
+    if (!IsConvertedFormat(fourcc)) {
+        ReadSurface(bo_mapping.BeginAccess(kRead), surface_format, tiled, x, y, width, height,
+            GetImagePlanes(image), fourcc);
+        return VA_STATUS_SUCCESS;
+    }
+    I420Picture i420(width, height);
+    ReadSurface(bo_mapping.BeginAccess(kRead), surface_format, tiled, x, y, width, height,
+        i420.planes, VA_FOURCC_I420);
+    ConvertFromI420(i420, width, height, GetImagePlanes(image), fourcc, kImageColorSpace);
+    return VA_STATUS_SUCCESS;
+}
+
+VAStatus PutSurfaceImage(const VSSurface &surface, const VSImage &image, int src_x, int src_y,
+    uint32_t src_width, uint32_t src_height, int dest_x, int dest_y, uint32_t dest_width,
+    uint32_t dest_height)
+{
+    if (!base::IsRegionWithin(src_x, src_y, src_width, src_height,
+            static_cast<uint32_t>(image.GetWidth()), static_cast<uint32_t>(image.GetHeight()))
+        || !base::IsRegionWithin(dest_x, dest_y, dest_width, dest_height, surface.GetWidth(),
+            surface.GetHeight())
+        || !base::IsChromaAligned(dest_x, dest_y)) {
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+    const SurfaceFormat surface_format = GetSurfaceFormat(surface);
+    uint32_t fourcc = image.GetFormat().fourcc;
+    const bool convert = IsConvertedFormat(fourcc);
+    if (!CanWrite(surface_format, convert ? VA_FOURCC_I420 : fourcc)) {
+        return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+    }
+    const bool same_size = src_width == dest_width && src_height == dest_height;
+    const bool halve = !same_size && base::IsHalf(src_width, dest_width)
+        && base::IsHalf(src_height, dest_height) && fourcc != VA_FOURCC_P010;
+    // Other scaling ratios are left to the video processor.
+    if (GetSurfaceLayout(surface) != SurfaceLayout::kLinear || !(same_size || halve)) {
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+    }
+
+    // TODO(b/316609501): Look into replacing this and making this function
+    // operate the same for both testing and non-testing environments.
+    const ScopedBOMapping &bo_mapping = surface.GetMappedBO();
+    if (!bo_mapping.IsValid()) { return VA_STATUS_SUCCESS; }
+
+    ImagePlanes src = GetImagePlanes(image);
+    std::optional<I420Picture> converted;
+    if (convert) {
+        converted.emplace(src_width, src_height);
+        ConvertToI420(src, fourcc, static_cast<uint32_t>(src_x), static_cast<uint32_t>(src_y),
+            src_width, src_height, *converted, kImageColorSpace);
+        src = converted->planes;
+        fourcc = VA_FOURCC_I420;
+        src_x = src_y = 0;
+    }
+
+    const ScopedBOMapping::ScopedAccess dst = bo_mapping.BeginAccess();
+    const bool dst_16bit = surface_format == SurfaceFormat::kP010;
+    const uint32_t bytes_per_sample = dst_16bit ? 2 : 1;
+    // The destination starts on a chroma sample, whose Cb/Cr pair is as wide
+    // as two luma samples.
+    uint8_t *const dst_y
+        = dst.GetData(0) + dest_y * dst.GetStride(0) + dest_x * bytes_per_sample;
+    uint8_t *const dst_uv
+        = dst.GetData(1) + dest_y / 2 * dst.GetStride(1) + dest_x * bytes_per_sample;
+    const uint32_t src_chroma_x = static_cast<uint32_t>(src_x) / 2;
+    const uint32_t src_chroma_y = static_cast<uint32_t>(src_y) / 2;
+    const uint32_t src_chroma_width = (src_width + 1) / 2;
+    const uint32_t src_chroma_height = (src_height + 1) / 2;
+    const uint32_t dest_chroma_width = (dest_width + 1) / 2;
+    const uint32_t dest_chroma_height = (dest_height + 1) / 2;
+
+    if (fourcc == VA_FOURCC_P010) {
+        base::CopyPlane(src.data[0] + src_y * src.stride[0] + 2 * src_x, src.stride[0], dst_y,
+            dst.GetStride(0), 2 * dest_width, dest_height);
+        base::CopyPlane(src.data[1] + src_chroma_y * src.stride[1] + 4 * src_chroma_x,
+            src.stride[1], dst_uv, dst.GetStride(1), 4 * dest_chroma_width, dest_chroma_height);
+        return VA_STATUS_SUCCESS;
+    }
+
+    // The 8-bit paths below prepare what needs reordering in cached memory,
+    // so that the surface only sees the final writes.
+    const uint8_t *const src_luma = src.data[0] + src_y * src.stride[0] + src_x;
+    if (same_size) {
+        WriteSamples(src_luma, src.stride[0], dst_y, dst.GetStride(0), dest_width, dest_height,
+            dst_16bit);
+    } else if (!dst_16bit) {
+        base::HalvePlane(src_luma, src.stride[0], src_width, src_height, dst_y, dst.GetStride(0),
+            dest_width, dest_height);
+    } else {
+        std::vector<uint8_t> luma(dest_width * dest_height);
+        base::HalvePlane(src_luma, src.stride[0], src_width, src_height, luma.data(), dest_width,
+            dest_width, dest_height);
+        base::ExpandPlaneTo16Bit(
+            luma.data(), dest_width, dst_y, dst.GetStride(0), dest_width, dest_height);
+    }
+
+    // Planar Cb and Cr of the source region.
+    const uint8_t *src_u, *src_v;
+    size_t src_u_stride, src_v_stride;
+    std::vector<uint8_t> split;
+    if (fourcc == VA_FOURCC_NV12) {
+        const uint8_t *const src_uv
+            = src.data[1] + src_chroma_y * src.stride[1] + 2 * src_chroma_x;
+        if (same_size) {
+            WriteSamples(src_uv, src.stride[1], dst_uv, dst.GetStride(1), 2 * dest_chroma_width,
+                dest_chroma_height, dst_16bit);
+            return VA_STATUS_SUCCESS;
+        }
+        split.resize(2 * src_chroma_width * src_chroma_height);
+        src_u = split.data();
+        src_v = split.data() + src_chroma_width * src_chroma_height;
+        src_u_stride = src_v_stride = src_chroma_width;
+        base::SplitUVPlane(src_uv, src.stride[1], split.data(), src_chroma_width,
+            split.data() + src_chroma_width * src_chroma_height, src_chroma_width,
+            src_chroma_width, src_chroma_height);
+    } else {
+        src_u = src.data[1] + src_chroma_y * src.stride[1] + src_chroma_x;
+        src_v = src.data[2] + src_chroma_y * src.stride[2] + src_chroma_x;
+        src_u_stride = src.stride[1];
+        src_v_stride = src.stride[2];
+    }
+
+    std::vector<uint8_t> halved;
+    if (halve) {
+        const size_t plane_size = dest_chroma_width * dest_chroma_height;
+        halved.resize(2 * plane_size);
+        base::HalvePlane(src_u, src_u_stride, src_chroma_width, src_chroma_height, halved.data(),
+            dest_chroma_width, dest_chroma_width, dest_chroma_height);
+        base::HalvePlane(src_v, src_v_stride, src_chroma_width, src_chroma_height,
+            halved.data() + plane_size, dest_chroma_width, dest_chroma_width, dest_chroma_height);
+        src_u = halved.data();
+        src_v = halved.data() + plane_size;
+        src_u_stride = src_v_stride = dest_chroma_width;
+    }
+
+    if (!dst_16bit) {
+        base::MergeUVPlane(src_u, src_u_stride, src_v, src_v_stride, dst_uv, dst.GetStride(1),
+            dest_chroma_width, dest_chroma_height);
+        return VA_STATUS_SUCCESS;
+    }
+    std::vector<uint8_t> merged(2 * dest_chroma_width * dest_chroma_height);
+    base::MergeUVPlane(src_u, src_u_stride, src_v, src_v_stride, merged.data(),
+        2 * dest_chroma_width, dest_chroma_width, dest_chroma_height);
+    base::ExpandPlaneTo16Bit(merged.data(), 2 * dest_chroma_width, dst_uv, dst.GetStride(1),
+        2 * dest_chroma_width, dest_chroma_height);
+    return VA_STATUS_SUCCESS;
+}
+
+} // namespace libvavc8000d
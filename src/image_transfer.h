@@ -0,0 +1,48 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IMAGE_TRANSFER_H_
+#define IMAGE_TRANSFER_H_
+
+#include <cstdint>
+#include <va/va.h>
+
+namespace libvavc8000d
+{
+
+class VSImage;
+class VSSurface;
+
+// Copies the |width| x |height| region of |surface| at (|x|, |y|) to the
+// top-left corner of |image|, for vaGetImage(). NV12 surfaces can be read into
+// NV12, I420 and YV12 images, I420 surfaces into I420 and YV12 images and
+// P010 surfaces into P010 images. 8-bit surfaces can also be read into NV21,
+// YUY2, UYVY, RGBX and BGRX images, which are converted from an I420 copy,
+// RGB with limited range BT.601. Tiled surfaces are detiled on the way, and
+// then the region must start on a whole tile of both planes: |x| must be a
+// multiple of 4 and |y| of 8. The surface is read once, with the widest loads
+// available, as its memory is usually uncached. This is a no-op for surfaces
+// without a CPU mapping.
+VAStatus GetSurfaceImage(const VSSurface &surface, int x, int y, uint32_t width, uint32_t height,
+    const VSImage &image);
+
+// Copies the |src_width| x |src_height| region of |image| at (|src_x|,
+// |src_y|) to the |dest_width| x |dest_height| region of |surface| at
+// (|dest_x|, |dest_y|), for vaPutImage(). NV12, I420 and YV12 images can be
+// written to NV12 and P010 surfaces, and P010 images to P010 surfaces. NV21,
+// YUY2, UYVY, RGBX and BGRX images are converted to I420 first, RGB with
+// limited range BT.601. 8-bit images can also be downscaled by two, the
+// destination region then being half the size of the source region, rounded
+// either way. The destination region must start at even coordinates, so that
+// it covers whole chroma samples. Only linear surfaces are supported. The
+// surface is written once, in whole cache lines where possible, and is
+// synchronized for CPU access around the writes. This is a no-op for surfaces
+// without a CPU mapping.
+VAStatus PutSurfaceImage(const VSSurface &surface, const VSImage &image, int src_x, int src_y,
+    uint32_t src_width, uint32_t src_height, int dest_x, int dest_y, uint32_t dest_width,
+    uint32_t dest_height);
+
+} // namespace libvavc8000d
+
+#endif // IMAGE_TRANSFER_H_
@@ -0,0 +1,414 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "mpeg4_decoder_delegate.h"
+
+#include "base/bit_writer.h"
+#include "base/logging.h"
+#include "basetype.h"
+#include "buffer.h"
+#include "decapicommon.h"
+#include "decode_engine.h"
+#include "dwl.h"
+#include "output_picture.h"
+#include "mp4decapi.h"
+#include "surface.h"
+#include <cstring>
+#include <iostream>
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // Start code values, see ISO/IEC 14496-2 table 6-3.
+    enum Mpeg4StartCode : uint8_t {
+        kStartCodeVideoObject = 0x00,
+        kStartCodeVideoObjectLayer = 0x20,
+        kStartCodeVisualObjectSequence = 0xB0,
+        kStartCodeVisualObject = 0xB5,
+    };
+
+    enum Mpeg4VideoObjectType : uint8_t {
+        kVideoObjectTypeSimple = 1,
+        kVideoObjectTypeAdvancedSimple = 17,
+    };
+
+    // The highest level of each profile, since the level is not carried by the
+    // VA buffers.
+    enum Mpeg4ProfileAndLevel : uint8_t {
+        kSimpleProfileLevel3 = 0x03,
+        kAdvancedSimpleProfileLevel5 = 0xF5,
+    };
+
+    // VAPictureParameterBufferMPEG4::vop_fields.bits.vop_coding_type values.
+    constexpr uint32_t kVopCodingTypeI = 0;
+
+    // sprite_enable value for global motion compensation.
+    constexpr uint32_t kSpriteGmc = 2;
+
+    constexpr size_t kQuantMatrixSize = 64;
+
+    // Writes the MPEG-4 Part 2 headers the driver has to rebuild. MPEG-4 start
+    // codes cannot be emulated by the header syntax, so unlike H.264 and VC-1 no
+    // escaping is needed.
+    using Mpeg4HeaderWriter = base::BitWriter<base::NoEmulationPrevention>;
+
+    void AppendStartCode(Mpeg4StartCode start_code, Mpeg4HeaderWriter &writer)
+    {
+        writer.AppendRawBytes({ 0x00, 0x00, 0x01, start_code });
+    }
+
+    void AppendMarker(Mpeg4HeaderWriter &writer) { writer.AppendBool(1); }
+
+    // next_start_code(): a zero bit followed by one bits up to the next byte
+    // boundary.
+    void NextStartCode(Mpeg4HeaderWriter &writer)
+    {
+        writer.AppendBool(0);
+        writer.AlignToByte(/*fill_bit=*/true);
+    }
+
+    // Builds the visual object sequence, visual object and video object
+    // headers following ISO/IEC 14496-2 sections 6.2.2 and 6.2.3.
+    void BuildVisualObjectHeaders(VAProfile profile, Mpeg4HeaderWriter &writer)
+    {
+        AppendStartCode(kStartCodeVisualObjectSequence, writer);
+        writer.AppendBits(8,
+            profile == VAProfileMPEG4Simple
+                ? kSimpleProfileLevel3
+                : kAdvancedSimpleProfileLevel5); // profile_and_level_indication.
+
+        AppendStartCode(kStartCodeVisualObject, writer);
+        writer.AppendBool(0); // is_visual_object_identifier.
+        writer.AppendBits(4, 1); // visual_object_type: video ID.
+        writer.AppendBool(0); // video_signal_type.
+        NextStartCode(writer);
+
+        AppendStartCode(kStartCodeVideoObject, writer);
+    }
+
+    void AppendQuantMatrix(const uint8_t *matrix, Mpeg4HeaderWriter &writer)
+    {
+        // VA passes the matrices in zigzag scan order, which is also the order of
+        // the bitstream.
+        for (size_t i = 0; i < kQuantMatrixSize; i++) { writer.AppendBits(8, matrix[i]); }
+    }
+
+    // Builds the video object layer header following ISO/IEC 14496-2 section
+    // 6.2.3.
+    void BuildVideoObjectLayer(const VAPictureParameterBufferMPEG4 &pic_param,
+        const VAIQMatrixBufferMPEG4 *iq_matrix, VAProfile profile, Mpeg4HeaderWriter &writer)
+    {
+        const bool advanced_simple = profile == VAProfileMPEG4AdvancedSimple;
+        // Tools beyond Simple profile (quarter_sample, GMC) need a version 2 VOL.
+        const uint32_t verid = advanced_simple ? 5 : 1;
+
+        AppendStartCode(kStartCodeVideoObjectLayer, writer);
+        writer.AppendBool(0); // random_accessible_vol.
+        writer.AppendBits(8,
+            advanced_simple ? kVideoObjectTypeAdvancedSimple
+                            : kVideoObjectTypeSimple); // video_object_type_indication.
+        writer.AppendBool(verid != 1); // is_object_layer_identifier.
+        if (verid != 1) {
+            writer.AppendBits(4, verid); // video_object_layer_verid.
+            writer.AppendBits(3, 1); // video_object_layer_priority.
+        }
+        writer.AppendBits(4, 1); // aspect_ratio_info: square pixels.
+        writer.AppendBool(0); // vol_control_parameters.
+        writer.AppendBits(2, 0); // video_object_layer_shape: rectangular.
+        AppendMarker(writer);
+        writer.AppendBits(16, pic_param.vop_time_increment_resolution);
+        AppendMarker(writer);
+        writer.AppendBool(0); // fixed_vop_rate.
+        AppendMarker(writer);
+        writer.AppendBits(13, pic_param.vop_width); // video_object_layer_width.
+        AppendMarker(writer);
+        writer.AppendBits(13, pic_param.vop_height); // video_object_layer_height.
+        AppendMarker(writer);
+        writer.AppendBool(pic_param.vol_fields.bits.interlaced); // interlaced.
+        writer.AppendBool(pic_param.vol_fields.bits.obmc_disable); // obmc_disable.
+        if (verid == 1) {
+            writer.AppendBool(pic_param.vol_fields.bits.sprite_enable); // sprite_enable.
+        } else {
+            writer.AppendBits(2, pic_param.vol_fields.bits.sprite_enable); // sprite_enable.
+        }
+        if (pic_param.vol_fields.bits.sprite_enable) {
+            // Static sprites are not part of any profile the hardware supports.
+            CHECK_EQ(pic_param.vol_fields.bits.sprite_enable, kSpriteGmc);
+            writer.AppendBits(6, pic_param.no_of_sprite_warping_points);
+            writer.AppendBits(2, pic_param.vol_fields.bits.sprite_warping_accuracy);
+            writer.AppendBool(0); // sprite_brightness_change.
+        }
+        writer.AppendBool(0); // not_8_bit.
+        writer.AppendBool(pic_param.vol_fields.bits.quant_type); // quant_type.
+        if (pic_param.vol_fields.bits.quant_type) {
+            const bool load_intra = iq_matrix && iq_matrix->load_intra_quant_mat;
+            writer.AppendBool(load_intra); // load_intra_quant_mat.
+            if (load_intra) { AppendQuantMatrix(iq_matrix->intra_quant_mat, writer); }
+            const bool load_non_intra = iq_matrix && iq_matrix->load_non_intra_quant_mat;
+            writer.AppendBool(load_non_intra); // load_nonintra_quant_mat.
+            if (load_non_intra) { AppendQuantMatrix(iq_matrix->non_intra_quant_mat, writer); }
+        }
+        if (verid != 1) {
+            writer.AppendBool(pic_param.vol_fields.bits.quarter_sample); // quarter_sample.
+        }
+        writer.AppendBool(1); // complexity_estimation_disable.
+        writer.AppendBool(
+            pic_param.vol_fields.bits.resync_marker_disable); // resync_marker_disable.
+        writer.AppendBool(pic_param.vol_fields.bits.data_partitioned); // data_partitioned.
+        if (pic_param.vol_fields.bits.data_partitioned) {
+            writer.AppendBool(pic_param.vol_fields.bits.reversible_vlc); // reversible_vlc.
+        }
+        if (verid != 1) {
+            writer.AppendBool(0); // newpred_enable.
+            writer.AppendBool(0); // reduced_resolution_vop_enable.
+        }
+        writer.AppendBool(0); // scalability.
+        NextStartCode(writer);
+    }
+
+} // namespace
+
+struct Mpeg4DecodeTraits
+{
+    using Inst = MP4DecInst;
+    using Input = MP4DecInput;
+    using Output = MP4DecOutput;
+    using Picture = MP4DecPicture;
+    using BufferInfo = MP4DecBufferInfo;
+    using Ret = MP4DecRet;
+
+    static DecodeEvent Classify(Ret ret)
+    {
+        switch (ret) {
+        case MP4DEC_OK:
+        case MP4DEC_HDRS_RDY:
+        case MP4DEC_DP_HDRS_RDY: return ret == MP4DEC_OK ? DecodeEvent::kContinue
+                                                         : DecodeEvent::kHeadersReady;
+        case MP4DEC_PIC_DECODED: return DecodeEvent::kPictureDecoded;
+        case MP4DEC_STRM_PROCESSED:
+        case MP4DEC_NONREF_PIC_SKIPPED:
+        case MP4DEC_VOS_END: return DecodeEvent::kStreamProcessed;
+        case MP4DEC_WAITING_FOR_BUFFER: return DecodeEvent::kWaitingForBuffer;
+        default: return DecodeEvent::kError;
+        }
+    }
+
+    static Ret Decode(Inst inst, Input *input, Output *output)
+    {
+        return MP4DecDecode(inst, input, output);
+    }
+
+    static bool NextPicture(Inst inst, Picture *picture)
+    {
+        auto ret = MP4DecNextPicture(inst, picture, 0);
+        return ret == MP4DEC_PIC_RDY || ret == MP4DEC_FLUSHED;
+    }
+
+    static void PictureConsumed(Inst inst, Picture *picture)
+    {
+        MP4DecPictureConsumed(inst, picture);
+    }
+
+    static void GetBufferInfo(Inst inst, BufferInfo *buffer_info)
+    {
+        MP4DecGetBufferInfo(inst, buffer_info);
+    }
+
+    static void AddBuffer(Inst inst, DWLLinearMem *mem) { MP4DecAddBuffer(inst, mem); }
+
+    static void Abort(Inst inst) { MP4DecAbort(inst); }
+
+    static void SetInput(
+        Input &input, const DWLLinearMem &stream_mem, uint32_t size, uint32_t pic_id)
+    {
+        input.stream = reinterpret_cast<uint8_t *>(stream_mem.virtual_address);
+        input.stream_bus_address = stream_mem.bus_address;
+        input.data_len = size;
+        input.pic_id = pic_id;
+        input.skip_non_reference = 0;
+    }
+
+    static void AdvanceInput(Input &input, const Output &output)
+    {
+        input.stream = output.strm_curr_pos;
+        input.data_len = output.data_left;
+        input.stream_bus_address = output.strm_curr_bus_address;
+    }
+
+    static uint32_t DataLeft(const Input &input) { return input.data_len; }
+
+    static uint32_t GetPicId(const Picture &picture) { return picture.pic_id; }
+
+    static OutputPicture GetOutput(const Picture &picture, int index)
+    {
+        const auto &output = picture.pictures[index];
+        // The chroma plane directly follows the luma plane, whose height is the
+        // frame height as stored in memory.
+        const uint8_t *luma = output.output_picture;
+        return {
+            .luma = luma,
+            .chroma = luma ? luma + output.pic_stride * output.frame_height : nullptr,
+            .width = output.frame_width ? output.coded_width : 0,
+            .height = output.frame_height ? output.coded_height : 0,
+            .luma_stride = output.pic_stride,
+            .chroma_stride = output.pic_stride_ch,
+            .format = output.output_format,
+        };
+    }
+};
+
+// Size of the timestamp cache, needs to be large enough for frame-reordering.
+constexpr size_t kTimestampCacheSize = 128;
+
+Mpeg4DecoderDelegate::Mpeg4DecoderDelegate(int picture_width_hint, int picture_height_hint,
+    VAProfile profile, SurfaceLayout output_layout)
+    : profile_(profile)
+    , output_layout_(output_layout)
+    , ts_to_outputs_(kTimestampCacheSize)
+{
+    dwl_instance_ = std::make_unique<DWLInstance>(DWL_CLIENT_TYPE_MPEG4_DEC);
+    // Matches the parameters the decoder is initialized with, since SetInfo()
+    // applies the whole configuration.
+    memset(&dec_config_, 0, sizeof(dec_config_));
+    dec_config_.error_handling = DEC_EC_FAST_FREEZE;
+    dec_config_.dpb_flags = GetDpbFlags(output_layout_);
+    dec_config_.use_adaptive_buffers = 1;
+    dec_config_.guard_size = 0;
+    auto ret = MP4DecInit(&hw_decoder_, dwl_instance_->instance, MP4DEC_MPEG4,
+        DEC_EC_FAST_FREEZE, /*num_frame_buffers=*/0, dec_config_.dpb_flags,
+        /*use_adaptive_buffers=*/1, /*n_guard_size=*/0);
+    CHECK_EQ(ret, MP4DEC_OK);
+    engine_ = std::make_unique<DecodeEngine<Mpeg4DecodeTraits>>(dwl_instance_->instance);
+}
+
+Mpeg4DecoderDelegate::~Mpeg4DecoderDelegate() { MP4DecRelease(hw_decoder_); }
+
+void Mpeg4DecoderDelegate::SetRenderTarget(const VSSurface &surface)
+{
+    render_target_ = &surface;
+    ts_to_outputs_.Put(current_ts_, PictureOutputs { .render_target = &surface });
+}
+
+void Mpeg4DecoderDelegate::SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces)
+{
+    additional_outputs_ = surfaces;
+}
+
+void Mpeg4DecoderDelegate::EnqueueWork(const std::vector<const VSBuffer *> &buffers)
+{
+    CHECK(render_target_);
+    CHECK(slice_data_buffers_.empty());
+    for (auto buffer : buffers) {
+        switch (buffer->GetType()) {
+        case VASliceDataBufferType: slice_data_buffers_.push_back(buffer); break;
+        case VAPictureParameterBufferType: pic_param_buffer_ = buffer; break;
+        case VAIQMatrixBufferType:
+            iq_matrix_ = *reinterpret_cast<const VAIQMatrixBufferMPEG4 *>(buffer->GetData());
+            break;
+        case VASliceParameterBufferType: slice_param_buffers_.push_back(buffer); break;
+        case VAProcPipelineParameterBufferType:
+            pp_params_ = ParsePostProcessingParams(
+                *reinterpret_cast<VAProcPipelineParameterBuffer *>(buffer->GetData()),
+                PictureOutputs { render_target_, additional_outputs_ });
+            // Outputs beyond the post-processor units are ignored.
+            if (pp_params_.num_additional_outputs < additional_outputs_.size()) {
+                additional_outputs_.resize(pp_params_.num_additional_outputs);
+            }
+            break;
+        default: break;
+        };
+    }
+}
+
+VAStatus Mpeg4DecoderDelegate::Run()
+{
+    CHECK(pic_param_buffer_);
+    const VAPictureParameterBufferMPEG4 *pic_param
+        = reinterpret_cast<VAPictureParameterBufferMPEG4 *>(pic_param_buffer_->GetData());
+    const VAIQMatrixBufferMPEG4 *iq_matrix = iq_matrix_ ? &*iq_matrix_ : nullptr;
+
+    Mpeg4HeaderWriter writer;
+    // Short video header (H.263) streams have no VOL. Otherwise the VOL is
+    // rebuilt before every I-VOP so the decoder can (re)start on it.
+    if (!pic_param->vol_fields.bits.short_video_header
+        && (current_ts_ == 0 || pic_param->vop_fields.bits.vop_coding_type == kVopCodingTypeI)) {
+        BuildVisualObjectHeaders(profile_, writer);
+        BuildVideoObjectLayer(*pic_param, iq_matrix, profile_, writer);
+    }
+
+    // The slice data already starts with the VOP start code.
+    for (const auto &slice_data_buffer : slice_data_buffers_) {
+        writer.AppendRawBytes(reinterpret_cast<uint8_t *>(slice_data_buffer->GetData()),
+            slice_data_buffer->GetDataSize());
+    }
+    const std::vector<uint8_t> &bitstream = writer.data();
+
+    if (headers_ready_ && pp_params_ != applied_pp_params_) { ConfigurePostProcessor(); }
+
+    ts_to_outputs_.Put(current_ts_,
+        PictureOutputs { render_target_, additional_outputs_, pp_params_.transform });
+
+    // Invoke HW Decoder
+    const bool decoded = engine_->Decode(
+        hw_decoder_, bitstream.data(), bitstream.size(), current_ts_++,
+        [this]() { ConfigurePostProcessor(); },
+        [this](const MP4DecPicture &picture) { OnFrameReady(picture); });
+    slice_data_buffers_.clear();
+    slice_param_buffers_.clear();
+    // The client may destroy the buffers once vaEndPicture() returns.
+    pic_param_buffer_ = nullptr;
+    pp_params_ = PostProcessingParams();
+    additional_outputs_.clear();
+    if (!decoded) { return VA_STATUS_ERROR_DECODING_ERROR; }
+    return post_processing_failed_ ? VA_STATUS_ERROR_OPERATION_FAILED : VA_STATUS_SUCCESS;
+}
+
+void Mpeg4DecoderDelegate::ConfigurePostProcessor()
+{
+    MP4DecInfo info;
+    memset(&info, 0, sizeof(info));
+    MP4DecGetInfo(hw_decoder_, &info);
+
+    CHECK(render_target_);
+    const DecodedStreamInfo stream = {
+        .width = info.coded_width,
+        .height = info.coded_height,
+        .bit_depth = 8,
+        .tiled_references = output_layout_ == SurfaceLayout::kTiled4x4,
+    };
+    const bool applied = ApplyPostProcessing(
+        stream, pp_params_, *render_target_, dec_config_.ppu_config, [this]() {
+            const auto ret = MP4DecSetInfo(hw_decoder_, &dec_config_);
+            if (ret != MP4DEC_OK) {
+                std::cerr << "Unsupported post-processing, return code: " << ret << std::endl;
+            }
+            return ret == MP4DEC_OK;
+        });
+    post_processing_failed_ = !applied;
+    if (!applied) { std::cerr << "No post-processing configuration accepted" << std::endl; }
+    // Not retried for every picture if it was rejected.
+    applied_pp_params_ = pp_params_;
+    headers_ready_ = true;
+}
+
+void Mpeg4DecoderDelegate::OnFrameReady(const MP4DecPicture &picture)
+{
+    const uint32_t ts = Mpeg4DecodeTraits::GetPicId(picture);
+    auto outputs_it = ts_to_outputs_.Peek(ts);
+    CHECK(outputs_it != ts_to_outputs_.end());
+    const PictureOutputs &outputs = outputs_it->second;
+    CHECK(outputs.render_target);
+    if (post_processing_failed_) { return; }
+
+    // The post-processor units write the render target and the additional
+    // outputs, in that order.
+    WritePictureOutputs(outputs,
+        [&picture](int index) { return Mpeg4DecodeTraits::GetOutput(picture, index); });
+}
+
+} // namespace libvavc8000d
+
+void MP4DecTrace(const char *string) { std::cerr << "[TRACE]" << string << std::endl; }
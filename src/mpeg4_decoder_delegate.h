@@ -0,0 +1,83 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef MPEG4_DECODER_DELEGATE_H_
+#define MPEG4_DECODER_DELEGATE_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <va/va.h>
+
+#include "base/lru_cache.h"
+#include "context_delegate.h"
+#include "dwl_instance.h"
+#include "post_processor.h"
+#include "mp4decapi.h"
+
+namespace libvavc8000d
+{
+
+template <typename Traits> class DecodeEngine;
+struct Mpeg4DecodeTraits;
+
+// Class used for MPEG-4 Part 2 (Simple and Advanced Simple profile) hardware
+// decoding.
+class Mpeg4DecoderDelegate : public ContextDelegate
+{
+public:
+    // |output_layout| is the layout shared by all the render targets.
+    explicit Mpeg4DecoderDelegate(int picture_width_hint, int picture_height_hint,
+        VAProfile profile, SurfaceLayout output_layout);
+    Mpeg4DecoderDelegate(const Mpeg4DecoderDelegate &) = delete;
+    Mpeg4DecoderDelegate &operator=(const Mpeg4DecoderDelegate &) = delete;
+    ~Mpeg4DecoderDelegate() override;
+
+    // ContextDelegate implementation.
+    void SetRenderTarget(const VSSurface &surface) override;
+    void SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces) override;
+    void EnqueueWork(const std::vector<const VSBuffer *> &buffers) override;
+    VAStatus Run() override;
+
+private:
+    // Programs the post-processor once the stream headers are known, and again
+    // whenever the requested processing changes.
+    void ConfigurePostProcessor();
+    void OnFrameReady(const MP4DecPicture &picture);
+
+    const VAProfile profile_;
+    const SurfaceLayout output_layout_;
+
+    std::vector<const VSBuffer *> slice_data_buffers_;
+    std::vector<const VSBuffer *> slice_param_buffers_;
+
+    const VSSurface *render_target_{ nullptr };
+    std::vector<const VSSurface *> additional_outputs_;
+    const VSBuffer *pic_param_buffer_{ nullptr };
+    // The quantization matrices stay in effect until the client sends new
+    // ones, possibly after destroying the buffer, so they are copied.
+    std::optional<VAIQMatrixBufferMPEG4> iq_matrix_;
+
+    // Processing requested for the picture being decoded, and the one the
+    // post-processor is currently programmed with.
+    PostProcessingParams pp_params_;
+    PostProcessingParams applied_pp_params_;
+    bool headers_ready_ = false;
+    // Whether the decoder rejected every post-processor configuration for
+    // |applied_pp_params_|. The pictures are then in a layout the surfaces
+    // don't have, so they are dropped and vaEndPicture() fails.
+    bool post_processing_failed_ = false;
+
+    std::unique_ptr<DWLInstance> dwl_instance_;
+    struct MP4DecConfig dec_config_;
+    MP4DecInst hw_decoder_;
+    std::unique_ptr<DecodeEngine<Mpeg4DecodeTraits>> engine_;
+
+    uint32_t current_ts_ = 0;
+    base::LRUCache<uint32_t, PictureOutputs> ts_to_outputs_;
+};
+
+} // namespace libvavc8000d
+
+#endif // MPEG4_DECODER_DELEGATE_H_
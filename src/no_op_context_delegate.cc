@@ -12,6 +12,6 @@ void NoOpContextDelegate::SetRenderTarget(const VSSurface &surface) {}
 
 void NoOpContextDelegate::EnqueueWork(const std::vector<const VSBuffer *> &buffers) {}
 
-void NoOpContextDelegate::Run() {}
+VAStatus NoOpContextDelegate::Run() { return VA_STATUS_SUCCESS; }
 
 } // namespace libvavc8000d
\ No newline at end of file
@@ -24,7 +24,7 @@ public:
     // ContextDelegate implementation.
     void SetRenderTarget(const VSSurface &surface) override;
     void EnqueueWork(const std::vector<const VSBuffer *> &buffers) override;
-    void Run() override;
+    VAStatus Run() override;
 };
 
 } // namespace libvavc8000d
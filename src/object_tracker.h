@@ -9,6 +9,7 @@
 #include <algorithm>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <vector>
 
 
@@ -30,14 +31,24 @@ public:
     ~ObjectTracker() = default;
 
     template <class... Args> typename T::IdType CreateObject(Args &&...args)
+    {
+        const std::optional<typename T::IdType> id = TryCreateObject(std::forward<Args>(args)...);
+        CHECK(id);
+        return *id;
+    }
+
+    // Like CreateObject(), but returns std::nullopt if T::Create() fails, i.e.
+    // returns nullptr.
+    template <class... Args> std::optional<typename T::IdType> TryCreateObject(Args &&...args)
     {
         const std::lock_guard<std::mutex> lock(lock_);
 
         // This ConstructObject<Args...>() trick creates an object of type T
         // preferring its constructor. If the constructor is not available (e.g.,
         // it's private), it creates the object using a static T::Create() method.
-        objects_.push_back(ConstructObject<Args...>(next_id_, std::forward<Args>(args)...));
-        CHECK(objects_.back());
+        std::unique_ptr<T> object = ConstructObject<Args...>(next_id_, std::forward<Args>(args)...);
+        if (!object) { return std::nullopt; }
+        objects_.push_back(std::move(object));
 
         do {
             CHECK_LT(next_id_, std::numeric_limits<typename T::IdType>::max());
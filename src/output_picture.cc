@@ -0,0 +1,356 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "output_picture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <libdrm/drm_fourcc.h>
+#include <optional>
+
+#include "base/detile.h"
+#include "base/logging.h"
+#include "base/plane_copy.h"
+#include "surface.h"
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // Copies |rows| rows of |row_bytes| bytes each.
+    void CopyPlane(const uint8_t *src, uint32_t src_stride, uint8_t *dst, uint32_t dst_stride,
+        uint32_t row_bytes, uint32_t rows)
+    {
+        for (uint32_t y = 0; y < rows; y++) {
+            memcpy(dst, src, row_bytes);
+            src += src_stride;
+            dst += dst_stride;
+        }
+    }
+
+    // Keeps the 8 most significant bits of P010 samples. Only used when the
+    // post-processor could not truncate the samples itself.
+    void TruncatePlaneTo8Bit(const uint8_t *src, uint32_t src_stride, uint8_t *dst,
+        uint32_t dst_stride, uint32_t samples, uint32_t rows)
+    {
+        for (uint32_t y = 0; y < rows; y++) {
+            const uint16_t *src_row = reinterpret_cast<const uint16_t *>(src);
+            for (uint32_t x = 0; x < samples; x++) {
+                dst[x] = static_cast<uint8_t>(src_row[x] >> 8);
+            }
+            src += src_stride;
+            dst += dst_stride;
+        }
+    }
+
+    // Copies |units| elements of type Unit from each of |rows| rows to the
+    // position |transform| moves them to. Every destination position is an
+    // affine function of the source column and row, so the copy just steps
+    // through the destination with signed strides.
+    template <typename Unit>
+    void TransformPlane(const uint8_t *src, uint32_t src_stride, uint8_t *dst,
+        uint32_t dst_stride, uint32_t units, uint32_t rows, const PictureTransform &transform)
+    {
+        const int64_t w = units;
+        const int64_t h = rows;
+        // Mirrored position: x' = mx0 + mx * x, y' = my0 + my * y.
+        int64_t mx0 = 0, mx = 1, my0 = 0, my = 1;
+        if (transform.mirror & VA_MIRROR_HORIZONTAL) {
+            mx0 = w - 1;
+            mx = -1;
+        }
+        if (transform.mirror & VA_MIRROR_VERTICAL) {
+            my0 = h - 1;
+            my = -1;
+        }
+        // Destination column c0 + cx * x + cy * y and row r0 + rx * x + ry * y.
+        int64_t c0, cx, cy, r0, rx, ry;
+        switch (transform.rotation) {
+        case VA_ROTATION_90: // (x', y') goes to (h - 1 - y', x').
+            c0 = h - 1 - my0, cx = 0, cy = -my, r0 = mx0, rx = mx, ry = 0;
+            break;
+        case VA_ROTATION_180: // (x', y') goes to (w - 1 - x', h - 1 - y').
+            c0 = w - 1 - mx0, cx = -mx, cy = 0, r0 = h - 1 - my0, rx = 0, ry = -my;
+            break;
+        case VA_ROTATION_270: // (x', y') goes to (y', w - 1 - x').
+            c0 = my0, cx = 0, cy = my, r0 = w - 1 - mx0, rx = -mx, ry = 0;
+            break;
+        default: c0 = mx0, cx = mx, cy = 0, r0 = my0, rx = 0, ry = my; break;
+        }
+
+        const int64_t unit_bytes = sizeof(Unit);
+        const int64_t step_x = cx * unit_bytes + rx * dst_stride;
+        const int64_t step_y = cy * unit_bytes + ry * dst_stride;
+        uint8_t *dst_row = dst + c0 * unit_bytes + r0 * dst_stride;
+        for (uint32_t y = 0; y < rows; y++) {
+            const uint8_t *s = src;
+            uint8_t *d = dst_row;
+            for (uint32_t x = 0; x < units; x++) {
+                Unit unit;
+                memcpy(&unit, s, sizeof(unit));
+                memcpy(d, &unit, sizeof(unit));
+                s += sizeof(unit);
+                d += step_x;
+            }
+            src += src_stride;
+            dst_row += step_y;
+        }
+    }
+
+    // Writes |rows| rows of |units| elements of |unit_bytes| bytes each.
+    void WritePlane(const uint8_t *src, uint32_t src_stride, uint8_t *dst, uint32_t dst_stride,
+        uint32_t units, uint32_t rows, uint32_t unit_bytes, const PictureTransform &transform)
+    {
+        if (transform.IsIdentity()) {
+            CopyPlane(src, src_stride, dst, dst_stride, units * unit_bytes, rows);
+            return;
+        }
+        switch (unit_bytes) {
+        case 1:
+            TransformPlane<uint8_t>(src, src_stride, dst, dst_stride, units, rows, transform);
+            break;
+        case 2:
+            TransformPlane<uint16_t>(src, src_stride, dst, dst_stride, units, rows, transform);
+            break;
+        case 4:
+            TransformPlane<uint32_t>(src, src_stride, dst, dst_stride, units, rows, transform);
+            break;
+        default: CHECK(false); break;
+        }
+    }
+
+    // Copies a packed or planar RGB picture, whose layout the post-processor
+    // already matched to the surface.
+    void WriteRgbPicture(const OutputPicture &picture, const ScopedBOMapping::ScopedAccess &dst,
+        uint32_t width, uint32_t height, const PictureTransform &transform)
+    {
+        if (IS_PIC_PACKED_RGB(picture.format)) {
+            WritePlane(picture.luma, picture.luma_stride, dst.GetData(0), dst.GetStride(0), width,
+                height, 4, transform);
+            return;
+        }
+        CHECK(IS_PIC_PLANAR_RGB(picture.format));
+        const size_t src_plane_size = static_cast<size_t>(picture.luma_stride) * picture.height;
+        for (size_t plane = 0; plane < 3; plane++) {
+            WritePlane(picture.luma + plane * src_plane_size, picture.luma_stride,
+                dst.GetData(plane), dst.GetStride(plane), width, height, 1, transform);
+        }
+    }
+
+    // Copies a planar 8-bit 4:2:0 picture, which only the post-processor
+    // produces.
+    void WritePlanarPicture(const OutputPicture &picture,
+        const ScopedBOMapping::ScopedAccess &dst, uint32_t width, uint32_t height,
+        const PictureTransform &transform)
+    {
+        CHECK(picture.chroma);
+        CHECK(IS_PIC_PLANAR(picture.format));
+        CHECK(!IS_PIC_16BIT(picture.format));
+        WritePlane(picture.luma, picture.luma_stride, dst.GetData(0), dst.GetStride(0), width,
+            height, 1, transform);
+        const size_t src_plane_size
+            = static_cast<size_t>(picture.chroma_stride) * ((picture.height + 1) / 2);
+        for (size_t plane = 1; plane < 3; plane++) {
+            WritePlane(picture.chroma + (plane - 1) * src_plane_size, picture.chroma_stride,
+                dst.GetData(plane), dst.GetStride(plane), (width + 1) / 2, (height + 1) / 2, 1,
+                transform);
+        }
+    }
+
+    // Copies an 8-bit NV12 picture in 4x4 tiles to a surface in the same
+    // layout. The picture strides are given per row of tiles.
+    void WriteTiledPicture(const OutputPicture &picture, const ScopedBOMapping::ScopedAccess &dst,
+        uint32_t width, uint32_t height, const PictureTransform &transform)
+    {
+        CHECK(picture.chroma);
+        if (!transform.IsIdentity()) {
+            std::cerr << "Ignoring rotation and mirroring of tiled pictures" << std::endl;
+        }
+        constexpr uint32_t kTileSize = 4;
+        const uint32_t row_bytes = (width + kTileSize - 1) / kTileSize * kTileSize * kTileSize;
+        const uint32_t tile_rows = (height + kTileSize - 1) / kTileSize;
+        const uint32_t chroma_tile_rows = ((height + 1) / 2 + kTileSize - 1) / kTileSize;
+        CopyPlane(picture.luma, picture.luma_stride, dst.GetData(0), kTileSize * dst.GetStride(0),
+            row_bytes, tile_rows);
+        CopyPlane(picture.chroma, picture.chroma_stride, dst.GetData(1),
+            kTileSize * dst.GetStride(1), row_bytes, chroma_tile_rows);
+    }
+
+    // Returns the shape of the tiles of |format|, if it is an 8-bit tiled
+    // format.
+    std::optional<base::TileShape> GetTileShape(enum DecPictureFormat format)
+    {
+        switch (format) {
+        case DEC_OUT_FRM_TILED_4X4:
+        case DEC_OUT_FRM_YUV420TILE: return base::TileShape::k4x4;
+        case DEC_OUT_FRM_TILED_8X4: return base::TileShape::k8x4;
+        default: return std::nullopt;
+        }
+    }
+
+    // Converts a tiled 8-bit NV12 picture for a linear surface, which is
+    // normally left to the post-processor. Y800 surfaces only get the luma.
+    void WriteDetiledPicture(const OutputPicture &picture, base::TileShape shape,
+        const ScopedBOMapping::ScopedAccess &dst, SurfaceFormat format, uint32_t width,
+        uint32_t height, const PictureTransform &transform)
+    {
+        if (!transform.IsIdentity()) {
+            std::cerr << "Ignoring rotation and mirroring of tiled pictures" << std::endl;
+        }
+        base::DetilePlane(picture.luma, picture.luma_stride, dst.GetData(0), dst.GetStride(0),
+            width, height, shape);
+        if (format == SurfaceFormat::kY800) { return; }
+        CHECK(picture.chroma);
+        base::DetilePlane(picture.chroma, picture.chroma_stride, dst.GetData(1),
+            dst.GetStride(1), (width + 1) & ~1u, (height + 1) / 2, shape);
+    }
+
+} // namespace
+
+SurfaceFormat GetSurfaceFormat(const VSSurface &surface)
+{
+    // Surfaces without an external buffer or a pixel format attribute have no
+    // fourcc, only a render target format.
+    switch (surface.GetVAFourCC()) {
+    case VA_FOURCC_I420: return SurfaceFormat::kI420;
+    case VA_FOURCC_P010: return SurfaceFormat::kP010;
+    case VA_FOURCC_Y800: return SurfaceFormat::kY800;
+    case VA_FOURCC_RGBX: return SurfaceFormat::kRGBX;
+    case VA_FOURCC_BGRX: return SurfaceFormat::kBGRX;
+    case VA_FOURCC_RGBP: return SurfaceFormat::kRGBP;
+    case 0u: break;
+    default: return SurfaceFormat::kNV12;
+    }
+    switch (surface.GetFormat()) {
+    case VA_RT_FORMAT_YUV420_10: return SurfaceFormat::kP010;
+    case VA_RT_FORMAT_YUV400: return SurfaceFormat::kY800;
+    // The default 32-bit layout of VA drivers.
+    case VA_RT_FORMAT_RGB32: return SurfaceFormat::kBGRX;
+    case VA_RT_FORMAT_RGBP: return SurfaceFormat::kRGBP;
+    default: return SurfaceFormat::kNV12;
+    }
+}
+
+SurfaceLayout GetSurfaceLayout(const VSSurface &surface)
+{
+    return surface.GetModifier() == VSSurface::kTiled4x4Modifier ? SurfaceLayout::kTiled4x4
+                                                                 : SurfaceLayout::kLinear;
+}
+
+bool IsP010Surface(const VSSurface &surface)
+{
+    return GetSurfaceFormat(surface) == SurfaceFormat::kP010;
+}
+
+bool WriteOutputPicture(
+    const OutputPicture &picture, const VSSurface &surface, const PictureTransform &transform)
+{
+    const ScopedBOMapping &bo_mapping = surface.GetMappedBO();
+    // TODO(b/316609501): Look into replacing this and making this function
+    // operate the same for both testing and non-testing environments.
+    if (!bo_mapping.IsValid()) { return true; }
+    // The picture replaces the contents of the surface, so the CPU caches need
+    // not be made coherent with the buffer before it is written.
+    constexpr ScopedBOMapping::AccessMode kWrite = ScopedBOMapping::AccessMode::kWrite;
+
+    CHECK(picture.luma);
+    // The size of the picture before it is rotated.
+    const bool swap = transform.SwapsDimensions();
+    const uint32_t width
+        = std::min(picture.width, swap ? surface.GetHeight() : surface.GetWidth());
+    const uint32_t height
+        = std::min(picture.height, swap ? surface.GetWidth() : surface.GetHeight());
+    const SurfaceFormat surface_format = GetSurfaceFormat(surface);
+    const bool tiled_surface = GetSurfaceLayout(surface) == SurfaceLayout::kTiled4x4;
+    const std::optional<base::TileShape> tile_shape = GetTileShape(picture.format);
+    if (tiled_surface) {
+        if (tile_shape == base::TileShape::k4x4) {
+            WriteTiledPicture(picture, bo_mapping.BeginAccess(kWrite), width, height, transform);
+            return true;
+        }
+        std::cerr << "Can't write a " << (tile_shape ? "8x4 tiled" : "linear")
+                  << " picture to a tiled surface" << std::endl;
+        return false;
+    }
+    if (tile_shape) {
+        if (surface_format == SurfaceFormat::kNV12 || surface_format == SurfaceFormat::kY800) {
+            WriteDetiledPicture(picture, *tile_shape, bo_mapping.BeginAccess(kWrite),
+                surface_format, width, height, transform);
+            return true;
+        }
+        std::cerr << "Can't write a tiled picture to a surface of format "
+                  << static_cast<int>(surface_format) << std::endl;
+        return false;
+    }
+    if (IsRgbFormat(surface_format)) {
+        WriteRgbPicture(picture, bo_mapping.BeginAccess(kWrite), width, height, transform);
+        return true;
+    }
+    if (surface_format == SurfaceFormat::kI420) {
+        WritePlanarPicture(picture, bo_mapping.BeginAccess(kWrite), width, height, transform);
+        return true;
+    }
+
+    // Converting sample containers is a fallback for when the post-processor
+    // could not do it, and doesn't rotate.
+    const bool src_16bit = IS_PIC_16BIT(picture.format);
+    const bool dst_16bit = surface_format == SurfaceFormat::kP010;
+    if (src_16bit != dst_16bit && !transform.IsIdentity()) {
+        std::cerr << "Ignoring rotation and mirroring of converted pictures" << std::endl;
+    }
+
+    if (surface_format == SurfaceFormat::kY800) {
+        // Usually written by the post-processor without chroma, but only the
+        // luma plane of a 4:2:0 picture is read otherwise.
+        const ScopedBOMapping::ScopedAccess mapped_bo = bo_mapping.BeginAccess(kWrite);
+        if (src_16bit) {
+            TruncatePlaneTo8Bit(picture.luma, picture.luma_stride, mapped_bo.GetData(0),
+                mapped_bo.GetStride(0), width, height);
+        } else {
+            WritePlane(picture.luma, picture.luma_stride, mapped_bo.GetData(0),
+                mapped_bo.GetStride(0), width, height, 1, transform);
+        }
+        return true;
+    }
+
+    CHECK(picture.chroma);
+    CHECK(IS_PIC_SEMIPLANAR(picture.format));
+    // Packed 10-bit layouts are never requested from the post-processor.
+    CHECK(!IS_PIC_10BIT(picture.format));
+
+    // Chroma is subsampled vertically and stored interleaved, so a chroma row
+    // holds as many samples as a luma row.
+    const uint32_t chroma_height = (height + 1) / 2;
+    const uint32_t chroma_samples = (width + 1) & ~1u;
+
+    const ScopedBOMapping::ScopedAccess mapped_bo = bo_mapping.BeginAccess(kWrite);
+    uint8_t *const dst_y = mapped_bo.GetData(0);
+    const uint32_t dst_y_stride = mapped_bo.GetStride(0);
+    uint8_t *const dst_uv = mapped_bo.GetData(1);
+    const uint32_t dst_uv_stride = mapped_bo.GetStride(1);
+
+    if (src_16bit == dst_16bit) {
+        // Chroma is moved as Cb/Cr pairs.
+        const uint32_t bytes_per_sample = dst_16bit ? 2u : 1u;
+        WritePlane(picture.luma, picture.luma_stride, dst_y, dst_y_stride, width, height,
+            bytes_per_sample, transform);
+        WritePlane(picture.chroma, picture.chroma_stride, dst_uv, dst_uv_stride,
+            chroma_samples / 2, chroma_height, 2 * bytes_per_sample, transform);
+    } else if (dst_16bit) {
+        base::ExpandPlaneTo16Bit(
+            picture.luma, picture.luma_stride, dst_y, dst_y_stride, width, height);
+        base::ExpandPlaneTo16Bit(picture.chroma, picture.chroma_stride, dst_uv, dst_uv_stride,
+            chroma_samples, chroma_height);
+    } else {
+        TruncatePlaneTo8Bit(
+            picture.luma, picture.luma_stride, dst_y, dst_y_stride, width, height);
+        TruncatePlaneTo8Bit(picture.chroma, picture.chroma_stride, dst_uv, dst_uv_stride,
+            chroma_samples, chroma_height);
+    }
+    return true;
+}
+
+} // namespace libvavc8000d
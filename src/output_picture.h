@@ -0,0 +1,108 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef OUTPUT_PICTURE_H_
+#define OUTPUT_PICTURE_H_
+
+#include <cstdint>
+#include <va/va.h>
+#include <va/va_vpp.h>
+
+#include "decapicommon.h"
+
+namespace libvavc8000d
+{
+
+class VSSurface;
+
+// One picture produced by the hardware decoder, i.e. one entry of the
+// pictures[] array of the codec specific *DecPicture structures, in a codec
+// agnostic form. Semi-planar and planar YUV and RGB formats are supported.
+// Planar YUV pictures store their Cr plane right after the Cb plane in
+// |chroma|. RGB pictures only use |luma|, planar ones store their planes one
+// after the other.
+struct OutputPicture
+{
+    const uint8_t *luma;
+    const uint8_t *chroma;
+    uint32_t width;
+    uint32_t height;
+    uint32_t luma_stride;
+    uint32_t chroma_stride;
+    enum DecPictureFormat format;
+};
+
+// Rotation and mirroring applied while a picture is written to a surface, with
+// the VA_ROTATION_* and VA_MIRROR_* values of VAProcPipelineParameterBuffer.
+// The picture is mirrored first, then rotated clockwise.
+struct PictureTransform
+{
+    uint32_t rotation = VA_ROTATION_NONE;
+    uint32_t mirror = VA_MIRROR_NONE;
+
+    bool IsIdentity() const { return rotation == VA_ROTATION_NONE && mirror == VA_MIRROR_NONE; }
+    // Whether the width and height of the picture are swapped in the surface.
+    bool SwapsDimensions() const
+    {
+        return rotation == VA_ROTATION_90 || rotation == VA_ROTATION_270;
+    }
+
+    bool operator==(const PictureTransform &) const = default;
+};
+
+// Layouts pictures can be written to surfaces in.
+enum class SurfaceFormat {
+    kNV12,
+    // Three 8-bit planes, Y, Cb and Cr.
+    kI420,
+    kP010,
+    // Luma only, with 8-bit samples.
+    kY800,
+    // Packed RGB with 8-bit samples, named after their byte order in memory.
+    kRGBX,
+    kBGRX,
+    // Three 8-bit planes, R, G and B.
+    kRGBP,
+};
+
+// Returns the layout of |surface|, from its fourcc if it has one and otherwise
+// from its render target format.
+SurfaceFormat GetSurfaceFormat(const VSSurface &surface);
+
+// Arrangements of the pixels of a surface, requested by clients through DRM
+// format modifiers.
+enum class SurfaceLayout {
+    kLinear,
+    // NV12 in 4x4 pixel tiles, the layout the decoders keep their reference
+    // frames in with DEC_REF_FRM_TILED_DEFAULT. Each row of tiles is stored
+    // contiguously, i.e. four times the pitch of a pixel row apart.
+    kTiled4x4,
+};
+
+// Returns the layout of |surface|, from its DRM format modifier.
+SurfaceLayout GetSurfaceLayout(const VSSurface &surface);
+
+inline bool IsRgbFormat(SurfaceFormat format)
+{
+    return format == SurfaceFormat::kRGBX || format == SurfaceFormat::kBGRX
+        || format == SurfaceFormat::kRGBP;
+}
+
+// Returns whether decoded pictures written to |surface| must be stored with
+// 16-bit samples (P010) rather than 8-bit samples (NV12).
+bool IsP010Surface(const VSSurface &surface);
+
+// Copies |picture| into |surface| with |transform| applied, converting between
+// 8-bit and 16-bit sample containers when the surface format requires it. RGB
+// pictures must already be in the layout of the surface. 8-bit tiled pictures
+// are copied as they are to tiled surfaces and detiled for linear NV12 and
+// Y800 ones, and are neither rotated nor mirrored. The picture is clipped to
+// the surface size. This is a no-op for surfaces without a CPU mapping. Returns
+// false when the picture can't be written in the layout of the surface.
+bool WriteOutputPicture(const OutputPicture &picture, const VSSurface &surface,
+    const PictureTransform &transform = PictureTransform());
+
+} // namespace libvavc8000d
+
+#endif // OUTPUT_PICTURE_H_
@@ -0,0 +1,219 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "post_processor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "base/logging.h"
+#include "output_picture.h"
+#include "surface.h"
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // The post-processor works on 4:2:0 pictures, so offsets and sizes must
+    // cover whole chroma samples.
+    uint32_t AlignDownToChroma(uint32_t value) { return value & ~1u; }
+
+    // Makes |ppu| convert to the RGB layout of |format|, which the colour
+    // conversion writes straight to the surface.
+    void ConfigureRgbConversion(
+        const DecodedStreamInfo &stream, SurfaceFormat format, PpUnitConfig &ppu)
+    {
+        ppu.rgb = 1;
+        switch (format) {
+        // The packed formats are named after 32-bit words, so ABGR888 has the
+        // byte order R, G, B, A in memory.
+        case SurfaceFormat::kRGBX: ppu.rgb_format = DEC_OUT_FRM_ABGR888; break;
+        case SurfaceFormat::kBGRX: ppu.rgb_format = DEC_OUT_FRM_ARGB888; break;
+        case SurfaceFormat::kRGBP:
+            ppu.rgb_planar = 1;
+            ppu.rgb_format = DEC_OUT_FRM_RGB888_P;
+            break;
+        default: CHECK(false); break;
+        }
+        ppu.rgb_stan = GetRgbStandard(stream);
+        ppu.video_range = stream.full_range;
+    }
+
+    // Programs |ppu| to write |crop| scaled to |output|. The unit is left
+    // disabled when the decoder output can be used as is, unless |required|.
+    void ConfigureUnit(const DecodedStreamInfo &stream, const CropRegion &crop,
+        const PostProcessingOutput &output, bool required, PpUnitConfig &ppu)
+    {
+        memset(&ppu, 0, sizeof(ppu));
+
+        const uint32_t source_width = crop.enabled ? crop.width : stream.width;
+        const uint32_t source_height = crop.enabled ? crop.height : stream.height;
+        const bool scale = output.width && output.height
+            && (output.width != source_width || output.height != source_height);
+
+        // The reference frames of 10-bit streams use a packed layout, so let the
+        // post-processor write either P010 or, for 8-bit surfaces, truncated
+        // 8-bit samples, which also halves the output bandwidth.
+        const bool high_bit_depth = stream.bit_depth > 8;
+        const bool rgb = IsRgbFormat(output.format);
+
+        // Luma-only outputs skip the chroma writes altogether.
+        const bool monochrome = output.format == SurfaceFormat::kY800;
+        const bool planar = output.format == SurfaceFormat::kI420;
+        // Tiled reference frames are converted for linear surfaces, tiled ones
+        // take them as they are.
+        const bool tiled = output.layout == SurfaceLayout::kTiled4x4;
+        const bool detile = stream.tiled_references && !tiled;
+
+        ppu.enabled = required || high_bit_depth || rgb || monochrome || planar || detile
+            || stream.compressed_references || crop.enabled || scale;
+        if (!ppu.enabled) { return; }
+
+        if (crop.enabled) {
+            ppu.crop.enabled = 1;
+            ppu.crop.set_by_user = 1;
+            ppu.crop.x = crop.x;
+            ppu.crop.y = crop.y;
+            ppu.crop.width = crop.width;
+            ppu.crop.height = crop.height;
+        }
+        if (scale) {
+            ppu.scale.enabled = 1;
+            ppu.scale.set_by_user = 1;
+            // Flexible ratio, the output size is given explicitly.
+            ppu.scale.ratio_x = 0;
+            ppu.scale.ratio_y = 0;
+            ppu.scale.width = output.width;
+            ppu.scale.height = output.height;
+        }
+        if (rgb) {
+            ConfigureRgbConversion(stream, output.format, ppu);
+            return;
+        }
+        ppu.monochrome = monochrome;
+        ppu.planar = planar;
+        ppu.tiled_e = tiled;
+        if (high_bit_depth) {
+            if (output.format == SurfaceFormat::kP010) {
+                ppu.out_p010 = 1;
+            } else {
+                ppu.out_cut_8bits = 1;
+            }
+        }
+    }
+
+} // namespace
+
+CropRegion ClampCropRegion(const DecodedStreamInfo &stream, const PostProcessingParams &params)
+{
+    CropRegion crop;
+    crop.enabled = params.crop_width && params.crop_height && params.crop_x < stream.width
+        && params.crop_y < stream.height
+        && (params.crop_x || params.crop_y || params.crop_width < stream.width
+            || params.crop_height < stream.height);
+    if (!crop.enabled) { return crop; }
+    crop.x = params.crop_x;
+    crop.y = params.crop_y;
+    crop.width = std::min(params.crop_width, stream.width - params.crop_x);
+    crop.height = std::min(params.crop_height, stream.height - params.crop_y);
+    return crop;
+}
+
+uint32_t GetRgbStandard(const DecodedStreamInfo &stream)
+{
+    // The _L variants expect limited range samples.
+    const bool full = stream.full_range;
+    switch (stream.matrix_coefficients) {
+    case 1: return full ? BT709 : BT709_L;
+    case 5:
+    case 6: return full ? BT601 : BT601_L;
+    case 9:
+    case 10: return full ? BT2020 : BT2020_L;
+    default: break;
+    }
+    if (stream.height > 576) { return full ? BT709 : BT709_L; }
+    return full ? BT601 : BT601_L;
+}
+
+PostProcessingParams ParsePostProcessingParams(
+    const VAProcPipelineParameterBuffer &pipeline, const PictureOutputs &outputs)
+{
+    PostProcessingParams params;
+    if (pipeline.surface_region) {
+        const VARectangle &region = *pipeline.surface_region;
+        params.crop_x = AlignDownToChroma(static_cast<uint32_t>(std::max<int16_t>(region.x, 0)));
+        params.crop_y = AlignDownToChroma(static_cast<uint32_t>(std::max<int16_t>(region.y, 0)));
+        params.crop_width = AlignDownToChroma(region.width);
+        params.crop_height = AlignDownToChroma(region.height);
+    }
+
+    uint32_t output_width = outputs.render_target->GetWidth();
+    uint32_t output_height = outputs.render_target->GetHeight();
+    if (pipeline.output_region) {
+        const VARectangle &region = *pipeline.output_region;
+        if (region.x != 0 || region.y != 0) {
+            std::cerr << "Ignoring output region offset " << region.x << "," << region.y
+                      << std::endl;
+        }
+        output_width = std::min<uint32_t>(region.width, output_width);
+        output_height = std::min<uint32_t>(region.height, output_height);
+    }
+    if (pipeline.rotation_state <= VA_ROTATION_270) {
+        params.transform.rotation = pipeline.rotation_state;
+    } else {
+        std::cerr << "Ignoring rotation " << pipeline.rotation_state << std::endl;
+    }
+    params.transform.mirror = pipeline.mirror_state & (VA_MIRROR_HORIZONTAL | VA_MIRROR_VERTICAL);
+    // Pictures rotated by 90 or 270 degrees are scaled to the transposed size
+    // of their surfaces.
+    const bool swap = params.transform.SwapsDimensions();
+
+    params.scale_width = AlignDownToChroma(swap ? output_height : output_width);
+    params.scale_height = AlignDownToChroma(swap ? output_width : output_height);
+
+    if (outputs.additional_outputs.size() > kMaxAdditionalOutputs) {
+        std::cerr << "Only " << kMaxAdditionalOutputs << " additional outputs are supported, "
+                  << "ignoring " << outputs.additional_outputs.size() - kMaxAdditionalOutputs
+                  << std::endl;
+    }
+    params.num_additional_outputs = std::min<uint32_t>(
+        static_cast<uint32_t>(outputs.additional_outputs.size()), kMaxAdditionalOutputs);
+    for (uint32_t i = 0; i < params.num_additional_outputs; i++) {
+        const VSSurface &surface = *outputs.additional_outputs[i];
+        params.additional_outputs[i] = {
+            .width = AlignDownToChroma(swap ? surface.GetHeight() : surface.GetWidth()),
+            .height = AlignDownToChroma(swap ? surface.GetWidth() : surface.GetHeight()),
+            .format = GetSurfaceFormat(surface),
+            .layout = GetSurfaceLayout(surface),
+        };
+    }
+    return params;
+}
+
+void ConfigurePpUnits(const DecodedStreamInfo &stream, const PostProcessingParams &params,
+    const VSSurface &render_target, PpUnitConfig (&ppu)[DEC_MAX_PPU_COUNT])
+{
+    const CropRegion crop = ClampCropRegion(stream, params);
+    // Without post-processing the decoder outputs its reference frames, so the
+    // first unit must write the render target as soon as any other unit is used.
+    const bool additional_outputs = params.num_additional_outputs > 0;
+    ConfigureUnit(stream, crop,
+        { .width = params.scale_width,
+            .height = params.scale_height,
+            .format = GetSurfaceFormat(render_target),
+            .layout = GetSurfaceLayout(render_target) },
+        additional_outputs, ppu[0]);
+    for (uint32_t i = 0; i < kMaxAdditionalOutputs; i++) {
+        if (i < params.num_additional_outputs) {
+            ConfigureUnit(
+                stream, crop, params.additional_outputs[i], /*required=*/true, ppu[i + 1]);
+        } else {
+            memset(&ppu[i + 1], 0, sizeof(ppu[i + 1]));
+        }
+    }
+}
+
+} // namespace libvavc8000d
@@ -0,0 +1,182 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef POST_PROCESSOR_H_
+#define POST_PROCESSOR_H_
+
+#include <array>
+#include <cstdint>
+#include <va/va.h>
+#include <va/va_vpp.h>
+#include <vector>
+
+#include "base/logging.h"
+#include "decapicommon.h"
+#include "output_picture.h"
+
+namespace libvavc8000d
+{
+
+class VSSurface;
+
+// The first post-processor unit writes the render target, the others write
+// the additional outputs of VAProcPipelineParameterBuffer.
+constexpr uint32_t kMaxAdditionalOutputs = DEC_MAX_PPU_COUNT - 1;
+
+// A rendition written by one of the post-processor units.
+struct PostProcessingOutput
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    SurfaceFormat format = SurfaceFormat::kNV12;
+    SurfaceLayout layout = SurfaceLayout::kLinear;
+
+    bool operator==(const PostProcessingOutput &) const = default;
+};
+
+// Processing applied by the decoder's post-processor while it writes a decoded
+// picture out. Clients request it by rendering a VAProcPipelineParameterBuffer
+// along with the picture (VAConfigAttribDecProcessing), so the render target
+// receives the processed picture without an extra pass over memory. The
+// parameters only apply to that picture, so a region of interest can follow
+// an object from frame to frame. The post-processor only reads the region, and
+// as long as the output size stays the same the decoder keeps its output
+// buffers when it is reprogrammed.
+struct PostProcessingParams
+{
+    // Region of the decoded picture to process. A zero size selects the whole
+    // picture.
+    uint32_t crop_x = 0;
+    uint32_t crop_y = 0;
+    uint32_t crop_width = 0;
+    uint32_t crop_height = 0;
+    // Size the region is scaled to. A zero size disables scaling.
+    uint32_t scale_width = 0;
+    uint32_t scale_height = 0;
+    // Renditions of the same region produced in the same pass, each one scaled
+    // to the size of its surface.
+    uint32_t num_additional_outputs = 0;
+    std::array<PostProcessingOutput, kMaxAdditionalOutputs> additional_outputs {};
+    // Applied when the outputs are written to their surfaces, as the
+    // post-processor can't rotate. The scaled sizes above are in the
+    // orientation of the decoded picture.
+    PictureTransform transform;
+
+    bool operator==(const PostProcessingParams &) const = default;
+};
+
+// Stream properties, as reported by the decoder once the headers are parsed,
+// that the post-processor configuration depends on.
+struct DecodedStreamInfo
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t bit_depth;
+    // Colour description used for RGB output: matrix_coefficients as in ITU-T
+    // H.273 (2, unspecified, when the stream has none) and whether the samples
+    // use the full range.
+    uint32_t matrix_coefficients = 2;
+    bool full_range = false;
+    // Whether the decoder keeps its reference frames in 4x4 tiles, which only
+    // tiled surfaces take without post-processing.
+    bool tiled_references = false;
+    // Whether the reference frames are compressed. Nothing but the decoder
+    // reads them then, so the post-processor writes every output.
+    bool compressed_references = false;
+};
+
+// Region of the decoded picture the post-processor units read.
+struct CropRegion
+{
+    bool enabled = false;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+// Returns the part of the pictures of |stream| that |params| selects, which is
+// disabled when it covers the whole picture.
+CropRegion ClampCropRegion(const DecodedStreamInfo &stream, const PostProcessingParams &params);
+
+// Returns the rgb_stan conversion matrix (BT601 to BT2020_L) for |stream|.
+// Streams without a colour description are assumed to be BT.601 up to
+// standard definition and BT.709 above.
+uint32_t GetRgbStandard(const DecodedStreamInfo &stream);
+
+// Layout of the reference frames of a decoder whose render targets are in
+// |layout|. Tiled reference frames are fetched more efficiently by motion
+// compensation, but linear surfaces then need the post-processor to convert
+// every picture, so they are only used when the render targets are tiled too.
+inline DecDpbFlags GetDpbFlags(SurfaceLayout layout)
+{
+    return layout == SurfaceLayout::kTiled4x4 ? DEC_REF_FRM_TILED_DEFAULT
+                                               : DEC_REF_FRM_RASTER_SCAN;
+}
+
+// Surfaces a decoded picture is written to.
+struct PictureOutputs
+{
+    const VSSurface *render_target = nullptr;
+    std::vector<const VSSurface *> additional_outputs;
+    PictureTransform transform;
+};
+
+// Translates |pipeline|, rendered to a decode context, into the processing of
+// the picture written to |outputs|. |outputs| holds the surfaces of
+// |pipeline|.additional_outputs, which the caller resolves. The output region
+// must start at the origin of the render target, other positions are ignored.
+PostProcessingParams ParsePostProcessingParams(
+    const VAProcPipelineParameterBuffer &pipeline, const PictureOutputs &outputs);
+
+// Programs the post-processor units in |ppu| to write the pictures of |stream|
+// to |render_target| and the additional outputs of |params|. The
+// post-processor is left disabled when the decoder output can be used as is.
+void ConfigurePpUnits(const DecodedStreamInfo &stream, const PostProcessingParams &params,
+    const VSSurface &render_target, PpUnitConfig (&ppu)[DEC_MAX_PPU_COUNT]);
+
+// Programs |ppu| for |params| and hands the configuration to the decoder with
+// |set_info|, which returns whether it was accepted. Parameters the decoder
+// rejects, e.g. a region of interest beyond the scaling limits, are relaxed
+// step by step: the crop is dropped first, so the render target still gets the
+// whole picture at the requested size, then all the processing. Returns whether
+// a configuration was accepted.
+template <typename SetInfo>
+bool ApplyPostProcessing(const DecodedStreamInfo &stream, PostProcessingParams params,
+    const VSSurface &render_target, PpUnitConfig (&ppu)[DEC_MAX_PPU_COUNT], SetInfo set_info)
+{
+    ConfigurePpUnits(stream, params, render_target, ppu);
+    if (set_info()) { return true; }
+    if (params.crop_width || params.crop_height) {
+        params.crop_x = params.crop_y = params.crop_width = params.crop_height = 0;
+        ConfigurePpUnits(stream, params, render_target, ppu);
+        if (set_info()) { return true; }
+    }
+    if (params == PostProcessingParams()) { return false; }
+    ConfigurePpUnits(stream, PostProcessingParams(), render_target, ppu);
+    return set_info();
+}
+
+// Writes the pictures of a decoded frame to |outputs|, which has at most
+// kMaxAdditionalOutputs additional outputs. |get_output| returns the
+// OutputPicture of a post-processor unit, whose size is zero when the unit
+// produced nothing. Returns false when a picture could not be written.
+template <typename GetOutput>
+bool WritePictureOutputs(const PictureOutputs &outputs, GetOutput get_output)
+{
+    CHECK_LE(outputs.additional_outputs.size(), size_t { kMaxAdditionalOutputs });
+    bool written = true;
+    for (size_t i = 0; i <= outputs.additional_outputs.size(); i++) {
+        const OutputPicture output = get_output(static_cast<int>(i));
+        if (output.width == 0 || output.height == 0) { continue; }
+        written &= WriteOutputPicture(output,
+            i == 0 ? *outputs.render_target : *outputs.additional_outputs[i - 1],
+            outputs.transform);
+    }
+    return written;
+}
+
+} // namespace libvavc8000d
+
+#endif // POST_PROCESSOR_H_
@@ -0,0 +1,97 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "scoped_bo_mapping_factory.h"
+
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <linux/dma-heap.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // A 1080p NV12 surface, with both planes in one dma-buf.
+    constexpr uint32_t kWidth = 1920;
+    constexpr uint32_t kHeight = 1088;
+    constexpr size_t kBufferSize = kWidth * kHeight * 3 / 2;
+
+    // Allocates the surface from the system dma-buf heap, where the accesses
+    // are synchronized as on the device, or from a memfd on hosts without
+    // one, where they aren't and only the bookkeeping is measured.
+    base::ScopedFD AllocateBuffer(bool &is_dma_buf)
+    {
+        const base::ScopedFD heap(open("/dev/dma_heap/system", O_RDWR | O_CLOEXEC));
+        is_dma_buf = heap.get() >= 0;
+        if (is_dma_buf) {
+            struct dma_heap_allocation_data allocation = {};
+            allocation.len = kBufferSize;
+            allocation.fd_flags = O_RDWR | O_CLOEXEC;
+            CHECK_EQ(ioctl(heap.get(), DMA_HEAP_IOCTL_ALLOC, &allocation), 0);
+            return base::ScopedFD(static_cast<int>(allocation.fd));
+        }
+        base::ScopedFD fd(memfd_create("surface", MFD_CLOEXEC));
+        CHECK_EQ(ftruncate(fd.get(), kBufferSize), 0);
+        return fd;
+    }
+
+    gbm_import_fd_modifier_data ImportData(int fd)
+    {
+        gbm_import_fd_modifier_data import_data = {};
+        import_data.width = kWidth;
+        import_data.height = kHeight;
+        import_data.format = GBM_FORMAT_NV12;
+        import_data.num_fds = 2;
+        import_data.fds[0] = fd;
+        import_data.fds[1] = fd;
+        import_data.strides[0] = kWidth;
+        import_data.strides[1] = kWidth;
+        import_data.offsets[1] = kWidth * kHeight;
+        return import_data;
+    }
+
+    // The cost of a BeginAccess() and the end of its ScopedAccess, which
+    // synchronize the dma-buf with DMA_BUF_IOCTL_SYNC in the direction of the
+    // access mode. Whether it needs that was probed once, on import.
+    void BM_ScopedAccess(benchmark::State &state)
+    {
+        const auto mode = static_cast<ScopedBOMapping::AccessMode>(state.range(0));
+        const uint32_t plane_mask = (1u << state.range(1)) - 1;
+        bool is_dma_buf;
+        const base::ScopedFD fd = AllocateBuffer(is_dma_buf);
+        ScopedBOMappingFactory factory(/*drm_fd=*/-1);
+        const ScopedBOMapping mapping = factory.Create(ImportData(fd.get()));
+        for (auto _ : state) {
+            const auto access = mapping.BeginAccess(mode, plane_mask);
+            benchmark::DoNotOptimize(access.GetData(0));
+        }
+        state.SetLabel(is_dma_buf ? "dma-heap" : "memfd, not synchronized");
+    }
+    BENCHMARK(BM_ScopedAccess)
+        ->ArgNames({ "mode", "planes" })
+        ->ArgsProduct({ { static_cast<int64_t>(ScopedBOMapping::AccessMode::kRead),
+                            static_cast<int64_t>(ScopedBOMapping::AccessMode::kWrite),
+                            static_cast<int64_t>(ScopedBOMapping::AccessMode::kReadWrite) },
+            { 1, 2 } });
+
+    // What probing whether the dma-buf needs synchronizing would add to every
+    // access if it weren't done on import.
+    void BM_NeedsSyncProbe(benchmark::State &state)
+    {
+        bool is_dma_buf;
+        const base::ScopedFD fd = AllocateBuffer(is_dma_buf);
+        for (auto _ : state) {
+            struct statfs fs_stat;
+            benchmark::DoNotOptimize(fstatfs(fd.get(), &fs_stat));
+        }
+    }
+    BENCHMARK(BM_NeedsSyncProbe);
+
+} // namespace
+} // namespace libvavc8000d
@@ -6,85 +6,132 @@
 #include "scoped_bo_mapping_factory.h"
 
 #include <linux/dma-buf.h>
+#include <linux/magic.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 
 namespace libvavc8000d
 {
+namespace
+{
+
+    uint64_t GetSyncDirection(ScopedBOMapping::AccessMode mode)
+    {
+        switch (mode) {
+        case ScopedBOMapping::AccessMode::kRead: return DMA_BUF_SYNC_READ;
+        case ScopedBOMapping::AccessMode::kWrite: return DMA_BUF_SYNC_WRITE;
+        case ScopedBOMapping::AccessMode::kReadWrite: return DMA_BUF_SYNC_RW;
+        }
+        return DMA_BUF_SYNC_RW;
+    }
+
+    // Returns whether CPU accesses to the buffer of |fd| must be bracketed by
+    // DMA_BUF_IOCTL_SYNC. The ioctl fails for files that aren't dma-bufs, as
+    // with the fake GBM backend, and costs a cache clean and invalidation on
+    // SoCs without coherent DMA, which platforms that have it can skip with
+    // USE_COHERENT_BUFFERS=1.
+    //
+    // The fstatfs() is a system call, costing many times the rest of an
+    // access that needs no sync, so it is made once per dma-buf on import and
+    // the result kept in Import::synced_buffers.
+    bool NeedsSync(int fd)
+    {
+        static const bool coherent = [] {
+            const char *use_coherent_buffers_env_var = getenv("USE_COHERENT_BUFFERS");
+            return use_coherent_buffers_env_var && strcmp(use_coherent_buffers_env_var, "1") == 0;
+        }();
+        if (coherent) { return false; }
+        struct statfs fs_stat;
+        return fstatfs(fd, &fs_stat) == 0 && fs_stat.f_type == DMA_BUF_MAGIC;
+    }
+
+    // Returns the size of the dma-buf of |fd|, or an estimate from the stride
+    // and height of its plane when the kernel doesn't report it.
+    size_t GetBufferSize(int fd, uint32_t stride, uint32_t height)
+    {
+        struct stat fd_stat;
+        if (fstat(fd, &fd_stat) == 0 && fd_stat.st_size > 0) {
+            return static_cast<size_t>(fd_stat.st_size);
+        }
+        return static_cast<size_t>(stride) * height;
+    }
+
+} // namespace
 
 void GbmDeviceDeleter::operator()(gbm_device *device)
 {
     if (device) gbm_device_destroy(device);
 }
 
-ScopedBOMapping::ScopedAccess::ScopedAccess(const ScopedBOMapping &mapping) : mapping_(mapping)
+ScopedBOMapping::ScopedAccess::ScopedAccess(
+    const ScopedBOMapping &mapping, AccessMode mode, uint32_t plane_mask)
+    : mapping_(mapping), direction_(GetSyncDirection(mode)), plane_mask_(plane_mask)
 {
-    for (const auto &plane : mapping_.planes_) {
-        struct dma_buf_sync sync_start;
-        memset(&sync_start, 0, sizeof(sync_start));
-        sync_start.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
-
-        // This will fail for the fake GBM backend, so ignore the return result. We
-        // leave the IOCTL in here anyway in case we're running on top of a real GEM
-        // driver.
-        HANDLE_EINTR(ioctl(plane.prime_fd.get(), DMA_BUF_IOCTL_SYNC, &sync_start));
-    }
+    Sync(DMA_BUF_SYNC_START);
 }
 
-ScopedBOMapping::ScopedAccess::~ScopedAccess()
+ScopedBOMapping::ScopedAccess::~ScopedAccess() { Sync(DMA_BUF_SYNC_END); }
+
+void ScopedBOMapping::ScopedAccess::Sync(uint64_t flags) const
 {
-    for (const auto &plane : mapping_.planes_) {
-        struct dma_buf_sync sync_end;
-        memset(&sync_end, 0, sizeof(sync_end));
-        sync_end.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
-        HANDLE_EINTR(ioctl(plane.prime_fd.get(), DMA_BUF_IOCTL_SYNC, &sync_end));
+    for (const auto &[fd, buffer_planes] : mapping_.import_->synced_buffers) {
+        if (!(buffer_planes & plane_mask_)) { continue; }
+        struct dma_buf_sync sync;
+        memset(&sync, 0, sizeof(sync));
+        sync.flags = flags | direction_;
+        HANDLE_EINTR(ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync));
     }
 }
 
 uint8_t *ScopedBOMapping::ScopedAccess::GetData(size_t plane) const
 {
-    CHECK_LT(plane, mapping_.planes_.size());
-    return static_cast<uint8_t *>(mapping_.planes_[plane].addr);
+    CHECK_LT(plane, mapping_.import_->planes.size());
+    CHECK(plane_mask_ & (1u << plane));
+    return static_cast<uint8_t *>(mapping_.import_->planes[plane].addr);
 }
 
 uint32_t ScopedBOMapping::ScopedAccess::GetStride(size_t plane) const
 {
-    CHECK_LT(plane, mapping_.planes_.size());
-    return mapping_.planes_[plane].stride;
+    CHECK_LT(plane, mapping_.import_->planes.size());
+    return mapping_.import_->planes[plane].stride;
 }
 
-ScopedBOMapping::ScopedBOMapping() : scoped_bo_mapping_factory_(nullptr), bo_import_(nullptr) {}
+ScopedBOMapping::ScopedBOMapping() : scoped_bo_mapping_factory_(nullptr), import_(nullptr) {}
 
-ScopedBOMapping::ScopedBOMapping(ScopedBOMappingFactory *scoped_bo_mapping_factory,
-    std::vector<Plane> planes, struct gbm_bo *bo_import)
-    : scoped_bo_mapping_factory_(scoped_bo_mapping_factory)
-    , planes_(std::move(planes))
-    , bo_import_(bo_import)
+ScopedBOMapping::ScopedBOMapping(ScopedBOMappingFactory *scoped_bo_mapping_factory, Import *import)
+    : scoped_bo_mapping_factory_(scoped_bo_mapping_factory), import_(import)
 {}
 
 ScopedBOMapping::ScopedBOMapping(ScopedBOMapping &&other)
     : scoped_bo_mapping_factory_(std::move(other.scoped_bo_mapping_factory_))
-    , planes_(std::move(other.planes_))
-    , bo_import_(std::move(other.bo_import_))
+    , import_(std::move(other.import_))
 {
     // Note: we explicitly set these members to nullptr because a raw_ptr<T> may
     // or may not be zeroed out on move (it depends on the build configuration).
     other.scoped_bo_mapping_factory_ = nullptr;
-    other.bo_import_ = nullptr;
+    other.import_ = nullptr;
 }
 
 ScopedBOMapping &ScopedBOMapping::operator=(ScopedBOMapping &&other)
 {
+    if (this == &other) { return *this; }
+    if (IsValid()) { scoped_bo_mapping_factory_->Release(import_); }
+
     // Note: we explicitly set |other.scoped_bo_mapping_factory_| and
-    // |other.bo_import_| to nullptr because a raw_ptr<T> may or may not be zeroed
+    // |other.import_| to nullptr because a raw_ptr<T> may or may not be zeroed
     // out on move (it depends on the build configuration).
     scoped_bo_mapping_factory_ = std::move(other.scoped_bo_mapping_factory_);
     other.scoped_bo_mapping_factory_ = nullptr;
 
-    planes_ = std::move(other.planes_);
-
-    bo_import_ = std::move(other.bo_import_);
-    other.bo_import_ = nullptr;
+    import_ = std::move(other.import_);
+    other.import_ = nullptr;
 
     return *this;
 }
@@ -92,23 +139,26 @@ ScopedBOMapping &ScopedBOMapping::operator=(ScopedBOMapping &&other)
 ScopedBOMapping::~ScopedBOMapping()
 {
     if (IsValid()) {
-        // We tell the factory to unmap and destroy the Buffer Object as it
-        // does so under a lock which cannot be done here.
-        scoped_bo_mapping_factory_->UnmapAndDestroyBufferObject(std::move(planes_), bo_import_);
+        // We hand the Buffer Object back to the factory, which keeps track of
+        // its users under a lock.
+        scoped_bo_mapping_factory_->Release(import_);
     }
 }
 
-ScopedBOMapping::Plane::Plane(uint32_t stride, void *addr, void *mmap_data, int prime_fd)
-    : stride(stride), addr(addr), mmap_data(mmap_data), prime_fd(prime_fd)
+ScopedBOMapping::Plane::Plane(
+    uint32_t stride, uint32_t offset, void *addr, void *mmap_data, int prime_fd)
+    : stride(stride), offset(offset), addr(addr), mmap_data(mmap_data), prime_fd(prime_fd)
 {}
 
 ScopedBOMapping::Plane::Plane(Plane &&other)
     : stride(other.stride)
+    , offset(other.offset)
     , addr(std::move(other.addr))
     , mmap_data(std::move(other.mmap_data))
     , prime_fd(std::move(other.prime_fd))
 {
     other.stride = 0u;
+    other.offset = 0u;
 
     // Note: we explicitly set these members to nullptr because a raw_ptr<T> may
     // or may not be zeroed out on move (it depends on the build configuration).
@@ -120,6 +170,8 @@ ScopedBOMapping::Plane &ScopedBOMapping::Plane::operator=(ScopedBOMapping::Plane
 {
     stride = other.stride;
     other.stride = 0u;
+    offset = other.offset;
+    other.offset = 0u;
 
     // Note: we explicitly set |other.addr| and |other.mmap_data| to nullptr
     // because a raw_ptr<T> may or may not be zeroed out on move (it depends on
@@ -137,63 +189,301 @@ ScopedBOMapping::Plane &ScopedBOMapping::Plane::operator=(ScopedBOMapping::Plane
 
 ScopedBOMapping::Plane::~Plane() = default;
 
-ScopedBOMapping::ScopedAccess ScopedBOMapping::BeginAccess() const
+ScopedBOMapping::ScopedAccess ScopedBOMapping::BeginAccess(
+    AccessMode mode, uint32_t plane_mask) const
 {
     CHECK(IsValid());
-    return ScopedBOMapping::ScopedAccess(*this);
+    scoped_bo_mapping_factory_->Map(*import_);
+    return ScopedBOMapping::ScopedAccess(*this, mode, plane_mask);
+}
+
+size_t ScopedBOMapping::GetNumPlanes() const { return import_ ? import_->planes.size() : 0u; }
+
+int ScopedBOMapping::GetPlaneFd(size_t plane) const
+{
+    CHECK_LT(plane, GetNumPlanes());
+    return import_->planes[plane].prime_fd.get();
 }
 
-ScopedBOMappingFactory::ScopedBOMappingFactory(int drm_fd) : gbm_device_(gbm_create_device(drm_fd))
+uint32_t ScopedBOMapping::GetPlaneStride(size_t plane) const
+{
+    CHECK_LT(plane, GetNumPlanes());
+    return import_->planes[plane].stride;
+}
+
+uint32_t ScopedBOMapping::GetPlaneOffset(size_t plane) const
+{
+    CHECK_LT(plane, GetNumPlanes());
+    return import_->planes[plane].offset;
+}
+
+uint8_t *ScopedBOMapping::GetContiguousData() const
+{
+    if (GetNumPlanes() == 0) { return nullptr; }
+    scoped_bo_mapping_factory_->Map(*import_);
+    const std::vector<Plane> &planes = import_->planes;
+    uint8_t *const base = static_cast<uint8_t *>(planes[0].addr);
+    for (const auto &plane : planes) {
+        if (plane.offset < planes[0].offset
+            || static_cast<uint8_t *>(plane.addr) != base + (plane.offset - planes[0].offset)) {
+            return nullptr;
+        }
+    }
+    return base;
+}
+
+ScopedBOMappingFactory::ScopedBOMappingFactory(int drm_fd)
+    : idle_imports_(decltype(idle_imports_)::NO_AUTO_EVICT), gbm_device_(gbm_create_device(drm_fd))
 {
     // CHECK_GE(drm_fd, 0);
     CHECK(gbm_device_);
 }
 
-ScopedBOMappingFactory::~ScopedBOMappingFactory() = default;
+ScopedBOMappingFactory::~ScopedBOMappingFactory()
+{
+    TrimIdleImports();
+    CHECK(imports_.empty());
+    std::cerr << "Buffer Import Stats: " << stats_ << std::endl;
+}
 
 ScopedBOMapping ScopedBOMappingFactory::Create(gbm_import_fd_modifier_data import_data)
+{
+    ImportKey key;
+    for (size_t plane = 0; plane < GBM_MAX_PLANES && import_data.strides[plane] > 0; plane++) {
+        struct stat fd_stat;
+        CHECK_EQ(fstat(import_data.fds[plane], &fd_stat), 0);
+        key.buffers[plane] = { fd_stat.st_dev, fd_stat.st_ino };
+        key.strides[plane] = import_data.strides[plane];
+        key.offsets[plane] = import_data.offsets[plane];
+    }
+    key.width = import_data.width;
+    key.height = import_data.height;
+    key.format = import_data.format;
+    key.modifier = import_data.modifier;
+
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        stats_.creates++;
+        if (Import *import = Acquire(key)) {
+            stats_.cache_hits++;
+            return ScopedBOMapping(this, import);
+        }
+    }
+
+    std::unique_ptr<Import> import = ImportBuffer(key, import_data);
+    Import *result;
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        // Another thread may have imported the same dma-buf in the meantime.
+        result = Acquire(key);
+        if (!result) {
+            result = import.get();
+            result->refs = 1;
+            imports_.emplace(key, std::move(import));
+            stats_.imports++;
+        }
+    }
+    if (import) { UnmapAndDestroy(std::move(import)); }
+    return ScopedBOMapping(this, result);
+}
+
+void ScopedBOMappingFactory::TrimIdleImports()
+{
+    std::vector<std::unique_ptr<Import>> evicted;
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        for (auto &idle : idle_imports_) { evicted.push_back(std::move(idle.second)); }
+        idle_imports_.Clear();
+        idle_bytes_ = 0;
+        stats_.evictions += evicted.size();
+    }
+    for (auto &import : evicted) { UnmapAndDestroy(std::move(import)); }
+}
+
+ImportStats ScopedBOMappingFactory::GetStats()
 {
     const std::lock_guard<std::mutex> lock(lock_);
-    struct gbm_bo *bo_import = gbm_bo_import(
-        gbm_device_.get(), GBM_BO_IMPORT_FD_MODIFIER, &import_data, GBM_BO_USE_RENDERING);
-    CHECK(bo_import);
+    return stats_;
+}
 
-    std::vector<ScopedBOMapping::Plane> planes;
-    for (int plane = 0; plane < gbm_bo_get_plane_count(bo_import); plane++) {
-        uint32_t stride;
-        void *mmap_data;
-        void *addr = gbm_bo_map2(bo_import, /*x=*/0, /*y=*/0, gbm_bo_get_width(bo_import),
-            gbm_bo_get_height(bo_import), GBM_BO_TRANSFER_READ_WRITE, &stride, &mmap_data, plane);
-        CHECK_NE(addr, MAP_FAILED);
-        CHECK_GE(stride, 0u);
-        CHECK(mmap_data);
+ScopedBOMapping ScopedBOMappingFactory::WrapUserMemory(
+    uint8_t *data, uint32_t num_planes, const uint32_t *strides, const uint32_t *offsets)
+{
+    CHECK(data);
+    CHECK_LE(num_planes, static_cast<uint32_t>(GBM_MAX_PLANES));
+    auto import = std::make_unique<Import>();
+    for (uint32_t plane = 0; plane < num_planes; plane++) {
+        import->planes.emplace_back(strides[plane], offsets[plane], data + offsets[plane],
+            /*mmap_data=*/nullptr, /*prime_fd=*/-1);
+    }
+    import->refs = 1;
+    return ScopedBOMapping(this, import.release());
+}
 
-        const int prime_fd = gbm_bo_get_fd_for_plane(bo_import, plane);
-        CHECK_GE(prime_fd, 0);
+ScopedBOMapping::Import *ScopedBOMappingFactory::Acquire(const ImportKey &key)
+{
+    const auto used = imports_.find(key);
+    if (used != imports_.end()) {
+        used->second->refs++;
+        return used->second.get();
+    }
+    const auto idle = idle_imports_.Peek(key);
+    if (idle == idle_imports_.end()) { return nullptr; }
+    Import *const import = idle->second.get();
+    idle_bytes_ -= import->size;
+    import->refs = 1;
+    imports_.emplace(key, std::move(idle->second));
+    idle_imports_.Erase(idle);
+    return import;
+}
+
+void ScopedBOMappingFactory::Release(Import *import)
+{
+    // Client memory is neither cached nor unmapped.
+    if (!import->bo) {
+        CHECK_EQ(import->refs, 1u);
+        delete import;
+        return;
+    }
 
-        planes.emplace_back(stride, addr, mmap_data, prime_fd);
+    std::vector<std::unique_ptr<Import>> evicted;
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        CHECK_GT(import->refs, 0u);
+        if (--import->refs > 0) { return; }
+        const auto used = imports_.find(import->key);
+        CHECK(used != imports_.end());
+        idle_bytes_ += import->size;
+        idle_imports_.Put(import->key, std::move(used->second));
+        imports_.erase(used);
+        while (!idle_imports_.empty()
+            && (idle_imports_.size() > kMaxIdleImports || idle_bytes_ > kMaxIdleBytes)) {
+            const auto oldest = idle_imports_.rbegin();
+            idle_bytes_ -= oldest->second->size;
+            evicted.push_back(std::move(oldest->second));
+            idle_imports_.Erase(oldest);
+        }
+        stats_.evictions += evicted.size();
     }
-    return ScopedBOMapping(this, std::move(planes), bo_import);
+    for (auto &evicted_import : evicted) { UnmapAndDestroy(std::move(evicted_import)); }
 }
 
-void ScopedBOMappingFactory::UnmapAndDestroyBufferObject(
-    std::vector<ScopedBOMapping::Plane> planes, struct gbm_bo *bo_import)
+std::unique_ptr<ScopedBOMapping::Import> ScopedBOMappingFactory::ImportBuffer(
+    const ImportKey &key, gbm_import_fd_modifier_data &import_data)
 {
-    const std::lock_guard<std::mutex> lock(lock_);
-    CHECK(bo_import);
+    auto import = std::make_unique<Import>();
+    import->key = key;
+    {
+        const std::lock_guard<std::mutex> lock(gbm_lock_);
+        import->bo = gbm_bo_import(
+            gbm_device_.get(), GBM_BO_IMPORT_FD_MODIFIER, &import_data, GBM_BO_USE_RENDERING);
+        CHECK(import->bo);
+        for (int plane = 0; plane < gbm_bo_get_plane_count(import->bo); plane++) {
+            const int prime_fd = gbm_bo_get_fd_for_plane(import->bo, plane);
+            CHECK_GE(prime_fd, 0);
+            import->planes.emplace_back(gbm_bo_get_stride_for_plane(import->bo, plane),
+                gbm_bo_get_offset(import->bo, plane), /*addr=*/nullptr, /*mmap_data=*/nullptr,
+                prime_fd);
+        }
+    }
+
+    // Planes in the same dma-buf are synchronized together, and counted once.
+    // Whether they need it is only probed here, not on each access.
+    for (size_t plane = 0; plane < import->planes.size(); plane++) {
+        size_t other = 0;
+        while (other < plane && key.buffers[other] != key.buffers[plane]) { other++; }
+        const int fd = import->planes[other].prime_fd.get();
+        if (other == plane) {
+            if (NeedsSync(fd)) { import->synced_buffers.emplace_back(fd, 1u << plane); }
+            import->size += GetBufferSize(fd, import->planes[plane].stride, key.height);
+            continue;
+        }
+        for (auto &[buffer_fd, buffer_planes] : import->synced_buffers) {
+            if (buffer_fd == fd) { buffer_planes |= 1u << plane; }
+        }
+    }
+    return import;
+}
+
+void ScopedBOMappingFactory::Map(Import &import)
+{
+    // Client memory is mapped already.
+    if (!import.bo) { return; }
+    std::call_once(import.map_once, [&]() {
+        MapPlanes(import);
+        const std::lock_guard<std::mutex> lock(lock_);
+        stats_.mapped_imports++;
+        stats_.mapped_bytes += import.size;
+    });
+}
+
+void ScopedBOMappingFactory::MapPlanes(Import &import)
+{
+    // Map each dma-buf once, as a whole and without going through minigbm,
+    // so that planes sharing a dma-buf share its mapping and mapping doesn't
+    // hold |gbm_lock_|.
+    for (size_t plane = 0; plane < import.planes.size(); plane++) {
+        auto &current = import.planes[plane];
+        for (size_t other = 0; other < plane; other++) {
+            const auto &previous = import.planes[other];
+            if (import.key.buffers[other] == import.key.buffers[plane] && !previous.mmap_data) {
+                current.addr = static_cast<uint8_t *>(previous.addr) - previous.offset
+                    + current.offset;
+                break;
+            }
+        }
+        if (current.addr) { continue; }
+
+        struct stat fd_stat;
+        CHECK_EQ(fstat(current.prime_fd.get(), &fd_stat), 0);
+        const size_t size = static_cast<size_t>(fd_stat.st_size);
+        if (size > current.offset) {
+            void *addr = mmap(
+                nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, current.prime_fd.get(), 0);
+            if (addr == MAP_FAILED && errno == ENOMEM) {
+                // Memory is short, give up the idle imports and try again.
+                TrimIdleImports();
+                addr = mmap(
+                    nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, current.prime_fd.get(), 0);
+            }
+            if (addr != MAP_FAILED) {
+                import.mappings.emplace_back(addr, size);
+                current.addr = static_cast<uint8_t *>(addr) + current.offset;
+                continue;
+            }
+        }
+
+        // The size of the dma-buf is unknown or it can't be mapped directly,
+        // so let minigbm map the plane.
+        const std::lock_guard<std::mutex> lock(gbm_lock_);
+        uint32_t stride;
+        current.addr = gbm_bo_map2(import.bo, /*x=*/0, /*y=*/0, gbm_bo_get_width(import.bo),
+            gbm_bo_get_height(import.bo), GBM_BO_TRANSFER_READ_WRITE, &stride,
+            &current.mmap_data, static_cast<int>(plane));
+        CHECK_NE(current.addr, MAP_FAILED);
+        CHECK(current.mmap_data);
+        CHECK_EQ(stride, current.stride);
+    }
+}
+
+void ScopedBOMappingFactory::UnmapAndDestroy(std::unique_ptr<Import> import)
+{
+    CHECK(import->bo);
+    for (const auto &mapping : import->mappings) { munmap(mapping.first, mapping.second); }
+
+    const std::lock_guard<std::mutex> lock(gbm_lock_);
     CHECK(gbm_device_);
-    for (const auto &plane : planes) {
-        CHECK(plane.mmap_data);
-        gbm_bo_unmap(bo_import, plane.mmap_data);
+    for (const auto &plane : import->planes) {
+        if (plane.mmap_data) { gbm_bo_unmap(import->bo, plane.mmap_data); }
     }
 
     // Note that calling gbm_bo_destroy() may not actually end up destroying the
     // buffer object. That's because minigbm is expected to do reference counting
-    // of GEM handles. This is fine: suppose we create multiple ScopedBOMapping
-    // instances for the same dma-buf; all of them should share the same GEM
-    // handle which should only get destroyed when all the ScopedBOMappings
+    // of GEM handles. This is fine: suppose we create multiple imports of the
+    // same dma-buf, e.g. with different layouts; all of them should share the
+    // same GEM handle which should only get destroyed when all the imports
     // sharing that GEM handle are destroyed.
-    gbm_bo_destroy(bo_import);
+    gbm_bo_destroy(import->bo);
 }
 
 } // namespace libvavc8000d
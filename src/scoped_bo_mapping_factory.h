@@ -8,11 +8,19 @@
 
 #include "fake_gbm.h"
 
+#include <sys/types.h>
+
+#include <array>
+#include <compare>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <ostream>
+#include <utility>
 #include <vector>
 
 #include "base/logging.h"
+#include "base/lru_cache.h"
 #include "base/scoped_fd.h"
 
 namespace libvavc8000d
@@ -28,14 +36,18 @@ using ScopedGbmDevice = std::unique_ptr<gbm_device, GbmDeviceDeleter>;
 class ScopedBOMappingFactory;
 
 // ScopedBOMapping tracks the CPU mapping of a minigbm Buffer Object (BO).
-// Upon destruction, it unmaps and destroys the Buffer Object.
+// Many surfaces never reach the CPU, e.g. when decoded frames go straight to
+// the display or to an encoder, so the Buffer Object is only mapped on the
+// first BeginAccess() or GetContiguousData(). Upon destruction, it releases the
+// Buffer Object.
 //
 // Notes:
 //
 // - Only a ScopedBOMappingFactory can create valid ScopedBOMapping instances.
-//   Upon destruction, the ScopedBOMapping requests the ScopedBOMappingFactory
-//   to unmap and destroy the Buffer Object. This is done to ensure that the GBM
-//   device is protected from concurrent operations on multiple threads.
+//   Upon destruction, the ScopedBOMapping hands the Buffer Object back to the
+//   ScopedBOMappingFactory, which may keep it imported and mapped for a later
+//   import of the same dma-buf. The GBM device is only used by the factory so
+//   that it is protected from concurrent operations on multiple threads.
 //   Therefore, the ScopedBOMappingFactory that creates a ScopedBOMapping must
 //   outlive it.
 //
@@ -46,6 +58,20 @@ class ScopedBOMappingFactory;
 class ScopedBOMapping
 {
 public:
+    // How a ScopedAccess uses the mapping, which decides the cache maintenance
+    // done when it begins and ends. kWrite skips making the CPU caches
+    // coherent with the buffer at the beginning, so it must only be used when
+    // the contents that matter are overwritten.
+    enum class AccessMode
+    {
+        kRead,
+        kWrite,
+        kReadWrite,
+    };
+
+    // Plane mask of BeginAccess() that selects every plane.
+    static constexpr uint32_t kAllPlanes = ~0u;
+
     // A ScopedAccess can be used to ensure cache-coherent CPU read/write access
     // to a Buffer Object mapping. The intended usage is as follows:
     //
@@ -55,6 +81,10 @@ public:
     //   /* Read/write using access.GetData() and access.GetStride() */
     // }
     //
+    // Only the dma-bufs holding the planes of the access are synchronized,
+    // each one once however many of its planes are accessed, and not at all if
+    // they are coherent.
+    //
     // ScopedAccess instances themselves are thread-safe but:
     //
     // - Concurrent reads/writes to the mapped data must be synchronized
@@ -73,6 +103,7 @@ public:
         ScopedAccess &operator=(const ScopedAccess &) = delete;
         ~ScopedAccess();
 
+        // |plane| must be one of the planes of the access.
         uint8_t *GetData(size_t plane) const;
         uint32_t GetStride(size_t plane) const;
 
@@ -80,9 +111,15 @@ public:
         // Only ScopedBOMapping should be able to create ScopedAccess instances.
         friend class ScopedBOMapping;
 
-        explicit ScopedAccess(const ScopedBOMapping &mapping);
+        ScopedAccess(const ScopedBOMapping &mapping, AccessMode mode, uint32_t plane_mask);
+
+        // Issues DMA_BUF_IOCTL_SYNC with |flags| for the dma-bufs of the access.
+        void Sync(uint64_t flags) const;
 
         const ScopedBOMapping &mapping_;
+        // DMA_BUF_SYNC_READ and/or DMA_BUF_SYNC_WRITE.
+        const uint64_t direction_;
+        const uint32_t plane_mask_;
     };
 
     // Creates an invalid ScopedBOMapping.
@@ -93,40 +130,133 @@ public:
     ScopedBOMapping &operator=(ScopedBOMapping &&other);
     ~ScopedBOMapping();
 
-    bool IsValid() const { return !!scoped_bo_mapping_factory_; }
+    bool IsValid() const { return !!import_; }
 
     explicit operator bool() const { return IsValid(); }
 
-    ScopedAccess BeginAccess() const;
+    // Begins an access in |mode| to the planes selected by the bits of
+    // |plane_mask|.
+    ScopedAccess BeginAccess(
+        AccessMode mode = AccessMode::kReadWrite, uint32_t plane_mask = kAllPlanes) const;
+
+    // Layout of the planes of the buffer object, e.g. to export it. The file
+    // descriptors remain owned by the mapping.
+    size_t GetNumPlanes() const;
+    int GetPlaneFd(size_t plane) const;
+    uint32_t GetPlaneStride(size_t plane) const;
+    uint32_t GetPlaneOffset(size_t plane) const;
+
+    // Returns the address of the first plane if all the planes are in a single
+    // CPU mapping, at the same distances from each other as in the dma-buf, so
+    // that they can be addressed from one pointer. Returns nullptr otherwise.
+    // Maps the Buffer Object if needed.
+    uint8_t *GetContiguousData() const;
 
 private:
     // Contains metadata for each element of a plane retrieved from minigbm.
     struct Plane
     {
-        Plane(uint32_t stride, void *addr, void *mmap_data, int prime_fd);
+        Plane(uint32_t stride, uint32_t offset, void *addr, void *mmap_data, int prime_fd);
         Plane(Plane &&other);
         Plane &operator=(Plane &&other);
         ~Plane();
 
         uint32_t stride;
+        // Offset of the plane in its dma-buf.
+        uint32_t offset;
+        // Set once the Import is mapped.
         void *addr;
+        // Set when the plane was mapped with gbm_bo_map2(), rather than being
+        // part of one of the mappings of its Import.
         void *mmap_data;
         base::ScopedFD prime_fd;
     };
+
+    // Identifies an imported dma-buf: the inode of the dma-buf of each plane,
+    // as returned by fstat(), and the layout it was imported with. The Import
+    // holds references to the dma-bufs, so their inodes can't be reused for
+    // other buffers while it is cached.
+    struct ImportKey
+    {
+        std::array<std::pair<dev_t, ino_t>, GBM_MAX_PLANES> buffers {};
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t format = 0;
+        std::array<int, GBM_MAX_PLANES> strides {};
+        std::array<int, GBM_MAX_PLANES> offsets {};
+        uint64_t modifier = 0;
+
+        auto operator<=>(const ImportKey &) const = default;
+    };
+
+    // A dma-buf imported into minigbm along with its CPU mappings. Imports
+    // are owned by the factory and shared by all the ScopedBOMappings of the
+    // same ImportKey. Imports of client memory have no buffer object and are
+    // owned by their only ScopedBOMapping.
+    struct Import
+    {
+        ImportKey key;
+        // Null for client memory.
+        struct gbm_bo *bo = nullptr;
+        std::vector<Plane> planes;
+        // The dma-bufs that need DMA_BUF_IOCTL_SYNC around CPU accesses, with
+        // a prime fd and the mask of the planes in each. Empty when the
+        // buffers are coherent, or not dma-bufs, as with the fake GBM backend.
+        // Probed once on import, so accesses only issue the ioctls.
+        std::vector<std::pair<int, uint32_t>> synced_buffers;
+        // Makes the first access map the planes, whichever ScopedBOMapping or
+        // thread it comes from.
+        std::once_flag map_once;
+        // Mappings of whole dma-bufs, each shared by the planes it holds.
+        std::vector<std::pair<void *, size_t>> mappings;
+        // Bytes of the dma-bufs of the import. Set before the import is
+        // shared and constant after, so it can be read without locking.
+        size_t size = 0;
+        // Number of ScopedBOMappings using the import. Guarded by the lock of
+        // the factory.
+        size_t refs = 0;
+    };
+
     // Needed so that GBMDeviceHolder can create ScopedBOMappings.
     friend class ScopedBOMappingFactory;
 
-    ScopedBOMapping(ScopedBOMappingFactory *scoped_bo_mapping_factory, std::vector<Plane> planes,
-        struct gbm_bo *bo_import);
+    ScopedBOMapping(ScopedBOMappingFactory *scoped_bo_mapping_factory, Import *import);
 
     ScopedBOMappingFactory *scoped_bo_mapping_factory_;
-    std::vector<Plane> planes_;
-    struct gbm_bo *bo_import_;
+    Import *import_;
 };
 
+// Counters kept by a ScopedBOMappingFactory over its lifetime.
+struct ImportStats
+{
+    // Calls to Create(), and those served by an import that was cached.
+    uint64_t creates = 0;
+    uint64_t cache_hits = 0;
+    // Imports made, and those that were ever mapped for CPU access, with the
+    // size of their dma-bufs.
+    uint64_t imports = 0;
+    uint64_t mapped_imports = 0;
+    uint64_t mapped_bytes = 0;
+    // Idle imports destroyed to stay within the cache limits or on request.
+    uint64_t evictions = 0;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const ImportStats &stats)
+{
+    return os << "creates=" << stats.creates << " cache_hits=" << stats.cache_hits
+              << " imports=" << stats.imports << " mapped_imports=" << stats.mapped_imports
+              << " mapped_bytes=" << stats.mapped_bytes << " evictions=" << stats.evictions;
+}
+
 // A ScopedBOMappingFactory provides thread-safe access to minigbm in order to
 // import dma-bufs and map them for CPU access.
 //
+// Clients such as Chrome and ffmpeg recreate their surfaces over the same
+// dma-bufs, e.g. on every resolution change or seek, so imports are cached by
+// ImportKey. An import is shared while ScopedBOMappings of the same dma-buf
+// exist, and kept after the last one is gone until it is evicted, least
+// recently used first, to stay within kMaxIdleImports and kMaxIdleBytes.
+//
 // ScopedBOMappingFactory instances are thread-safe.
 class ScopedBOMappingFactory
 {
@@ -136,20 +266,67 @@ public:
     ScopedBOMappingFactory &operator=(const ScopedBOMappingFactory &) = delete;
     ~ScopedBOMappingFactory();
 
-    // Imports and maps the dma-buf referenced by |import_data|. This method
-    // always returns a valid mapping. If the dma-buf can't be imported, it
-    // crashes.
+    // Imports the dma-buf referenced by |import_data|, or reuses a cached
+    // import of it. The dma-buf is mapped on first access. This method always
+    // returns a valid mapping. If the dma-buf can't be imported, it crashes.
     ScopedBOMapping Create(gbm_import_fd_modifier_data import_data);
 
+    // Wraps the |num_planes| planes at |offsets| from |data|, with |strides|,
+    // in memory the client allocated, e.g. for VA_SURFACE_ATTRIB_MEM_TYPE_USER_PTR
+    // surfaces. The CPU accesses the memory in place, so it must outlive the
+    // mapping. The planes have no file descriptor.
+    ScopedBOMapping WrapUserMemory(uint8_t *data, uint32_t num_planes, const uint32_t *strides,
+        const uint32_t *offsets);
+
+    // Unmaps and destroys the imports no ScopedBOMapping uses, e.g. when
+    // memory is short. The dma-bufs they hold are freed unless their owners
+    // still use them.
+    void TrimIdleImports();
+
+    ImportStats GetStats();
+
 private:
-    // Needed so that the ScopedBOMapping can call UnmapAndDestroyBufferObject().
+    using Import = ScopedBOMapping::Import;
+    using ImportKey = ScopedBOMapping::ImportKey;
+
+    // Idle imports keep their dma-bufs alive, so they are bounded both in
+    // number and in size. This covers the surface pool of a 1080p stream.
+    static constexpr size_t kMaxIdleImports = 32;
+    static constexpr size_t kMaxIdleBytes = 128u << 20;
+
+    // Needed so that the ScopedBOMapping can call Map() and Release().
     friend class ScopedBOMapping;
 
-    // Unmaps all the |planes| of the buffer object referenced by |bo_import|.
-    void UnmapAndDestroyBufferObject(
-        std::vector<ScopedBOMapping::Plane> planes, struct gbm_bo *bo_import);
+    // Returns the cached import of |key| with a new reference, or nullptr.
+    // |lock_| must be held.
+    Import *Acquire(const ImportKey &key);
+
+    // Drops a reference to |import|, which becomes idle when it was the last.
+    void Release(Import *import);
 
+    std::unique_ptr<Import> ImportBuffer(
+        const ImportKey &key, gbm_import_fd_modifier_data &import_data);
+
+    // Maps the planes of |import| for CPU access unless that's done already.
+    void Map(Import &import);
+    void MapPlanes(Import &import);
+
+    // Unmaps all the planes of |import| and destroys its buffer object.
+    void UnmapAndDestroy(std::unique_ptr<Import> import);
+
+    // Guards the caches. It is never held during minigbm calls or while
+    // mapping, so imports of different dma-bufs don't wait for each other.
     std::mutex lock_;
+    // Imports used by ScopedBOMappings.
+    std::map<ImportKey, std::unique_ptr<Import>> imports_;
+    // Imports no ScopedBOMapping uses, most recently released first.
+    base::LRUCache<ImportKey, std::unique_ptr<Import>> idle_imports_;
+    size_t idle_bytes_ = 0;
+    ImportStats stats_;
+
+    // minigbm is not thread-safe, so all the calls on the device and its
+    // buffer objects are made under |gbm_lock_|.
+    std::mutex gbm_lock_;
     const ScopedGbmDevice gbm_device_;
 };
 
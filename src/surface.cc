@@ -12,38 +12,169 @@
 #include "surface.h"
 
 #include <libdrm/drm_fourcc.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <va/va_drmcommon.h>
 
+#include <array>
+#include <cstring>
+#include <iostream>
 #include <unordered_set>
 
 #include "base/logging.h"
 #include "base/ptr_util.h"
+#include "decapicommon.h"
 
 #define GBM_FORMAT_P010 __gbm_fourcc_code('P', '0', '1', '0')
+#define GBM_FORMAT_RGBP __gbm_fourcc_code('R', 'G', 'B', 'P')
 
 namespace libvavc8000d
 {
+namespace
+{
+
+    // Layouts of the buffers that can be imported as surfaces.
+    struct ImportFormat
+    {
+        uint32_t va_fourcc;
+        unsigned int rt_format;
+        // Format of the layers of the VADRMPRIMESurfaceDescriptor.
+        uint32_t drm_format;
+        uint32_t gbm_format;
+        uint32_t num_planes;
+        // Formats of the planes when they are exported as separate layers.
+        std::array<uint32_t, 3> plane_drm_formats;
+    };
+
+    constexpr ImportFormat kImportFormats[] = {
+        { VA_FOURCC_NV12, VA_RT_FORMAT_YUV420, DRM_FORMAT_NV12, GBM_FORMAT_NV12, 2,
+            { DRM_FORMAT_R8, DRM_FORMAT_GR88 } },
+        { VA_FOURCC_I420, VA_RT_FORMAT_YUV420, DRM_FORMAT_YUV420, GBM_FORMAT_YUV420, 3,
+            { DRM_FORMAT_R8, DRM_FORMAT_R8, DRM_FORMAT_R8 } },
+        { VA_FOURCC_P010, VA_RT_FORMAT_YUV420_10, DRM_FORMAT_P010, GBM_FORMAT_P010, 2,
+            { DRM_FORMAT_R16, DRM_FORMAT_GR1616 } },
+        { VA_FOURCC_Y800, VA_RT_FORMAT_YUV400, DRM_FORMAT_R8, GBM_FORMAT_R8, 1,
+            { DRM_FORMAT_R8 } },
+        // Byte order R, G, B, X in memory.
+        { VA_FOURCC_RGBX, VA_RT_FORMAT_RGB32, DRM_FORMAT_XBGR8888, GBM_FORMAT_XBGR8888, 1,
+            { DRM_FORMAT_XBGR8888 } },
+        { VA_FOURCC_BGRX, VA_RT_FORMAT_RGB32, DRM_FORMAT_XRGB8888, GBM_FORMAT_XRGB8888, 1,
+            { DRM_FORMAT_XRGB8888 } },
+        // DRM has no planar RGB format, so each plane is described as an R8
+        // layer, the way drivers export such surfaces.
+        { VA_FOURCC_RGBP, VA_RT_FORMAT_RGBP, DRM_FORMAT_R8, GBM_FORMAT_RGBP, 3,
+            { DRM_FORMAT_R8, DRM_FORMAT_R8, DRM_FORMAT_R8 } },
+    };
+
+    const ImportFormat *FindImportFormat(uint32_t va_fourcc)
+    {
+        for (const auto &import_format : kImportFormats) {
+            if (import_format.va_fourcc == va_fourcc) { return &import_format; }
+        }
+        return nullptr;
+    }
+
+    // The layout of the surfaces allocated without a pixel format attribute,
+    // which matches how GetSurfaceFormat() sees them. Returns 0 if the driver
+    // can't allocate surfaces of |rt_format|.
+    uint32_t GetDefaultFourCC(unsigned int rt_format)
+    {
+        switch (rt_format) {
+        case VA_RT_FORMAT_YUV420: return VA_FOURCC_NV12;
+        case VA_RT_FORMAT_YUV420_10: return VA_FOURCC_P010;
+        case VA_RT_FORMAT_YUV400: return VA_FOURCC_Y800;
+        case VA_RT_FORMAT_RGB32: return VA_FOURCC_BGRX;
+        case VA_RT_FORMAT_RGBP: return VA_FOURCC_RGBP;
+        default: return 0u;
+        }
+    }
+
+    // Rows and planes of the surfaces the driver allocates are aligned as the
+    // post-processor aligns its output by default, so that the pictures are
+    // copied a cache line at a time.
+    constexpr uint32_t kSurfaceAlignment = 1u << DEC_ALIGN_64B;
+    constexpr size_t kPageSize = 4096;
+
+    constexpr size_t AlignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Size of the samples of a plane, and the subsampling of the plane.
+    struct PlaneShape
+    {
+        uint32_t bytes_per_sample;
+        uint32_t horizontal_subsampling;
+        uint32_t vertical_subsampling;
+    };
+
+    PlaneShape GetPlaneShape(uint32_t va_fourcc, uint32_t plane)
+    {
+        switch (va_fourcc) {
+        // Chroma samples come in Cb/Cr pairs.
+        case VA_FOURCC_NV12: return plane == 0 ? PlaneShape { 1, 1, 1 } : PlaneShape { 2, 2, 2 };
+        case VA_FOURCC_P010: return plane == 0 ? PlaneShape { 2, 1, 1 } : PlaneShape { 4, 2, 2 };
+        case VA_FOURCC_I420: return plane == 0 ? PlaneShape { 1, 1, 1 } : PlaneShape { 1, 2, 2 };
+        case VA_FOURCC_RGBX:
+        case VA_FOURCC_BGRX: return { 4, 1, 1 };
+        default: return { 1, 1, 1 };
+        }
+    }
+
+    // Returns whether pictures can be written to surfaces of |va_fourcc| in the
+    // layout of |modifier|. Tiled surfaces receive the decoders' reference
+    // frames as they are, which only exist as NV12.
+    bool IsSupportedModifier(uint32_t va_fourcc, uint64_t modifier)
+    {
+        if (modifier == DRM_FORMAT_MOD_LINEAR) { return true; }
+        return modifier == VSSurface::kTiled4x4Modifier
+            && (va_fourcc == VA_FOURCC_NV12 || va_fourcc == 0u);
+    }
+
+    // Picks the layout of a surface the driver allocates among the |modifiers|
+    // its consumer supports. Tiled surfaces are preferred, as they spare the
+    // post-processor pass that converts the reference frames.
+    uint64_t SelectModifier(uint32_t va_fourcc, const VADRMFormatModifierList &list)
+    {
+        bool linear = false;
+        for (uint32_t i = 0; i < list.num_modifiers; i++) {
+            if (list.modifiers[i] == DRM_FORMAT_MOD_LINEAR) {
+                linear = true;
+            } else if (IsSupportedModifier(va_fourcc, list.modifiers[i])) {
+                return list.modifiers[i];
+            }
+        }
+        if (!linear) {
+            std::cerr << "No supported modifier requested, using a linear layout" << std::endl;
+        }
+        return DRM_FORMAT_MOD_LINEAR;
+    }
+
+} // namespace
 
 VSSurface::VSSurface(VSSurface::IdType id, unsigned int format, uint32_t va_fourcc,
-    unsigned int width, unsigned int height, std::vector<VASurfaceAttrib> attrib_list,
-    ScopedBOMapping mapped_bo)
+    unsigned int width, unsigned int height, uint64_t modifier,
+    std::vector<VASurfaceAttrib> attrib_list, ScopedBOMapping mapped_bo,
+    SurfaceMemoryPool::Buffer memory)
     : id_(id)
     , format_(format)
     , va_fourcc_(va_fourcc)
     , width_(width)
     , height_(height)
+    , modifier_(modifier)
     , attrib_list_(std::move(attrib_list))
+    , memory_(std::move(memory))
     , mapped_bo_(std::move(mapped_bo))
 {}
 
 VSSurface::~VSSurface() = default;
 
 std::unique_ptr<VSSurface> VSSurface::Create(IdType id, unsigned int format, unsigned int width,
-    unsigned int height, std::vector<VASurfaceAttrib> attrib_list,
-    ScopedBOMappingFactory &scoped_bo_mapping_factory)
+    unsigned int height, std::vector<VASurfaceAttrib> attrib_list, unsigned int index,
+    ScopedBOMappingFactory &scoped_bo_mapping_factory, SurfaceMemoryPool &surface_memory_pool,
+    VAStatus &status)
 {
-    // There are no specified attributes to this surface
-
+    status = VA_STATUS_SUCCESS;
     // Dump the attributes for debugging.
     // for (auto &attrib : attrib_list) {
     //     std::cerr << "attrib.type: " << attrib.type << std::endl;
@@ -55,15 +186,18 @@ std::unique_ptr<VSSurface> VSSurface::Create(IdType id, unsigned int format, uns
     //     }
     // }
 
-    if (attrib_list.empty()) {
-        return base::WrapUnique(
-            new VSSurface(id, format, /*va_fourcc=*/0u, width, height, std::move(attrib_list),
-                /*mapped_bo=*/{}));
-    }
-
     // Verify attributes and extract surface descriptor.
     std::unordered_set<VASurfaceAttribType> attribs;
-    VADRMPRIMESurfaceDescriptor *surf_desc = nullptr;
+    // A VADRMPRIMESurfaceDescriptor, or a VASurfaceAttribExternalBuffers for
+    // user pointers.
+    void *descriptor = nullptr;
+    // Surfaces allocated by the driver only know their layout from this
+    // attribute, if the client sets it.
+    uint32_t pixel_format = 0u;
+    const VADRMFormatModifierList *modifier_list = nullptr;
+    uint32_t usage_hint = VA_SURFACE_ATTRIB_USAGE_HINT_GENERIC;
+    bool driver_allocated = false;
+    bool user_ptr = false;
     for (auto attrib : attrib_list) {
         // Some libva clients are quirky about their surface attributes, so
         // simply ignore unexpected attribute types.
@@ -72,18 +206,47 @@ std::unique_ptr<VSSurface> VSSurface::Create(IdType id, unsigned int format, uns
 
         if (attrib.type == VASurfaceAttribMemoryType) {
             CHECK_EQ(attrib.value.type, VAGenericValueTypeInteger);
-            if (attrib.value.value.i == VA_SURFACE_ATTRIB_MEM_TYPE_VA) {
-                return base::WrapUnique(new VSSurface(id, format, /*va_fourcc=*/0u, width, height,
-                    std::move(attrib_list), /*mapped_bo=*/{}));
+            driver_allocated = attrib.value.value.i == VA_SURFACE_ATTRIB_MEM_TYPE_VA;
+            user_ptr = attrib.value.value.i == VA_SURFACE_ATTRIB_MEM_TYPE_USER_PTR;
+            if (!driver_allocated && !user_ptr) {
+                CHECK_EQ(attrib.value.value.i, VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2);
             }
-            CHECK_EQ(attrib.value.value.i, VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2);
         } else if (attrib.type == VASurfaceAttribExternalBufferDescriptor) {
             CHECK_EQ(attrib.value.type, VAGenericValueTypePointer);
-            surf_desc = static_cast<VADRMPRIMESurfaceDescriptor *>(attrib.value.value.p);
+            descriptor = attrib.value.value.p;
+        } else if (attrib.type == VASurfaceAttribPixelFormat) {
+            CHECK_EQ(attrib.value.type, VAGenericValueTypeInteger);
+            pixel_format = static_cast<uint32_t>(attrib.value.value.i);
+        } else if (attrib.type == VASurfaceAttribDRMFormatModifiers) {
+            CHECK_EQ(attrib.value.type, VAGenericValueTypePointer);
+            modifier_list = static_cast<const VADRMFormatModifierList *>(attrib.value.value.p);
+        } else if (attrib.type == VASurfaceAttribUsageHint) {
+            CHECK_EQ(attrib.value.type, VAGenericValueTypeInteger);
+            usage_hint = static_cast<uint32_t>(attrib.value.value.i);
+        }
+    }
+    // Surfaces without attributes, e.g. those of ffmpeg, are allocated by the
+    // driver too.
+    if (driver_allocated || attribs.find(VASurfaceAttribMemoryType) == attribs.end()) {
+        const uint32_t va_fourcc = pixel_format ? pixel_format : GetDefaultFourCC(format);
+        const uint64_t modifier = modifier_list ? SelectModifier(va_fourcc, *modifier_list)
+                                                : DRM_FORMAT_MOD_LINEAR;
+        return CreateAllocated(id, format, va_fourcc, width, height, modifier, usage_hint,
+            std::move(attrib_list), scoped_bo_mapping_factory, surface_memory_pool, status);
+    }
+    if (user_ptr) {
+        if (!descriptor) {
+            std::cerr << "User pointer surfaces need a VASurfaceAttribExternalBuffers" << std::endl;
+            status = VA_STATUS_ERROR_INVALID_PARAMETER;
+            return nullptr;
         }
+        return CreateFromUserPtr(id, format, width, height,
+            *static_cast<const VASurfaceAttribExternalBuffers *>(descriptor), index,
+            std::move(attrib_list), scoped_bo_mapping_factory, status);
     }
-    CHECK(surf_desc);
-    CHECK(attribs.find(VASurfaceAttribMemoryType) != attribs.end());
+    CHECK(descriptor);
+    const VADRMPRIMESurfaceDescriptor *surf_desc
+        = static_cast<const VADRMPRIMESurfaceDescriptor *>(descriptor);
 
     struct gbm_import_fd_modifier_data fd_data{};
 
@@ -94,16 +257,12 @@ std::unique_ptr<VSSurface> VSSurface::Create(IdType id, unsigned int format, uns
 
     fd_data.width = surf_desc->width;
     fd_data.height = surf_desc->height;
-    CHECK(surf_desc->fourcc == VA_FOURCC_NV12 || surf_desc->fourcc == VA_FOURCC_P010);
-    const unsigned int expected_rt_format
-        = surf_desc->fourcc == VA_FOURCC_NV12 ? VA_RT_FORMAT_YUV420 : VA_RT_FORMAT_YUV420_10;
-
-    const uint32_t expected_drm_format
-        = surf_desc->fourcc == VA_FOURCC_NV12 ? DRM_FORMAT_NV12 : DRM_FORMAT_P010;
-    const uint32_t expected_num_planes = 2u;
-    fd_data.format = surf_desc->fourcc == VA_FOURCC_NV12 ? GBM_FORMAT_NV12 : GBM_FORMAT_P010;
+    const ImportFormat *import_format = FindImportFormat(surf_desc->fourcc);
+    CHECK(import_format);
+    const uint32_t expected_num_planes = import_format->num_planes;
+    fd_data.format = import_format->gbm_format;
 
-    CHECK_EQ(format, expected_rt_format);
+    CHECK_EQ(format, import_format->rt_format);
     CHECK_GT(surf_desc->num_objects, 0u);
     CHECK_LE(surf_desc->num_objects, static_cast<uint32_t>(std::size(surf_desc->objects)));
     fd_data.num_fds = surf_desc->num_objects;
@@ -112,24 +271,185 @@ std::unique_ptr<VSSurface> VSSurface::Create(IdType id, unsigned int format, uns
     for (uint32_t i = 1u; i < surf_desc->num_objects; i++) {
         CHECK_EQ(surf_desc->objects[i].drm_format_modifier, fd_data.modifier);
     }
+    // The tiled layout is private to the driver, so no other component can
+    // have produced it.
+    if (fd_data.modifier != DRM_FORMAT_MOD_LINEAR) {
+        std::cerr << "Can't import a buffer with modifier 0x" << std::hex << fd_data.modifier
+                  << std::dec << std::endl;
+        status = VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+        return nullptr;
+    }
 
-    // In general, the planes may be distributed across multiple layers, but let's
-    // only handle the situation in which all the planes are in one layer.
-    CHECK_EQ(surf_desc->num_layers, 1u);
-    CHECK_EQ(surf_desc->layers[0].drm_format, expected_drm_format);
-    CHECK_EQ(surf_desc->layers[0].num_planes, expected_num_planes);
-
-    for (uint32_t plane = 0u; plane < expected_num_planes; ++plane) {
-        CHECK_LT(surf_desc->layers[0].object_index[plane], surf_desc->num_objects);
-        fd_data.fds[plane] = surf_desc->objects[surf_desc->layers[0].object_index[plane]].fd;
-        fd_data.strides[plane] = static_cast<int>(surf_desc->layers[0].pitch[plane]);
-        fd_data.offsets[plane] = static_cast<int>(surf_desc->layers[0].offset[plane]);
+    // The planes are either all in one layer, or in one layer each, which is
+    // the only way to describe planar RGB.
+    CHECK(surf_desc->num_layers == 1u || surf_desc->num_layers == expected_num_planes);
+    uint32_t plane = 0u;
+    for (uint32_t layer = 0u; layer < surf_desc->num_layers; ++layer) {
+        const auto &desc_layer = surf_desc->layers[layer];
+        CHECK_EQ(desc_layer.drm_format, import_format->drm_format);
+        for (uint32_t layer_plane = 0u; layer_plane < desc_layer.num_planes; ++layer_plane) {
+            CHECK_LT(plane, expected_num_planes);
+            CHECK_LT(desc_layer.object_index[layer_plane], surf_desc->num_objects);
+            fd_data.fds[plane] = surf_desc->objects[desc_layer.object_index[layer_plane]].fd;
+            fd_data.strides[plane] = static_cast<int>(desc_layer.pitch[layer_plane]);
+            fd_data.offsets[plane] = static_cast<int>(desc_layer.offset[layer_plane]);
+            ++plane;
+        }
     }
+    CHECK_EQ(plane, expected_num_planes);
 
     ScopedBOMapping mapped_bo = scoped_bo_mapping_factory.Create(fd_data);
     CHECK(!!mapped_bo);
     return base::WrapUnique(new VSSurface(id, format, surf_desc->fourcc, width, height,
-        std::move(attrib_list), std::move(mapped_bo)));
+        fd_data.modifier, std::move(attrib_list), std::move(mapped_bo)));
+}
+
+std::unique_ptr<VSSurface> VSSurface::CreateAllocated(IdType id, unsigned int format,
+    uint32_t va_fourcc, unsigned int width, unsigned int height, uint64_t modifier,
+    uint32_t usage_hint, std::vector<VASurfaceAttrib> attrib_list,
+    ScopedBOMappingFactory &scoped_bo_mapping_factory, SurfaceMemoryPool &surface_memory_pool,
+    VAStatus &status)
+{
+    if (width == 0 || height == 0) {
+        status = VA_STATUS_ERROR_INVALID_PARAMETER;
+        return nullptr;
+    }
+    const ImportFormat *import_format = FindImportFormat(va_fourcc);
+    if (!import_format || import_format->rt_format != format
+        || !IsSupportedModifier(va_fourcc, modifier)) {
+        std::cerr << "Can't allocate a surface of fourcc 0x" << std::hex << va_fourcc << std::dec
+                  << " and format 0x" << std::hex << format << std::dec << std::endl;
+        status = VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+        return nullptr;
+    }
+
+    // All the planes are in one buffer. Tiled surfaces hold whole rows of 4x4
+    // tiles, of luma and of chroma. Their layout is only known to the driver,
+    // minigbm maps them as linear buffers.
+    struct gbm_import_fd_modifier_data fd_data{};
+    fd_data.width = width;
+    fd_data.height = height;
+    fd_data.format = import_format->gbm_format;
+    fd_data.num_fds = 1;
+    fd_data.modifier = DRM_FORMAT_MOD_LINEAR;
+    const size_t rows = AlignUp(height, modifier == kTiled4x4Modifier ? 8u : 2u);
+    size_t size = 0;
+    for (uint32_t plane = 0; plane < import_format->num_planes; plane++) {
+        const PlaneShape shape = GetPlaneShape(va_fourcc, plane);
+        const size_t stride = AlignUp(
+            AlignUp(width, shape.horizontal_subsampling) / shape.horizontal_subsampling
+                * shape.bytes_per_sample,
+            kSurfaceAlignment);
+        fd_data.strides[plane] = static_cast<int>(stride);
+        fd_data.offsets[plane] = static_cast<int>(size);
+        size += AlignUp(stride * (rows / shape.vertical_subsampling), kSurfaceAlignment);
+    }
+
+    // Surfaces the client only processes are given DWL linear memory, which
+    // the post-processor reads in place instead of from a copy. No other
+    // device can import that memory, so surfaces that may be exported or
+    // displayed keep a dma-buf.
+    const uint32_t shared_usage
+        = VA_SURFACE_ATTRIB_USAGE_HINT_EXPORT | VA_SURFACE_ATTRIB_USAGE_HINT_DISPLAY;
+    const bool vpp_input
+        = (usage_hint & VA_SURFACE_ATTRIB_USAGE_HINT_VPP_READ) && !(usage_hint & shared_usage);
+    if (vpp_input && modifier == DRM_FORMAT_MOD_LINEAR
+        && (va_fourcc == VA_FOURCC_NV12 || va_fourcc == VA_FOURCC_I420)) {
+        SurfaceMemoryPool::Buffer memory
+            = surface_memory_pool.AllocateDeviceMemory(AlignUp(size, kPageSize));
+        if (memory.IsValid()) {
+            std::array<uint32_t, GBM_MAX_PLANES> strides {};
+            std::array<uint32_t, GBM_MAX_PLANES> offsets {};
+            for (uint32_t plane = 0; plane < import_format->num_planes; plane++) {
+                strides[plane] = static_cast<uint32_t>(fd_data.strides[plane]);
+                offsets[plane] = static_cast<uint32_t>(fd_data.offsets[plane]);
+            }
+            ScopedBOMapping mapped_bo = scoped_bo_mapping_factory.WrapUserMemory(
+                reinterpret_cast<uint8_t *>(memory.GetDeviceMemory()->virtual_address),
+                import_format->num_planes, strides.data(), offsets.data());
+            return base::WrapUnique(new VSSurface(id, format, va_fourcc, width, height, modifier,
+                std::move(attrib_list), std::move(mapped_bo), std::move(memory)));
+        }
+    }
+
+    SurfaceMemoryPool::Buffer memory = surface_memory_pool.Allocate(AlignUp(size, kPageSize));
+    if (!memory.IsValid()) {
+        status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        return nullptr;
+    }
+    for (uint32_t plane = 0; plane < import_format->num_planes; plane++) {
+        fd_data.fds[plane] = memory.GetFd();
+    }
+
+    ScopedBOMapping mapped_bo = scoped_bo_mapping_factory.Create(fd_data);
+    if (!mapped_bo) {
+        std::cerr << "Can't import the buffer of a " << width << "x" << height << " surface"
+                  << std::endl;
+        status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+        return nullptr;
+    }
+    return base::WrapUnique(new VSSurface(id, format, va_fourcc, width, height, modifier,
+        std::move(attrib_list), std::move(mapped_bo), std::move(memory)));
+}
+
+std::unique_ptr<VSSurface> VSSurface::CreateFromUserPtr(IdType id, unsigned int format,
+    unsigned int width, unsigned int height, const VASurfaceAttribExternalBuffers &buffers,
+    unsigned int index, std::vector<VASurfaceAttrib> attrib_list,
+    ScopedBOMappingFactory &scoped_bo_mapping_factory, VAStatus &status)
+{
+    // The descriptor comes from the client, so it is validated rather than
+    // checked.
+    const auto reject = [&status](VAStatus error, const char *reason) {
+        std::cerr << "Can't create a user pointer surface: " << reason << std::endl;
+        status = error;
+        return nullptr;
+    };
+    const ImportFormat *import_format = FindImportFormat(buffers.pixel_format);
+    if (!import_format) {
+        return reject(VA_STATUS_ERROR_ATTR_NOT_SUPPORTED, "unsupported pixel format");
+    }
+    // Client memory can only be linear.
+    if (buffers.flags & VA_SURFACE_EXTBUF_DESC_ENABLE_TILING) {
+        return reject(VA_STATUS_ERROR_ATTR_NOT_SUPPORTED, "tiled buffers");
+    }
+    if (format != import_format->rt_format) {
+        return reject(VA_STATUS_ERROR_INVALID_PARAMETER, "render target format mismatch");
+    }
+    if (width == 0 || height == 0 || buffers.width != width || buffers.height != height) {
+        return reject(VA_STATUS_ERROR_INVALID_PARAMETER, "size mismatch");
+    }
+    if (buffers.num_planes != import_format->num_planes) {
+        return reject(VA_STATUS_ERROR_INVALID_PARAMETER, "wrong number of planes");
+    }
+    if (!buffers.buffers || index >= buffers.num_buffers || !buffers.buffers[index]) {
+        return reject(VA_STATUS_ERROR_INVALID_PARAMETER, "missing buffer");
+    }
+    for (uint32_t plane = 0; plane < buffers.num_planes; plane++) {
+        const PlaneShape shape = GetPlaneShape(buffers.pixel_format, plane);
+        const uint64_t row_bytes = uint64_t { AlignUp(width, shape.horizontal_subsampling) }
+            / shape.horizontal_subsampling * shape.bytes_per_sample;
+        const uint64_t rows
+            = AlignUp(height, shape.vertical_subsampling) / shape.vertical_subsampling;
+        if (buffers.pitches[plane] < row_bytes) {
+            return reject(VA_STATUS_ERROR_INVALID_PARAMETER, "pitch too small");
+        }
+        // The size is optional.
+        if (buffers.data_size
+            && uint64_t { buffers.offsets[plane] } + buffers.pitches[plane] * (rows - 1) + row_bytes
+                > buffers.data_size) {
+            return reject(VA_STATUS_ERROR_INVALID_PARAMETER, "plane beyond the buffer");
+        }
+    }
+
+    // Every consumer of the surfaces of this driver reads or writes them with
+    // the CPU, so the client memory is used in place. udmabuf could only give
+    // it a dma-buf if it came from a memfd, which a pointer doesn't tell, so
+    // these surfaces can't be exported.
+    ScopedBOMapping mapped_bo = scoped_bo_mapping_factory.WrapUserMemory(
+        reinterpret_cast<uint8_t *>(buffers.buffers[index]), buffers.num_planes, buffers.pitches,
+        buffers.offsets);
+    return base::WrapUnique(new VSSurface(id, format, buffers.pixel_format, width, height,
+        DRM_FORMAT_MOD_LINEAR, std::move(attrib_list), std::move(mapped_bo)));
 }
 
 VSSurface::IdType VSSurface::GetID() const { return id_; }
@@ -142,8 +462,75 @@ unsigned int VSSurface::GetWidth() const { return width_; }
 
 unsigned int VSSurface::GetHeight() const { return height_; }
 
+uint64_t VSSurface::GetModifier() const { return modifier_; }
+
 const std::vector<VASurfaceAttrib> &VSSurface::GetSurfaceAttribs() const { return attrib_list_; }
 
 const ScopedBOMapping &VSSurface::GetMappedBO() const { return mapped_bo_; }
 
+const DWLLinearMem *VSSurface::GetDeviceMemory() const { return memory_.GetDeviceMemory(); }
+
+VAStatus VSSurface::ExportDRMPrime(uint32_t flags, VADRMPRIMESurfaceDescriptor &descriptor) const
+{
+    if (!mapped_bo_.IsValid() || mapped_bo_.GetPlaneFd(0) < 0) {
+        std::cerr << "Surface " << id_ << " has no buffer to export" << std::endl;
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
+    // Consumers can't describe the tiles of the VC8000D.
+    if (modifier_ != DRM_FORMAT_MOD_LINEAR) {
+        std::cerr << "Tiled surface " << id_ << " can't be exported" << std::endl;
+        return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
+    }
+    // Surfaces with a buffer have been imported with a fourcc.
+    const ImportFormat *import_format = FindImportFormat(va_fourcc_);
+    CHECK(import_format);
+    CHECK_EQ(mapped_bo_.GetNumPlanes(), import_format->num_planes);
+    const bool separate_layers = flags & VA_EXPORT_SURFACE_SEPARATE_LAYERS;
+    if (!separate_layers && va_fourcc_ == VA_FOURCC_RGBP) {
+        std::cerr << "Planar RGB surfaces can only be exported as separate layers" << std::endl;
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+
+    memset(&descriptor, 0, sizeof(descriptor));
+    descriptor.fourcc = va_fourcc_;
+    descriptor.width = width_;
+    descriptor.height = height_;
+
+    // Planes that share a dma-buf are exported as a single object. Each
+    // object gets a new file descriptor, which the caller owns.
+    std::array<uint32_t, 3> object_index {};
+    std::array<std::pair<dev_t, ino_t>, 3> object_ids {};
+    for (uint32_t plane = 0; plane < import_format->num_planes; plane++) {
+        const int fd = mapped_bo_.GetPlaneFd(plane);
+        struct stat fd_stat;
+        CHECK_EQ(fstat(fd, &fd_stat), 0);
+        const std::pair<dev_t, ino_t> id(fd_stat.st_dev, fd_stat.st_ino);
+        uint32_t object = 0;
+        while (object < descriptor.num_objects && object_ids[object] != id) { object++; }
+        if (object == descriptor.num_objects) {
+            object_ids[object] = id;
+            auto &desc_object = descriptor.objects[descriptor.num_objects++];
+            desc_object.fd = dup(fd);
+            CHECK_GE(desc_object.fd, 0);
+            const off_t size = lseek(desc_object.fd, 0, SEEK_END);
+            lseek(desc_object.fd, 0, SEEK_SET);
+            desc_object.size = size > 0 ? static_cast<uint32_t>(size) : 0u;
+            desc_object.drm_format_modifier = modifier_;
+        }
+        object_index[plane] = object;
+    }
+
+    descriptor.num_layers = separate_layers ? import_format->num_planes : 1u;
+    for (uint32_t plane = 0; plane < import_format->num_planes; plane++) {
+        auto &layer = descriptor.layers[separate_layers ? plane : 0u];
+        const uint32_t layer_plane = layer.num_planes++;
+        layer.drm_format
+            = separate_layers ? import_format->plane_drm_formats[plane] : import_format->drm_format;
+        layer.object_index[layer_plane] = object_index[plane];
+        layer.offset[layer_plane] = mapped_bo_.GetPlaneOffset(plane);
+        layer.pitch[layer_plane] = mapped_bo_.GetPlaneStride(plane);
+    }
+    return VA_STATUS_SUCCESS;
+}
+
 } // namespace libvavc8000d
\ No newline at end of file
@@ -6,12 +6,19 @@
 #ifndef FAKE_SURFACE_H_
 #define FAKE_SURFACE_H_
 
+#include <libdrm/drm_fourcc.h>
 #include <va/va.h>
+#include <va/va_drmcommon.h>
 
 #include <memory>
 #include <vector>
 
 #include "scoped_bo_mapping_factory.h"
+#include "surface_memory_pool.h"
+
+// Vendor of the DRM format modifiers private to this driver. It isn't
+// allocated upstream, so these modifiers must never leave the driver.
+#define DRM_FORMAT_MOD_VENDOR_VSI 0xf1
 
 namespace libvavc8000d
 {
@@ -30,34 +37,84 @@ class VSSurface
 public:
     using IdType = VASurfaceID;
 
+    // Modifier of NV12 surfaces in the 4x4 tiles of the decoders' reference
+    // frames. No upstream modifier describes the VC8000D tiles, so clients
+    // that know this one can request it for the surfaces the driver allocates
+    // and read them back with vaGetImage(), but these surfaces are never
+    // exported and imported buffers are always linear.
+    static constexpr uint64_t kTiled4x4Modifier = fourcc_mod_code(VSI, 1);
+
     VSSurface(const VSSurface &) = delete;
     VSSurface &operator=(const VSSurface &) = delete;
     ~VSSurface();
 
-    // Note: |scoped_bo_mapping_factory| must outlive the `VSSurface` since
-    // it's used to unmap the backing buffer object (if applicable).
+    // Surfaces without an external buffer get one from |surface_memory_pool|,
+    // laid out as the pixel format and modifier attributes request. |index| is
+    // the position of the surface among those of the same vaCreateSurfaces()
+    // call, which selects its buffer in a VASurfaceAttribExternalBuffers.
+    // Returns nullptr with the reason in |status| if the surface can't be
+    // created.
+    //
+    // Note: |scoped_bo_mapping_factory| and |surface_memory_pool| must outlive
+    // the `VSSurface` since they're used to unmap and free the backing buffer
+    // object (if applicable).
     static std::unique_ptr<VSSurface> Create(IdType id, unsigned int format, unsigned int width,
-        unsigned int height, std::vector<VASurfaceAttrib> attrib_list,
-        ScopedBOMappingFactory &scoped_bo_mapping_factory);
+        unsigned int height, std::vector<VASurfaceAttrib> attrib_list, unsigned int index,
+        ScopedBOMappingFactory &scoped_bo_mapping_factory, SurfaceMemoryPool &surface_memory_pool,
+        VAStatus &status);
 
     IdType GetID() const;
     unsigned int GetFormat() const;
     uint32_t GetVAFourCC() const;
     unsigned int GetWidth() const;
     unsigned int GetHeight() const;
+    // DRM format modifier of the buffer, linear unless a consumer negotiated
+    // another layout.
+    uint64_t GetModifier() const;
     const std::vector<VASurfaceAttrib> &GetSurfaceAttribs() const;
     const ScopedBOMapping &GetMappedBO() const;
 
+    // The DWL linear memory of the surface, which the VPU reads by its bus
+    // address, or nullptr if the surface has none.
+    const DWLLinearMem *GetDeviceMemory() const;
+
+    // Describes the buffer of the surface in |descriptor|, with the planes in a
+    // single layer or, if |flags| has VA_EXPORT_SURFACE_SEPARATE_LAYERS, in one
+    // layer each. The file descriptors of the objects are duplicated and owned
+    // by the caller. Only linear surfaces can be exported.
+    VAStatus ExportDRMPrime(uint32_t flags, VADRMPRIMESurfaceDescriptor &descriptor) const;
+
 private:
     VSSurface(IdType id, unsigned int format, uint32_t va_fourcc, unsigned int width,
-        unsigned int height, std::vector<VASurfaceAttrib> attrib_list, ScopedBOMapping mapped_bo);
+        unsigned int height, uint64_t modifier, std::vector<VASurfaceAttrib> attrib_list,
+        ScopedBOMapping mapped_bo, SurfaceMemoryPool::Buffer memory = {});
+
+    // Creates a surface backed by a buffer of |surface_memory_pool|. Fails if
+    // no buffer can be allocated in the layout of |va_fourcc| and |modifier|.
+    // |usage_hint| holds the VA_SURFACE_ATTRIB_USAGE_HINT_* flags of the
+    // client.
+    static std::unique_ptr<VSSurface> CreateAllocated(IdType id, unsigned int format,
+        uint32_t va_fourcc, unsigned int width, unsigned int height, uint64_t modifier,
+        uint32_t usage_hint, std::vector<VASurfaceAttrib> attrib_list,
+        ScopedBOMappingFactory &scoped_bo_mapping_factory,
+        SurfaceMemoryPool &surface_memory_pool, VAStatus &status);
+
+    // Creates a surface over the client memory of buffer |index| of |buffers|
+    // (VA_SURFACE_ATTRIB_MEM_TYPE_USER_PTR).
+    static std::unique_ptr<VSSurface> CreateFromUserPtr(IdType id, unsigned int format,
+        unsigned int width, unsigned int height, const VASurfaceAttribExternalBuffers &buffers,
+        unsigned int index, std::vector<VASurfaceAttrib> attrib_list,
+        ScopedBOMappingFactory &scoped_bo_mapping_factory, VAStatus &status);
 
     const IdType id_;
     const unsigned int format_;
     const uint32_t va_fourcc_;
     const unsigned int width_;
     const unsigned int height_;
+    const uint64_t modifier_;
     const std::vector<VASurfaceAttrib> attrib_list_;
+    // The buffer allocated by the driver, invalid for imported buffers.
+    SurfaceMemoryPool::Buffer memory_;
     ScopedBOMapping mapped_bo_;
 };
 
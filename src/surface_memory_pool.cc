@@ -0,0 +1,219 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "surface_memory_pool.h"
+
+#include <fcntl.h>
+#include <linux/dma-heap.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+
+#include "base/logging.h"
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // Heaps in order of preference.
+    constexpr const char *kHeapPaths[] = {
+        "/dev/dma_heap/linux,cma",
+        "/dev/dma_heap/system",
+    };
+
+    base::ScopedFD OpenHeap()
+    {
+        for (const char *path : kHeapPaths) {
+            const int fd = HANDLE_EINTR(open(path, O_RDONLY | O_CLOEXEC));
+            if (fd >= 0) { return base::ScopedFD(fd); }
+        }
+        std::cerr << "No dma-buf heap, allocating surfaces with memfd" << std::endl;
+        return base::ScopedFD(-1);
+    }
+
+} // namespace
+
+SurfaceMemoryPool::Buffer::Buffer() : pool_(nullptr), fd_(-1), device_memory_ {}, size_(0) {}
+
+SurfaceMemoryPool::Buffer::Buffer(SurfaceMemoryPool *pool, base::ScopedFD fd, size_t size)
+    : pool_(pool), fd_(std::move(fd)), device_memory_ {}, size_(size)
+{}
+
+SurfaceMemoryPool::Buffer::Buffer(
+    SurfaceMemoryPool *pool, const DWLLinearMem &device_memory, size_t size)
+    : pool_(pool), fd_(-1), device_memory_(device_memory), size_(size)
+{}
+
+SurfaceMemoryPool::Buffer::Buffer(Buffer &&other)
+    : pool_(other.pool_)
+    , fd_(std::move(other.fd_))
+    , device_memory_(other.device_memory_)
+    , size_(other.size_)
+{
+    other.pool_ = nullptr;
+    other.device_memory_ = {};
+    other.size_ = 0;
+}
+
+SurfaceMemoryPool::Buffer &SurfaceMemoryPool::Buffer::operator=(Buffer &&other)
+{
+    if (this == &other) { return *this; }
+    Release();
+    pool_ = other.pool_;
+    other.pool_ = nullptr;
+    fd_ = std::move(other.fd_);
+    device_memory_ = other.device_memory_;
+    other.device_memory_ = {};
+    size_ = other.size_;
+    other.size_ = 0;
+    return *this;
+}
+
+SurfaceMemoryPool::Buffer::~Buffer() { Release(); }
+
+void SurfaceMemoryPool::Buffer::Release()
+{
+    if (fd_.get() >= 0) {
+        pool_->Release(std::move(fd_), size_);
+    } else if (device_memory_.virtual_address) {
+        pool_->Release(device_memory_, size_);
+        device_memory_ = {};
+    }
+}
+
+SurfaceMemoryPool::SurfaceMemoryPool() : heap_(OpenHeap()) {}
+
+SurfaceMemoryPool::~SurfaceMemoryPool()
+{
+    for (auto &[size, device_memory] : free_device_memory_) {
+        DWLFreeLinear(dwl_->instance, &device_memory);
+    }
+    std::cerr << "Surface Memory Stats: allocations=" << allocations_ << " reuses=" << reuses_
+              << std::endl;
+}
+
+SurfaceMemoryPool::Buffer SurfaceMemoryPool::Allocate(size_t size)
+{
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        // The most recently freed buffer is the most likely to be cached.
+        for (auto it = free_buffers_.rbegin(); it != free_buffers_.rend(); ++it) {
+            if (it->first != size) { continue; }
+            base::ScopedFD fd = std::move(it->second);
+            free_buffers_.erase(std::next(it).base());
+            free_bytes_ -= size;
+            reuses_++;
+            return Buffer(this, std::move(fd), size);
+        }
+    }
+
+    base::ScopedFD fd = AllocateBuffer(size);
+    if (fd.get() < 0) { return Buffer(); }
+    const std::lock_guard<std::mutex> lock(lock_);
+    allocations_++;
+    return Buffer(this, std::move(fd), size);
+}
+
+SurfaceMemoryPool::Buffer SurfaceMemoryPool::AllocateDeviceMemory(size_t size)
+{
+    const void *dwl;
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        for (auto it = free_device_memory_.rbegin(); it != free_device_memory_.rend(); ++it) {
+            if (it->first != size) { continue; }
+            const DWLLinearMem device_memory = it->second;
+            free_device_memory_.erase(std::next(it).base());
+            free_device_bytes_ -= size;
+            reuses_++;
+            return Buffer(this, device_memory, size);
+        }
+        if (!dwl_) {
+            dwl_ = std::make_unique<DWLInstance>(DWL_CLIENT_TYPE_ST_PP);
+            if (!dwl_->instance) {
+                std::cerr << "No VPU, allocating surfaces with file descriptors only" << std::endl;
+            }
+        }
+        dwl = dwl_->instance;
+    }
+    if (!dwl || size > UINT32_MAX) { return Buffer(); }
+
+    DWLLinearMem device_memory;
+    memset(&device_memory, 0, sizeof(device_memory));
+    device_memory.mem_type = DWL_MEM_TYPE_CPU;
+    if (DWLMallocLinear(dwl, static_cast<u32>(size), &device_memory) != 0) {
+        std::cerr << "Failed to allocate a " << size << " byte surface in DWL memory"
+                  << std::endl;
+        return Buffer();
+    }
+    memset(device_memory.virtual_address, 0, size);
+    const std::lock_guard<std::mutex> lock(lock_);
+    allocations_++;
+    return Buffer(this, device_memory, size);
+}
+
+void SurfaceMemoryPool::Release(base::ScopedFD fd, size_t size)
+{
+    if (size > kMaxFreeBytes) { return; }
+    // Evicted buffers are closed once the lock is released.
+    std::deque<std::pair<size_t, base::ScopedFD>> evicted;
+    const std::lock_guard<std::mutex> lock(lock_);
+    free_buffers_.emplace_back(size, std::move(fd));
+    free_bytes_ += size;
+    while (free_bytes_ > kMaxFreeBytes) {
+        free_bytes_ -= free_buffers_.front().first;
+        evicted.push_back(std::move(free_buffers_.front()));
+        free_buffers_.pop_front();
+    }
+}
+
+void SurfaceMemoryPool::Release(const DWLLinearMem &device_memory, size_t size)
+{
+    // Evicted memory is freed once the lock is released. |dwl_| is set
+    // before any of it is allocated, and outlives it.
+    std::deque<std::pair<size_t, DWLLinearMem>> evicted;
+    {
+        const std::lock_guard<std::mutex> lock(lock_);
+        free_device_memory_.emplace_back(size, device_memory);
+        free_device_bytes_ += size;
+        while (free_device_bytes_ > kMaxFreeBytes) {
+            free_device_bytes_ -= free_device_memory_.front().first;
+            evicted.push_back(free_device_memory_.front());
+            free_device_memory_.pop_front();
+        }
+    }
+    for (auto &[evicted_size, evicted_memory] : evicted) {
+        DWLFreeLinear(dwl_->instance, &evicted_memory);
+    }
+}
+
+base::ScopedFD SurfaceMemoryPool::AllocateBuffer(size_t size)
+{
+    if (heap_.get() >= 0) {
+        struct dma_heap_allocation_data allocation;
+        memset(&allocation, 0, sizeof(allocation));
+        allocation.len = size;
+        allocation.fd_flags = O_RDWR | O_CLOEXEC;
+        if (HANDLE_EINTR(ioctl(heap_.get(), DMA_HEAP_IOCTL_ALLOC, &allocation)) == 0) {
+            return base::ScopedFD(static_cast<int>(allocation.fd));
+        }
+        std::cerr << "Failed to allocate a " << size << " byte surface: " << strerror(errno)
+                  << std::endl;
+        return base::ScopedFD(-1);
+    }
+
+    const int fd = memfd_create("vs-surface", MFD_CLOEXEC);
+    if (fd < 0) { return base::ScopedFD(-1); }
+    base::ScopedFD memfd(fd);
+    if (HANDLE_EINTR(ftruncate(fd, static_cast<off_t>(size))) != 0) { return base::ScopedFD(-1); }
+    return memfd;
+}
+
+} // namespace libvavc8000d
@@ -0,0 +1,129 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SURFACE_MEMORY_POOL_H_
+#define SURFACE_MEMORY_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "base/scoped_fd.h"
+#include "dwl.h"
+#include "dwl_instance.h"
+
+namespace libvavc8000d
+{
+
+// Allocates the memory of the surfaces that clients create without an external
+// buffer, e.g. ffmpeg by default. The buffers are file descriptors, so that
+// they are imported like the buffers of clients and can be exported. They come
+// from a dma-buf heap, the CMA one first as the display controller of the
+// TH1520 scans out contiguous buffers, or from memfd when there is no heap,
+// e.g. for testing with the fake GBM backend.
+//
+// Surfaces only the VPU reads can instead have DWL linear memory, which the
+// post-processor reads by its bus address rather than from a copy. These
+// buffers have no file descriptor, so they can't be exported.
+//
+// Buffers freed by destroyed surfaces are kept for new surfaces of the same
+// size, up to kMaxFreeBytes, so that clients which destroy and recreate their
+// surfaces, e.g. when a stream is reopened, don't allocate them again.
+//
+// SurfaceMemoryPool instances are thread-safe.
+class SurfaceMemoryPool
+{
+public:
+    // A buffer of the pool, given back to it on destruction. The pool must
+    // outlive its buffers.
+    class Buffer
+    {
+    public:
+        // Creates an invalid Buffer.
+        Buffer();
+
+        // Not copyable but movable (the copy ctors are deleted by default).
+        Buffer(Buffer &&other);
+        Buffer &operator=(Buffer &&other);
+        ~Buffer();
+
+        bool IsValid() const { return fd_.get() >= 0 || device_memory_.virtual_address; }
+
+        // The file descriptor remains owned by the buffer. It is invalid for
+        // DWL linear memory.
+        int GetFd() const { return fd_.get(); }
+        // The DWL linear memory of the buffer, or nullptr if it has a file
+        // descriptor.
+        const DWLLinearMem *GetDeviceMemory() const
+        {
+            return device_memory_.virtual_address ? &device_memory_ : nullptr;
+        }
+        size_t GetSize() const { return size_; }
+
+    private:
+        // Only SurfaceMemoryPool should be able to create valid Buffers.
+        friend class SurfaceMemoryPool;
+
+        Buffer(SurfaceMemoryPool *pool, base::ScopedFD fd, size_t size);
+        Buffer(SurfaceMemoryPool *pool, const DWLLinearMem &device_memory, size_t size);
+
+        // Hands the memory back to the pool.
+        void Release();
+
+        SurfaceMemoryPool *pool_;
+        base::ScopedFD fd_;
+        // Zeroed unless the buffer is DWL linear memory.
+        DWLLinearMem device_memory_;
+        size_t size_;
+    };
+
+    SurfaceMemoryPool();
+    SurfaceMemoryPool(const SurfaceMemoryPool &) = delete;
+    SurfaceMemoryPool &operator=(const SurfaceMemoryPool &) = delete;
+    ~SurfaceMemoryPool();
+
+    // Returns a buffer of |size| bytes, a free one if there is one of that
+    // size, or an invalid Buffer if none can be allocated. New buffers are
+    // zeroed, reused ones hold the pictures of their previous surface.
+    Buffer Allocate(size_t size);
+
+    // Returns a buffer of |size| bytes of DWL linear memory, a free one if
+    // there is one of that size, or an invalid Buffer if there is no VPU or
+    // none can be allocated. New buffers are zeroed.
+    Buffer AllocateDeviceMemory(size_t size);
+
+private:
+    // Free buffers keep their memory, which is scarce when it comes from CMA.
+    // This holds the surfaces of a 4K stream.
+    static constexpr size_t kMaxFreeBytes = 256u << 20;
+
+    // Takes back the buffer |fd| of |size| bytes.
+    void Release(base::ScopedFD fd, size_t size);
+    void Release(const DWLLinearMem &device_memory, size_t size);
+
+    base::ScopedFD AllocateBuffer(size_t size);
+
+    std::mutex lock_;
+    // Buffers no surface uses, least recently freed first.
+    std::deque<std::pair<size_t, base::ScopedFD>> free_buffers_;
+    size_t free_bytes_ = 0;
+    // Likewise for DWL linear memory, which is bounded separately.
+    std::deque<std::pair<size_t, DWLLinearMem>> free_device_memory_;
+    size_t free_device_bytes_ = 0;
+    uint64_t allocations_ = 0;
+    uint64_t reuses_ = 0;
+
+    // The dma-buf heap buffers are allocated from, invalid to use memfd.
+    const base::ScopedFD heap_;
+    // Opened on the first allocation of DWL linear memory, which is freed
+    // through it. Guarded by |lock_|.
+    std::unique_ptr<DWLInstance> dwl_;
+};
+
+} // namespace libvavc8000d
+
+#endif // SURFACE_MEMORY_POOL_H_
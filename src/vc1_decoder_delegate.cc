@@ -0,0 +1,430 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "vc1_decoder_delegate.h"
+
+#include "base/bit_writer.h"
+#include "base/logging.h"
+#include "basetype.h"
+#include "buffer.h"
+#include "decapicommon.h"
+#include "decode_engine.h"
+#include "dwl.h"
+#include "output_picture.h"
+#include "surface.h"
+#include "vc1decapi.h"
+#include <cstring>
+#include <iostream>
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // Start code suffixes of the bitstream data units, see SMPTE 421M Annex E.
+    enum Vc1StartCode : uint8_t {
+        kStartCodeSlice = 0x0B,
+        kStartCodeField = 0x0C,
+        kStartCodeFrame = 0x0D,
+        kStartCodeEntryPoint = 0x0E,
+        kStartCodeSequenceHeader = 0x0F,
+    };
+
+    // Profile values expected by VC1DecMetaData::profile.
+    enum Vc1MetaDataProfile : uint32_t {
+        kMetaDataProfileSimple = 0,
+        kMetaDataProfileMain = 4,
+        kMetaDataProfileAdvanced = 8,
+    };
+
+    // VAPictureParameterBufferVC1::picture_fields.bits.picture_type values.
+    constexpr uint32_t kPictureTypeI = 0;
+
+    // Level is not carried by the VA buffers. Level 4 is the highest one, so
+    // the decoder won't reject a stream because of it.
+    constexpr uint32_t kAdvancedProfileLevel = 4;
+
+    // Writes the advanced profile bitstream data units (BDUs) the driver has to
+    // rebuild: the sequence header and the entry-point header. Emulation
+    // prevention bytes are inserted as described in SMPTE 421M Annex E.
+    using Vc1HeaderWriter = base::BitWriter<base::StartCodeEmulationPrevention>;
+
+    void BeginBDU(Vc1StartCode start_code, Vc1HeaderWriter &writer)
+    {
+        writer.AppendRawBytes({ 0x00, 0x00, 0x01, start_code });
+    }
+
+    // Appends the RBDU stuffing: a one bit followed by zero bits up to the next
+    // byte boundary.
+    void FinishBDU(Vc1HeaderWriter &writer)
+    {
+        writer.AppendTrailingBits();
+        writer.Flush();
+    }
+
+    // Builds the sequence header following SMPTE 421M section 6.1.
+    void BuildSequenceHeader(const VAPictureParameterBufferVC1 &pic_param, Vc1HeaderWriter &writer)
+    {
+        BeginBDU(kStartCodeSequenceHeader, writer);
+        writer.AppendBits(2, 3); // PROFILE: advanced.
+        writer.AppendBits(3, kAdvancedProfileLevel); // LEVEL.
+        writer.AppendBits(2, 1); // COLORDIFF_FORMAT: 4:2:0.
+        writer.AppendBits(3, 0); // FRMRTQ_POSTPROC.
+        writer.AppendBits(5, 0); // BITRTQ_POSTPROC.
+        writer.AppendBool(pic_param.post_processing != 0); // POSTPROCFLAG.
+        writer.AppendBits(12, pic_param.coded_width / 2 - 1); // MAX_CODED_WIDTH.
+        writer.AppendBits(12, pic_param.coded_height / 2 - 1); // MAX_CODED_HEIGHT.
+        writer.AppendBool(pic_param.sequence_fields.bits.pulldown); // PULLDOWN.
+        writer.AppendBool(pic_param.sequence_fields.bits.interlace); // INTERLACE.
+        writer.AppendBool(pic_param.sequence_fields.bits.tfcntrflag); // TFCNTRFLAG.
+        writer.AppendBool(pic_param.sequence_fields.bits.finterpflag); // FINTERPFLAG.
+        writer.AppendBool(1); // RESERVED.
+        writer.AppendBool(pic_param.sequence_fields.bits.psf); // PSF.
+        writer.AppendBool(0); // DISPLAY_EXT.
+        writer.AppendBool(0); // HRD_PARAM_FLAG.
+        FinishBDU(writer);
+    }
+
+    // Builds the entry-point header following SMPTE 421M section 6.2.
+    void BuildEntryPointHeader(
+        const VAPictureParameterBufferVC1 &pic_param, Vc1HeaderWriter &writer)
+    {
+        BeginBDU(kStartCodeEntryPoint, writer);
+        writer.AppendBool(pic_param.entrypoint_fields.bits.broken_link); // BROKEN_LINK.
+        writer.AppendBool(pic_param.entrypoint_fields.bits.closed_entry); // CLOSED_ENTRY.
+        writer.AppendBool(pic_param.entrypoint_fields.bits.panscan_flag); // PANSCAN_FLAG.
+        writer.AppendBool(pic_param.reference_fields.bits.reference_distance_flag); // REFDIST_FLAG.
+        writer.AppendBool(pic_param.entrypoint_fields.bits.loopfilter); // LOOPFILTER.
+        writer.AppendBool(pic_param.fast_uvmc_flag); // FASTUVMC.
+        writer.AppendBool(pic_param.mv_fields.bits.extended_mv_flag); // EXTENDED_MV.
+        writer.AppendBits(2, pic_param.pic_quantizer_fields.bits.dquant); // DQUANT.
+        writer.AppendBool(
+            pic_param.transform_fields.bits.variable_sized_transform_flag); // VSTRANSFORM.
+        writer.AppendBool(pic_param.sequence_fields.bits.overlap); // OVERLAP.
+        writer.AppendBits(2, pic_param.pic_quantizer_fields.bits.quantizer); // QUANTIZER.
+        writer.AppendBool(1); // CODED_SIZE_FLAG.
+        writer.AppendBits(12, pic_param.coded_width / 2 - 1); // CODED_WIDTH.
+        writer.AppendBits(12, pic_param.coded_height / 2 - 1); // CODED_HEIGHT.
+        if (pic_param.mv_fields.bits.extended_mv_flag) {
+            writer.AppendBool(pic_param.mv_fields.bits.extended_dmv_flag); // EXTENDED_DMV.
+        }
+        writer.AppendBool(pic_param.range_mapping_fields.bits.luma_flag); // RANGE_MAPY_FLAG.
+        if (pic_param.range_mapping_fields.bits.luma_flag) {
+            writer.AppendBits(3, pic_param.range_mapping_fields.bits.luma); // RANGE_MAPY.
+        }
+        writer.AppendBool(pic_param.range_mapping_fields.bits.chroma_flag); // RANGE_MAPUV_FLAG.
+        if (pic_param.range_mapping_fields.bits.chroma_flag) {
+            writer.AppendBits(3, pic_param.range_mapping_fields.bits.chroma); // RANGE_MAPUV.
+        }
+        FinishBDU(writer);
+    }
+
+} // namespace
+
+struct Vc1DecodeTraits
+{
+    using Inst = VC1DecInst;
+    using Input = VC1DecInput;
+    using Output = VC1DecOutput;
+    using Picture = VC1DecPicture;
+    using BufferInfo = VC1DecBufferInfo;
+    using Ret = VC1DecRet;
+
+    static DecodeEvent Classify(Ret ret)
+    {
+        switch (ret) {
+        case VC1DEC_OK:
+        case VC1DEC_RESOLUTION_CHANGED: return DecodeEvent::kContinue;
+        case VC1DEC_HDRS_RDY: return DecodeEvent::kHeadersReady;
+        case VC1DEC_PIC_DECODED: return DecodeEvent::kPictureDecoded;
+        case VC1DEC_STRM_PROCESSED:
+        case VC1DEC_NONREF_PIC_SKIPPED: return DecodeEvent::kStreamProcessed;
+        case VC1DEC_WAITING_FOR_BUFFER: return DecodeEvent::kWaitingForBuffer;
+        default: return DecodeEvent::kError;
+        }
+    }
+
+    static Ret Decode(Inst inst, Input *input, Output *output)
+    {
+        return VC1DecDecode(inst, input, output);
+    }
+
+    static bool NextPicture(Inst inst, Picture *picture)
+    {
+        auto ret = VC1DecNextPicture(inst, picture, 0);
+        return ret == VC1DEC_PIC_RDY || ret == VC1DEC_FLUSHED;
+    }
+
+    static void PictureConsumed(Inst inst, Picture *picture)
+    {
+        VC1DecPictureConsumed(inst, picture);
+    }
+
+    static void GetBufferInfo(Inst inst, BufferInfo *buffer_info)
+    {
+        VC1DecGetBufferInfo(inst, buffer_info);
+    }
+
+    static void AddBuffer(Inst inst, DWLLinearMem *mem) { VC1DecAddBuffer(inst, mem); }
+
+    static void Abort(Inst inst) { VC1DecAbort(inst); }
+
+    static void SetInput(
+        Input &input, const DWLLinearMem &stream_mem, uint32_t size, uint32_t pic_id)
+    {
+        input.stream = reinterpret_cast<uint8_t *>(stream_mem.virtual_address);
+        input.stream_bus_address = stream_mem.bus_address;
+        input.stream_size = size;
+        input.pic_id = pic_id;
+        input.skip_non_reference = 0;
+    }
+
+    static void AdvanceInput(Input &input, const Output &output)
+    {
+        input.stream = output.p_stream_curr_pos;
+        input.stream_size = output.data_left;
+        input.stream_bus_address = output.strm_curr_bus_address;
+    }
+
+    static uint32_t DataLeft(const Input &input) { return input.stream_size; }
+
+    static uint32_t GetPicId(const Picture &picture) { return picture.pic_id; }
+
+    static OutputPicture GetOutput(const Picture &picture, int index)
+    {
+        const auto &output = picture.pictures[index];
+        // The chroma plane directly follows the luma plane, whose height is the
+        // frame height as stored in memory.
+        const uint8_t *luma = output.output_picture;
+        return {
+            .luma = luma,
+            .chroma = luma ? luma + output.pic_stride * output.frame_height : nullptr,
+            .width = output.frame_width ? output.coded_width : 0,
+            .height = output.frame_height ? output.coded_height : 0,
+            .luma_stride = output.pic_stride,
+            .chroma_stride = output.pic_stride_ch,
+            .format = output.output_format,
+        };
+    }
+};
+
+// Size of the timestamp cache, needs to be large enough for frame-reordering.
+constexpr size_t kTimestampCacheSize = 128;
+
+Vc1DecoderDelegate::Vc1DecoderDelegate(int picture_width_hint, int picture_height_hint,
+    VAProfile profile, SurfaceLayout output_layout)
+    : profile_(profile)
+    , output_layout_(output_layout)
+    , picture_width_hint_(picture_width_hint)
+    , picture_height_hint_(picture_height_hint)
+    , ts_to_outputs_(kTimestampCacheSize)
+{
+    dwl_instance_ = std::make_unique<DWLInstance>(DWL_CLIENT_TYPE_VC1_DEC);
+    // Matches the parameters the decoder is initialized with, since SetInfo()
+    // applies the whole configuration.
+    memset(&dec_config_, 0, sizeof(dec_config_));
+    dec_config_.error_handling = DEC_EC_FAST_FREEZE;
+    dec_config_.dpb_flags = GetDpbFlags(output_layout_);
+    dec_config_.use_adaptive_buffers = 1;
+    dec_config_.guard_size = 0;
+    engine_ = std::make_unique<DecodeEngine<Vc1DecodeTraits>>(dwl_instance_->instance);
+}
+
+Vc1DecoderDelegate::~Vc1DecoderDelegate()
+{
+    if (hw_decoder_) { VC1DecRelease(hw_decoder_); }
+}
+
+void Vc1DecoderDelegate::InitializeDecoder(const VAPictureParameterBufferVC1 &pic_param)
+{
+    VC1DecMetaData meta_data;
+    memset(&meta_data, 0, sizeof(meta_data));
+    meta_data.max_coded_width = pic_param.coded_width ? pic_param.coded_width
+                                                      : static_cast<u32>(picture_width_hint_);
+    meta_data.max_coded_height = pic_param.coded_height ? pic_param.coded_height
+                                                        : static_cast<u32>(picture_height_hint_);
+
+    switch (profile_) {
+    case VAProfileVC1Simple:
+    case VAProfileVC1Main:
+        // Simple and Main profile streams carry no sequence header in-band; the
+        // metadata normally comes from the container (STRUCT_C), so rebuild it
+        // from the picture parameters.
+        meta_data.profile
+            = profile_ == VAProfileVC1Simple ? kMetaDataProfileSimple : kMetaDataProfileMain;
+        meta_data.vs_transform = pic_param.transform_fields.bits.variable_sized_transform_flag;
+        meta_data.overlap = pic_param.sequence_fields.bits.overlap;
+        meta_data.sync_marker = pic_param.sequence_fields.bits.syncmarker;
+        meta_data.quantizer = pic_param.pic_quantizer_fields.bits.quantizer;
+        meta_data.frame_interp = pic_param.sequence_fields.bits.finterpflag;
+        meta_data.max_bframes = pic_param.sequence_fields.bits.max_b_frames;
+        meta_data.fast_uv_mc = pic_param.fast_uvmc_flag;
+        meta_data.extended_mv = pic_param.mv_fields.bits.extended_mv_flag;
+        meta_data.multi_res = pic_param.sequence_fields.bits.multires;
+        meta_data.range_red = pic_param.sequence_fields.bits.rangered;
+        meta_data.dquant = pic_param.pic_quantizer_fields.bits.dquant;
+        meta_data.loop_filter = pic_param.entrypoint_fields.bits.loopfilter;
+        break;
+    case VAProfileVC1Advanced:
+        // The rest of the metadata is parsed from the in-band sequence header.
+        meta_data.profile = kMetaDataProfileAdvanced;
+        break;
+    default: CHECK(false); break;
+    }
+
+    auto ret = VC1DecInit(&hw_decoder_, dwl_instance_->instance, &meta_data, DEC_EC_FAST_FREEZE,
+        /*num_frame_buffers=*/0, dec_config_.dpb_flags, /*use_adaptive_buffers=*/1,
+        /*n_guard_size=*/0);
+    CHECK_EQ(ret, VC1DEC_OK);
+}
+
+void Vc1DecoderDelegate::SetRenderTarget(const VSSurface &surface)
+{
+    render_target_ = &surface;
+    ts_to_outputs_.Put(current_ts_, PictureOutputs { .render_target = &surface });
+}
+
+void Vc1DecoderDelegate::SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces)
+{
+    additional_outputs_ = surfaces;
+}
+
+void Vc1DecoderDelegate::EnqueueWork(const std::vector<const VSBuffer *> &buffers)
+{
+    CHECK(render_target_);
+    CHECK(slice_data_buffers_.empty());
+    for (auto buffer : buffers) {
+        switch (buffer->GetType()) {
+        case VASliceDataBufferType: slice_data_buffers_.push_back(buffer); break;
+        case VAPictureParameterBufferType: pic_param_buffer_ = buffer; break;
+        case VASliceParameterBufferType: slice_param_buffers_.push_back(buffer); break;
+        case VAProcPipelineParameterBufferType:
+            pp_params_ = ParsePostProcessingParams(
+                *reinterpret_cast<VAProcPipelineParameterBuffer *>(buffer->GetData()),
+                PictureOutputs { render_target_, additional_outputs_ });
+            // Outputs beyond the post-processor units are ignored.
+            if (pp_params_.num_additional_outputs < additional_outputs_.size()) {
+                additional_outputs_.resize(pp_params_.num_additional_outputs);
+            }
+            break;
+        default: break;
+        };
+    }
+}
+
+VAStatus Vc1DecoderDelegate::Run()
+{
+    CHECK(pic_param_buffer_);
+    const VAPictureParameterBufferVC1 *pic_param
+        = reinterpret_cast<VAPictureParameterBufferVC1 *>(pic_param_buffer_->GetData());
+
+    const bool first_picture = !hw_decoder_;
+    if (first_picture) {
+        InitializeDecoder(*pic_param);
+        // Simple and Main profile sequences are known from the metadata, the
+        // decoder may not report headers for them.
+        ConfigurePostProcessor();
+    }
+
+    Vc1HeaderWriter writer;
+    if (profile_ == VAProfileVC1Advanced) {
+        // Clients strip the sequence and entry-point headers, so they are rebuilt
+        // ahead of every I picture.
+        if (first_picture
+            || (pic_param->picture_fields.bits.picture_type == kPictureTypeI
+                && pic_param->picture_fields.bits.is_first_field)) {
+            BuildSequenceHeader(*pic_param, writer);
+            BuildEntryPointHeader(*pic_param, writer);
+        }
+
+        // The slice data starts right after the start code, which is stripped by
+        // clients as well.
+        for (size_t i = 0; i < slice_data_buffers_.size(); i++) {
+            uint8_t start_code = kStartCodeSlice;
+            if (i == 0) {
+                start_code = pic_param->picture_fields.bits.is_first_field ? kStartCodeFrame
+                                                                           : kStartCodeField;
+            }
+            writer.AppendRawBytes({ 0x00, 0x00, 0x01, start_code });
+            writer.AppendRawBytes(reinterpret_cast<uint8_t *>(slice_data_buffers_[i]->GetData()),
+                slice_data_buffers_[i]->GetDataSize());
+        }
+    } else {
+        // Simple and Main profile frames are passed as-is.
+        for (const auto &slice_data_buffer : slice_data_buffers_) {
+            writer.AppendRawBytes(reinterpret_cast<uint8_t *>(slice_data_buffer->GetData()),
+                slice_data_buffer->GetDataSize());
+        }
+    }
+    const std::vector<uint8_t> &bitstream = writer.data();
+
+    if (headers_ready_ && pp_params_ != applied_pp_params_) { ConfigurePostProcessor(); }
+
+    ts_to_outputs_.Put(current_ts_,
+        PictureOutputs { render_target_, additional_outputs_, pp_params_.transform });
+
+    // Invoke HW Decoder
+    const bool decoded = engine_->Decode(
+        hw_decoder_, bitstream.data(), bitstream.size(), current_ts_++,
+        [this]() { ConfigurePostProcessor(); },
+        [this](const VC1DecPicture &picture) { OnFrameReady(picture); });
+    slice_data_buffers_.clear();
+    slice_param_buffers_.clear();
+    // The client may destroy the buffers once vaEndPicture() returns.
+    pic_param_buffer_ = nullptr;
+    pp_params_ = PostProcessingParams();
+    additional_outputs_.clear();
+    if (!decoded) { return VA_STATUS_ERROR_DECODING_ERROR; }
+    return post_processing_failed_ ? VA_STATUS_ERROR_OPERATION_FAILED : VA_STATUS_SUCCESS;
+}
+
+void Vc1DecoderDelegate::ConfigurePostProcessor()
+{
+    VC1DecInfo info;
+    memset(&info, 0, sizeof(info));
+    VC1DecGetInfo(hw_decoder_, &info);
+    // Advanced profile sequence headers are only parsed along with the first
+    // picture.
+    if (info.coded_width == 0 || info.coded_height == 0) { return; }
+
+    CHECK(render_target_);
+    const DecodedStreamInfo stream = {
+        .width = info.coded_width,
+        .height = info.coded_height,
+        .bit_depth = 8,
+        .tiled_references = output_layout_ == SurfaceLayout::kTiled4x4,
+    };
+    const bool applied = ApplyPostProcessing(
+        stream, pp_params_, *render_target_, dec_config_.ppu_config, [this]() {
+            const auto ret = VC1DecSetInfo(hw_decoder_, &dec_config_);
+            if (ret != VC1DEC_OK) {
+                std::cerr << "Unsupported post-processing, return code: " << ret << std::endl;
+            }
+            return ret == VC1DEC_OK;
+        });
+    post_processing_failed_ = !applied;
+    if (!applied) { std::cerr << "No post-processing configuration accepted" << std::endl; }
+    // Not retried for every picture if it was rejected.
+    applied_pp_params_ = pp_params_;
+    headers_ready_ = true;
+}
+
+void Vc1DecoderDelegate::OnFrameReady(const VC1DecPicture &picture)
+{
+    const uint32_t ts = Vc1DecodeTraits::GetPicId(picture);
+    auto outputs_it = ts_to_outputs_.Peek(ts);
+    CHECK(outputs_it != ts_to_outputs_.end());
+    const PictureOutputs &outputs = outputs_it->second;
+    CHECK(outputs.render_target);
+    if (post_processing_failed_) { return; }
+
+    // The post-processor units write the render target and the additional
+    // outputs, in that order.
+    WritePictureOutputs(outputs,
+        [&picture](int index) { return Vc1DecodeTraits::GetOutput(picture, index); });
+}
+
+} // namespace libvavc8000d
+
+void VC1DecTrace(const char *string) { std::cerr << "[TRACE]" << string << std::endl; }
@@ -0,0 +1,83 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef VC1_DECODER_DELEGATE_H_
+#define VC1_DECODER_DELEGATE_H_
+
+#include <cstdint>
+#include <memory>
+#include <va/va.h>
+
+#include "base/lru_cache.h"
+#include "context_delegate.h"
+#include "dwl_instance.h"
+#include "post_processor.h"
+#include "vc1decapi.h"
+
+namespace libvavc8000d
+{
+
+template <typename Traits> class DecodeEngine;
+struct Vc1DecodeTraits;
+
+// Class used for VC-1 (Simple, Main and Advanced profile) hardware decoding.
+class Vc1DecoderDelegate : public ContextDelegate
+{
+public:
+    // |output_layout| is the layout shared by all the render targets.
+    explicit Vc1DecoderDelegate(int picture_width_hint, int picture_height_hint,
+        VAProfile profile, SurfaceLayout output_layout);
+    Vc1DecoderDelegate(const Vc1DecoderDelegate &) = delete;
+    Vc1DecoderDelegate &operator=(const Vc1DecoderDelegate &) = delete;
+    ~Vc1DecoderDelegate() override;
+
+    // ContextDelegate implementation.
+    void SetRenderTarget(const VSSurface &surface) override;
+    void SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces) override;
+    void EnqueueWork(const std::vector<const VSBuffer *> &buffers) override;
+    VAStatus Run() override;
+
+private:
+    // The VC-1 decoder needs the sequence metadata at initialization time, which
+    // is only known once the first picture parameter buffer arrives.
+    void InitializeDecoder(const VAPictureParameterBufferVC1 &pic_param);
+    // Programs the post-processor once the stream headers are known, and again
+    // whenever the requested processing changes.
+    void ConfigurePostProcessor();
+    void OnFrameReady(const VC1DecPicture &picture);
+
+    const VAProfile profile_;
+    const SurfaceLayout output_layout_;
+    const int picture_width_hint_;
+    const int picture_height_hint_;
+
+    std::vector<const VSBuffer *> slice_data_buffers_;
+    std::vector<const VSBuffer *> slice_param_buffers_;
+
+    const VSSurface *render_target_{ nullptr };
+    std::vector<const VSSurface *> additional_outputs_;
+    const VSBuffer *pic_param_buffer_{ nullptr };
+
+    // Processing requested for the picture being decoded, and the one the
+    // post-processor is currently programmed with.
+    PostProcessingParams pp_params_;
+    PostProcessingParams applied_pp_params_;
+    bool headers_ready_ = false;
+    // Whether the decoder rejected every post-processor configuration for
+    // |applied_pp_params_|. The pictures are then in a layout the surfaces
+    // don't have, so they are dropped and vaEndPicture() fails.
+    bool post_processing_failed_ = false;
+
+    std::unique_ptr<DWLInstance> dwl_instance_;
+    struct VC1DecConfig dec_config_;
+    VC1DecInst hw_decoder_{ nullptr };
+    std::unique_ptr<DecodeEngine<Vc1DecodeTraits>> engine_;
+
+    uint32_t current_ts_ = 0;
+    base::LRUCache<uint32_t, PictureOutputs> ts_to_outputs_;
+};
+
+} // namespace libvavc8000d
+
+#endif // VC1_DECODER_DELEGATE_H_
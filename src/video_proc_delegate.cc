@@ -0,0 +1,303 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "video_proc_delegate.h"
+
+#include "base/logging.h"
+#include "buffer.h"
+#include "cpu_post_processor.h"
+#include "decapicommon.h"
+#include "dwl.h"
+#include "output_picture.h"
+#include "post_processor.h"
+#include "surface.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <va/va_vpp.h>
+
+namespace libvavc8000d
+{
+namespace
+{
+
+    // Row alignment of the pictures read and written by the post-processor.
+    constexpr uint32_t kInputAlignment = 16;
+    constexpr uint32_t kOutputAlignment = 64;
+
+    uint32_t AlignUp(uint32_t value, uint32_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Translates the colour standard of the source into the matrix_coefficients
+    // of ITU-T H.273.
+    uint32_t GetMatrixCoefficients(VAProcColorStandardType standard)
+    {
+        switch (standard) {
+        case VAProcColorStandardBT709:
+        case VAProcColorStandardXVYCC709: return 1;
+        case VAProcColorStandardBT601:
+        case VAProcColorStandardBT470BG:
+        case VAProcColorStandardSMPTE170M:
+        case VAProcColorStandardXVYCC601: return 6;
+        case VAProcColorStandardBT2020: return 9;
+        default: return 2;
+        }
+    }
+
+    // Room for a picture written to |surface| in the largest layout the
+    // post-processor produces, 32-bit RGB, in either orientation.
+    size_t GetOutputSize(const VSSurface &surface)
+    {
+        return size_t { 4 } * AlignUp(surface.GetWidth(), kOutputAlignment)
+            * AlignUp(surface.GetHeight(), kOutputAlignment);
+    }
+
+    // Returns whether the post-processor can read |source| where it is, at the
+    // start of |memory|: with luma rows it can address and the chroma right
+    // after the luma, as in the copies of the other inputs.
+    bool IsInPlaceInput(const SourcePicture &source, const DWLLinearMem &memory)
+    {
+        const uint8_t *const base = reinterpret_cast<const uint8_t *>(memory.virtual_address);
+        const uint32_t stride = source.strides[0];
+        const uint8_t *const chroma = base + static_cast<size_t>(stride) * source.height;
+        if (source.planes[0] != base || stride % kInputAlignment != 0
+            || source.planes[1] != chroma) {
+            return false;
+        }
+        if (source.format != SurfaceFormat::kI420) { return source.strides[1] == stride; }
+        const uint32_t chroma_stride = stride / 2;
+        const size_t chroma_size = static_cast<size_t>(chroma_stride) * ((source.height + 1) / 2);
+        return source.strides[1] == chroma_stride && source.strides[2] == chroma_stride
+            && source.planes[2] == chroma + chroma_size;
+    }
+
+    void CopyRows(const uint8_t *src, uint32_t src_stride, uint8_t *dst, uint32_t dst_stride,
+        uint32_t row_bytes, uint32_t rows)
+    {
+        for (uint32_t y = 0; y < rows; y++) {
+            memcpy(dst + static_cast<size_t>(y) * dst_stride,
+                src + static_cast<size_t>(y) * src_stride, row_bytes);
+        }
+    }
+
+} // namespace
+
+VideoProcDelegate::VideoProcDelegate()
+{
+    memset(&pp_config_, 0, sizeof(pp_config_));
+    memset(&in_buffer_, 0, sizeof(in_buffer_));
+
+    const char *use_cpu_env_var = getenv("USE_CPU_VIDEO_PROC");
+    if (use_cpu_env_var && strcmp(use_cpu_env_var, "1") == 0) {
+        std::cerr << "Using the CPU reference for video processing" << std::endl;
+        return;
+    }
+
+    dwl_instance_ = std::make_unique<DWLInstance>(DWL_CLIENT_TYPE_ST_PP);
+    const PPResult ret
+        = dwl_instance_->instance ? PPInit(&pp_inst_, dwl_instance_->instance) : PP_DWL_ERROR;
+    if (ret != PP_OK) {
+        std::cerr << "Post-processor unavailable, return code: " << ret
+                  << ", using the CPU reference for video processing" << std::endl;
+        pp_inst_ = nullptr;
+        dwl_instance_.reset();
+    }
+}
+
+VideoProcDelegate::~VideoProcDelegate()
+{
+    if (!pp_inst_) { return; }
+    PPRelease(pp_inst_);
+    for (DWLLinearMem *mem : { &in_buffer_, &pp_config_.pp_out_buffer }) {
+        if (mem->virtual_address) { DWLFreeLinear(dwl_instance_->instance, mem); }
+    }
+}
+
+void VideoProcDelegate::SetRenderTarget(const VSSurface &surface) { render_target_ = &surface; }
+
+void VideoProcDelegate::SetInputSurface(const VSSurface &surface) { input_surface_ = &surface; }
+
+void VideoProcDelegate::SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces)
+{
+    additional_outputs_ = surfaces;
+}
+
+void VideoProcDelegate::EnqueueWork(const std::vector<const VSBuffer *> &buffers)
+{
+    CHECK(render_target_);
+    for (auto buffer : buffers) {
+        if (buffer->GetType() == VAProcPipelineParameterBufferType) { pipeline_buffer_ = buffer; }
+    }
+}
+
+VAStatus VideoProcDelegate::Run()
+{
+    VAStatus status = VA_STATUS_ERROR_INVALID_PARAMETER;
+    if (pipeline_buffer_ && input_surface_) {
+        status = Process();
+    } else {
+        std::cerr << "Video processing without a pipeline or an input surface" << std::endl;
+    }
+    pipeline_buffer_ = nullptr;
+    input_surface_ = nullptr;
+    additional_outputs_.clear();
+    return status;
+}
+
+VAStatus VideoProcDelegate::Process()
+{
+    const VAProcPipelineParameterBuffer &pipeline
+        = *reinterpret_cast<const VAProcPipelineParameterBuffer *>(pipeline_buffer_->GetData());
+    PictureOutputs outputs { render_target_, additional_outputs_ };
+    const PostProcessingParams params = ParsePostProcessingParams(pipeline, outputs);
+    outputs.transform = params.transform;
+    if (params.num_additional_outputs < outputs.additional_outputs.size()) {
+        outputs.additional_outputs.resize(params.num_additional_outputs);
+    }
+
+    // Like the decoders, only surfaces backed by a buffer hold pixels.
+    const VSSurface &input = *input_surface_;
+    const ScopedBOMapping &input_bo = input.GetMappedBO();
+    if (!input_bo.IsValid()) {
+        std::cerr << "Video processing input without a buffer" << std::endl;
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
+    const SurfaceFormat format = GetSurfaceFormat(input);
+    if ((format != SurfaceFormat::kNV12 && format != SurfaceFormat::kI420)
+        || GetSurfaceLayout(input) != SurfaceLayout::kLinear) {
+        std::cerr << "Unsupported input format for video processing" << std::endl;
+        return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+    }
+
+    const DecodedStreamInfo stream = {
+        .width = input.GetWidth(),
+        .height = input.GetHeight(),
+        .bit_depth = 8,
+        .matrix_coefficients = GetMatrixCoefficients(pipeline.surface_color_standard),
+        .full_range = pipeline.input_color_properties.color_range == VA_SOURCE_RANGE_FULL,
+    };
+
+    const ScopedBOMapping::ScopedAccess access
+        = input_bo.BeginAccess(ScopedBOMapping::AccessMode::kRead);
+    SourcePicture source = { .width = stream.width, .height = stream.height, .format = format };
+    for (size_t plane = 0; plane < (format == SurfaceFormat::kI420 ? 3u : 2u); plane++) {
+        source.planes[plane] = access.GetData(plane);
+        source.strides[plane] = access.GetStride(plane);
+    }
+
+    if (pp_inst_) { return RunPostProcessor(source, stream, params, outputs); }
+    return RunCpuPostProcessing(source, stream, params, outputs)
+        ? VA_STATUS_SUCCESS
+        : VA_STATUS_ERROR_OPERATION_FAILED;
+}
+
+VAStatus VideoProcDelegate::RunPostProcessor(const SourcePicture &source,
+    const DecodedStreamInfo &stream, const PostProcessingParams &params,
+    const PictureOutputs &outputs)
+{
+    // The input buffer holds the luma plane followed by the interleaved or
+    // planar chroma, whose rows add up to the luma stride either way.
+    const bool planar = source.format == SurfaceFormat::kI420;
+    const DWLLinearMem *const device_memory = input_surface_->GetDeviceMemory();
+    if (device_memory && IsInPlaceInput(source, *device_memory)) {
+        pp_config_.pp_in_buffer = *device_memory;
+        pp_config_.in_stride = source.strides[0];
+    } else {
+        // Imported buffers have no bus address, and the post-processor reads
+        // neither the padded chroma of odd heights nor unaligned rows.
+        const uint32_t stride = AlignUp(source.width, kInputAlignment);
+        const uint32_t chroma_height = (source.height + 1) / 2;
+        const size_t luma_size = static_cast<size_t>(stride) * source.height;
+        if (!EnsureCapacity(in_buffer_, luma_size + static_cast<size_t>(stride) * chroma_height)) {
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+        }
+
+        uint8_t *const in = reinterpret_cast<uint8_t *>(in_buffer_.virtual_address);
+        CopyRows(source.planes[0], source.strides[0], in, stride, source.width, source.height);
+        if (planar) {
+            const uint32_t chroma_stride = stride / 2;
+            const size_t chroma_size = static_cast<size_t>(chroma_stride) * chroma_height;
+            for (size_t plane = 1; plane < 3; plane++) {
+                CopyRows(source.planes[plane], source.strides[plane],
+                    in + luma_size + (plane - 1) * chroma_size, chroma_stride,
+                    (source.width + 1) / 2, chroma_height);
+            }
+        } else {
+            CopyRows(source.planes[1], source.strides[1], in + luma_size, stride,
+                (source.width + 1) & ~1u, chroma_height);
+        }
+        pp_config_.pp_in_buffer = in_buffer_;
+        pp_config_.in_stride = stride;
+    }
+
+    size_t output_size = GetOutputSize(*outputs.render_target);
+    for (const VSSurface *surface : outputs.additional_outputs) {
+        output_size += GetOutputSize(*surface);
+    }
+    if (!EnsureCapacity(pp_config_.pp_out_buffer, output_size)) {
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    pp_config_.in_format = planar ? DEC_OUT_FRM_YUV420P : DEC_OUT_FRM_YUV420SP;
+    pp_config_.in_width = source.width;
+    pp_config_.in_height = source.height;
+    const bool applied = ApplyPostProcessing(
+        stream, params, *outputs.render_target, pp_config_.ppu_config, [this]() {
+            // Without a decoder there is no picture to pass through, so the
+            // first unit always writes the render target.
+            pp_config_.ppu_config[0].enabled = 1;
+            const PPResult ret = PPSetInfo(pp_inst_, &pp_config_);
+            if (ret != PP_OK) {
+                std::cerr << "Unsupported post-processing, return code: " << ret << std::endl;
+            }
+            return ret == PP_OK;
+        });
+    if (!applied) { return VA_STATUS_ERROR_OPERATION_FAILED; }
+
+    PPResult ret = PPDecode(pp_inst_);
+    if (ret != PP_OK) {
+        std::cerr << "Post-processing failed, return code: " << ret << std::endl;
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
+    PPDecPicture picture;
+    memset(&picture, 0, sizeof(picture));
+    ret = PPNextPicture(pp_inst_, &picture);
+    if (ret != PP_OK) {
+        std::cerr << "No post-processed picture, return code: " << ret << std::endl;
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
+    const bool written = WritePictureOutputs(outputs, [&picture](int index) {
+        const auto &output = picture.pictures[index];
+        return OutputPicture {
+            .luma = reinterpret_cast<const uint8_t *>(output.output_picture),
+            .chroma = reinterpret_cast<const uint8_t *>(output.output_picture_chroma),
+            .width = output.pic_width,
+            .height = output.pic_height,
+            .luma_stride = output.pic_stride,
+            .chroma_stride = output.pic_stride_ch,
+            .format = output.output_format,
+        };
+    });
+    return written ? VA_STATUS_SUCCESS : VA_STATUS_ERROR_OPERATION_FAILED;
+}
+
+bool VideoProcDelegate::EnsureCapacity(DWLLinearMem &mem, size_t size)
+{
+    if (mem.virtual_address && mem.logical_size >= size) { return true; }
+    if (mem.virtual_address) { DWLFreeLinear(dwl_instance_->instance, &mem); }
+
+    memset(&mem, 0, sizeof(mem));
+    mem.mem_type = DWL_MEM_TYPE_CPU;
+    if (DWLMallocLinear(dwl_instance_->instance, static_cast<u32>(size), &mem) != 0) {
+        std::cerr << "Failed to allocate " << size << " bytes for the post-processor"
+                  << std::endl;
+        memset(&mem, 0, sizeof(mem));
+        return false;
+    }
+    return true;
+}
+
+} // namespace libvavc8000d
@@ -0,0 +1,73 @@
+// Copyright 2024 The ChromiumOS Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef VIDEO_PROC_DELEGATE_H_
+#define VIDEO_PROC_DELEGATE_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "context_delegate.h"
+#include "dwl_instance.h"
+#include "ppapi.h"
+
+namespace libvavc8000d
+{
+
+struct DecodedStreamInfo;
+struct PictureOutputs;
+struct PostProcessingParams;
+struct SourcePicture;
+
+// Class used for surface-to-surface processing (VAEntrypointVideoProc):
+// cropping, scaling and conversion between NV12, I420 and RGB, as described by
+// a VAProcPipelineParameterBuffer. The work runs on the standalone
+// post-processor (ppapi.h), which uses the same units as the decoders. When
+// the post-processor is unavailable, or USE_CPU_VIDEO_PROC=1 is set, a much
+// slower CPU reference does the same.
+class VideoProcDelegate : public ContextDelegate
+{
+public:
+    VideoProcDelegate();
+    VideoProcDelegate(const VideoProcDelegate &) = delete;
+    VideoProcDelegate &operator=(const VideoProcDelegate &) = delete;
+    ~VideoProcDelegate() override;
+
+    // ContextDelegate implementation.
+    void SetRenderTarget(const VSSurface &surface) override;
+    void SetInputSurface(const VSSurface &surface) override;
+    void SetAdditionalOutputs(const std::vector<const VSSurface *> &surfaces) override;
+    void EnqueueWork(const std::vector<const VSBuffer *> &buffers) override;
+    VAStatus Run() override;
+
+private:
+    VAStatus Process();
+    // Has the post-processor read |source|, in place when the input surface is
+    // in DWL memory in a layout it reads, otherwise from a copy, and writes
+    // the pictures it produces to |outputs|.
+    VAStatus RunPostProcessor(const SourcePicture &source, const DecodedStreamInfo &stream,
+        const PostProcessingParams &params, const PictureOutputs &outputs);
+    // Makes |mem| hold at least |size| bytes. Buffers are kept across pictures
+    // and only reallocated when they are too small. Returns false when the
+    // allocation fails.
+    bool EnsureCapacity(DWLLinearMem &mem, size_t size);
+
+    const VSSurface *render_target_{ nullptr };
+    const VSSurface *input_surface_{ nullptr };
+    std::vector<const VSSurface *> additional_outputs_;
+    const VSBuffer *pipeline_buffer_{ nullptr };
+
+    std::unique_ptr<DWLInstance> dwl_instance_;
+    // Null when the CPU reference is used.
+    PPInst pp_inst_{ nullptr };
+    PPConfig pp_config_;
+    // Holds the copies of the inputs the post-processor can't read in place.
+    // |pp_config_.pp_in_buffer| is either this or the memory of the input.
+    DWLLinearMem in_buffer_;
+};
+
+} // namespace libvavc8000d
+
+#endif // VIDEO_PROC_DELEGATE_H_